@@ -0,0 +1,1258 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef MIDI_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "zfile.h"
+#include "archive.h"
+
+#define TAR_BLOCK               512
+#define TAR_NAME_SIZE           100
+#define TAR_PREFIX_SIZE         155
+
+#define TAR_OFFSET_NAME         0
+#define TAR_OFFSET_MODE         100
+#define TAR_OFFSET_UID          108
+#define TAR_OFFSET_GID          116
+#define TAR_OFFSET_SIZE         124
+#define TAR_OFFSET_MTIME        136
+#define TAR_OFFSET_CHKSUM       148
+#define TAR_OFFSET_TYPE         156
+#define TAR_OFFSET_MAGIC        257
+#define TAR_OFFSET_VERSION      263
+#define TAR_OFFSET_PREFIX       345
+
+#define ZIP_LOCAL_MAGIC         0x04034b50
+#define ZIP_CENTRAL_MAGIC       0x02014b50
+#define ZIP_END_MAGIC           0x06054b50
+#define ZIP_DESCRIPTOR_MAGIC    0x08074b50
+#define ZIP_LOCAL_SIZE          30      // Fixed part of the local header, magic included
+#define ZIP_FLAG_ENCRYPTED      0x0001
+#define ZIP_FLAG_DESCRIPTOR     0x0008
+#define ZIP_METHOD_STORED       0
+#define ZIP_METHOD_DEFLATED     8
+#define ZIP_EXTRA_ZIP64         0x0001
+
+#define PACK_VERSION            2
+#define PACK_HEADER_SIZE        32
+#define PACK_RECORD_SIZE        8       // Fixed part of a record, before the name
+#define PACK_DIR_ENTRY_SIZE     20      // Fixed part of a directory entry, before the name
+
+#define ARCHIVE_NAME_MAX        4096
+#define ARCHIVE_CHUNK           (64 * 1024)
+#define ARCHIVE_MEMBER_MAX      (1024 * 1024 * 1024)    // Bytes of a member read into memory
+
+static const uint8_t PACK_MAGIC[] = { 'M', 'P', 'A', 'K' };
+
+enum {
+    ARCHIVE_TAR,
+    ARCHIVE_ZIP,
+    ARCHIVE_PACK
+};
+
+struct archive {
+    FILE *      fp;
+    int         type;
+    int         status;
+    bool        done;
+    uint8_t *   data;           // Current member
+    size_t      cap;
+    bool        long_name;      // name was set by a GNU long name or pax record
+    uint32_t    remaining;      // Members left in a pack
+    char        name[ARCHIVE_NAME_MAX];
+};
+
+static inline uint16_t le_16(const uint8_t *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static inline uint32_t le_32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline uint64_t le_64(const uint8_t *p)
+{
+    return le_32(p) | (uint64_t)le_32(p + 4) << 32;
+}
+
+static inline void put_le_16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static inline void put_le_32(uint8_t *p, uint32_t v)
+{
+    put_le_16(p, v);
+    put_le_16(p + 2, v >> 16);
+}
+
+static inline void put_le_64(uint8_t *p, uint64_t v)
+{
+    put_le_32(p, v);
+    put_le_32(p + 4, v >> 32);
+}
+
+static int archive_reserve(archive_t *ar, size_t size)
+{
+    if (size <= ar->cap) {
+        return 0;
+    }
+
+    uint8_t *data = realloc(ar->data, size);
+
+    if (data == NULL) {
+        return ENOMEM;
+    }
+    ar->data = data;
+    ar->cap = size;
+
+    return 0;
+}
+
+static bool archive_fail(archive_t *ar, int status)
+{
+    ar->status = status;
+    ar->done = true;
+
+    return false;
+}
+
+/**
+ * Check a member size from a header before reading (max
+ * ARCHIVE_MEMBER_MAX) or skipping (max LONG_MAX) that much: EFBIG past max,
+ * EILSEQ past the end of the archive (known for plain files only, a
+ * compressed one has no size before it is read).
+ */
+static int archive_check_size(archive_t *ar, uint64_t size, uint64_t max)
+{
+    struct stat sb;
+    long pos;
+    int fd = fileno(ar->fp);
+
+    if (size > max || size > SIZE_MAX - 1) {
+        return EFBIG;
+    }
+    if (fd >= 0 && fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode)
+            && (pos = ftell(ar->fp)) >= 0 && size > (uint64_t)(sb.st_size - pos)) {
+        return EILSEQ;
+    }
+
+    return 0;
+}
+
+// Relative, without ".." components
+static bool archive_name_safe(const char *name)
+{
+    const char *p = name;
+
+    if (name[0] == '/' || name[0] == '\0') {
+        return false;
+    }
+
+    while (p != NULL) {
+        if (p[0] == '.' && p[1] == '.' && (p[2] == '/' || p[2] == '\0')) {
+            return false;
+        }
+        p = strchr(p, '/');
+        p = p ? p + 1 : NULL;
+    }
+
+    return true;
+}
+
+/*
+ * tar
+ */
+
+static uint64_t tar_number(const uint8_t *field, size_t size)
+{
+    uint64_t n = 0;
+
+    // GNU base-256 for large values
+    if (field[0] & 0x80) {
+        n = field[0] & 0x7F;
+        for (size_t i = 1; i < size; ++i) {
+            n = n << 8 | field[i];
+        }
+        return n;
+    }
+
+    for (size_t i = 0; i < size && field[i] != '\0' && field[i] != ' '; ++i) {
+        if (field[i] < '0' || field[i] > '7') {
+            break;
+        }
+        n = n * 8 + (field[i] - '0');
+    }
+
+    return n;
+}
+
+static bool tar_checksum_ok(const uint8_t *hdr)
+{
+    uint32_t sum = 0;
+
+    for (int i = 0; i < TAR_BLOCK; ++i) {
+        sum += (i >= TAR_OFFSET_CHKSUM && i < TAR_OFFSET_CHKSUM + 8) ? ' ' : hdr[i];
+    }
+
+    return sum == tar_number(hdr + TAR_OFFSET_CHKSUM, 8);
+}
+
+static bool tar_read_member(archive_t *ar, uint64_t size)
+{
+    uint64_t padded = (size + TAR_BLOCK - 1) & ~(uint64_t)(TAR_BLOCK - 1);
+    int status = archive_check_size(ar, size, ARCHIVE_MEMBER_MAX);
+
+    if (status == 0) {
+        status = archive_reserve(ar, size + 1);
+    }
+    if (status) {
+        return archive_fail(ar, status);
+    }
+    if (fread(ar->data, 1, size, ar->fp) != size) {
+        return archive_fail(ar, EIO);
+    }
+    ar->data[size] = '\0';
+    if (padded > size && fseek(ar->fp, padded - size, SEEK_CUR) != 0) {
+        return archive_fail(ar, errno);
+    }
+
+    return true;
+}
+
+// pax extended header records: "<length> <key>=<value>\n"
+static void tar_pax_path(archive_t *ar, size_t size)
+{
+    char *p = (char *)ar->data;
+    char *end = p + size;
+
+    while (p < end) {
+        char *record = p;
+        unsigned long len = strtoul(p, &p, 10);
+
+        if (len == 0 || record + len > end || *p != ' ') {
+            break;
+        }
+        p++;
+        if (strncmp(p, "path=", 5) == 0) {
+            size_t n = record + len - (p + 5) - 1;
+
+            if (n < sizeof(ar->name)) {
+                memcpy(ar->name, p + 5, n);
+                ar->name[n] = '\0';
+                ar->long_name = true;
+            }
+        }
+        p = record + len;
+    }
+}
+
+static bool tar_next(archive_t *ar, archive_entry_t *entry)
+{
+    uint8_t hdr[TAR_BLOCK];
+
+    for (;;) {
+        size_t n = fread(hdr, 1, TAR_BLOCK, ar->fp);
+        uint64_t size;
+        uint8_t type;
+        int status;
+
+        // End of archive: zero block, or plain end of file
+        if (n == 0 || (n == TAR_BLOCK && hdr[0] == '\0')) {
+            ar->done = true;
+            return false;
+        }
+        if (n != TAR_BLOCK || !tar_checksum_ok(hdr)) {
+            return archive_fail(ar, EILSEQ);
+        }
+
+        size = tar_number(hdr + TAR_OFFSET_SIZE, 12);
+        type = hdr[TAR_OFFSET_TYPE];
+
+        switch (type) {
+            case 'L':
+                // GNU long name of the next member
+                if (!tar_read_member(ar, size)) {
+                    return false;
+                }
+                snprintf(ar->name, sizeof(ar->name), "%s", (char *)ar->data);
+                ar->long_name = true;
+                continue;
+            case 'x':
+                if (!tar_read_member(ar, size)) {
+                    return false;
+                }
+                tar_pax_path(ar, size);
+                continue;
+            case '0':
+            case '\0':
+            case '7':
+                break;
+            default:
+                // Directories, links, global headers...
+                status = archive_check_size(ar, size, LONG_MAX);
+                if (status) {
+                    return archive_fail(ar, status);
+                }
+                if (fseek(ar->fp, (size + TAR_BLOCK - 1) & ~(uint64_t)(TAR_BLOCK - 1), SEEK_CUR) != 0) {
+                    return archive_fail(ar, errno);
+                }
+                ar->long_name = false;
+                continue;
+        }
+
+        if (!ar->long_name) {
+            if (memcmp(hdr + TAR_OFFSET_MAGIC, "ustar", 5) == 0 && hdr[TAR_OFFSET_PREFIX] != '\0') {
+                snprintf(ar->name, sizeof(ar->name), "%.*s/%.*s", TAR_PREFIX_SIZE, hdr + TAR_OFFSET_PREFIX,
+                        TAR_NAME_SIZE, hdr + TAR_OFFSET_NAME);
+            } else {
+                snprintf(ar->name, sizeof(ar->name), "%.*s", TAR_NAME_SIZE, hdr + TAR_OFFSET_NAME);
+            }
+        }
+        ar->long_name = false;
+
+        if (!tar_read_member(ar, size)) {
+            return false;
+        }
+        if (!archive_name_safe(ar->name)) {
+            continue;
+        }
+
+        entry->name = ar->name;
+        entry->data = ar->data;
+        entry->size = size;
+
+        return true;
+    }
+}
+
+/*
+ * zip
+ */
+
+#ifdef MIDI_HAVE_ZLIB
+/**
+ * Inflate a raw deflate stream from the current position. When the
+ * compressed size is unknown (data descriptor), what was read past the end
+ * of the stream is given back by seeking.
+ */
+static bool zip_inflate(archive_t *ar, uint64_t csize, bool csize_known, uint64_t usize, size_t *size)
+{
+    uint8_t in[ARCHIVE_CHUNK];
+    long start = ftell(ar->fp);
+    z_stream zs;
+    int ret = Z_OK;
+    int status;
+
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, -MAX_WBITS) != Z_OK) {
+        return archive_fail(ar, ENOMEM);
+    }
+
+    status = archive_check_size(ar, csize_known ? csize : 0, LONG_MAX);
+    if (status == 0) {
+        status = usize > ARCHIVE_MEMBER_MAX ? EFBIG : archive_reserve(ar, (usize ? usize : ARCHIVE_CHUNK) + 1);
+    }
+    *size = 0;
+
+    while (status == 0 && ret != Z_STREAM_END) {
+        if (zs.avail_in == 0) {
+            size_t want = sizeof(in);
+
+            if (csize_known && want > csize - (ftell(ar->fp) - start)) {
+                want = csize - (ftell(ar->fp) - start);
+            }
+            zs.next_in = in;
+            zs.avail_in = fread(in, 1, want, ar->fp);
+            if (zs.avail_in == 0) {
+                status = EIO;
+                break;
+            }
+        }
+        if (ar->cap - 1 - *size == 0) {
+            status = ar->cap > ARCHIVE_MEMBER_MAX ? EFBIG : archive_reserve(ar, ar->cap * 2);
+            if (status) {
+                break;
+            }
+        }
+
+        zs.next_out = ar->data + *size;
+        zs.avail_out = ar->cap - 1 - *size;
+        ret = inflate(&zs, Z_NO_FLUSH);
+        *size = ar->cap - 1 - zs.avail_out;
+
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+            status = EILSEQ;
+        }
+    }
+
+    inflateEnd(&zs);
+
+    if (status == 0 && zs.avail_in > 0 && fseek(ar->fp, -(long)zs.avail_in, SEEK_CUR) != 0) {
+        status = errno;
+    }
+    if (status) {
+        return archive_fail(ar, status);
+    }
+
+    ar->data[*size] = '\0';
+
+    return true;
+}
+#endif
+
+static bool zip_skip_descriptor(archive_t *ar, bool zip64)
+{
+    uint8_t buf[4];
+    // crc, compressed and uncompressed size, after an optional magic
+    long rest = zip64 ? 4 + 8 + 8 : 4 + 4 + 4;
+
+    if (fread(buf, 1, 4, ar->fp) != 4) {
+        return archive_fail(ar, EIO);
+    }
+    if (le_32(buf) != ZIP_DESCRIPTOR_MAGIC) {
+        rest -= 4;
+    }
+    if (fseek(ar->fp, rest, SEEK_CUR) != 0) {
+        return archive_fail(ar, errno);
+    }
+
+    return true;
+}
+
+static bool zip_next(archive_t *ar, archive_entry_t *entry)
+{
+    uint8_t hdr[ZIP_LOCAL_SIZE];
+    uint8_t extra[0x10000];
+
+    for (;;) {
+        size_t n = fread(hdr, 1, ZIP_LOCAL_SIZE, ar->fp);
+        uint16_t flags, method, name_len, extra_len;
+        uint64_t csize, usize;
+        size_t size = 0;
+        bool zip64 = false;
+        bool known;
+        int status;
+
+        // Central directory, end record or end of file: no more members
+        if (n < 4 || le_32(hdr) != ZIP_LOCAL_MAGIC) {
+            if (n >= 4 && le_32(hdr) != ZIP_CENTRAL_MAGIC && le_32(hdr) != ZIP_END_MAGIC) {
+                return archive_fail(ar, EILSEQ);
+            }
+            ar->done = true;
+            return false;
+        }
+        if (n != ZIP_LOCAL_SIZE) {
+            return archive_fail(ar, EIO);
+        }
+
+        flags = le_16(hdr + 6);
+        method = le_16(hdr + 8);
+        csize = le_32(hdr + 18);
+        usize = le_32(hdr + 22);
+        name_len = le_16(hdr + 26);
+        extra_len = le_16(hdr + 28);
+
+        if (name_len >= sizeof(ar->name)
+                || fread(ar->name, 1, name_len, ar->fp) != name_len
+                || fread(extra, 1, extra_len, ar->fp) != extra_len) {
+            return archive_fail(ar, EIO);
+        }
+        ar->name[name_len] = '\0';
+
+        // Zip64 sizes are in the extra field
+        for (uint32_t i = 0; i + 4 <= extra_len && i + 4 + le_16(extra + i + 2) <= extra_len;
+                i += 4 + le_16(extra + i + 2)) {
+            if (le_16(extra + i) == ZIP_EXTRA_ZIP64 && le_16(extra + i + 2) >= 16 && i + 20 <= extra_len) {
+                usize = le_64(extra + i + 4);
+                csize = le_64(extra + i + 12);
+                zip64 = true;
+            }
+        }
+
+        known = !(flags & ZIP_FLAG_DESCRIPTOR) || csize != 0;
+#ifndef MIDI_HAVE_ZLIB
+        (void)usize;    // Only inflating needs it
+#endif
+
+        if (method == ZIP_METHOD_STORED) {
+            if (!known) {
+                // The end of a stored member with a descriptor can't be found
+                return archive_fail(ar, EILSEQ);
+            }
+            status = archive_check_size(ar, csize, ARCHIVE_MEMBER_MAX);
+            if (status == 0 && archive_reserve(ar, csize + 1) != 0) {
+                status = ENOMEM;
+            }
+            if (status) {
+                return archive_fail(ar, status);
+            }
+            if (fread(ar->data, 1, csize, ar->fp) != csize) {
+                return archive_fail(ar, EIO);
+            }
+            ar->data[csize] = '\0';
+            size = csize;
+#ifdef MIDI_HAVE_ZLIB
+        } else if (method == ZIP_METHOD_DEFLATED && !(flags & ZIP_FLAG_ENCRYPTED)) {
+            long start = ftell(ar->fp);
+
+            if (!zip_inflate(ar, csize, known, usize, &size)) {
+                return false;
+            }
+            // Trust the header over where inflate stopped
+            if (known && fseek(ar->fp, start + csize, SEEK_SET) != 0) {
+                return archive_fail(ar, errno);
+            }
+#endif
+        } else {
+            if (!known) {
+                return archive_fail(ar, ENOTSUP);
+            }
+            status = archive_check_size(ar, csize, LONG_MAX);
+            if (status) {
+                return archive_fail(ar, status);
+            }
+            if (fseek(ar->fp, csize, SEEK_CUR) != 0) {
+                return archive_fail(ar, errno);
+            }
+            if (flags & ZIP_FLAG_DESCRIPTOR && !zip_skip_descriptor(ar, zip64)) {
+                return false;
+            }
+            continue;
+        }
+
+        if (flags & ZIP_FLAG_DESCRIPTOR && !zip_skip_descriptor(ar, zip64)) {
+            return false;
+        }
+
+        // Directories end in '/'
+        if (name_len == 0 || ar->name[name_len - 1] == '/' || !archive_name_safe(ar->name)) {
+            continue;
+        }
+
+        entry->name = ar->name;
+        entry->data = ar->data;
+        entry->size = size;
+
+        return true;
+    }
+}
+
+/*
+ * midi-pack
+ */
+
+static bool pack_next(archive_t *ar, archive_entry_t *entry)
+{
+    uint8_t rec[PACK_RECORD_SIZE];
+
+    while (ar->remaining > 0) {
+        uint32_t size;
+        uint16_t name_len;
+        int status;
+
+        if (fread(rec, 1, PACK_RECORD_SIZE, ar->fp) != PACK_RECORD_SIZE) {
+            return archive_fail(ar, EIO);
+        }
+        size = le_32(rec);
+        name_len = le_16(rec + 4);
+        ar->remaining--;
+
+        if (name_len >= sizeof(ar->name) || fread(ar->name, 1, name_len, ar->fp) != name_len) {
+            return archive_fail(ar, EIO);
+        }
+        ar->name[name_len] = '\0';
+
+        status = archive_check_size(ar, size, ARCHIVE_MEMBER_MAX);
+        if (status == 0 && archive_reserve(ar, (size_t)size + 1) != 0) {
+            status = ENOMEM;
+        }
+        if (status) {
+            return archive_fail(ar, status);
+        }
+        if (fread(ar->data, 1, size, ar->fp) != size) {
+            return archive_fail(ar, EIO);
+        }
+        ar->data[size] = '\0';
+
+        if (name_len == 0 || !archive_name_safe(ar->name)) {
+            continue;
+        }
+
+        entry->name = ar->name;
+        entry->data = ar->data;
+        entry->size = size;
+
+        return true;
+    }
+
+    ar->done = true;
+
+    return false;
+}
+
+int archive_open(const char *path, archive_t **ar)
+{
+    uint8_t hdr[TAR_BLOCK];
+    size_t n;
+
+    *ar = calloc(1, sizeof **ar);
+    if (*ar == NULL) {
+        return ENOMEM;
+    }
+
+    // tar archives may be compressed
+    (*ar)->fp = zfile_open(path);
+    if ((*ar)->fp == NULL) {
+        int status = errno;
+
+        free(*ar);
+        *ar = NULL;
+        return status;
+    }
+
+    // Members are read front to back, let the kernel read ahead of them
+    if (fileno((*ar)->fp) >= 0) {
+        posix_fadvise(fileno((*ar)->fp), 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    n = fread(hdr, 1, sizeof(hdr), (*ar)->fp);
+    if (n >= PACK_HEADER_SIZE && memcmp(hdr, PACK_MAGIC, sizeof(PACK_MAGIC)) == 0
+            && le_16(hdr + 4) == PACK_VERSION) {
+        (*ar)->type = ARCHIVE_PACK;
+        (*ar)->remaining = le_32(hdr + 8);
+    } else if (n >= 4 && (le_32(hdr) == ZIP_LOCAL_MAGIC || le_32(hdr) == ZIP_END_MAGIC)) {
+        (*ar)->type = ARCHIVE_ZIP;
+    } else if (n == TAR_BLOCK && tar_checksum_ok(hdr)) {
+        (*ar)->type = ARCHIVE_TAR;
+    } else {
+        archive_close(*ar);
+        *ar = NULL;
+        return EINVAL;
+    }
+
+    if (fseek((*ar)->fp, (*ar)->type == ARCHIVE_PACK ? PACK_HEADER_SIZE : 0, SEEK_SET) != 0) {
+        int status = errno;
+
+        archive_close(*ar);
+        *ar = NULL;
+        return status;
+    }
+
+    return 0;
+}
+
+void archive_close(archive_t *ar)
+{
+    if (ar == NULL) {
+        return;
+    }
+
+    if (ar->fp != NULL) {
+        fclose(ar->fp);
+    }
+    free(ar->data);
+    free(ar);
+}
+
+bool archive_next(archive_t *ar, archive_entry_t *entry)
+{
+    if (ar->done) {
+        return false;
+    }
+
+    switch (ar->type) {
+        case ARCHIVE_ZIP:
+            return zip_next(ar, entry);
+        case ARCHIVE_PACK:
+            return pack_next(ar, entry);
+        default:
+            return tar_next(ar, entry);
+    }
+}
+
+int archive_errno(const archive_t *ar)
+{
+    return ar->status;
+}
+
+/*
+ * tar writer
+ */
+
+static void tar_header(uint8_t *hdr, const char *name, size_t size, uint8_t type)
+{
+    size_t len = strlen(name);
+    uint32_t sum = 0;
+
+    memset(hdr, 0, TAR_BLOCK);
+
+    if (len <= TAR_NAME_SIZE) {
+        memcpy(hdr + TAR_OFFSET_NAME, name, len);
+    } else {
+        // Split at a '/' into prefix and name, the caller made sure it fits
+        const char *split = name + len - TAR_NAME_SIZE - 1;
+
+        while (*split != '/') {
+            split++;
+        }
+        memcpy(hdr + TAR_OFFSET_PREFIX, name, split - name);
+        memcpy(hdr + TAR_OFFSET_NAME, split + 1, len - (split + 1 - name));
+    }
+
+    snprintf((char *)hdr + TAR_OFFSET_MODE, 8, "%07o", 0644);
+    snprintf((char *)hdr + TAR_OFFSET_UID, 8, "%07o", 0);
+    snprintf((char *)hdr + TAR_OFFSET_GID, 8, "%07o", 0);
+    snprintf((char *)hdr + TAR_OFFSET_SIZE, 12, "%011llo", (unsigned long long)size);
+    snprintf((char *)hdr + TAR_OFFSET_MTIME, 12, "%011llo", (unsigned long long)time(NULL));
+    hdr[TAR_OFFSET_TYPE] = type;
+    memcpy(hdr + TAR_OFFSET_MAGIC, "ustar", 6);
+    memcpy(hdr + TAR_OFFSET_VERSION, "00", 2);
+
+    memset(hdr + TAR_OFFSET_CHKSUM, ' ', 8);
+    for (int i = 0; i < TAR_BLOCK; ++i) {
+        sum += hdr[i];
+    }
+    snprintf((char *)hdr + TAR_OFFSET_CHKSUM, 8, "%06o", sum);
+}
+
+// Fits name[100], or prefix[155] '/' name[100]
+static bool tar_name_fits(const char *name)
+{
+    size_t len = strlen(name);
+
+    if (len <= TAR_NAME_SIZE) {
+        return true;
+    }
+    if (len > TAR_PREFIX_SIZE + 1 + TAR_NAME_SIZE) {
+        return false;
+    }
+
+    for (const char *split = name + len - TAR_NAME_SIZE - 1; *split; ++split) {
+        if (*split == '/') {
+            return split - name <= TAR_PREFIX_SIZE;
+        }
+    }
+
+    return false;
+}
+
+static void tar_write(tar_t *tar, const void *data, size_t size)
+{
+    static const uint8_t zeros[TAR_BLOCK];
+    size_t pad = (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK;
+
+    if (tar->status) {
+        return;
+    }
+    if ((size && fwrite(data, size, 1, tar->out) != 1) || (pad && fwrite(zeros, pad, 1, tar->out) != 1)) {
+        tar->status = errno ? errno : EIO;
+    }
+}
+
+tar_t *tar_create(const char *path)
+{
+    tar_t *tar = calloc(1, sizeof *tar);
+
+    if (tar == NULL) {
+        return NULL;
+    }
+
+    tar->out = fopen(path, "wb");
+    if (tar->out == NULL) {
+        int status = errno;
+
+        free(tar);
+        errno = status;
+        return NULL;
+    }
+
+    return tar;
+}
+
+int tar_add(tar_t *tar, const char *name, const void *data, size_t size)
+{
+    uint8_t hdr[TAR_BLOCK];
+
+    if (!tar_name_fits(name)) {
+        // GNU long name record, the member keeps a truncated name
+        tar_header(hdr, "././@LongLink", strlen(name) + 1, 'L');
+        tar_write(tar, hdr, TAR_BLOCK);
+        tar_write(tar, name, strlen(name) + 1);
+
+        char short_name[TAR_NAME_SIZE + 1];
+
+        snprintf(short_name, sizeof(short_name), "%s", name);
+        tar_header(hdr, short_name, size, '0');
+    } else {
+        tar_header(hdr, name, size, '0');
+    }
+
+    tar_write(tar, hdr, TAR_BLOCK);
+    tar_write(tar, data, size);
+
+    return tar->status;
+}
+
+int tar_close(tar_t *tar)
+{
+    static const uint8_t end[TAR_BLOCK * 2];
+    int status;
+
+    tar_write(tar, end, sizeof(end));
+    if (fclose(tar->out) != 0 && tar->status == 0) {
+        tar->status = errno;
+    }
+
+    status = tar->status;
+    free(tar);
+
+    return status;
+}
+
+/*
+ * midi-pack writer
+ */
+
+static void pack_write(pack_t *pack, const void *data, size_t size)
+{
+    if (pack->status == 0 && size && fwrite(data, size, 1, pack->out) != 1) {
+        pack->status = errno ? errno : EIO;
+    }
+    pack->pos += size;
+}
+
+pack_t *pack_create(const char *path)
+{
+    uint8_t hdr[PACK_HEADER_SIZE] = { 0 };
+    pack_t *pack = calloc(1, sizeof *pack);
+
+    if (pack == NULL) {
+        return NULL;
+    }
+
+    pack->out = fopen(path, "wb");
+    if (pack->out == NULL) {
+        int status = errno;
+
+        free(pack);
+        errno = status;
+        return NULL;
+    }
+
+    // Member count and directory offset are filled in by pack_close()
+    pack_write(pack, hdr, sizeof(hdr));
+
+    return pack;
+}
+
+uint32_t pack_meta_bit(uint8_t type)
+{
+    static const uint8_t types[] = { 0x20, 0x21, 0x2F, 0x51, 0x54, 0x58, 0x59, 0x7F };
+
+    if (type < 16) {
+        return 1u << type;
+    }
+    for (size_t i = 0; i < sizeof(types); ++i) {
+        if (types[i] == type) {
+            return 1u << (16 + i);
+        }
+    }
+
+    return PACK_META_OTHER;
+}
+
+void pack_features_unknown(pack_features_t *features)
+{
+    features->programs[0] = UINT64_MAX;
+    features->programs[1] = UINT64_MAX;
+    features->tempo_min = 0;
+    features->tempo_max = UINT32_MAX;
+    features->metas = UINT32_MAX;
+    features->channels = UINT16_MAX;
+    features->pitch_lo = 0;
+    features->pitch_hi = 127;
+}
+
+// Columns of the sketch: offsets from its start, each 8 byte aligned
+static void pack_sketch_layout(uint32_t n, size_t col[8], size_t *size)
+{
+    static const uint8_t width[8] = { 8, 8, 4, 4, 4, 2, 1, 1 };
+    size_t pos = 0;
+
+    for (int i = 0; i < 8; ++i) {
+        col[i] = pos;
+        pos += (width[i] * (size_t)n + 7) & ~(size_t)7;
+    }
+    *size = pos;
+}
+
+// Writes the features as columns, so a query scans one array per property
+static void pack_write_sketch(pack_t *pack)
+{
+    uint8_t buf[ARCHIVE_CHUNK];
+    size_t col[8];
+    size_t size;
+    size_t len = 0;
+    uint64_t start = pack->pos;
+
+    pack_sketch_layout(pack->files, col, &size);
+
+    for (int c = 0; c < 8; ++c) {
+        // Padding of the previous column
+        while (pack->pos - start < col[c]) {
+            pack_write(pack, "", 1);
+        }
+        for (uint32_t i = 0; i < pack->files; ++i) {
+            const pack_features_t *f = &pack->features[i];
+
+            if (len + 8 > sizeof(buf)) {
+                pack_write(pack, buf, len);
+                len = 0;
+            }
+            switch (c) {
+                case 0: put_le_64(buf + len, f->programs[0]); len += 8; break;
+                case 1: put_le_64(buf + len, f->programs[1]); len += 8; break;
+                case 2: put_le_32(buf + len, f->tempo_min); len += 4; break;
+                case 3: put_le_32(buf + len, f->tempo_max); len += 4; break;
+                case 4: put_le_32(buf + len, f->metas); len += 4; break;
+                case 5: put_le_16(buf + len, f->channels); len += 2; break;
+                case 6: buf[len++] = f->pitch_lo; break;
+                case 7: buf[len++] = f->pitch_hi; break;
+            }
+        }
+        pack_write(pack, buf, len);
+        len = 0;
+    }
+    while (pack->pos - start < size) {
+        pack_write(pack, "", 1);
+    }
+}
+
+int pack_add(pack_t *pack, const char *name, const void *data, size_t size, const pack_features_t *features)
+{
+    const uint8_t *smf = data;
+    size_t name_len = strlen(name);
+    uint8_t rec[PACK_DIR_ENTRY_SIZE];
+    uint8_t *dir;
+
+    if (name_len == 0 || name_len >= ARCHIVE_NAME_MAX || size > UINT32_MAX) {
+        return EINVAL;
+    }
+
+    if (pack->dir_len + PACK_DIR_ENTRY_SIZE + name_len > pack->dir_cap) {
+        size_t cap = pack->dir_cap ? pack->dir_cap * 2 : ARCHIVE_CHUNK;
+
+        while (cap < pack->dir_len + PACK_DIR_ENTRY_SIZE + name_len) {
+            cap *= 2;
+        }
+        dir = realloc(pack->dir, cap);
+        if (dir == NULL) {
+            return ENOMEM;
+        }
+        pack->dir = dir;
+        pack->dir_cap = cap;
+    }
+
+    // Directory entry, with the summary of the MThd header
+    dir = pack->dir + pack->dir_len;
+    memset(dir, 0, PACK_DIR_ENTRY_SIZE);
+    put_le_64(dir, pack->pos);
+    put_le_32(dir + 8, size);
+    if (size >= 14 && memcmp(smf, "MThd", 4) == 0) {
+        put_le_16(dir + 12, smf[8] << 8 | smf[9]);
+        put_le_16(dir + 14, smf[10] << 8 | smf[11]);
+        put_le_16(dir + 16, smf[12] << 8 | smf[13]);
+    }
+    put_le_16(dir + 18, name_len);
+    memcpy(dir + PACK_DIR_ENTRY_SIZE, name, name_len);
+    pack->dir_len += PACK_DIR_ENTRY_SIZE + name_len;
+
+    if (pack->files == pack->features_cap) {
+        size_t cap = pack->features_cap ? pack->features_cap * 2 : 1024;
+        pack_features_t *f = realloc(pack->features, cap * sizeof(*f));
+
+        if (f == NULL) {
+            return ENOMEM;
+        }
+        pack->features = f;
+        pack->features_cap = cap;
+    }
+    if (features != NULL) {
+        pack->features[pack->files] = *features;
+    } else {
+        pack_features_unknown(&pack->features[pack->files]);
+    }
+    pack->files++;
+
+    memset(rec, 0, PACK_RECORD_SIZE);
+    put_le_32(rec, size);
+    put_le_16(rec + 4, name_len);
+    pack_write(pack, rec, PACK_RECORD_SIZE);
+    pack_write(pack, name, name_len);
+    pack_write(pack, data, size);
+
+    return pack->status;
+}
+
+int pack_close(pack_t *pack)
+{
+    uint8_t hdr[PACK_HEADER_SIZE] = { 0 };
+    uint64_t sketch = pack->pos;
+    uint64_t dir;
+    int status;
+
+    pack_write_sketch(pack);
+    dir = pack->pos;
+    pack_write(pack, pack->dir, pack->dir_len);
+
+    memcpy(hdr, PACK_MAGIC, sizeof(PACK_MAGIC));
+    put_le_16(hdr + 4, PACK_VERSION);
+    put_le_32(hdr + 8, pack->files);
+    put_le_64(hdr + 16, dir);
+    put_le_64(hdr + 24, sketch);
+    if (pack->status == 0 && fseek(pack->out, 0, SEEK_SET) != 0) {
+        pack->status = errno;
+    }
+    pack_write(pack, hdr, sizeof(hdr));
+
+    if (fclose(pack->out) != 0 && pack->status == 0) {
+        pack->status = errno;
+    }
+
+    status = pack->status;
+    free(pack->dir);
+    free(pack->features);
+    free(pack);
+
+    return status;
+}
+
+int pack_list(const char *path, void (*summary_cb)(const pack_summary_t *summary, void *arg), void *arg)
+{
+    uint8_t hdr[PACK_HEADER_SIZE];
+    uint8_t *dir = NULL;
+    uint64_t dir_offset;
+    uint32_t files;
+    long end;
+    size_t size;
+    int status = 0;
+    FILE *fp = fopen(path, "rb");
+
+    if (fp == NULL) {
+        return errno;
+    }
+
+    if (fread(hdr, 1, sizeof(hdr), fp) != sizeof(hdr) || memcmp(hdr, PACK_MAGIC, sizeof(PACK_MAGIC)) != 0
+            || le_16(hdr + 4) != PACK_VERSION) {
+        fclose(fp);
+        return EINVAL;
+    }
+    files = le_32(hdr + 8);
+    dir_offset = le_64(hdr + 16);
+
+    // Only the directory is read, not the members
+    if (fseek(fp, 0, SEEK_END) != 0 || (end = ftell(fp)) < 0 || dir_offset > (uint64_t)end
+            || fseek(fp, dir_offset, SEEK_SET) != 0) {
+        fclose(fp);
+        return EINVAL;
+    }
+    size = end - dir_offset;
+    dir = malloc(size + 1);
+    if (dir == NULL) {
+        fclose(fp);
+        return ENOMEM;
+    }
+    if (fread(dir, 1, size, fp) != size) {
+        status = EIO;
+    }
+    fclose(fp);
+
+    for (size_t pos = 0; status == 0 && files > 0; --files) {
+        pack_summary_t summary;
+        char name[ARCHIVE_NAME_MAX];
+        uint16_t name_len;
+
+        if (size - pos < PACK_DIR_ENTRY_SIZE || (name_len = le_16(dir + pos + 18)) >= sizeof(name)
+                || size - pos - PACK_DIR_ENTRY_SIZE < name_len) {
+            status = EILSEQ;
+            break;
+        }
+        memcpy(name, dir + pos + PACK_DIR_ENTRY_SIZE, name_len);
+        name[name_len] = '\0';
+
+        summary.name = name;
+        summary.index = le_32(hdr + 8) - files;
+        summary.offset = le_64(dir + pos);
+        summary.size = le_32(dir + pos + 8);
+        summary.format = le_16(dir + pos + 12);
+        summary.tracks = le_16(dir + pos + 14);
+        summary.division = le_16(dir + pos + 16);
+        summary_cb(&summary, arg);
+
+        pos += PACK_DIR_ENTRY_SIZE + name_len;
+    }
+
+    free(dir);
+
+    return status;
+}
+
+int pack_sketch_read(const char *path, pack_sketch_t *sketch)
+{
+    uint8_t hdr[PACK_HEADER_SIZE];
+    uint8_t *p;
+    size_t col[8];
+    size_t size;
+    uint32_t n;
+    int status = 0;
+    FILE *fp = fopen(path, "rb");
+
+    memset(sketch, 0, sizeof(*sketch));
+
+    if (fp == NULL) {
+        return errno;
+    }
+
+    if (fread(hdr, 1, sizeof(hdr), fp) != sizeof(hdr) || memcmp(hdr, PACK_MAGIC, sizeof(PACK_MAGIC)) != 0
+            || le_16(hdr + 4) != PACK_VERSION) {
+        fclose(fp);
+        return EINVAL;
+    }
+    n = le_32(hdr + 8);
+    pack_sketch_layout(n, col, &size);
+
+    // Read as stored, then turned into host order in place
+    p = malloc(size ? size : 1);
+    if (p == NULL) {
+        fclose(fp);
+        return ENOMEM;
+    }
+    if (fseek(fp, le_64(hdr + 24), SEEK_SET) != 0 || fread(p, 1, size, fp) != size) {
+        status = EIO;
+    }
+    fclose(fp);
+    if (status) {
+        free(p);
+        return status;
+    }
+
+    sketch->count = n;
+    sketch->programs_lo = (uint64_t *)(p + col[0]);
+    sketch->programs_hi = (uint64_t *)(p + col[1]);
+    sketch->tempo_min = (uint32_t *)(p + col[2]);
+    sketch->tempo_max = (uint32_t *)(p + col[3]);
+    sketch->metas = (uint32_t *)(p + col[4]);
+    sketch->channels = (uint16_t *)(p + col[5]);
+    sketch->pitch_lo = p + col[6];
+    sketch->pitch_hi = p + col[7];
+
+    for (uint32_t i = 0; i < n; ++i) {
+        sketch->programs_lo[i] = le_64(p + col[0] + i * 8);
+        sketch->programs_hi[i] = le_64(p + col[1] + i * 8);
+        sketch->tempo_min[i] = le_32(p + col[2] + i * 4);
+        sketch->tempo_max[i] = le_32(p + col[3] + i * 4);
+        sketch->metas[i] = le_32(p + col[4] + i * 4);
+        sketch->channels[i] = le_16(p + col[5] + i * 2);
+    }
+
+    return 0;
+}
+
+void pack_sketch_free(pack_sketch_t *sketch)
+{
+    // All columns are in one block, starting with the first
+    free(sketch->programs_lo);
+    memset(sketch, 0, sizeof(*sketch));
+}
+
+void pack_query_init(pack_query_t *query)
+{
+    memset(query, 0, sizeof(*query));
+    query->tempo_max = UINT32_MAX;
+    query->pitch_hi = 255;
+}
+
+#define PACK_QUERY_BLOCK        16
+
+/**
+ * One block of members, branch free with a fixed count and one pass per
+ * property, so the compiler vectorizes the passes even at -O2.
+ */
+static uint32_t pack_query_block(const pack_sketch_t *sketch, const pack_query_t *query, uint32_t base,
+        uint8_t *restrict match)
+{
+    const uint16_t *restrict channels = sketch->channels + base;
+    const uint32_t *restrict metas = sketch->metas + base;
+    const uint64_t *restrict programs_lo = sketch->programs_lo + base;
+    const uint64_t *restrict programs_hi = sketch->programs_hi + base;
+    const uint8_t *restrict pitch_lo = sketch->pitch_lo + base;
+    const uint8_t *restrict pitch_hi = sketch->pitch_hi + base;
+    const uint32_t *restrict tempo_min = sketch->tempo_min + base;
+    const uint32_t *restrict tempo_max = sketch->tempo_max + base;
+    const uint8_t any_program = (query->programs[0] | query->programs[1]) == 0;
+    uint8_t m[PACK_QUERY_BLOCK];
+    uint32_t count = 0;
+
+    for (int i = 0; i < PACK_QUERY_BLOCK; ++i) {
+        m[i] = (channels[i] & query->channels) == query->channels;
+    }
+    for (int i = 0; i < PACK_QUERY_BLOCK; ++i) {
+        m[i] &= (metas[i] & query->metas) == query->metas;
+    }
+    for (int i = 0; i < PACK_QUERY_BLOCK; ++i) {
+        m[i] &= (((programs_lo[i] & query->programs[0]) | (programs_hi[i] & query->programs[1])) != 0) | any_program;
+    }
+    // Ranges overlap
+    for (int i = 0; i < PACK_QUERY_BLOCK; ++i) {
+        m[i] &= (pitch_lo[i] <= query->pitch_hi) & (pitch_hi[i] >= query->pitch_lo);
+    }
+    for (int i = 0; i < PACK_QUERY_BLOCK; ++i) {
+        m[i] &= (tempo_min[i] <= query->tempo_max) & (tempo_max[i] >= query->tempo_min);
+    }
+
+    for (int i = 0; i < PACK_QUERY_BLOCK; ++i) {
+        match[i] = m[i];
+        count += m[i];
+    }
+
+    return count;
+}
+
+uint32_t pack_query_run(const pack_sketch_t *sketch, const pack_query_t *query, uint8_t *match)
+{
+    uint32_t count = 0;
+    uint32_t i = 0;
+
+    for (; i + PACK_QUERY_BLOCK <= sketch->count; i += PACK_QUERY_BLOCK) {
+        count += pack_query_block(sketch, query, i, match + i);
+    }
+
+    // The rest, one by one
+    for (; i < sketch->count; ++i) {
+        match[i] = (sketch->channels[i] & query->channels) == query->channels
+            && (sketch->metas[i] & query->metas) == query->metas
+            && ((sketch->programs_lo[i] & query->programs[0]) || (sketch->programs_hi[i] & query->programs[1])
+                || (query->programs[0] | query->programs[1]) == 0)
+            && sketch->pitch_lo[i] <= query->pitch_hi && sketch->pitch_hi[i] >= query->pitch_lo
+            && sketch->tempo_min[i] <= query->tempo_max && sketch->tempo_max[i] >= query->tempo_min;
+        count += match[i];
+    }
+
+    return count;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
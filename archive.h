@@ -0,0 +1,209 @@
+#ifndef __ARCHIVE_H__
+#define __ARCHIVE_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+/**
+ * Archive Reading and Writing
+ *
+ * Walks the members of a tar, zip or midi-pack archive in one sequential read, handing
+ * out the bytes of every regular file in memory, nothing is extracted:
+ *
+ * archive_t *ar;
+ * archive_entry_t entry;
+ *
+ * if (archive_open("corpus.tar.gz", &ar) == 0) {
+ *     while (archive_next(ar, &entry)) {
+ *         // entry.name, entry.data, entry.size, valid until the next call
+ *     }
+ *     status = archive_errno(ar);      // 0 at a clean end
+ *     archive_close(ar);
+ * }
+ *
+ * Supported:
+ * - tar: ustar and old style headers, GNU long names, pax path records.
+ *   The archive may be compressed (see zfile.h)
+ * - zip: stored and deflated members (deflate needs MIDI_HAVE_ZLIB), also
+ *   with data descriptors and zip64 sizes
+ * - midi-pack: see pack_create(), also compressed
+ *
+ * Members with absolute paths or ".." components are skipped, so their
+ * names are always safe to use as relative output paths.
+ *
+ * Archives are written as ustar, see tar_create(), or as midi-pack.
+ */
+
+typedef struct archive archive_t;
+
+typedef struct {
+    const char *    name;
+    const uint8_t * data;
+    size_t          size;
+} archive_entry_t;
+
+/**
+ * Returns 0, EINVAL if path is not a tar, zip or midi-pack archive, or a
+ * POSIX errno.
+ */
+int archive_open(const char *path, archive_t **ar);
+void archive_close(archive_t *ar);
+
+// Next regular file member, false at the end or on error
+bool archive_next(archive_t *ar, archive_entry_t *entry);
+// 0, or the error that stopped archive_next()
+int archive_errno(const archive_t *ar);
+
+/**
+ * tar Writer
+ *
+ * Members are written as they are added. Not thread safe, callers adding
+ * from several threads lock around tar_add().
+ */
+typedef struct {
+    FILE *      out;
+    int         status;     // First write error
+} tar_t;
+
+tar_t *tar_create(const char *path);
+int tar_add(tar_t *tar, const char *name, const void *data, size_t size);
+// Writes the end of archive, returns 0 or the first error
+int tar_close(tar_t *tar);
+
+/**
+ * midi-pack Writer
+ *
+ * A pack holds many small midi files back to back, for scanning a corpus
+ * with one sequential read instead of an open per file. All numbers are
+ * little endian:
+ *
+ * - header, 32 bytes: "MPAK", version (16 bit), reserved (16 bit), member
+ *   count (32 bit), reserved (32 bit), directory offset (64 bit), sketch
+ *   offset (64 bit)
+ * - members: size (32 bit), name length (16 bit), reserved (16 bit), the
+ *   name, then the midi file as it is
+ * - directory: per member its offset (64 bit) and size (32 bit), the
+ *   format, tracks and division of its MThd header (16 bit each, 0 if it
+ *   has none), name length (16 bit) and name
+ * - sketch, before the directory: the pack_features_t of all members as
+ *   columns, programs (2 x 64 bit), tempo min, tempo max, metas (32 bit),
+ *   channels (16 bit), pitch min, pitch max (8 bit), each padded to 8 bytes
+ *
+ * Not thread safe, like tar_t.
+ */
+
+// Bits of pack_features_t.metas: types 0 - 15 as they are, then these
+#define PACK_META_CHANNEL_PREFIX    (1u << 16)
+#define PACK_META_PORT              (1u << 17)
+#define PACK_META_END_TRACK         (1u << 18)
+#define PACK_META_TEMPO             (1u << 19)
+#define PACK_META_SMPTE_OFFSET      (1u << 20)
+#define PACK_META_TIME_SIGNATURE    (1u << 21)
+#define PACK_META_KEY_SIGNATURE     (1u << 22)
+#define PACK_META_SEQUENCER         (1u << 23)
+#define PACK_META_OTHER             (1u << 24)
+
+/**
+ * What a member uses, for queries to skip members without parsing them.
+ * Channels and programs are those of sounding notes (program 0 until a
+ * program change), pitches those of notes, tempo in us per quarter note
+ * (500000 when the file has no tempo event). A file without notes has
+ * pitch_lo 255 and pitch_hi 0.
+ */
+typedef struct {
+    uint64_t    programs[2];    // GM program bitmap
+    uint32_t    tempo_min;
+    uint32_t    tempo_max;
+    uint32_t    metas;          // Meta event types, see pack_meta_bit()
+    uint16_t    channels;       // Channel bitmap, bit 9 is the GM drums
+    uint8_t     pitch_lo;
+    uint8_t     pitch_hi;
+} pack_features_t;
+
+uint32_t pack_meta_bit(uint8_t type);
+// Features that match any query, for files that could not be parsed
+void pack_features_unknown(pack_features_t *features);
+
+typedef struct {
+    FILE *              out;
+    int                 status;     // First write error
+    uint64_t            pos;
+    uint32_t            files;
+    uint8_t *           dir;        // Directory, written at the end
+    size_t              dir_len;
+    size_t              dir_cap;
+    pack_features_t *   features;   // Sketch, written before the directory
+    size_t              features_cap;
+} pack_t;
+
+pack_t *pack_create(const char *path);
+// features may be NULL when unknown
+int pack_add(pack_t *pack, const char *name, const void *data, size_t size, const pack_features_t *features);
+// Writes the directory, returns 0 or the first error
+int pack_close(pack_t *pack);
+
+typedef struct {
+    const char *    name;
+    uint32_t        index;      // Member number, from 0
+    uint64_t        offset;     // Of the member record
+    uint32_t        size;
+    uint16_t        format;
+    uint16_t        tracks;
+    uint16_t        division;
+} pack_summary_t;
+
+/**
+ * Calls summary_cb for every member of the (uncompressed) pack path, from
+ * its directory alone. Returns 0, EINVAL if path is not a pack, or a POSIX
+ * errno.
+ */
+int pack_list(const char *path, void (*summary_cb)(const pack_summary_t *summary, void *arg), void *arg);
+
+/**
+ * Pack Queries
+ *
+ * The sketch of a pack is read on its own and scanned column by column:
+ *
+ * pack_sketch_t sketch;
+ * pack_query_t query;
+ *
+ * pack_query_init(&query);
+ * query.channels = 1 << 9;         // Uses the drum channel
+ * query.metas = 1 << MIDI_META_LYRICS;
+ * pack_sketch_read("corpus.mpk", &sketch);
+ * n = pack_query_run(&sketch, &query, match);  // match[i] for member i
+ */
+typedef struct {
+    uint32_t    count;
+    uint64_t *  programs_lo;
+    uint64_t *  programs_hi;
+    uint32_t *  tempo_min;
+    uint32_t *  tempo_max;
+    uint32_t *  metas;
+    uint16_t *  channels;
+    uint8_t *   pitch_lo;
+    uint8_t *   pitch_hi;
+} pack_sketch_t;
+
+typedef struct {
+    uint16_t    channels;       // All of them used
+    uint32_t    metas;          // All of them used
+    uint64_t    programs[2];    // Any of them used, none for no condition
+    uint8_t     pitch_lo;       // Some note in the range
+    uint8_t     pitch_hi;
+    uint32_t    tempo_min;      // Some tempo in the range, us per quarter note
+    uint32_t    tempo_max;
+} pack_query_t;
+
+int pack_sketch_read(const char *path, pack_sketch_t *sketch);
+void pack_sketch_free(pack_sketch_t *sketch);
+
+// A query every member matches
+void pack_query_init(pack_query_t *query);
+// Sets match[i] to 1 for matching members, 0 for the others, returns the count
+uint32_t pack_query_run(const pack_sketch_t *sketch, const pack_query_t *query, uint8_t *match);
+
+#endif /* __ARCHIVE_H__ */
+
+/* vim: set ts=4 sw=4 tw=0 list : */
@@ -0,0 +1,512 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "arrow.h"
+
+/**
+ * Flatbuffers, as far as the Arrow messages go
+ *
+ * A flatbuffer is read from its root offset, at 0, which points forward to
+ * the root table. A table starts with the signed offset back to its vtable
+ * (the vtable size, the table size and the offset of every field in the
+ * table, 0 for absent fields), followed by its fields. Offsets to strings,
+ * vectors and tables are unsigned and point forward, from where they are
+ * stored.
+ *
+ * The builder here lays a buffer out front to back: a table is written
+ * with room for its offsets, then what they point to, and the offsets are
+ * filled in (fb_ref). Every table starts 8 byte aligned and its fields are
+ * aligned to their size. The buffer starts with the 8 byte prefix of the
+ * message, so it is written as it is.
+ */
+
+#define ARROW_CONTINUATION      0xFFFFFFFF
+#define ARROW_METADATA_V5       4
+#define ARROW_ALIGN             8
+#define ARROW_STRING_CAP        65536
+#define ARROW_PREFIX            8           // Continuation and metadata size
+
+// MessageHeader union
+#define ARROW_HEADER_SCHEMA     1
+#define ARROW_HEADER_BATCH      3
+
+// Type union
+#define ARROW_TYPE_INT          2
+#define ARROW_TYPE_BINARY       4
+#define ARROW_TYPE_UTF8         5
+
+typedef struct {
+    uint8_t *   buf;
+    uint32_t    size;
+    uint32_t    cap;
+    bool        failed;
+} arrow_fb_t;
+
+static const uint8_t arrow_zeros[ARROW_ALIGN];
+
+static inline uint32_t arrow_pad(uint64_t size)
+{
+    return (ARROW_ALIGN - size % ARROW_ALIGN) % ARROW_ALIGN;
+}
+
+// Room for n zeroed bytes at the end, returns where
+static uint32_t fb_alloc(arrow_fb_t *fb, uint32_t n)
+{
+    uint32_t pos = fb->size;
+
+    if (fb->failed) {
+        return 0;
+    }
+    if (fb->size + n > fb->cap) {
+        uint32_t cap = fb->cap ? fb->cap : 1024;
+        uint8_t *buf;
+
+        while (cap < fb->size + n) {
+            cap *= 2;
+        }
+        buf = realloc(fb->buf, cap);
+        if (buf == NULL) {
+            fb->failed = true;
+            fb->size = 0;
+            return 0;
+        }
+        fb->buf = buf;
+        fb->cap = cap;
+    }
+
+    memset(fb->buf + pos, 0, n);
+    fb->size += n;
+
+    return pos;
+}
+
+// Pad until (size + skew) is a multiple of align
+static void fb_align(arrow_fb_t *fb, uint32_t align, uint32_t skew)
+{
+    fb_alloc(fb, (align - (fb->size + skew) % align) % align);
+}
+
+static void fb_put(arrow_fb_t *fb, uint32_t pos, uint64_t v, uint8_t size)
+{
+    if (fb->failed) {
+        return;
+    }
+    // Little endian, as Arrow IPC is here
+    for (uint8_t i = 0; i < size; ++i) {
+        fb->buf[pos + i] = v >> (8 * i);
+    }
+}
+
+// Store the offset at pos to target, which comes later
+static void fb_ref(arrow_fb_t *fb, uint32_t pos, uint32_t target)
+{
+    fb_put(fb, pos, target - pos, 4);
+}
+
+/**
+ * A table of n fields of sizes[] bytes, 0 for absent ones. Returns the
+ * table, and where its fields are in pos[].
+ */
+static uint32_t fb_table(arrow_fb_t *fb, int n, const uint8_t *sizes, uint32_t *pos)
+{
+    uint16_t offsets[ARROW_MAX_FIELDS];
+    uint32_t size = 4;
+    uint32_t vtable;
+    uint32_t table;
+
+    for (int i = 0; i < n; ++i) {
+        offsets[i] = 0;
+        if (sizes[i]) {
+            size = (size + sizes[i] - 1) / sizes[i] * sizes[i];
+            offsets[i] = size;
+            size += sizes[i];
+        }
+    }
+
+    fb_align(fb, 2, 0);
+    vtable = fb_alloc(fb, 4 + 2 * n);
+    fb_put(fb, vtable, 4 + 2 * n, 2);
+    fb_put(fb, vtable + 2, size, 2);
+    for (int i = 0; i < n; ++i) {
+        fb_put(fb, vtable + 4 + 2 * i, offsets[i], 2);
+    }
+
+    fb_align(fb, ARROW_ALIGN, 0);
+    table = fb_alloc(fb, size);
+    fb_put(fb, table, table - vtable, 4);
+    for (int i = 0; i < n; ++i) {
+        pos[i] = table + offsets[i];
+    }
+
+    return table;
+}
+
+static uint32_t fb_string(arrow_fb_t *fb, const char *s)
+{
+    uint32_t len = strlen(s);
+    uint32_t pos;
+
+    fb_align(fb, 4, 0);
+    pos = fb_alloc(fb, 4 + len + 1);
+    fb_put(fb, pos, len, 4);
+    if (!fb->failed) {
+        memcpy(fb->buf + pos + 4, s, len);
+    }
+
+    return pos;
+}
+
+// A vector of n elements of size bytes, aligned to 8, returns its length field
+static uint32_t fb_vector(arrow_fb_t *fb, uint32_t n, uint32_t size)
+{
+    uint32_t pos;
+
+    fb_align(fb, ARROW_ALIGN, 4);
+    pos = fb_alloc(fb, 4 + n * size);
+    fb_put(fb, pos, n, 4);
+
+    return pos;
+}
+
+/**
+ * The Message around a header: version, header type, header and body
+ * length, after the prefix of the encapsulated message. Returns where the
+ * offset to the header goes.
+ */
+static uint32_t fb_message(arrow_fb_t *fb, uint8_t header_type, uint64_t body_length)
+{
+    static const uint8_t sizes[] = { 2, 1, 4, 8 };
+    uint32_t pos[4];
+    uint32_t root;
+
+    fb_alloc(fb, ARROW_PREFIX);
+    root = fb_alloc(fb, 4);
+
+    fb_ref(fb, root, fb_table(fb, 4, sizes, pos));
+    fb_put(fb, pos[0], ARROW_METADATA_V5, 2);
+    fb_put(fb, pos[1], header_type, 1);
+    fb_put(fb, pos[3], body_length, 8);
+
+    return pos[2];
+}
+
+static uint32_t arrow_width(uint8_t type)
+{
+    switch (type) {
+        case ARROW_UINT8:
+            return 1;
+        case ARROW_UINT16:
+            return 2;
+        case ARROW_UINT32:
+            return 4;
+        default:
+            return 0;
+    }
+}
+
+static bool arrow_is_string(uint8_t type)
+{
+    return type == ARROW_BINARY || type == ARROW_UTF8;
+}
+
+static void fb_schema(arrow_fb_t *fb, const arrow_field_t *fields, uint16_t count)
+{
+    static const uint8_t schema_sizes[] = { 0, 4 };
+    static const uint8_t field_sizes[] = { 4, 1, 1, 4, 0, 4 };
+    static const uint8_t int_sizes[] = { 4, 1 };
+    uint32_t header = fb_message(fb, ARROW_HEADER_SCHEMA, 0);
+    uint32_t schema[2];
+    uint32_t vec;
+
+    fb_ref(fb, header, fb_table(fb, 2, schema_sizes, schema));
+    vec = fb_vector(fb, count, 4);
+    fb_ref(fb, schema[1], vec);
+
+    for (uint16_t i = 0; i < count; ++i) {
+        uint32_t field[6];
+        uint32_t type[2];
+
+        fb_ref(fb, vec + 4 + 4 * i, fb_table(fb, 6, field_sizes, field));
+
+        // Types: Int { bitWidth, is_signed }, Binary / Utf8 { }
+        if (arrow_is_string(fields[i].type)) {
+            fb_put(fb, field[2], fields[i].type == ARROW_UTF8 ? ARROW_TYPE_UTF8 : ARROW_TYPE_BINARY, 1);
+            fb_ref(fb, field[3], fb_table(fb, 0, NULL, type));
+        } else {
+            fb_put(fb, field[2], ARROW_TYPE_INT, 1);
+            fb_ref(fb, field[3], fb_table(fb, 2, int_sizes, type));
+            fb_put(fb, type[0], 8 * arrow_width(fields[i].type), 4);
+        }
+
+        fb_ref(fb, field[0], fb_string(fb, fields[i].name));
+        fb_ref(fb, field[5], fb_vector(fb, 0, 4));
+    }
+}
+
+static int arrow_writev(int fd, struct iovec *iov, int n)
+{
+    while (n > 0) {
+        ssize_t done = writev(fd, iov, n);
+
+        if (done < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+        while (n > 0 && (size_t)done >= iov->iov_len) {
+            done -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Write a message: the continuation and the metadata size in front of the
+ * metadata (fb_message() leaves room for them), the metadata padded to 8
+ * bytes, then the body buffers in iov[1..n), all in one writev()
+ */
+static int arrow_message(int fd, arrow_fb_t *fb, struct iovec *iov, int n)
+{
+    uint32_t size;
+
+    fb_align(fb, ARROW_ALIGN, 0);
+    if (fb->failed) {
+        return ENOMEM;
+    }
+    size = fb->size - ARROW_PREFIX;
+
+    fb_put(fb, 0, ARROW_CONTINUATION, 4);
+    fb_put(fb, 4, size, 4);
+    iov[0].iov_base = fb->buf;
+    iov[0].iov_len = fb->size;
+
+    return arrow_writev(fd, iov, n);
+}
+
+int arrow_table_open(arrow_table_t *t, int fd, const arrow_field_t *fields, uint16_t count, uint32_t batch_rows)
+{
+    arrow_fb_t fb = { 0 };
+    struct iovec iov;
+    int status;
+
+    memset(t, 0, sizeof(*t));
+    if (count == 0 || count > ARROW_MAX_FIELDS || batch_rows == 0) {
+        return EINVAL;
+    }
+    t->fd = fd;
+    t->fields = fields;
+    t->count = count;
+    t->batch_rows = batch_rows;
+
+    for (uint16_t i = 0; i < count; ++i) {
+        arrow_column_t *col = &t->columns[i];
+
+        if (arrow_is_string(fields[i].type)) {
+            col->offsets = calloc((size_t)batch_rows + 1, sizeof(*col->offsets));
+            col->values = malloc(ARROW_STRING_CAP);
+            col->cap = ARROW_STRING_CAP;
+        } else {
+            col->values = malloc((size_t)batch_rows * arrow_width(fields[i].type));
+        }
+        if (col->values == NULL || (arrow_is_string(fields[i].type) && col->offsets == NULL)) {
+            t->errnum = ENOMEM;
+        }
+    }
+
+    fb_schema(&fb, fields, count);
+    status = t->errnum ? t->errnum : arrow_message(fd, &fb, &iov, 1);
+    free(fb.buf);
+    t->errnum = status;
+
+    return status;
+}
+
+int arrow_table_flush(arrow_table_t *t)
+{
+    static const uint8_t batch_sizes[] = { 8, 4, 4 };
+    struct iovec iov[1 + ARROW_MAX_FIELDS * 4];
+    arrow_fb_t fb = { 0 };
+    uint64_t body = 0;
+    uint32_t buffers = 0;
+    uint32_t batch[3];
+    uint32_t nodes;
+    uint32_t bufs;
+    uint32_t header;
+    int n = 1;
+
+    if (t->errnum || t->rows == 0) {
+        return t->errnum;
+    }
+
+    // The body: per column an empty validity bitmap, then the values, or
+    // the offsets and the bytes of strings, each padded to 8 bytes
+    for (uint16_t i = 0; i < t->count; ++i) {
+        if (arrow_is_string(t->fields[i].type)) {
+            uint64_t offsets = ((uint64_t)t->rows + 1) * sizeof(*t->columns[i].offsets);
+
+            body += offsets + arrow_pad(offsets) + t->columns[i].size + arrow_pad(t->columns[i].size);
+            buffers += 3;
+        } else {
+            uint64_t values = (uint64_t)t->rows * arrow_width(t->fields[i].type);
+
+            body += values + arrow_pad(values);
+            buffers += 2;
+        }
+    }
+
+    header = fb_message(&fb, ARROW_HEADER_BATCH, body);
+    fb_ref(&fb, header, fb_table(&fb, 3, batch_sizes, batch));
+    fb_put(&fb, batch[0], t->rows, 8);
+    nodes = fb_vector(&fb, t->count, 16);
+    fb_ref(&fb, batch[1], nodes);
+    bufs = fb_vector(&fb, buffers, 16);
+    fb_ref(&fb, batch[2], bufs);
+
+    body = 0;
+    buffers = 0;
+    for (uint16_t i = 0; i < t->count; ++i) {
+        const arrow_column_t *col = &t->columns[i];
+        const void *data[2];
+        uint64_t size[2];
+        int parts = 1;
+
+        fb_put(&fb, nodes + 4 + 16 * i, t->rows, 8);
+
+        // Validity: none, no nulls
+        fb_put(&fb, bufs + 4 + 16 * buffers, body, 8);
+        buffers++;
+
+        if (arrow_is_string(t->fields[i].type)) {
+            data[0] = col->offsets;
+            size[0] = ((uint64_t)t->rows + 1) * sizeof(*col->offsets);
+            data[1] = col->values;
+            size[1] = col->size;
+            parts = 2;
+        } else {
+            data[0] = col->values;
+            size[0] = (uint64_t)t->rows * arrow_width(t->fields[i].type);
+        }
+
+        for (int p = 0; p < parts; ++p) {
+            fb_put(&fb, bufs + 4 + 16 * buffers, body, 8);
+            fb_put(&fb, bufs + 4 + 16 * buffers + 8, size[p], 8);
+            buffers++;
+
+            iov[n].iov_base = (void *)data[p];
+            iov[n++].iov_len = size[p];
+            if (arrow_pad(size[p])) {
+                iov[n].iov_base = (void *)arrow_zeros;
+                iov[n++].iov_len = arrow_pad(size[p]);
+            }
+            body += size[p] + arrow_pad(size[p]);
+        }
+    }
+
+    t->errnum = arrow_message(t->fd, &fb, iov, n);
+    free(fb.buf);
+
+    t->total += t->rows;
+    t->batches++;
+    t->rows = 0;
+    for (uint16_t i = 0; i < t->count; ++i) {
+        t->columns[i].size = 0;
+    }
+
+    return t->errnum;
+}
+
+static int arrow_append_bytes(arrow_column_t *col, uint32_t row, const arrow_value_t *value)
+{
+    if (value->size > col->cap - col->size) {
+        uint64_t cap = col->cap;
+        uint8_t *values;
+
+        while (cap < (uint64_t)col->size + value->size) {
+            cap *= 2;
+        }
+        if (cap > INT32_MAX) {
+            return EOVERFLOW;
+        }
+        values = realloc(col->values, cap);
+        if (values == NULL) {
+            return ENOMEM;
+        }
+        col->values = values;
+        col->cap = cap;
+    }
+
+    memcpy((uint8_t *)col->values + col->size, value->bytes, value->size);
+    col->size += value->size;
+    col->offsets[row + 1] = col->size;
+
+    return 0;
+}
+
+int arrow_table_append(arrow_table_t *t, const arrow_value_t *row)
+{
+    uint32_t r = t->rows;
+
+    if (t->errnum) {
+        return t->errnum;
+    }
+
+    for (uint16_t i = 0; i < t->count && t->errnum == 0; ++i) {
+        arrow_column_t *col = &t->columns[i];
+
+        switch (t->fields[i].type) {
+            case ARROW_UINT8:
+                ((uint8_t *)col->values)[r] = row[i].u;
+                break;
+            case ARROW_UINT16:
+                ((uint16_t *)col->values)[r] = row[i].u;
+                break;
+            case ARROW_UINT32:
+                ((uint32_t *)col->values)[r] = row[i].u;
+                break;
+            default:
+                t->errnum = arrow_append_bytes(col, r, &row[i]);
+                break;
+        }
+    }
+
+    if (t->errnum == 0 && ++t->rows == t->batch_rows) {
+        arrow_table_flush(t);
+    }
+
+    return t->errnum;
+}
+
+int arrow_table_close(arrow_table_t *t)
+{
+    int status = arrow_table_flush(t);
+
+    if (status == 0) {
+        uint8_t eos[8] = { 0xFF, 0xFF, 0xFF, 0xFF, 0, 0, 0, 0 };
+        struct iovec iov = { eos, sizeof(eos) };
+
+        status = arrow_writev(t->fd, &iov, 1);
+    }
+
+    for (uint16_t i = 0; i < t->count; ++i) {
+        free(t->columns[i].values);
+        free(t->columns[i].offsets);
+    }
+    memset(t->columns, 0, sizeof(t->columns));
+
+    return status;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
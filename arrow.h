@@ -0,0 +1,96 @@
+#ifndef __ARROW_H__
+#define __ARROW_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Arrow IPC Stream Writer
+ *
+ * Writes tables as an Apache Arrow IPC stream (https://arrow.apache.org/
+ * docs/format/Columnar.html#ipc-streaming-format), which pyarrow, pandas,
+ * polars and DuckDB read as they are:
+ *
+ *   <schema message> <record batch message> ... <end of stream>
+ *
+ * Messages are built by hand, the flatbuffers of their metadata included,
+ * for the few types the tools need: unsigned integers, binary and utf8
+ * strings, none of them nullable.
+ *
+ * A table is kept as Arrow lays out a record batch: one array per column,
+ * plus an offsets array for the strings. A full batch is written from the
+ * columns as they are with one writev(), no copy, and the table starts
+ * over, so a table of any size takes the memory of one batch:
+ *
+ * static const arrow_field_t fields[] = {
+ *     { "key", ARROW_UINT8 },
+ *     { "name", ARROW_UTF8 },
+ * };
+ * arrow_table_t t;
+ * arrow_value_t row[2];
+ *
+ * arrow_table_open(&t, fd, fields, 2, 65536);  // Writes the schema
+ * row[0].u = 60;
+ * row[1].bytes = "C4";
+ * row[1].size = 2;
+ * arrow_table_append(&t, row);                 // Writes full batches
+ * arrow_table_close(&t);                       // The rest, end of stream
+ *
+ * Functions return 0 or a POSIX errno.
+ */
+
+#define ARROW_MAX_FIELDS    16
+
+enum {
+    ARROW_UINT8,
+    ARROW_UINT16,
+    ARROW_UINT32,
+    ARROW_BINARY,
+    ARROW_UTF8
+};
+
+typedef struct {
+    const char *    name;
+    uint8_t         type;
+} arrow_field_t;
+
+typedef struct {
+    uint32_t        u;          // Integer columns
+    const void *    bytes;      // Binary / utf8 columns, size bytes
+    uint32_t        size;
+} arrow_value_t;
+
+typedef struct {
+    void *          values;     // rows values, or the bytes of the strings
+    int32_t *       offsets;    // Strings: rows + 1 offsets into values
+    uint32_t        size;       // Strings: bytes in values
+    uint32_t        cap;        // Strings: room in values
+} arrow_column_t;
+
+typedef struct {
+    int                     fd;
+    const arrow_field_t *   fields;
+    uint16_t                count;
+    uint32_t                rows;       // In the batch being filled
+    uint32_t                batch_rows;
+    arrow_column_t          columns[ARROW_MAX_FIELDS];
+    uint64_t                total;      // Rows written
+    uint32_t                batches;
+    int                     errnum;     // First error, later calls do nothing
+} arrow_table_t;
+
+// Open a table writing to fd, batches of batch_rows rows. Writes the schema
+int arrow_table_open(arrow_table_t *t, int fd, const arrow_field_t *fields, uint16_t count, uint32_t batch_rows);
+
+// Append a row of count values, writing the batch when it is full
+int arrow_table_append(arrow_table_t *t, const arrow_value_t *row);
+
+// Write the rows left, if any
+int arrow_table_flush(arrow_table_t *t);
+
+// Flush, write the end of stream and free the columns. Doesn't close fd
+int arrow_table_close(arrow_table_t *t);
+
+#endif /* __ARROW_H__ */
+
+/* vim: set ts=4 sw=4 tw=0 list : */
@@ -0,0 +1,208 @@
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <math.h>
+
+#include "beat.h"
+
+#define BEAT_DEFAULT_TEMPO  500000      // Microseconds per quarter note without a tempo event
+#define BEAT_MIN_BPM        40
+#define BEAT_MAX_BPM        240
+#define BEAT_PRIOR_BPM      120
+#define BEAT_PRIOR_OCTAVES  1.0         // Width of the tempo prior
+#define BEAT_LANES          8           // Partial sums of a correlation
+#define BEAT_MIN_STRENGTH   0.05        // Weaker periods are noise
+#define BEAT_COMB_STEPS     20          // Periods tried per frame around the peak
+
+/**
+ * Sum of a[i] * b[i] over n, in BEAT_LANES partial sums: a float sum can't
+ * be reordered by the compiler, so the lanes are spelled out and the fixed
+ * count inner loop becomes vector multiply-adds.
+ */
+static float beat_dot(const float *restrict a, const float *restrict b, uint32_t n)
+{
+    float acc[BEAT_LANES] = { 0 };
+    float sum = 0;
+    uint32_t i = 0;
+
+    for (; i + BEAT_LANES <= n; i += BEAT_LANES) {
+        for (int k = 0; k < BEAT_LANES; ++k) {
+            acc[k] += a[i + k] * b[i + k];
+        }
+    }
+    for (; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    for (int k = 0; k < BEAT_LANES; ++k) {
+        sum += acc[k];
+    }
+
+    return sum;
+}
+
+// Onset strength: velocities per frame, smoothed over +-2 frames, mean taken off
+static void beat_envelope(const midi_note_t *notes, uint32_t count, double frame_ticks, float *env, uint32_t frames)
+{
+    static const float kernel[5] = { 1 / 9.0f, 2 / 9.0f, 3 / 9.0f, 2 / 9.0f, 1 / 9.0f };
+    float *raw = env + frames;
+    const double per_tick = 1 / frame_ticks;
+    float mean = 0;
+
+    memset(raw, 0, frames * sizeof(*raw));
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t f = (uint32_t)(notes[i].start * per_tick + 0.5);
+
+        if (f < frames) {
+            raw[f] += notes[i].velocity / 127.0f;
+        }
+    }
+
+    for (uint32_t f = 0; f < frames; ++f) {
+        float v = 0;
+
+        for (int k = -2; k <= 2; ++k) {
+            if (f + k < frames) {
+                v += kernel[k + 2] * raw[f + k];
+            }
+        }
+        env[f] = v;
+        mean += v;
+    }
+
+    mean /= frames;
+    for (uint32_t f = 0; f < frames; ++f) {
+        env[f] -= mean;
+    }
+}
+
+static double beat_prior(uint32_t lag, double prior_lag)
+{
+    double octaves = log2(lag / prior_lag) / BEAT_PRIOR_OCTAVES;
+
+    return exp(-0.5 * octaves * octaves);
+}
+
+// Sum of the onset strength on the comb of period frames from phase on
+static float beat_comb(const float *env, uint32_t frames, double period, uint32_t phase)
+{
+    float sum = 0;
+
+    for (double f = phase; f < frames; f += period) {
+        sum += env[(uint32_t)(f + 0.5)];
+    }
+
+    return sum;
+}
+
+/**
+ * The comb that picks up the most onset strength, over the phases of the
+ * periods within a frame of *period: an error of a hundredth of a frame
+ * adds up over a song, the comb sharpens the period and finds the phase.
+ */
+static uint32_t beat_phase(const float *env, uint32_t frames, double *period)
+{
+    const double around = *period;
+    uint32_t best = 0;
+    float best_sum = -INFINITY;
+
+    for (int step = -BEAT_COMB_STEPS; step <= BEAT_COMB_STEPS; ++step) {
+        double p = around + (double)step / BEAT_COMB_STEPS;
+
+        for (uint32_t phase = 0; phase < p && phase + p < frames; ++phase) {
+            float sum = beat_comb(env, frames, p, phase);
+
+            if (sum > best_sum) {
+                best_sum = sum;
+                best = phase;
+                *period = p;
+            }
+        }
+    }
+
+    return best;
+}
+
+int beat_estimate(const midi_note_t *notes, uint32_t count, uint16_t ppq, beat_t *beat)
+{
+    const double frame_ticks = (double)ppq * BEAT_FRAME_US / BEAT_DEFAULT_TEMPO;
+    const uint32_t lag_min = 60000000 / BEAT_MAX_BPM / BEAT_FRAME_US;
+    const double prior_lag = 60000000.0 / BEAT_PRIOR_BPM / BEAT_FRAME_US;
+    uint32_t lag_max = 60000000 / BEAT_MIN_BPM / BEAT_FRAME_US;
+    uint32_t last = 0;
+    uint32_t frames;
+    uint32_t lag = 0;
+    double best = 0;
+    double period;
+    double ticks;
+    float *env;
+    float ac[60000000 / BEAT_MIN_BPM / BEAT_FRAME_US + 2];
+    float energy;
+
+    memset(beat, 0, sizeof(*beat));
+    if (count < BEAT_MIN_NOTES || ppq == 0) {
+        return ENODATA;
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        last = notes[i].start > last ? notes[i].start : last;
+    }
+    frames = last / frame_ticks + 3 < BEAT_MAX_FRAMES ? (uint32_t)(last / frame_ticks) + 3 : BEAT_MAX_FRAMES;
+    if (lag_max + 1 > frames / 2) {
+        lag_max = frames / 2 - 1;
+    }
+    if (frames < 4 || lag_max <= lag_min) {
+        return ENODATA;
+    }
+
+    // The envelope, and the raw onsets behind it while it is built
+    env = malloc(2 * frames * sizeof(*env));
+    if (env == NULL) {
+        return ENOMEM;
+    }
+    beat_envelope(notes, count, frame_ticks, env, frames);
+
+    energy = beat_dot(env, env, frames);
+    for (uint32_t l = lag_min - 1; l <= lag_max + 1; ++l) {
+        // Normalized by the overlap, so long lags aren't favoured less
+        ac[l] = beat_dot(env, env + l, frames - l) / (frames - l);
+    }
+    for (uint32_t l = lag_min; l <= lag_max; ++l) {
+        double score = ac[l] * beat_prior(l, prior_lag);
+
+        if (score > best) {
+            best = score;
+            lag = l;
+        }
+    }
+    if (lag == 0 || energy <= 0 || ac[lag] * frames / energy < BEAT_MIN_STRENGTH) {
+        free(env);
+        return ENODATA;
+    }
+
+    // Parabola through the peak and its neighbours
+    period = lag;
+    if (ac[lag - 1] - 2 * ac[lag] + ac[lag + 1] < 0) {
+        period += 0.5 * (ac[lag - 1] - ac[lag + 1]) / (ac[lag - 1] - 2 * ac[lag] + ac[lag + 1]);
+    }
+
+    beat->strength = ac[lag] * frames / energy;
+    if (fabs(period * frame_ticks - ppq) <= BEAT_SNAP * ppq) {
+        // The division is the beat, and its beats start at tick 0
+        beat->period = ppq;
+    } else {
+        uint32_t phase = beat_phase(env, frames, &period);
+
+        ticks = period * frame_ticks;
+        beat->period = ticks > 1 ? (uint32_t)(ticks + 0.5) : 1;
+        beat->phase = (uint32_t)(phase * frame_ticks + 0.5) % beat->period;
+        beat->shift = (beat->period - beat->phase) % beat->period;
+    }
+    beat->tempo = (uint32_t)((double)beat->period * BEAT_DEFAULT_TEMPO / ppq + 0.5);
+
+    free(env);
+
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
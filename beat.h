@@ -0,0 +1,62 @@
+#ifndef __BEAT_H__
+#define __BEAT_H__
+
+#include <stdint.h>
+
+#include "timeline.h"
+
+/**
+ * Beat Tracking
+ *
+ * Recorded performances often come without a tempo event and with a
+ * placeholder division: their ticks are real time (at the default 120 beats
+ * per minute) and a quarter note of the division has nothing to do with the
+ * beat played. This estimates the beat from the note onsets:
+ *
+ * - Onset strength: the velocities of the notes starting in every frame of
+ *   BEAT_FRAME_US, the mean taken off
+ * - Tempo: the autocorrelation of the envelope over the lags of 40 to 240
+ *   beats per minute, weighted by a log-normal prior around 120, the
+ *   winning lag refined to a fraction of a frame
+ * - Phase: the comb that picks up the most onset strength, over periods
+ *   within a frame of the one found, which also sharpens the period
+ *
+ * beat_t beat;
+ *
+ * if (beat_estimate(notes, count, ppq, &beat) == 0) {
+ *     quant_grid_init(&grid, beat.period, divisions, 4, 2);
+ *     grid.shift = beat.shift;
+ * }
+ *
+ * A period within BEAT_SNAP of the division is taken to be the division,
+ * so files whose division is right keep their note lengths. Only the first
+ * BEAT_MAX_FRAMES of a song are looked at, which keeps the cost at a
+ * millisecond or two.
+ */
+
+#define BEAT_FRAME_US       10000       // Envelope resolution, 10 ms
+#define BEAT_MAX_FRAMES     32768       // About 5 1/2 minutes
+#define BEAT_MIN_NOTES      8
+#define BEAT_SNAP           0.04
+
+typedef struct {
+    uint32_t    period;     // Ticks per beat
+    uint32_t    phase;      // Tick of the first beat, less than period
+    uint32_t    shift;      // Ticks to add to put beats on multiples of period
+    uint32_t    tempo;      // Microseconds per beat, at the default tempo of the ticks
+    float       strength;   // Autocorrelation at the period over that at lag 0
+} beat_t;
+
+/**
+ * Estimate the beat of notes (any order) of a file of division ppq, without
+ * tempo events.
+ *
+ * Returns 0, ENODATA with fewer than BEAT_MIN_NOTES notes or no periodicity
+ * to find, or ENOMEM. A period of ppq means the division already is the
+ * beat.
+ */
+int beat_estimate(const midi_note_t *notes, uint32_t count, uint16_t ppq, beat_t *beat);
+
+#endif /* __BEAT_H__ */
+
+/* vim: set ts=4 sw=4 tw=0 list : */
@@ -0,0 +1,487 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "midi.h"
+#include "timeline.h"
+#include "archive.h"
+#include "corpus.h"
+#include "trkcache.h"
+#include "convert.h"
+
+typedef struct {
+    const midi_emitter_t *const *   emitters;
+    void **                         ctx;
+    int                             count;
+    trkcache_track_t *              record;     // Track cache being filled, NULL if none
+} convert_pass_t;
+
+typedef struct {
+    const char *                    name;       // Input, outputs are <name>[.<song>]<suffix>
+    const void *                    buf;        // In memory input, NULL to open name
+    size_t                          size;
+    const convert_output_t *        output;     // NULL for files
+    const midi_emitter_t *const *   emitters;
+    int                             count;
+    const emitter_options_t *       opt;
+} convert_job_t;
+
+typedef struct {
+    FILE *      fp;
+    char *      buf;        // Output collected in memory for job->output
+    size_t      len;
+} convert_out_t;
+
+typedef struct {
+    tar_t *             tar;
+    pthread_mutex_t     lock;
+} convert_tar_t;
+
+typedef struct {
+    const convert_job_t *           job;
+    int                             songs;
+    int                             next;       // Next song to convert
+    int                             status;     // First error
+    pthread_mutex_t                 lock;
+} convert_songs_t;
+
+static void convert_note(const midi_note_t *note, void *arg)
+{
+    convert_pass_t *pass = arg;
+
+    for (int i = 0; i < pass->count; ++i) {
+        pass->emitters[i]->note(pass->ctx[i], note);
+    }
+    if (pass->record != NULL) {
+        trkcache_note(note, pass->record);
+    }
+}
+
+static void convert_meta(uint32_t tick, const midi_event_t *event, void *arg)
+{
+    convert_pass_t *pass = arg;
+
+    for (int i = 0; i < pass->count; ++i) {
+        pass->emitters[i]->meta(pass->ctx[i], tick, event);
+    }
+    if (pass->record != NULL) {
+        trkcache_meta(tick, event, pass->record);
+    }
+}
+
+// track_jobs threads decode a big track chunk, see midi_set_jobs()
+static int convert_open(const convert_job_t *job, midi_t **midi, uint16_t track_jobs)
+{
+    int status = job->buf ? midi_open_mem(job->buf, job->size, midi) : midi_open(job->name, midi);
+
+    if (status == 0) {
+        midi_set_recover(*midi, job->opt->recover);
+        midi_set_jobs(*midi, track_jobs ? track_jobs : 1);
+    }
+
+    return status;
+}
+
+// Create the directories of path, for outputs of archive members
+static int convert_mkdirs(const char *path)
+{
+    char dir[1024];
+
+    snprintf(dir, sizeof(dir), "%s", path);
+    for (char *p = strchr(dir + 1, '/'); p != NULL; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+            return errno;
+        }
+        *p = '/';
+    }
+
+    return 0;
+}
+
+static int convert_out_open(const convert_job_t *job, const char *name, convert_out_t *out)
+{
+    memset(out, 0, sizeof(*out));
+
+    if (job->output != NULL) {
+        out->fp = open_memstream(&out->buf, &out->len);
+        return out->fp ? 0 : errno;
+    }
+
+    out->fp = fopen(name, "wb");
+    if (out->fp == NULL && errno == ENOENT && convert_mkdirs(name) == 0) {
+        out->fp = fopen(name, "wb");
+    }
+
+    return out->fp ? 0 : errno;
+}
+
+static int convert_out_close(const convert_job_t *job, const char *name, convert_out_t *out, int status)
+{
+    if (out->fp == NULL) {
+        return status;
+    }
+
+    if (fclose(out->fp) != 0 && status == 0) {
+        status = errno;
+    }
+    if (job->output != NULL) {
+        if (status == 0) {
+            status = job->output->write(name, out->buf, out->len, job->output->arg);
+        }
+        free(out->buf);
+    }
+
+    return status;
+}
+
+/**
+ * Run the emitters over tracks [first, first + view->hdr.tracks) of midi,
+ * writing <out_name><suffix>. The emitters see view: the whole file, or a
+ * single song of a format 2 file with its track renumbered to 0.
+ *
+ * With opt->incremental, tracks are hashed first and the ones found in
+ * <out_name>.trkc are replayed from there instead of parsed and walked.
+ */
+static int convert_tracks(const convert_job_t *job, midi_t *midi, const midi_t *view, int first, const char *out_name)
+{
+    const midi_emitter_t *const *emitters = job->emitters;
+    int count = job->count;
+    midi_track_t *track;
+    convert_pass_t pass;
+    void *ctx[count > 0 ? count : 1];
+    convert_out_t out[count > 0 ? count : 1];
+    char file_name[count > 0 ? count : 1][1024];
+    // The track cache lives next to the output files
+    bool cached = job->opt->incremental && job->output == NULL;
+    trkcache_t prev, next;
+    char cache_name[1024];
+    int reused = 0;
+    int status = 0;
+
+    memset(ctx, 0, sizeof(ctx));
+    memset(out, 0, sizeof(out));
+    memset(&prev, 0, sizeof(prev));
+    memset(&next, 0, sizeof(next));
+
+    pass.emitters = emitters;
+    pass.ctx = ctx;
+    pass.count = 0;
+    pass.record = NULL;
+
+    for (int i = 0; i < count && status == 0; ++i) {
+        snprintf(file_name[i], sizeof(file_name[i]), "%s%s", out_name, emitters[i]->suffix);
+
+        status = convert_out_open(job, file_name[i], &out[i]);
+        if (status) {
+            break;
+        }
+
+        errno = 0;
+        ctx[i] = emitters[i]->begin(view, out[i].fp, job->opt);
+        if (ctx[i] == NULL) {
+            status = errno ? errno : ENOMEM;
+            break;
+        }
+        pass.count++;
+    }
+
+    if (cached && status == 0) {
+        // No cache yet, or a stale one, just means converting every track
+        snprintf(cache_name, sizeof(cache_name), "%s.trkc", out_name);
+        if (trkcache_load(cache_name, &prev) == 0 && prev.recover != job->opt->recover) {
+            trkcache_free(&prev);
+        }
+        status = trkcache_init(&next, view->hdr.tracks);
+        next.recover = job->opt->recover;
+    }
+
+    // One parse and one walk per track for all emitters
+    for (int i = 0; i < view->hdr.tracks && status == 0; ++i) {
+        if (cached) {
+            trkcache_track_t *hit;
+            uint64_t hash;
+
+            status = midi_get_track_hash(midi, first + i, &hash);
+            if (status) {
+                break;
+            }
+
+            hit = trkcache_find(&prev, hash, i);
+            if (hit != NULL) {
+                // Unchanged since the last conversion, only the emitters run
+                midi_track_t stub = {
+                    .hdr = { .magic = { 'M', 'T', 'r', 'k' }, .size = hit->size },
+                    .events = hit->events,
+                    .num = i,
+                };
+
+                for (int e = 0; e < pass.count; ++e) {
+                    emitters[e]->begin_track(ctx[e], &stub);
+                }
+                trkcache_replay(hit, i, convert_note, convert_meta, &pass);
+                trkcache_move(&next, i, hit);
+                reused++;
+                continue;
+            }
+
+            pass.record = trkcache_track(&next, i);
+            pass.record->hash = hash;
+        }
+
+        track = midi_get_track(midi, first + i);
+        if (track == NULL) {
+            status = midi_get_errno(midi) ? midi_get_errno(midi) : EINVAL;
+            break;
+        }
+        track->num = i;
+
+        if (track->damaged) {
+            fprintf(stderr, "%s: track %d: skipped %u damaged byte ranges\n", job->name, first + i, track->damaged);
+        }
+
+        if (pass.record != NULL) {
+            pass.record->events = track->events;
+            pass.record->size = track->hdr.size;
+        }
+
+        for (int e = 0; e < pass.count; ++e) {
+            emitters[e]->begin_track(ctx[e], track);
+        }
+        midi_track_walk(track, convert_note, convert_meta, &pass);
+        pass.record = NULL;
+
+        midi_free_track(track);
+    }
+
+    if (cached) {
+        if (status == 0) {
+            if (job->opt->verbose) {
+                printf("%s: %d of %d tracks unchanged\n", out_name, reused, view->hdr.tracks);
+            }
+            // Outputs are complete without it, a cache that can't be written is only slower next time
+            trkcache_save(cache_name, &next);
+        }
+        trkcache_free(&prev);
+        trkcache_free(&next);
+    }
+
+    for (int i = 0; i < pass.count; ++i) {
+        int end = emitters[i]->end(ctx[i]);
+
+        status = status ? status : end;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        status = convert_out_close(job, file_name[i], &out[i], status);
+    }
+
+    return status;
+}
+
+static void *convert_song_worker(void *arg)
+{
+    convert_songs_t *songs = arg;
+    const convert_job_t *job = songs->job;
+    midi_t *midi;
+    midi_t view;
+    char out_name[1024];
+    int status;
+
+    // Every worker has the file open once for all its songs. The songs are
+    // the parallel part, their tracks are decoded serially
+    status = convert_open(job, &midi, 1);
+
+    for (;;) {
+        int song;
+
+        pthread_mutex_lock(&songs->lock);
+        if (status && songs->status == 0) {
+            songs->status = status;
+        }
+        song = midi == NULL ? songs->songs : songs->next++;
+        pthread_mutex_unlock(&songs->lock);
+
+        if (song >= songs->songs) {
+            break;
+        }
+
+        // A song is a format 0 file of its own
+        view = *midi;
+        view.hdr.format = MIDI_FORMAT_SINGLE;
+        view.hdr.tracks = 1;
+
+        snprintf(out_name, sizeof(out_name), "%s.%d", job->name, song + 1);
+        status = convert_tracks(job, midi, &view, song, out_name);
+    }
+
+    midi_close(midi);
+
+    return NULL;
+}
+
+static int convert_songs(const convert_job_t *job, int songs_n)
+{
+    convert_songs_t songs;
+    long threads_n = job->opt->jobs ? job->opt->jobs : sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_t *threads;
+
+    memset(&songs, 0, sizeof(songs));
+    songs.job = job;
+    songs.songs = songs_n;
+
+    if (threads_n > songs_n) {
+        threads_n = songs_n;
+    }
+    if (threads_n < 1) {
+        threads_n = 1;
+    }
+
+    threads = calloc(threads_n, sizeof *threads);
+    if (threads == NULL) {
+        return ENOMEM;
+    }
+
+    pthread_mutex_init(&songs.lock, NULL);
+
+    for (long i = 0; i < threads_n; ++i) {
+        if (pthread_create(&threads[i], NULL, convert_song_worker, &songs) != 0) {
+            threads_n = i;
+            break;
+        }
+    }
+    if (threads_n == 0) {
+        // No thread could be started, convert in this one
+        convert_song_worker(&songs);
+    }
+    for (long i = 0; i < threads_n; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&songs.lock);
+    free(threads);
+
+    return songs.status;
+}
+
+static int convert_run(const convert_job_t *job)
+{
+    midi_t *midi;
+    int status;
+
+    status = convert_open(job, &midi, job->opt->track_jobs);
+    if (status) {
+        return status;
+    }
+
+    if (midi->hdr.format == MIDI_FORMAT_SONGS) {
+        int songs = midi->hdr.tracks;
+
+        midi_close(midi);
+
+        return convert_songs(job, songs);
+    }
+
+    status = convert_tracks(job, midi, midi, 0, job->name);
+
+    midi_close(midi);
+
+    return status;
+}
+
+int midi_convert(const char *midi_file, const midi_emitter_t *const *emitters, int count, const emitter_options_t *opt)
+{
+    return midi_convert_from(midi_file, NULL, 0, emitters, count, opt, NULL);
+}
+
+int midi_convert_from(const char *name, const void *buf, size_t size, const midi_emitter_t *const *emitters,
+        int count, const emitter_options_t *opt, const convert_output_t *output)
+{
+    convert_job_t job = {
+        .name = name,
+        .buf = buf,
+        .size = size,
+        .output = output,
+        .emitters = emitters,
+        .count = count,
+        .opt = opt,
+    };
+
+    return convert_run(&job);
+}
+
+static int convert_tar_write(const char *name, const void *data, size_t size, void *arg)
+{
+    convert_tar_t *tar = arg;
+    int status;
+
+    // Names inside the archive are relative
+    while (name[0] == '/' || strncmp(name, "./", 2) == 0) {
+        name += name[0] == '/' ? 1 : 2;
+    }
+
+    // Outputs of the songs of a format 2 file come from several threads
+    pthread_mutex_lock(&tar->lock);
+    status = tar_add(tar->tar, name, data, size);
+    pthread_mutex_unlock(&tar->lock);
+
+    return status;
+}
+
+int midi_convert_corpus(char **paths, int count, const midi_emitter_t *const *emitters, int emitters_n,
+        const emitter_options_t *opt, const char *out_archive)
+{
+    convert_tar_t tar;
+    convert_output_t output = { convert_tar_write, &tar };
+    corpus_t corpus;
+    corpus_entry_t entry;
+    int failed = 0;
+
+    if (out_archive != NULL) {
+        tar.tar = tar_create(out_archive);
+        if (tar.tar == NULL) {
+            fprintf(stderr, "Failed to create %s: %s\n", out_archive, strerror(errno));
+            return count;
+        }
+        pthread_mutex_init(&tar.lock, NULL);
+    }
+
+    corpus_init(&corpus, paths, count);
+    while (corpus_next(&corpus, &entry)) {
+        int status = entry.status;
+
+        if (status == 0) {
+            status = midi_convert_from(entry.name, entry.data, entry.size, emitters, emitters_n, opt,
+                    out_archive ? &output : NULL);
+        }
+
+        if (status) {
+            if (entry.archive) {
+                fprintf(stderr, "Failed to convert %s in %s: %s\n", entry.name, entry.archive, strerror(status));
+            } else {
+                fprintf(stderr, "Failed to convert %s: %s\n", entry.name, strerror(status));
+            }
+            failed++;
+        }
+    }
+    corpus_close(&corpus);
+
+    if (out_archive != NULL) {
+        int status = tar_close(tar.tar);
+
+        pthread_mutex_destroy(&tar.lock);
+        if (status) {
+            fprintf(stderr, "Failed to write %s: %s\n", out_archive, strerror(status));
+            failed++;
+        }
+    }
+
+    return failed;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
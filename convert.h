@@ -0,0 +1,61 @@
+#ifndef __CONVERT_H__
+#define __CONVERT_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "emitter.h"
+
+/**
+ * Conversion Pass
+ *
+ * Parses a midi file once, walks every track once and drives all the given
+ * emitters, each writing <midi_file><suffix>:
+ *
+ * const midi_emitter_t *emitters[] = { &midi_emitter_ssc, &midi_emitter_csv };
+ * emitter_options_t opt = { .divisions = 4 };
+ *
+ * status = midi_convert("a.mid", emitters, 2, &opt);   // a.mid.ssc, a.mid.csv
+ *
+ * Format 2 files are a series of independent songs: every track is
+ * converted on its own, with its own tempo, key and time signature, into
+ * <midi_file>.<n><suffix> (n from 1). Songs are converted in parallel by
+ * opt->jobs threads, 0 for one per CPU.
+ *
+ * Returns 0 on success or a POSIX errno. On error, outputs may be incomplete.
+ */
+int midi_convert(const char *midi_file, const midi_emitter_t *const *emitters, int count, const emitter_options_t *opt);
+
+/**
+ * Where outputs go instead of files: every output is collected in memory
+ * and handed to write() once complete. write() may be called from several
+ * threads (format 2 songs). Returns 0 or a POSIX errno.
+ */
+typedef struct {
+    int     (*write)(const char *name, const void *data, size_t size, void *arg);
+    void *  arg;
+} convert_output_t;
+
+/**
+ * Same as midi_convert(), reading the midi file from buf (size bytes) when
+ * buf is not NULL, and writing through output when it is not NULL. Outputs
+ * are still named after name, missing directories are created for files.
+ */
+int midi_convert_from(const char *name, const void *buf, size_t size, const midi_emitter_t *const *emitters,
+        int count, const emitter_options_t *opt, const convert_output_t *output);
+
+/**
+ * Convert all the inputs of a batch tool (see corpus.h): midi files, and the
+ * midi members of tar / zip archives straight from memory. Outputs are
+ * written next to the files and under the current directory for members,
+ * or all into the tar archive out_archive when it is not NULL.
+ *
+ * Failures are printed to stderr, returns the number of them.
+ */
+int midi_convert_corpus(char **paths, int count, const midi_emitter_t *const *emitters, int emitters_n,
+        const emitter_options_t *opt, const char *out_archive);
+
+#endif /* __CONVERT_H__ */
+
+/* vim: set ts=4 sw=4 tw=0 list : */
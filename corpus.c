@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+
+#include "corpus.h"
+
+static const char *midi_suffixes[] = { ".mid", ".midi", ".kar" };
+static const char *compressed_suffixes[] = { ".gz", ".zst" };
+
+// Length of the first of suffixes the len bytes of name end in, 0 if none
+static size_t suffix_len(const char *name, size_t len, const char **suffixes, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        size_t n = strlen(suffixes[i]);
+
+        if (len > n && strncasecmp(name + len - n, suffixes[i], n) == 0) {
+            return n;
+        }
+    }
+
+    return 0;
+}
+
+bool corpus_is_midi_name(const char *name)
+{
+    return suffix_len(name, strlen(name), midi_suffixes, sizeof(midi_suffixes) / sizeof(midi_suffixes[0])) > 0;
+}
+
+size_t corpus_compressed_suffix(const char *path)
+{
+    size_t len = strlen(path);
+    size_t n = suffix_len(path, len, compressed_suffixes, sizeof(compressed_suffixes) / sizeof(compressed_suffixes[0]));
+
+    return n && suffix_len(path, len - n, midi_suffixes, sizeof(midi_suffixes) / sizeof(midi_suffixes[0])) ? n : 0;
+}
+
+bool corpus_is_midi_file(const char *path)
+{
+    return corpus_is_midi_name(path) || corpus_compressed_suffix(path) > 0;
+}
+
+void corpus_init(corpus_t *corpus, char **paths, int count)
+{
+    memset(corpus, 0, sizeof(*corpus));
+    corpus->paths = paths;
+    corpus->count = count;
+}
+
+bool corpus_next(corpus_t *corpus, corpus_entry_t *entry)
+{
+    archive_entry_t member;
+    int status;
+
+    memset(entry, 0, sizeof(*entry));
+
+    for (;;) {
+        if (corpus->ar != NULL) {
+            while (archive_next(corpus->ar, &member)) {
+                if (corpus_is_midi_name(member.name)) {
+                    entry->name = member.name;
+                    entry->archive = corpus->ar_path;
+                    entry->data = member.data;
+                    entry->size = member.size;
+                    return true;
+                }
+            }
+
+            status = archive_errno(corpus->ar);
+            archive_close(corpus->ar);
+            corpus->ar = NULL;
+
+            if (status) {
+                entry->name = corpus->ar_path;
+                entry->status = status;
+                return true;
+            }
+        }
+
+        if (corpus->next >= corpus->count) {
+            return false;
+        }
+
+        const char *path = corpus->paths[corpus->next++];
+
+        status = archive_open(path, &corpus->ar);
+        if (status == 0) {
+            corpus->ar_path = path;
+            continue;
+        }
+
+        // Not an archive: a midi file, errors are left to opening it
+        entry->name = path;
+        return true;
+    }
+}
+
+void corpus_close(corpus_t *corpus)
+{
+    archive_close(corpus->ar);
+    corpus->ar = NULL;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
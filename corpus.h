@@ -0,0 +1,67 @@
+#ifndef __CORPUS_H__
+#define __CORPUS_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "archive.h"
+
+/**
+ * Corpus Input
+ *
+ * Iterates the inputs given to a batch tool: plain (or compressed) midi
+ * files are handed out by path, tar and zip archives are opened and walked
+ * in one sequential read, handing out the bytes of every midi member
+ * (.mid, .midi, .kar) in memory:
+ *
+ * corpus_t corpus;
+ * corpus_entry_t entry;
+ *
+ * corpus_init(&corpus, &argv[optind], argc - optind);
+ * while (corpus_next(&corpus, &entry)) {
+ *     if (entry.status) {
+ *         // entry.name could not be read, the corpus moves on
+ *     } else if (entry.data) {
+ *         // Member entry.name of entry.archive, entry.size bytes
+ *     } else {
+ *         // File entry.name
+ *     }
+ * }
+ * corpus_close(&corpus);
+ */
+
+typedef struct {
+    const char *    name;       // File path, or member name
+    const char *    archive;    // Archive of a member, NULL for files
+    const uint8_t * data;       // Member bytes, NULL for files. Valid until the next call
+    size_t          size;
+    int             status;     // Error reading the archive
+} corpus_entry_t;
+
+typedef struct {
+    char **         paths;
+    int             count;
+    int             next;
+    archive_t *     ar;         // Archive being walked
+    const char *    ar_path;
+} corpus_t;
+
+void corpus_init(corpus_t *corpus, char **paths, int count);
+bool corpus_next(corpus_t *corpus, corpus_entry_t *entry);
+void corpus_close(corpus_t *corpus);
+
+// Name ends in .mid, .midi or .kar, any case
+bool corpus_is_midi_name(const char *name);
+
+// Path of a midi file to open with zfile_open(): a midi name, or one
+// followed by .gz or .zst. For walking directories; archive members are
+// handed out as they are and must have a midi name
+bool corpus_is_midi_file(const char *path);
+
+// Length of the .gz / .zst suffix of a compressed midi file name, 0 if none
+size_t corpus_compressed_suffix(const char *path);
+
+#endif /* __CORPUS_H__ */
+
+/* vim: set ts=4 sw=4 tw=0 list : */
@@ -0,0 +1,757 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "note.h"
+#include "key.h"
+#include "quantize.h"
+#include "musicxml.h"
+#include "segment.h"
+#include "beat.h"
+#include "emitter.h"
+
+/**
+ * ssc - Score File
+ *
+ * MIDI File:
+ *
+ *      +----------------+
+ *      | header         |   -> ppq (pulse(ticks) per quarternote
+ *      |                |
+ *      +----------------+
+ *      | track 0        |   -> tempo
+ *      |                |   -> time signature
+ *      |                |   -> key signature
+ *      |                |
+ *      +----------------+
+ *      | track 1        |   -> note 1 with note / sharp / octaves / length
+ *      |                |   -> note 2 with note / sharp / octaves / length
+ *      |                |   -> :
+ *      |                |   -> :
+ *      |                |
+ *      +----------------+
+ *
+ * Score File:
+ *
+ * Byte 0           1           2           3           4
+ *      +-----------+-----------+-----------+-----------+
+ *    0 |     M     |     S     |     S     |     C     |
+ *      +-----------+-----------+-----------+-----------+
+ *    4 | Clef      | Key Sign  | Time Sign | Reserved  |
+ *      +-----------+-----------+-----------+-----------+
+ *    8 | Size(MSB) | Size(LSB) | Reserved  | Reserved  |
+ *      +-----------+-----------+-----------+-----------+
+ *   12 | Note 1    | Note 1    | Note 2    | Note 3    |
+ *      +-----------+-----------+-----------+-----------+
+ *      | ....      | ....      | ....      | ....      |
+ *      | ....      | ....      | ....      | ....      |
+ *      +-----------+-----------+-----------+-----------+
+ *
+ * Currently only support midi file which contain 1 or 2 tracks.
+ * If there are more than 2 tracks, only the first two tracks will be handled.
+ *
+ * midi->hdr.tracks
+ *   0          : Invalid (Should not happen)
+ *   1          : Only 1 track (format 0, or a song of a format 2 file). Tempo, key signature and
+ *                time signature setting in the same track as the notes.
+ *   2 (or more): Multiple tracks. Tempo, key signature and time signature setting in track 0.
+ *
+ * Assumption for the notes track:
+ * - 1 channel
+ * - Note On -> Note Off -> Note On -> Note Off -> ...
+ */
+
+#define SCORE_OFFSET_MAGIC          0
+#define SCORE_OFFSET_SIGNATURE      4
+#define SCORE_OFFSET_SIZE           8
+#define SCORE_OFFSET_DATA           12
+#define SCORE_SIZE                  512
+
+#define FRACTION_TOLERANCE          0.40
+
+typedef struct {
+    FILE *              out;
+    bool                verbose;
+    float               tolerance;
+    uint16_t            ppq;
+    uint32_t            tempo;
+    bool                have_tempo;
+    bool                track_beats; // Keep the notes until a tempo event or the end, see ssc_put_notes()
+    midi_note_t *       notes;
+    uint32_t            notes_n;
+    uint32_t            notes_size;
+    int                 errnum;
+    int                 conductor;  // Track with tempo / signatures
+    int                 melody;     // Track with notes
+    int                 track;      // Current track
+    uint32_t            last_end;   // End of the previous note
+    uint32_t            count;
+    uint32_t            position;
+    bool                full;
+    Clef_t              clef;
+    KeySignature_t      ks;
+    TimeSignature_t     ts;
+    uint8_t             score[SCORE_SIZE];
+} ssc_t;
+
+static uint8_t midi_delta_time_to_length(uint32_t delta_time, uint32_t base, float tolerance)
+{
+    uint8_t len = 0;
+    float fraction = 1.0;
+
+    if (!delta_time || !base) {
+        return NOTE_LENGTH_QUARTER;
+    }
+
+    fraction = (float)delta_time / base;
+
+    // Simple algorithm for length calculation.
+    //
+    // Can be extended to support dot note.
+    // Eg, for a quarternote with dot, the fraction will be 1.5
+    // TODO
+    //
+    if (fraction >= 4.0 - tolerance) {
+        len = NOTE_LENGTH_WHOLE;
+    } else if (fraction >= 2.0 - tolerance / 2) {
+        len = NOTE_LENGTH_HALF;
+    } else if (fraction >= 1.0 - tolerance / 4) {
+        len = NOTE_LENGTH_QUARTER;
+    } else if (fraction >= 0.5 - tolerance / 8) {
+        len = NOTE_LENGTH_EIGHTH;
+    } else {
+        len = NOTE_LENGTH_16TH;
+    }
+
+    return len;
+}
+
+static void *ssc_begin(const midi_t *midi, FILE *out, const emitter_options_t *opt)
+{
+    ssc_t *ssc;
+
+    if (midi->hdr.tracks == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    ssc = calloc(1, sizeof *ssc);
+    if (ssc == NULL) {
+        return NULL;
+    }
+
+    ssc->out = out;
+    ssc->verbose = opt->verbose;
+    ssc->tolerance = opt->tolerance > 0 ? opt->tolerance : FRACTION_TOLERANCE;
+    ssc->ppq = midi->ppq;
+    ssc->tempo = 500000;        // 0x07A120
+    ssc->track_beats = opt->beats;
+    ssc->ts.upper = 4;          // 4 / 4
+    ssc->ts.lower = 2;
+    ssc->conductor = 0;
+    ssc->melody = midi->hdr.tracks >= 2 ? 1 : 0;
+    ssc->position = SCORE_OFFSET_DATA;
+
+    return ssc;
+}
+
+static void ssc_begin_track(void *ctx, const midi_track_t *trk)
+{
+    ((ssc_t *)ctx)->track = trk->num;
+}
+
+static void ssc_meta(void *ctx, uint32_t tick, const midi_event_t *event)
+{
+    ssc_t *ssc = ctx;
+
+    (void)tick;
+
+    if (ssc->track != ssc->conductor) {
+        return;
+    }
+
+    switch (event->cmd) {
+        case MIDI_META_TEMPO_CHANGE:
+            // Tempo (in microseconds per MIDI quarter-note)
+            // FF 51 03 tttttt
+            ssc->tempo = event->data[0] << 16 | event->data[1] << 8 | event->data[2];
+            ssc->have_tempo = true;
+            if (ssc->verbose) {
+                printf("Tempo: %d us per quarternote\n", ssc->tempo);
+            }
+            break;
+        case MIDI_META_TIME_SIGNATURE:
+            // Time Signature
+            // FF 58 04 nn dd cc bb
+            ssc->ts.upper = event->data[0];
+            ssc->ts.lower = event->data[1];
+            if (ssc->verbose) {
+                printf("Time Signature: %d/%d\n", event->data[0], 1 << event->data[1]);
+            }
+            break;
+        case MIDI_META_KEY_SIGNATURE:
+            // Key Signature
+            // FF 59 02 sf mi
+            // sf = -7 : 7 flats
+            // sf = -1 : 1 flat
+            // sf =  0 : key of C
+            // sf =  1 : 1 sharp
+            // sf =  7 : 7 sharps
+            // mi =  0 : major key
+            // mi =  1 : minor key
+            ssc->ks.signature = event->data[0];
+            ssc->ks.scale = event->data[1];
+            break;
+        default:
+            break;
+    }
+}
+
+// Add a note, of a length in quarter notes of base ticks
+static void ssc_put(ssc_t *ssc, const midi_note_t *note, uint32_t base)
+{
+    NoteSimplified_t simp;
+
+    // The length runs from the end of the previous note, so rests are
+    // folded into the note that follows them
+    simp = NumNotaiton_KeyToNoteSimp(note->key,
+            midi_delta_time_to_length(note->end - ssc->last_end, base, ssc->tolerance));
+    ssc->last_end = note->end;
+
+    if (ssc->position >= SCORE_SIZE) {
+        if (!ssc->full && ssc->verbose) {
+            printf("Score full, dropping notes after %d\n", ssc->count);
+        }
+        ssc->full = true;
+        return;
+    }
+
+    ssc->count += 1;
+    ssc->score[ssc->position] = *(uint8_t *)&simp;
+    ssc->position += 1;
+    if (ssc->verbose) {
+        printf("Note - note: %d, sharp: %d, length: %d, octaves: %d\n", simp.note, simp.sharp, simp.length, simp.octaves);
+    }
+}
+
+static void ssc_put_notes(ssc_t *ssc);
+
+static void ssc_note(void *ctx, const midi_note_t *note)
+{
+    ssc_t *ssc = ctx;
+
+    if (ssc->track != ssc->melody) {
+        return;
+    }
+
+    // With a tempo event there is no beat to estimate, the notes kept so far
+    // go out and the rest are streamed
+    if (!ssc->track_beats || ssc->have_tempo) {
+        if (ssc->notes_n) {
+            ssc_put_notes(ssc);
+        }
+        ssc_put(ssc, note, ssc->ppq);
+        return;
+    }
+
+    if (ssc->notes_n == ssc->notes_size) {
+        uint32_t size = ssc->notes_size ? ssc->notes_size * 2 : 256;
+        midi_note_t *notes = realloc(ssc->notes, size * sizeof *notes);
+
+        if (notes == NULL) {
+            ssc->errnum = ENOMEM;
+            return;
+        }
+        ssc->notes = notes;
+        ssc->notes_size = size;
+    }
+
+    ssc->notes[ssc->notes_n++] = *note;
+}
+
+/**
+ * With track_beats the notes are kept until the end or the first tempo
+ * event: a file without one has its beat estimated (beat.h) and the lengths
+ * of its notes taken in beats rather than quarter notes of its division
+ */
+static void ssc_put_notes(ssc_t *ssc)
+{
+    uint32_t base = ssc->ppq;
+    beat_t beat;
+
+    if (!ssc->have_tempo && beat_estimate(ssc->notes, ssc->notes_n, ssc->ppq, &beat) == 0 && beat.period != ssc->ppq) {
+        base = beat.period;
+        if (ssc->verbose) {
+            printf("Tempo: %d us per quarternote, estimated (%u ticks per beat)\n", beat.tempo, beat.period);
+        }
+    }
+
+    for (uint32_t i = 0; i < ssc->notes_n; ++i) {
+        ssc_put(ssc, &ssc->notes[i], base);
+    }
+    ssc->notes_n = 0;
+}
+
+static int ssc_end(void *ctx)
+{
+    ssc_t *ssc = ctx;
+    uint8_t *score = ssc->score;
+    int status = ssc->errnum;
+
+    if (ssc->track_beats && status == 0) {
+        ssc_put_notes(ssc);
+    }
+
+    // Magic
+    score[0] = 'M';
+    score[1] = 'S';
+    score[2] = 'S';
+    score[3] = 'C';
+    // Header
+    score[4] = *(uint8_t *)&ssc->clef;
+    score[5] = *(uint8_t *)&ssc->ks;
+    score[6] = *(uint8_t *)&ssc->ts;
+    score[7] = 0;
+
+    if (ssc->verbose) {
+        printf("Total count of notes: %d\n", ssc->count);
+    }
+    score[8] = (ssc->count >> 8) & 0xFF;
+    score[9] = ssc->count & 0xFF;
+    score[10] = 0;
+    score[11] = 0;
+
+    if (status == 0 && fwrite(score, SCORE_SIZE, 1, ssc->out) != 1) {
+        status = errno ? errno : EIO;
+    }
+
+    free(ssc->notes);
+    free(ssc);
+
+    return status;
+}
+
+const midi_emitter_t midi_emitter_ssc = {
+    .name = "ssc",
+    .suffix = ".ssc",
+    .begin = ssc_begin,
+    .begin_track = ssc_begin_track,
+    .note = ssc_note,
+    .meta = ssc_meta,
+    .end = ssc_end,
+};
+
+/**
+ * csv - One row per note
+ *
+ * track,channel,start,end,key,velocity
+ */
+
+static void *csv_begin(const midi_t *midi, FILE *out, const emitter_options_t *opt)
+{
+    (void)midi;
+    (void)opt;
+
+    fputs("track,channel,start,end,key,velocity\n", out);
+
+    return out;
+}
+
+static void csv_begin_track(void *ctx, const midi_track_t *trk)
+{
+    (void)ctx;
+    (void)trk;
+}
+
+static void csv_note(void *ctx, const midi_note_t *note)
+{
+    fprintf((FILE *)ctx, "%u,%u,%u,%u,%u,%u\n",
+            note->track, note->chan, note->start, note->end, note->key, note->velocity);
+}
+
+static void csv_meta(void *ctx, uint32_t tick, const midi_event_t *event)
+{
+    (void)ctx;
+    (void)tick;
+    (void)event;
+}
+
+static int csv_end(void *ctx)
+{
+    return ferror((FILE *)ctx) ? EIO : 0;
+}
+
+const midi_emitter_t midi_emitter_csv = {
+    .name = "csv",
+    .suffix = ".csv",
+    .begin = csv_begin,
+    .begin_track = csv_begin_track,
+    .note = csv_note,
+    .meta = csv_meta,
+    .end = csv_end,
+};
+
+/**
+ * ndjson - One JSON object per line
+ *
+ * {"type":"header","format":1,"tracks":2,"ppq":960}
+ * {"type":"track","track":0,"events":6,"size":72}
+ * {"type":"meta","track":0,"tick":0,"cmd":81,"data":"07a120"}
+ * {"type":"note","track":1,"channel":0,"start":0,"end":960,"key":60,"velocity":100}
+ */
+
+typedef struct {
+    FILE *      out;
+    uint16_t    track;
+} ndjson_t;
+
+static void *ndjson_begin(const midi_t *midi, FILE *out, const emitter_options_t *opt)
+{
+    ndjson_t *nd = calloc(1, sizeof *nd);
+
+    (void)opt;
+
+    if (nd == NULL) {
+        return NULL;
+    }
+
+    nd->out = out;
+    fprintf(out, "{\"type\":\"header\",\"format\":%u,\"tracks\":%u,\"ppq\":%u}\n",
+            midi->hdr.format, midi->hdr.tracks, midi->ppq);
+
+    return nd;
+}
+
+static void ndjson_begin_track(void *ctx, const midi_track_t *trk)
+{
+    ndjson_t *nd = ctx;
+
+    nd->track = trk->num;
+    fprintf(nd->out, "{\"type\":\"track\",\"track\":%u,\"events\":%u,\"size\":%u}\n",
+            trk->num, trk->events, trk->hdr.size);
+}
+
+static void ndjson_note(void *ctx, const midi_note_t *note)
+{
+    fprintf(((ndjson_t *)ctx)->out,
+            "{\"type\":\"note\",\"track\":%u,\"channel\":%u,\"start\":%u,\"end\":%u,\"key\":%u,\"velocity\":%u}\n",
+            note->track, note->chan, note->start, note->end, note->key, note->velocity);
+}
+
+static void ndjson_meta(void *ctx, uint32_t tick, const midi_event_t *event)
+{
+    ndjson_t *nd = ctx;
+
+    fprintf(nd->out, "{\"type\":\"meta\",\"track\":%u,\"tick\":%u,\"cmd\":%u,\"data\":\"",
+            nd->track, tick, event->cmd);
+    for (int i = 0; i < event->size; ++i) {
+        fprintf(nd->out, "%02x", event->data[i]);
+    }
+    fputs("\"}\n", nd->out);
+}
+
+static int ndjson_end(void *ctx)
+{
+    ndjson_t *nd = ctx;
+    int status = ferror(nd->out) ? EIO : 0;
+
+    free(nd);
+
+    return status;
+}
+
+const midi_emitter_t midi_emitter_ndjson = {
+    .name = "ndjson",
+    .suffix = ".ndjson",
+    .begin = ndjson_begin,
+    .begin_track = ndjson_begin_track,
+    .note = ndjson_note,
+    .meta = ndjson_meta,
+    .end = ndjson_end,
+};
+
+/**
+ * xml - MusicXML
+ *
+ * Every track with notes becomes a part. Tempo, time and key signature are
+ * taken from the first ones found in the file. Notes are kept per part until
+ * the end, then quantized and written. Long parts are written in segments in
+ * parallel, cut at the marker and cue point events of the file (segment.h).
+ */
+
+typedef struct {
+    midi_note_t *   notes;
+    uint32_t        count;
+    uint32_t        size;
+    char            name[128];
+} xml_part_t;
+
+typedef struct {
+    FILE *          out;
+    uint16_t        ppq;
+    uint16_t        divisions;
+    uint16_t        tracks;
+    xml_part_t *    parts;
+    xml_part_t *    part;       // Current track
+    uint32_t        tempo;
+    uint8_t         beats;
+    uint8_t         beat_type;
+    int8_t          fifths;
+    bool            have_key;
+    uint32_t *      cuts;       // Ticks of markers and cue points
+    uint32_t        cuts_n;
+    uint32_t        cuts_size;
+    uint16_t        jobs;
+    bool            track_beats;
+    int             errnum;
+} xml_t;
+
+static void *xml_begin(const midi_t *midi, FILE *out, const emitter_options_t *opt)
+{
+    xml_t *x = calloc(1, sizeof *x);
+
+    if (x == NULL) {
+        return NULL;
+    }
+
+    x->out = out;
+    x->ppq = midi->ppq;
+    x->divisions = opt->divisions ? opt->divisions : 4;
+    x->tracks = midi->hdr.tracks;
+    x->jobs = opt->jobs;
+    x->track_beats = opt->beats;
+    x->beat_type = 2;
+    x->parts = calloc(x->tracks ? x->tracks : 1, sizeof *x->parts);
+    if (x->parts == NULL) {
+        free(x);
+        return NULL;
+    }
+
+    return x;
+}
+
+static void xml_begin_track(void *ctx, const midi_track_t *trk)
+{
+    xml_t *x = ctx;
+
+    x->part = trk->num < x->tracks ? &x->parts[trk->num] : NULL;
+    if (x->part != NULL) {
+        snprintf(x->part->name, sizeof(x->part->name), "Track %d", trk->num);
+    }
+}
+
+static void xml_note(void *ctx, const midi_note_t *note)
+{
+    xml_t *x = ctx;
+    xml_part_t *part = x->part;
+
+    if (part == NULL) {
+        return;
+    }
+
+    if (part->count == part->size) {
+        uint32_t size = part->size ? part->size * 2 : 256;
+        midi_note_t *notes = realloc(part->notes, size * sizeof *notes);
+
+        if (notes == NULL) {
+            x->errnum = ENOMEM;
+            return;
+        }
+        part->notes = notes;
+        part->size = size;
+    }
+
+    part->notes[part->count++] = *note;
+}
+
+static void xml_meta(void *ctx, uint32_t tick, const midi_event_t *event)
+{
+    xml_t *x = ctx;
+
+    (void)tick;
+
+    switch (event->cmd) {
+        case MIDI_META_SEQUENCE_NAME:
+            if (x->part != NULL) {
+                snprintf(x->part->name, sizeof(x->part->name), "%.*s", event->size, (const char *)event->data);
+            }
+            break;
+        case MIDI_META_TEMPO_CHANGE:
+            if (x->tempo == 0 && event->size >= 3) {
+                x->tempo = event->data[0] << 16 | event->data[1] << 8 | event->data[2];
+            }
+            break;
+        case MIDI_META_TIME_SIGNATURE:
+            if (x->beats == 0 && event->size >= 2) {
+                x->beats = event->data[0];
+                x->beat_type = event->data[1];
+            }
+            break;
+        case MIDI_META_KEY_SIGNATURE:
+            if (!x->have_key && event->size >= 1) {
+                x->fifths = (int8_t)event->data[0];
+                x->have_key = true;
+            }
+            break;
+        case MIDI_META_MARKER:
+        case MIDI_META_CUE_POINT:
+            if (x->cuts_n == x->cuts_size) {
+                uint32_t size = x->cuts_size ? x->cuts_size * 2 : 64;
+                uint32_t *cuts = realloc(x->cuts, size * sizeof *cuts);
+
+                if (cuts == NULL) {
+                    x->errnum = ENOMEM;
+                    break;
+                }
+                x->cuts = cuts;
+                x->cuts_size = size;
+            }
+            x->cuts[x->cuts_n++] = tick;
+            break;
+        default:
+            break;
+    }
+}
+
+static int xml_compare_tick(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Without a tempo event, the beat estimated from the onsets of all parts
+ * becomes the quarter note of the grid, its first beat a bar line
+ */
+static void xml_track_beats(xml_t *x, xml_part_t **parts, uint16_t count, quant_grid_t *grid)
+{
+    midi_note_t *notes;
+    uint32_t total = 0;
+    beat_t beat;
+
+    for (uint16_t i = 0; i < count; ++i) {
+        total += parts[i]->count;
+    }
+    notes = malloc((total ? total : 1) * sizeof(*notes));
+    if (notes == NULL) {
+        return;
+    }
+
+    total = 0;
+    for (uint16_t i = 0; i < count; ++i) {
+        memcpy(notes + total, parts[i]->notes, parts[i]->count * sizeof(*notes));
+        total += parts[i]->count;
+    }
+
+    if (beat_estimate(notes, total, x->ppq, &beat) == 0 && beat.period != x->ppq && beat.period <= UINT16_MAX) {
+        quant_grid_init(grid, beat.period, grid->divisions, grid->beats, grid->beat_type);
+        grid->shift = beat.shift;
+        x->tempo = beat.tempo;
+    }
+
+    free(notes);
+}
+
+static int xml_end(void *ctx)
+{
+    xml_t *x = ctx;
+    const char **names = calloc(x->tracks ? x->tracks : 1, sizeof *names);
+    xml_part_t **parts = calloc(x->tracks ? x->tracks : 1, sizeof *parts);
+    uint16_t count = 0;
+    quant_grid_t grid;
+    musicxml_t xml;
+    segment_opt_t seg = { x->cuts, x->cuts_n, 0, x->jobs };
+    int status = x->errnum;
+
+    if (names == NULL || parts == NULL) {
+        status = ENOMEM;
+    }
+
+    for (uint16_t i = 0; status == 0 && i < x->tracks; ++i) {
+        if (x->parts[i].count > 0) {
+            names[count] = x->parts[i].name;
+            parts[count++] = &x->parts[i];
+        }
+    }
+
+    quant_grid_init(&grid, x->ppq, x->divisions, x->beats ? x->beats : 4, x->beat_type);
+    if (status == 0 && x->track_beats && x->tempo == 0) {
+        xml_track_beats(x, parts, count, &grid);
+    }
+
+    // Markers of all tracks cut every part
+    if (x->cuts_n > 1) {
+        qsort(x->cuts, x->cuts_n, sizeof *x->cuts, xml_compare_tick);
+    }
+
+    if (status == 0) {
+        status = musicxml_open(&xml, x->out, &grid, x->fifths);
+    }
+
+    if (status == 0) {
+        musicxml_part_list(&xml, names, count);
+
+        for (uint16_t i = 0; i < count; ++i) {
+            uint64_t sum = 0;
+
+            for (uint32_t n = 0; n < parts[i]->count; ++n) {
+                sum += parts[i]->notes[n].key;
+            }
+
+            musicxml_begin_part(&xml, i, sum / parts[i]->count < KEY_PIANO_60 ? CLEF_TYPE_F : CLEF_TYPE_G, i == 0 ? x->tempo : 0);
+            if (status == 0) {
+                status = segment_musicxml(&xml, parts[i]->notes, parts[i]->count, &grid, &seg);
+            }
+            musicxml_end_part(&xml);
+        }
+
+        int end = musicxml_close(&xml);
+
+        status = status ? status : end;
+    }
+
+    for (uint16_t i = 0; i < x->tracks; ++i) {
+        free(x->parts[i].notes);
+    }
+    free(x->parts);
+    free(x->cuts);
+    free(names);
+    free(parts);
+    free(x);
+
+    return status;
+}
+
+const midi_emitter_t midi_emitter_xml = {
+    .name = "xml",
+    .suffix = ".musicxml",
+    .begin = xml_begin,
+    .begin_track = xml_begin_track,
+    .note = xml_note,
+    .meta = xml_meta,
+    .end = xml_end,
+};
+
+static const midi_emitter_t *const emitters[] = {
+    &midi_emitter_ssc,
+    &midi_emitter_csv,
+    &midi_emitter_ndjson,
+    &midi_emitter_xml,
+};
+
+const midi_emitter_t *midi_emitter_find(const char *name)
+{
+    for (size_t i = 0; i < sizeof(emitters) / sizeof(emitters[0]); ++i) {
+        if (!strcmp(emitters[i]->name, name)) {
+            return emitters[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
@@ -0,0 +1,72 @@
+#ifndef __EMITTER_H__
+#define __EMITTER_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "midi.h"
+#include "timeline.h"
+
+/**
+ * Output Emitters
+ *
+ * An emitter turns the walk of a midi file into one output format. The
+ * conversion pass (convert.h) parses and walks the file once and drives any
+ * number of emitters at the same time:
+ *
+ *   begin()                        once, with the opened output file
+ *   begin_track()                  for every track
+ *     note() / meta()              notes in note off order, meta events
+ *                                  as they are reached
+ *   end()                          once, writes what is left, frees the context
+ *
+ * Available emitters:
+ *
+ *   name     suffix      output
+ *   ssc      .ssc        Score file, see emitter.c
+ *   csv      .csv        One row per note
+ *   ndjson   .ndjson     One JSON object per note / meta event
+ *   xml      .musicxml   MusicXML, one part per track with notes
+ *
+ * dan and midi-dump keep their own loops over the events: dan writes the
+ * raw note on / off events in file order, one file per part, and
+ * midi-dump prints a damaged file up to the track that fails, neither of
+ * which the note / meta walk and its all or nothing outputs give.
+ */
+
+typedef struct {
+    uint16_t    divisions;  // xml: grid units per quarter note
+    bool        verbose;    // ssc: print converted settings and notes
+    float       tolerance;  // ssc: how far short of a length a note may fall, in quarter notes, 0 for 0.40
+    uint16_t    jobs;       // Songs of a format 2 file converted in parallel, 0 for one per CPU
+    uint16_t    track_jobs; // Threads decoding a track chunk of 1 MiB or more, 0 for serial (midi_set_jobs)
+    bool        recover;    // Skip damaged events instead of failing (midi_set_recover)
+    bool        incremental; // Replay unchanged tracks from the <output>.trkc cache, see trkcache.h
+    bool        beats;      // ssc, xml: estimate the beat of files without tempo events, see beat.h
+} emitter_options_t;
+
+typedef struct {
+    const char *    name;
+    const char *    suffix;
+
+    // Returns the emitter context, NULL on error
+    void *  (*begin)(const midi_t *midi, FILE *out, const emitter_options_t *opt);
+    void    (*begin_track)(void *ctx, const midi_track_t *trk);
+    void    (*note)(void *ctx, const midi_note_t *note);
+    void    (*meta)(void *ctx, uint32_t tick, const midi_event_t *event);
+    // Returns 0 or a POSIX errno
+    int     (*end)(void *ctx);
+} midi_emitter_t;
+
+extern const midi_emitter_t midi_emitter_ssc;
+extern const midi_emitter_t midi_emitter_csv;
+extern const midi_emitter_t midi_emitter_ndjson;
+extern const midi_emitter_t midi_emitter_xml;
+
+// Look an emitter up by name, NULL if unknown
+const midi_emitter_t *midi_emitter_find(const char *name);
+
+#endif /* __EMITTER_H__ */
+
+/* vim: set ts=4 sw=4 tw=0 list : */
@@ -0,0 +1,372 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+
+#include "midi.h"
+#include "timeline.h"
+#include "note.h"
+#include "player.h"
+#include "convert.h"
+#include "fidelity.h"
+
+// See emitter.c
+#define SCORE_OFFSET_SIZE           8
+#define SCORE_OFFSET_DATA           12
+#define SCORE_SIZE                  512
+
+#define MAX_SONGS                   256
+
+typedef struct {
+    uint32_t    tick;
+    uint32_t    tempo;      // us per quarter note from tick on
+    double      time;       // us at tick
+} fidelity_tempo_t;
+
+typedef struct {
+    const char *    name;
+    uint8_t *       scores[MAX_SONGS];  // Score of every song, 0 for all but format 2
+} fidelity_scores_t;
+
+typedef struct {
+    midi_note_t *       notes;
+    uint32_t            count;
+    uint32_t            cap;
+    fidelity_tempo_t *  tempos;
+    uint32_t            tempos_n;
+    uint32_t            tempos_cap;
+    int                 status;
+} fidelity_source_t;
+
+static double fidelity_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Keeps the score of every song the conversion writes
+static int fidelity_write(const char *name, const void *data, size_t size, void *arg)
+{
+    fidelity_scores_t *scores = arg;
+    size_t len = strlen(scores->name);
+    int song = 1;
+
+    if (size != SCORE_SIZE || strncmp(name, scores->name, len) != 0) {
+        return EINVAL;
+    }
+
+    // <name>.ssc or <name>.<song>.ssc
+    if (strcmp(name + len, ".ssc") != 0 && sscanf(name + len, ".%d.ssc", &song) != 1) {
+        return EINVAL;
+    }
+    if (song < 1 || song > MAX_SONGS) {
+        return 0;
+    }
+
+    scores->scores[song - 1] = malloc(size);
+    if (scores->scores[song - 1] == NULL) {
+        return ENOMEM;
+    }
+    memcpy(scores->scores[song - 1], data, size);
+
+    return 0;
+}
+
+static void fidelity_note(const midi_note_t *note, void *arg)
+{
+    fidelity_source_t *src = arg;
+
+    if (src->count == src->cap) {
+        uint32_t cap = src->cap ? src->cap * 2 : 256;
+        midi_note_t *notes = realloc(src->notes, cap * sizeof(*notes));
+
+        if (notes == NULL) {
+            src->status = ENOMEM;
+            return;
+        }
+        src->notes = notes;
+        src->cap = cap;
+    }
+
+    src->notes[src->count++] = *note;
+}
+
+static void fidelity_meta(uint32_t tick, const midi_event_t *event, void *arg)
+{
+    fidelity_source_t *src = arg;
+    fidelity_tempo_t *last = &src->tempos[src->tempos_n - 1];
+    uint32_t tempo;
+
+    if (event->cmd != MIDI_META_TEMPO_CHANGE || event->size < 3) {
+        return;
+    }
+    tempo = event->data[0] << 16 | event->data[1] << 8 | event->data[2];
+
+    // A change at the tick of the last one replaces it
+    if (tick == last->tick) {
+        last->tempo = tempo;
+        return;
+    }
+
+    if (src->tempos_n == src->tempos_cap) {
+        uint32_t cap = src->tempos_cap * 2;
+        fidelity_tempo_t *tempos = realloc(src->tempos, cap * sizeof(*tempos));
+
+        if (tempos == NULL) {
+            src->status = ENOMEM;
+            return;
+        }
+        src->tempos = tempos;
+        src->tempos_cap = cap;
+        last = &src->tempos[src->tempos_n - 1];
+    }
+
+    src->tempos[src->tempos_n].tick = tick;
+    src->tempos[src->tempos_n].tempo = tempo;
+    src->tempos[src->tempos_n].time = 0;
+    src->tempos_n++;
+}
+
+// Time of tick in us, by the tempo map
+static double fidelity_time(const fidelity_source_t *src, uint32_t tick, uint16_t ppq)
+{
+    uint32_t lo = 0;
+    uint32_t hi = src->tempos_n;
+
+    // Last change at or before tick
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+
+        if (src->tempos[mid].tick <= tick) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return src->tempos[lo].time + (double)(tick - src->tempos[lo].tick) * src->tempos[lo].tempo / ppq;
+}
+
+/**
+ * Align the notes of one score with the source notes of its melody track,
+ * see fidelity.h.
+ */
+static void fidelity_align(const fidelity_source_t *src, const uint8_t *score, uint16_t ppq, uint16_t song,
+        fidelity_note_cb_t cb, void *arg, fidelity_t *result)
+{
+    uint32_t count = score[SCORE_OFFSET_SIZE] << 8 | score[SCORE_OFFSET_SIZE + 1];
+    // The score is played at the tempo the file starts with
+    double quarter = src->tempos[0].tempo;
+    double score_end = 0;
+    double source_end = 0;
+    double drift = 0;
+
+    if (count > src->count) {
+        count = src->count;
+    }
+    if (count > SCORE_SIZE - SCORE_OFFSET_DATA) {
+        count = SCORE_SIZE - SCORE_OFFSET_DATA;
+    }
+
+    result->songs++;
+    result->notes += src->count;
+    result->dropped += src->count - count;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const midi_note_t *note = &src->notes[i];
+        fidelity_note_t n;
+        NoteSimplified_t simp;
+        double onset;
+        double length;
+
+        memcpy(&simp, score + SCORE_OFFSET_DATA + i, sizeof(simp));
+
+        n.song = song;
+        n.index = i;
+        n.source_key = note->key;
+        n.score_key = NumNotaiton_NoteSimpToKeyNote(simp);
+        n.source_start = fidelity_time(src, note->start, ppq);
+        n.source_length = fidelity_time(src, note->end, ppq) - n.source_start;
+        n.score_start = score_end;
+        n.score_length = player_note_32nds(simp) * quarter / 8;
+
+        if (n.source_start > source_end) {
+            result->rests += n.source_start - source_end;
+        }
+        score_end += n.score_length;
+        source_end = n.source_start + n.source_length;
+
+        onset = n.score_start - n.source_start;
+        length = n.score_length - n.source_length;
+        drift = score_end - source_end;
+
+        onset = onset < 0 ? -onset : onset;
+        length = length < 0 ? -length : length;
+        result->onset_error += onset;
+        result->onset_error_max = onset > result->onset_error_max ? onset : result->onset_error_max;
+        result->length_error += length;
+        result->length_error_max = length > result->length_error_max ? length : result->length_error_max;
+        if ((drift < 0 ? -drift : drift) > result->drift_max) {
+            result->drift_max = drift < 0 ? -drift : drift;
+        }
+        if (n.score_key != n.source_key) {
+            result->pitch_mismatches++;
+        }
+
+        if (cb != NULL) {
+            cb(&n, arg);
+        }
+    }
+
+    result->drift_end = drift;
+}
+
+/**
+ * Read the tempo map of track conductor and the notes of track melody, in
+ * note off order as the ssc emitter sees them.
+ */
+static int fidelity_read(midi_t *midi, int conductor, int melody, fidelity_source_t *src)
+{
+    midi_track_t *trk;
+
+    src->count = 0;
+    src->tempos_n = 1;
+    src->tempos[0].tick = 0;
+    src->tempos[0].tempo = 500000;
+    src->tempos[0].time = 0;
+    src->status = 0;
+
+    trk = midi_get_track(midi, conductor);
+    if (trk == NULL) {
+        return midi_get_errno(midi) ? midi_get_errno(midi) : EINVAL;
+    }
+    midi_track_walk(trk, conductor == melody ? fidelity_note : NULL, fidelity_meta, src);
+    midi_free_track(trk);
+
+    if (conductor != melody) {
+        trk = midi_get_track(midi, melody);
+        if (trk == NULL) {
+            return midi_get_errno(midi) ? midi_get_errno(midi) : EINVAL;
+        }
+        midi_track_notes(trk, fidelity_note, src);
+        midi_free_track(trk);
+    }
+
+    for (uint32_t i = 1; i < src->tempos_n; ++i) {
+        const fidelity_tempo_t *prev = &src->tempos[i - 1];
+
+        src->tempos[i].time = prev->time + (double)(src->tempos[i].tick - prev->tick) * prev->tempo / midi->ppq;
+    }
+
+    return src->status;
+}
+
+int fidelity_measure(const char *name, const void *buf, size_t size, const emitter_options_t *opt,
+        fidelity_note_cb_t cb, void *arg, fidelity_t *result)
+{
+    static const midi_emitter_t *const emitters[] = { &midi_emitter_ssc };
+    fidelity_scores_t scores = { .name = name };
+    convert_output_t output = { fidelity_write, &scores };
+    emitter_options_t conv = *opt;
+    fidelity_source_t src;
+    midi_t *midi = NULL;
+    double start;
+    int songs;
+    int status;
+
+    memset(result, 0, sizeof(*result));
+    memset(&src, 0, sizeof(src));
+
+    // Quiet, and nothing cached: the conversion itself is measured
+    conv.verbose = false;
+    conv.incremental = false;
+
+    start = fidelity_now_ns();
+    status = midi_convert_from(name, buf, size, emitters, 1, &conv, &output);
+    result->convert_ns = fidelity_now_ns() - start;
+    if (status) {
+        goto cleanup;
+    }
+
+    status = buf ? midi_open_mem(buf, size, &midi) : midi_open(name, &midi);
+    if (status) {
+        goto cleanup;
+    }
+    midi_set_recover(midi, opt->recover);
+    if (midi->ppq == 0 || midi->hdr.tracks == 0) {
+        status = EINVAL;
+        goto cleanup;
+    }
+
+    src.tempos_cap = 16;
+    src.tempos = malloc(src.tempos_cap * sizeof(*src.tempos));
+    if (src.tempos == NULL) {
+        status = ENOMEM;
+        goto cleanup;
+    }
+
+    // A song of a format 2 file is its own conductor and melody
+    songs = midi->hdr.format == MIDI_FORMAT_SONGS ? midi->hdr.tracks : 1;
+    if (songs > MAX_SONGS) {
+        songs = MAX_SONGS;
+    }
+
+    for (int song = 0; song < songs && status == 0; ++song) {
+        bool format2 = midi->hdr.format == MIDI_FORMAT_SONGS;
+        int conductor = format2 ? song : 0;
+        int melody = format2 ? song : (midi->hdr.tracks >= 2 ? 1 : 0);
+        fidelity_t one;
+
+        if (scores.scores[song] == NULL) {
+            continue;
+        }
+
+        status = fidelity_read(midi, conductor, melody, &src);
+        if (status == 0) {
+            memset(&one, 0, sizeof(one));
+            fidelity_align(&src, scores.scores[song], midi->ppq, song, cb, arg, &one);
+            fidelity_add(result, &one);
+        }
+    }
+
+cleanup:
+    if (midi != NULL) {
+        midi_close(midi);
+    }
+    for (int i = 0; i < MAX_SONGS; ++i) {
+        free(scores.scores[i]);
+    }
+    free(src.notes);
+    free(src.tempos);
+
+    return status;
+}
+
+void fidelity_add(fidelity_t *total, const fidelity_t *result)
+{
+    total->songs += result->songs;
+    total->notes += result->notes;
+    total->dropped += result->dropped;
+    total->pitch_mismatches += result->pitch_mismatches;
+    total->onset_error += result->onset_error;
+    total->length_error += result->length_error;
+    total->rests += result->rests;
+    total->convert_ns += result->convert_ns;
+    if (result->onset_error_max > total->onset_error_max) {
+        total->onset_error_max = result->onset_error_max;
+    }
+    if (result->length_error_max > total->length_error_max) {
+        total->length_error_max = result->length_error_max;
+    }
+    if (result->drift_max > total->drift_max) {
+        total->drift_max = result->drift_max;
+    }
+    total->drift_end = result->drift_end;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
@@ -0,0 +1,77 @@
+#ifndef __FIDELITY_H__
+#define __FIDELITY_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "emitter.h"
+
+/**
+ * Playback Fidelity
+ *
+ * Measures what converting a midi file to a score file loses: the file is
+ * converted with the ssc emitter (see emitter.c), the score played back
+ * with the length model of the player (see player.h) at the tempo the file
+ * starts with, and every score note aligned with the source note it was
+ * made of, the melody track in note off order:
+ *
+ *            source  |---A---|  |--B--|           rest folded into B
+ *            score   |---A---|--B-----|
+ *                            ^onset   ^end
+ *
+ * - onset error: score note start - source note start, what rests folded
+ *   into the note and lengths rounded before it add up to
+ * - duration error: score note length - source note length
+ * - drift: score note end - source note end, the error carried forward
+ * - pitch mismatch: the score key differs from the source key (out of
+ *   the octaves a score holds)
+ *
+ * Times are in microseconds, tempo changes of the source included. Format 2
+ * songs are measured one by one and summed up.
+ */
+
+typedef struct {
+    uint16_t    song;       // From 0, format 2 files only
+    uint32_t    index;      // In the score
+    uint8_t     source_key;
+    uint8_t     score_key;
+    double      source_start;
+    double      source_length;
+    double      score_start;
+    double      score_length;
+} fidelity_note_t;
+
+typedef struct {
+    uint32_t    songs;
+    uint32_t    notes;          // Source notes of the melody
+    uint32_t    dropped;        // Not in the score, it was full
+    uint32_t    pitch_mismatches;
+    double      onset_error;    // Sum of absolute errors, us
+    double      onset_error_max;
+    double      length_error;
+    double      length_error_max;
+    double      drift_max;      // Largest absolute drift, us
+    double      drift_end;      // Drift of the last note, of the last result added
+    double      rests;          // Time of the rests folded into notes, us
+    double      convert_ns;     // Time spent converting
+} fidelity_t;
+
+typedef void (*fidelity_note_cb_t)(const fidelity_note_t *note, void *arg);
+
+/**
+ * Measure the midi file name, read from buf (size bytes) when buf is not
+ * NULL, converted with the options opt. Every aligned note is handed to cb
+ * when it is not NULL.
+ *
+ * Returns 0 or a POSIX errno.
+ */
+int fidelity_measure(const char *name, const void *buf, size_t size, const emitter_options_t *opt,
+        fidelity_note_cb_t cb, void *arg, fidelity_t *result);
+
+// Add the counts of one result to another
+void fidelity_add(fidelity_t *total, const fidelity_t *result);
+
+#endif /* __FIDELITY_H__ */
+
+/* vim: set ts=4 sw=4 tw=0 list : */
@@ -0,0 +1,748 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "grep.h"
+
+enum {
+    GREP_OP_KIND,       // Event is of kind value
+    GREP_OP_META,       // Meta event of type value
+    GREP_OP_CMP,        // field cmp value
+    GREP_OP_AND,
+    GREP_OP_OR,
+    GREP_OP_NOT,
+};
+
+enum {
+    GREP_FIELD_CHAN,
+    GREP_FIELD_KEY,
+    GREP_FIELD_VEL,
+    GREP_FIELD_CC,
+    GREP_FIELD_PROGRAM,
+    GREP_FIELD_VALUE,
+    GREP_FIELD_BPM,     // Milli bpm
+    GREP_FIELD_TEMPO,   // Us per quarter note
+    GREP_FIELD_META,
+    GREP_FIELD_TICK,
+    GREP_FIELD_TRACK,
+};
+
+enum {
+    GREP_EQ,
+    GREP_NE,
+    GREP_LT,
+    GREP_LE,
+    GREP_GT,
+    GREP_GE,
+};
+
+#define GREP_CHANNEL_KINDS  ((1u << GREP_KIND_META) - 1)
+#define GREP_ALL_KINDS      ((1u << GREP_KINDS) - 1)
+
+#define GREP_META_TEMPO     0x51
+
+static const struct {
+    const char *    name;
+    uint8_t         kind;
+    int16_t         meta;       // Meta type, or -1
+} grep_kinds[] = {
+    { "note_on", GREP_KIND_NOTE_ON, -1 },
+    { "note_off", GREP_KIND_NOTE_OFF, -1 },
+    { "aftertouch", GREP_KIND_AFTERTOUCH, -1 },
+    { "cc", GREP_KIND_CC, -1 },
+    { "program", GREP_KIND_PROGRAM, -1 },
+    { "pressure", GREP_KIND_PRESSURE, -1 },
+    { "pitch_bend", GREP_KIND_PITCH_BEND, -1 },
+    { "meta", GREP_KIND_META, -1 },
+    { "sysex", GREP_KIND_SYSEX, -1 },
+    { "text", GREP_KIND_META, 0x01 },
+    { "copyright", GREP_KIND_META, 0x02 },
+    { "name", GREP_KIND_META, 0x03 },
+    { "instrument", GREP_KIND_META, 0x04 },
+    { "lyrics", GREP_KIND_META, 0x05 },
+    { "marker", GREP_KIND_META, 0x06 },
+    { "cue", GREP_KIND_META, 0x07 },
+    { "tempo", GREP_KIND_META, GREP_META_TEMPO },
+    { "timesig", GREP_KIND_META, 0x58 },
+    { "keysig", GREP_KIND_META, 0x59 },
+};
+
+static const struct {
+    const char *    name;
+    uint8_t         field;
+    uint16_t        kinds;      // Kinds of events having the field
+} grep_fields[] = {
+    { "ch", GREP_FIELD_CHAN, GREP_CHANNEL_KINDS },
+    { "key", GREP_FIELD_KEY, 1u << GREP_KIND_NOTE_OFF | 1u << GREP_KIND_NOTE_ON | 1u << GREP_KIND_AFTERTOUCH },
+    { "vel", GREP_FIELD_VEL, 1u << GREP_KIND_NOTE_OFF | 1u << GREP_KIND_NOTE_ON },
+    { "cc", GREP_FIELD_CC, 1u << GREP_KIND_CC },
+    { "program", GREP_FIELD_PROGRAM, 1u << GREP_KIND_PROGRAM },
+    { "value", GREP_FIELD_VALUE, 1u << GREP_KIND_AFTERTOUCH | 1u << GREP_KIND_CC | 1u << GREP_KIND_PROGRAM |
+                                 1u << GREP_KIND_PRESSURE | 1u << GREP_KIND_PITCH_BEND },
+    { "tempo", GREP_FIELD_BPM, 1u << GREP_KIND_META },
+    { "meta", GREP_FIELD_META, 1u << GREP_KIND_META },
+    { "tick", GREP_FIELD_TICK, GREP_ALL_KINDS },
+    { "track", GREP_FIELD_TRACK, GREP_ALL_KINDS },
+};
+
+/*
+ * Compiler: a recursive descent parser emitting postfix ops as it goes
+ */
+
+typedef struct {
+    const char *    pos;
+    grep_prog_t *   prog;
+    char *          err;
+    size_t          size;
+    bool            failed;
+} grep_parser_t;
+
+static void grep_error(grep_parser_t *p, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (p->failed) {
+        return;
+    }
+    p->failed = true;
+    va_start(ap, fmt);
+    vsnprintf(p->err, p->size, fmt, ap);
+    va_end(ap);
+}
+
+static void grep_emit(grep_parser_t *p, uint8_t op, uint8_t field, uint8_t cmp, uint32_t value)
+{
+    if (p->prog->count == GREP_MAX_OPS) {
+        grep_error(p, "expression too long");
+        return;
+    }
+    p->prog->ops[p->prog->count++] = (grep_op_t){ op, field, cmp, value };
+}
+
+static void grep_skip_space(grep_parser_t *p)
+{
+    while (isspace((unsigned char)*p->pos)) {
+        p->pos++;
+    }
+}
+
+// Length of the word at pos, 0 if there is none
+static size_t grep_word(grep_parser_t *p)
+{
+    size_t n = 0;
+
+    grep_skip_space(p);
+    while (isalpha((unsigned char)p->pos[n]) || p->pos[n] == '_') {
+        n++;
+    }
+    return n;
+}
+
+static bool grep_accept(grep_parser_t *p, const char *token)
+{
+    size_t n = strlen(token);
+
+    grep_skip_space(p);
+    if (strncasecmp(p->pos, token, n) != 0) {
+        return false;
+    }
+    // Whole words only
+    if (isalpha((unsigned char)token[0]) && (isalpha((unsigned char)p->pos[n]) || p->pos[n] == '_')) {
+        return false;
+    }
+    p->pos += n;
+    return true;
+}
+
+static bool grep_number_next(grep_parser_t *p)
+{
+    grep_skip_space(p);
+    return isdigit((unsigned char)*p->pos) || (*p->pos == '.' && isdigit((unsigned char)p->pos[1]));
+}
+
+static int grep_cmp_next(grep_parser_t *p)
+{
+    static const struct { const char *token; int cmp; } cmps[] = {
+        { "==", GREP_EQ }, { "!=", GREP_NE }, { "<=", GREP_LE }, { ">=", GREP_GE },
+        { "=", GREP_EQ }, { "<", GREP_LT }, { ">", GREP_GT },
+    };
+
+    for (size_t i = 0; i < sizeof(cmps) / sizeof(cmps[0]); ++i) {
+        if (grep_accept(p, cmps[i].token)) {
+            return cmps[i].cmp;
+        }
+    }
+    return -1;
+}
+
+static double grep_number(grep_parser_t *p)
+{
+    char *end;
+    double value;
+
+    grep_skip_space(p);
+    value = strtod(p->pos, &end);
+    if (end == p->pos || !(value >= 0)) {
+        grep_error(p, *p->pos ? "number expected at \"%s\"" : "number expected at the end", p->pos);
+        return 0;
+    }
+    p->pos = end;
+    return value;
+}
+
+static uint32_t grep_value(grep_parser_t *p, uint8_t field, double number)
+{
+    double value = field == GREP_FIELD_BPM ? number * 1000 + 0.5 : number;
+
+    if (field != GREP_FIELD_BPM && number != (uint32_t)number) {
+        grep_error(p, "whole number expected, not %g", number);
+    }
+    return value > UINT32_MAX ? UINT32_MAX : (uint32_t)value;
+}
+
+// field [cmp] number [bpm|us] | field number-number
+static void grep_compare(grep_parser_t *p, uint8_t field)
+{
+    int cmp = grep_cmp_next(p);
+    double low = grep_number(p), high = low;
+    bool range = false;
+
+    if (cmp < 0 && *p->pos == '-') {
+        p->pos++;
+        high = grep_number(p);
+        range = true;
+    }
+    if (field == GREP_FIELD_BPM) {
+        if (grep_accept(p, "us")) {
+            field = GREP_FIELD_TEMPO;
+        } else {
+            grep_accept(p, "bpm");
+        }
+    }
+    if (p->failed) {
+        return;
+    }
+    if (range) {
+        grep_emit(p, GREP_OP_CMP, field, GREP_GE, grep_value(p, field, low));
+        grep_emit(p, GREP_OP_CMP, field, GREP_LE, grep_value(p, field, high));
+        grep_emit(p, GREP_OP_AND, 0, 0, 0);
+    } else {
+        grep_emit(p, GREP_OP_CMP, field, cmp < 0 ? GREP_EQ : cmp, grep_value(p, field, low));
+    }
+}
+
+static void grep_or(grep_parser_t *p);
+
+static void grep_term(grep_parser_t *p)
+{
+    size_t n = grep_word(p);
+    const char *word = p->pos;
+    size_t fields = sizeof(grep_fields) / sizeof(grep_fields[0]);
+    size_t field;
+
+    if (n == 0) {
+        grep_error(p, *p->pos ? "unexpected \"%s\"" : "unexpected end of expression", p->pos);
+        return;
+    }
+    p->pos += n;
+
+    // A word that is both a field and a kind (cc, program, tempo, meta)
+    // is the field when a comparison follows
+    for (field = 0; field < fields; ++field) {
+        if (strlen(grep_fields[field].name) == n && strncasecmp(word, grep_fields[field].name, n) == 0) {
+            break;
+        }
+    }
+    if (field < fields) {
+        const char *pos = p->pos;
+
+        if (grep_cmp_next(p) >= 0 || grep_number_next(p)) {
+            p->pos = pos;
+            grep_compare(p, grep_fields[field].field);
+            return;
+        }
+        p->pos = pos;
+    }
+
+    for (size_t i = 0; i < sizeof(grep_kinds) / sizeof(grep_kinds[0]); ++i) {
+        if (strlen(grep_kinds[i].name) == n && strncasecmp(word, grep_kinds[i].name, n) == 0) {
+            if (grep_kinds[i].meta < 0) {
+                grep_emit(p, GREP_OP_KIND, 0, 0, grep_kinds[i].kind);
+            } else {
+                grep_emit(p, GREP_OP_META, 0, 0, grep_kinds[i].meta);
+            }
+            return;
+        }
+    }
+
+    if (field < fields) {
+        // Reports the missing number
+        grep_compare(p, grep_fields[field].field);
+    } else {
+        grep_error(p, "unknown word \"%.*s\"", (int)n, word);
+    }
+}
+
+static void grep_unary(grep_parser_t *p)
+{
+    if (grep_accept(p, "!") || grep_accept(p, "not")) {
+        grep_unary(p);
+        grep_emit(p, GREP_OP_NOT, 0, 0, 0);
+    } else if (grep_accept(p, "(")) {
+        grep_or(p);
+        if (!grep_accept(p, ")")) {
+            grep_error(p, "missing )");
+        }
+    } else {
+        grep_term(p);
+    }
+}
+
+static void grep_and(grep_parser_t *p)
+{
+    grep_unary(p);
+    while (!p->failed) {
+        const char *pos;
+
+        if (!grep_accept(p, "&&") && !grep_accept(p, "and")) {
+            // Juxtaposed terms, unless it's the end of the group
+            pos = p->pos;
+            grep_skip_space(p);
+            if (*p->pos == '\0' || *p->pos == ')' || *p->pos == '|' || grep_accept(p, "or")) {
+                p->pos = pos;
+                break;
+            }
+        }
+        grep_unary(p);
+        grep_emit(p, GREP_OP_AND, 0, 0, 0);
+    }
+}
+
+static void grep_or(grep_parser_t *p)
+{
+    grep_and(p);
+    while (!p->failed && (grep_accept(p, "||") || grep_accept(p, "or"))) {
+        grep_and(p);
+        grep_emit(p, GREP_OP_OR, 0, 0, 0);
+    }
+}
+
+/**
+ * Evaluate prog for a kind of event, three-valued: *can_true / *can_false
+ * tell whether it can be true / false for some event of the kind. A kind
+ * test is known, a field the kind doesn't have known false, the rest
+ * unknown (both).
+ */
+static void grep_eval_kind(const grep_prog_t *prog, uint8_t kind, bool *can_true, bool *can_false)
+{
+    uint64_t t = 0, f = 0;
+
+    for (uint8_t i = 0; i < prog->count; ++i) {
+        const grep_op_t *op = &prog->ops[i];
+        uint64_t a, b;
+
+        switch (op->op) {
+            case GREP_OP_KIND:
+                t = t << 1 | (kind == op->value);
+                f = f << 1 | (kind != op->value);
+                break;
+            case GREP_OP_META:
+                t = t << 1 | (kind == GREP_KIND_META);
+                f = f << 1 | 1;
+                break;
+            case GREP_OP_CMP:
+                for (size_t j = 0; j < sizeof(grep_fields) / sizeof(grep_fields[0]); ++j) {
+                    if (grep_fields[j].field == (op->field == GREP_FIELD_TEMPO ? GREP_FIELD_BPM : op->field)) {
+                        t = t << 1 | ((grep_fields[j].kinds >> kind) & 1);
+                        break;
+                    }
+                }
+                f = f << 1 | 1;
+                break;
+            case GREP_OP_AND:
+                a = t & 1;
+                b = f & 1;
+                t >>= 1;
+                f >>= 1;
+                t = (t & ~1ull) | (t & a & 1);
+                f = (f & ~1ull) | ((f | b) & 1);
+                break;
+            case GREP_OP_OR:
+                a = t & 1;
+                b = f & 1;
+                t >>= 1;
+                f >>= 1;
+                t = (t & ~1ull) | ((t | a) & 1);
+                f = (f & ~1ull) | (f & b & 1);
+                break;
+            case GREP_OP_NOT:
+                a = t & 1;
+                t = (t & ~1ull) | (f & 1);
+                f = (f & ~1ull) | a;
+                break;
+        }
+    }
+    *can_true = t & 1;
+    *can_false = f & 1;
+}
+
+int grep_compile(const char *expr, grep_prog_t *prog, char *err, size_t size)
+{
+    grep_parser_t p = { .pos = expr, .prog = prog, .err = err, .size = size };
+    int depth = 0;
+
+    memset(prog, 0, sizeof(*prog));
+    grep_or(&p);
+    grep_skip_space(&p);
+    if (!p.failed && *p.pos) {
+        grep_error(&p, "unexpected \"%s\"", p.pos);
+    }
+    if (p.failed) {
+        return EINVAL;
+    }
+
+    // The bit stacks of the evaluation are 64 deep
+    for (uint8_t i = 0; i < prog->count; ++i) {
+        depth += prog->ops[i].op < GREP_OP_AND ? 1 : prog->ops[i].op == GREP_OP_NOT ? 0 : -1;
+        if (depth > 64) {
+            grep_error(&p, "expression too deep");
+            return EINVAL;
+        }
+    }
+
+    for (uint8_t kind = 0; kind < GREP_KINDS; ++kind) {
+        bool can_true, can_false;
+
+        grep_eval_kind(prog, kind, &can_true, &can_false);
+        prog->kinds |= (uint16_t)can_true << kind;
+    }
+
+    return 0;
+}
+
+static bool grep_field(const grep_event_t *event, uint8_t field, uint32_t *value)
+{
+    bool channel = event->kind < GREP_KIND_META;
+
+    switch (field) {
+        case GREP_FIELD_CHAN:
+            *value = event->chan;
+            return channel;
+        case GREP_FIELD_KEY:
+            *value = event->data[0];
+            return event->kind <= GREP_KIND_AFTERTOUCH;
+        case GREP_FIELD_VEL:
+            *value = event->data[1];
+            return event->kind <= GREP_KIND_NOTE_ON;
+        case GREP_FIELD_CC:
+            *value = event->data[0];
+            return event->kind == GREP_KIND_CC;
+        case GREP_FIELD_PROGRAM:
+            *value = event->data[0];
+            return event->kind == GREP_KIND_PROGRAM;
+        case GREP_FIELD_VALUE:
+            switch (event->kind) {
+                case GREP_KIND_AFTERTOUCH:
+                case GREP_KIND_CC:
+                    *value = event->data[1];
+                    return true;
+                case GREP_KIND_PROGRAM:
+                case GREP_KIND_PRESSURE:
+                    *value = event->data[0];
+                    return true;
+                case GREP_KIND_PITCH_BEND:
+                    *value = event->data[1] << 7 | event->data[0];
+                    return true;
+            }
+            return false;
+        case GREP_FIELD_BPM:
+        case GREP_FIELD_TEMPO:
+            if (event->kind != GREP_KIND_META || event->meta != GREP_META_TEMPO || event->tempo == 0) {
+                return false;
+            }
+            if (field == GREP_FIELD_TEMPO) {
+                *value = event->tempo;
+            } else {
+                uint64_t bpm = 60000000000ull / event->tempo;
+
+                *value = bpm > UINT32_MAX ? UINT32_MAX : (uint32_t)bpm;
+            }
+            return true;
+        case GREP_FIELD_META:
+            *value = event->meta;
+            return event->kind == GREP_KIND_META;
+        case GREP_FIELD_TICK:
+            *value = event->tick;
+            return true;
+        case GREP_FIELD_TRACK:
+            *value = event->track;
+            return true;
+    }
+    return false;
+}
+
+bool grep_eval(const grep_prog_t *prog, const grep_event_t *event)
+{
+    uint64_t stack = 0;
+
+    if (!(prog->kinds >> event->kind & 1)) {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < prog->count; ++i) {
+        const grep_op_t *op = &prog->ops[i];
+        uint32_t value;
+        uint64_t top;
+        bool bit = false;
+
+        switch (op->op) {
+            case GREP_OP_KIND:
+                stack = stack << 1 | (event->kind == op->value);
+                break;
+            case GREP_OP_META:
+                stack = stack << 1 | (event->kind == GREP_KIND_META && event->meta == op->value);
+                break;
+            case GREP_OP_CMP:
+                if (grep_field(event, op->field, &value)) {
+                    switch (op->cmp) {
+                        case GREP_EQ: bit = value == op->value; break;
+                        case GREP_NE: bit = value != op->value; break;
+                        case GREP_LT: bit = value < op->value; break;
+                        case GREP_LE: bit = value <= op->value; break;
+                        case GREP_GT: bit = value > op->value; break;
+                        case GREP_GE: bit = value >= op->value; break;
+                    }
+                }
+                stack = stack << 1 | bit;
+                break;
+            case GREP_OP_AND:
+                top = stack & 1;
+                stack >>= 1;
+                stack &= ~1ull | top;
+                break;
+            case GREP_OP_OR:
+                top = stack & 1;
+                stack >>= 1;
+                stack |= top;
+                break;
+            case GREP_OP_NOT:
+                stack ^= 1;
+                break;
+        }
+    }
+
+    return stack & 1;
+}
+
+/*
+ * Streaming decoder
+ */
+
+typedef struct {
+    FILE *      fp;
+    uint32_t    left;       // Bytes left in the track chunk
+    bool        short_read; // Or a bad variable length
+} grep_reader_t;
+
+static inline int grep_byte(grep_reader_t *r)
+{
+    int c;
+
+    if (r->left == 0 || (c = getc_unlocked(r->fp)) == EOF) {
+        r->short_read = true;
+        return 0;
+    }
+    r->left--;
+    return c;
+}
+
+static uint32_t grep_vlq(grep_reader_t *r)
+{
+    uint32_t value = 0;
+
+    for (int i = 0; i < 4; ++i) {
+        int c = grep_byte(r);
+
+        value = value << 7 | (c & 0x7F);
+        if (!(c & 0x80)) {
+            return value;
+        }
+    }
+    // Longer than 4 bytes, as midi.c rejects it
+    r->short_read = true;
+    return value;
+}
+
+static void grep_skip(grep_reader_t *r, uint32_t size)
+{
+    if (size > r->left) {
+        size = r->left;
+        r->short_read = true;
+    }
+    // Small skips stay in the stdio buffer, getc is cheaper than a seek there
+    if (size <= 16) {
+        for (uint32_t i = 0; i < size; ++i) {
+            getc_unlocked(r->fp);
+        }
+    } else if (fseek(r->fp, size, SEEK_CUR) != 0) {
+        r->short_read = true;
+    }
+    r->left -= size;
+}
+
+static bool grep_read(FILE *fp, void *buf, size_t size)
+{
+    return fread(buf, 1, size, fp) == size;
+}
+
+static uint32_t grep_be32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+int grep_stream(FILE *fp, const grep_prog_t *prog, grep_event_t *match, bool *found)
+{
+    uint8_t hdr[14], chunk[8];
+    uint16_t tracks;
+    uint32_t size;
+
+    *found = false;
+
+    if (!grep_read(fp, hdr, sizeof(hdr)) || memcmp(hdr, "MThd", 4) != 0 || grep_be32(&hdr[4]) < 6) {
+        return EINVAL;
+    }
+    tracks = hdr[10] << 8 | hdr[11];
+    size = grep_be32(&hdr[4]) - 6;
+    if (size && fseek(fp, size, SEEK_CUR) != 0) {
+        return EINVAL;
+    }
+
+    // Events are checked as midi_get_track() decodes them: the same files
+    // fail, and the events up to the failure are the same
+    for (uint16_t t = 0; t < tracks; ++t) {
+        grep_reader_t r = { .fp = fp };
+        grep_event_t event = { .track = t };
+        uint8_t running = 0;
+
+        if (!grep_read(fp, chunk, sizeof(chunk)) || memcmp(chunk, "MTrk", 4) != 0) {
+            return EINVAL;
+        }
+        r.left = grep_be32(&chunk[4]);
+
+        while (r.left && !r.short_read) {
+            uint8_t status;
+
+            event.tick += grep_vlq(&r);
+            status = grep_byte(&r);
+            if (status < 0x80) {
+                // Running status, the byte is the first data byte
+                if (running == 0) {
+                    return EINVAL;
+                }
+                event.data[0] = status;
+                status = running;
+            } else if (status < 0xF0) {
+                event.data[0] = grep_byte(&r);
+            }
+
+            event.status = status;
+            if (status < 0xF0) {
+                running = status;
+                event.kind = (status >> 4) - 8;
+                event.chan = status & 0x0F;
+                event.data[1] = event.kind == GREP_KIND_PROGRAM || event.kind == GREP_KIND_PRESSURE ? 0 : grep_byte(&r);
+            } else if (status == 0xFF) {
+                uint32_t len;
+
+                event.kind = GREP_KIND_META;
+                event.meta = grep_byte(&r);
+                if (event.meta & 0x80) {
+                    return EINVAL;
+                }
+                event.tempo = 0;
+                len = grep_vlq(&r);
+                if (event.meta == GREP_META_TEMPO && len >= 3) {
+                    event.tempo = grep_byte(&r) << 16;
+                    event.tempo |= grep_byte(&r) << 8;
+                    event.tempo |= grep_byte(&r);
+                    len -= 3;
+                }
+                grep_skip(&r, len);
+            } else if (status == 0xF0 || status == 0xF7) {
+                // Sysex cancels running status
+                running = 0;
+                event.kind = GREP_KIND_SYSEX;
+                grep_skip(&r, grep_vlq(&r));
+            } else {
+                // System messages have no place in a file
+                return EINVAL;
+            }
+            if (r.short_read) {
+                return EINVAL;
+            }
+
+            if (grep_eval(prog, &event)) {
+                *match = event;
+                *found = true;
+                return 0;
+            }
+        }
+        if (r.short_read) {
+            return EINVAL;
+        }
+    }
+
+    return 0;
+}
+
+void grep_describe(const grep_event_t *event, char *buf, size_t size)
+{
+    static const char *kinds[] = {
+        "note_off", "note_on", "aftertouch", "cc", "program", "pressure", "pitch_bend", "meta", "sysex"
+    };
+
+    switch (event->kind) {
+        case GREP_KIND_NOTE_OFF:
+        case GREP_KIND_NOTE_ON:
+            snprintf(buf, size, "%s ch %u key %u vel %u", kinds[event->kind],
+                    event->chan, event->data[0], event->data[1]);
+            break;
+        case GREP_KIND_AFTERTOUCH:
+        case GREP_KIND_CC:
+            snprintf(buf, size, "%s ch %u %s %u value %u", kinds[event->kind], event->chan,
+                    event->kind == GREP_KIND_CC ? "cc" : "key", event->data[0], event->data[1]);
+            break;
+        case GREP_KIND_PROGRAM:
+        case GREP_KIND_PRESSURE:
+            snprintf(buf, size, "%s ch %u value %u", kinds[event->kind], event->chan, event->data[0]);
+            break;
+        case GREP_KIND_PITCH_BEND:
+            snprintf(buf, size, "%s ch %u value %u", kinds[event->kind], event->chan,
+                    event->data[1] << 7 | event->data[0]);
+            break;
+        case GREP_KIND_META:
+            for (size_t i = 0; i < sizeof(grep_kinds) / sizeof(grep_kinds[0]); ++i) {
+                if (grep_kinds[i].meta == event->meta) {
+                    if (event->meta == GREP_META_TEMPO && event->tempo) {
+                        snprintf(buf, size, "tempo %.2f bpm (%u us)", 60000000.0 / event->tempo, event->tempo);
+                    } else {
+                        snprintf(buf, size, "%s", grep_kinds[i].name);
+                    }
+                    return;
+                }
+            }
+            snprintf(buf, size, "meta 0x%02X", event->meta);
+            break;
+        default:
+            snprintf(buf, size, "sysex 0x%02X", event->status);
+            break;
+    }
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
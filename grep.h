@@ -0,0 +1,118 @@
+#ifndef __GREP_H__
+#define __GREP_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * Event Search
+ *
+ * A predicate over midi events, compiled from an expression into a short
+ * bytecode, and a streaming decoder that runs it on every event of a file
+ * until the first match:
+ *
+ *   note_on ch 9 key 49 vel > 100          crash cymbal, hit hard
+ *   tempo < 60 bpm
+ *   cc 64 value >= 64 && tick < 1920       sustain pedal down in the first bar
+ *   (lyrics || marker) && track 0
+ *   program 0-7 && !ch 9
+ *
+ * Terms are either a kind of event:
+ *
+ *   note_on, note_off, aftertouch, cc, program, pressure, pitch_bend,
+ *   sysex, meta, and meta events by name: text, copyright, name,
+ *   instrument, lyrics, marker, cue, tempo, timesig, keysig
+ *
+ * or a field compared to a number (=, ==, !=, <, <=, >, >=, a bare number
+ * is =) or in a range a-b:
+ *
+ *   ch        channel of a channel event, 0 - 15 as midi-dump prints it
+ *   key       key of a note on / off or aftertouch
+ *   vel       velocity of a note on / off
+ *   cc        controller number of a control change
+ *   program   program number of a program change
+ *   value     controller value, program, pressure, aftertouch pressure or
+ *             pitch bend (0 - 16383)
+ *   tempo     tempo of a tempo event, in bpm (decimals allowed), or in us
+ *             per quarter note with "us" after the number
+ *   meta      type of a meta event
+ *   tick      absolute tick, in the track
+ *   track     number of the track
+ *
+ * A field an event doesn't have never compares true. Terms next to each
+ * other are and-ed; &&, ||, !, and, or, not and parentheses combine them.
+ *
+ * Compilation also works out which kinds of events the predicate can match
+ * at all (prog->kinds), the others are skipped without evaluating it.
+ */
+
+#define GREP_MAX_OPS        64
+
+enum {
+    GREP_KIND_NOTE_OFF,         // Channel events, by cmd - 8
+    GREP_KIND_NOTE_ON,
+    GREP_KIND_AFTERTOUCH,
+    GREP_KIND_CC,
+    GREP_KIND_PROGRAM,
+    GREP_KIND_PRESSURE,
+    GREP_KIND_PITCH_BEND,
+    GREP_KIND_META,
+    GREP_KIND_SYSEX,
+    GREP_KINDS
+};
+
+typedef struct {
+    uint8_t     op;
+    uint8_t     field;
+    uint8_t     cmp;
+    uint32_t    value;
+} grep_op_t;
+
+typedef struct {
+    grep_op_t   ops[GREP_MAX_OPS];  // Postfix
+    uint8_t     count;
+    uint16_t    kinds;      // Bit per kind the predicate can be true for
+} grep_prog_t;
+
+typedef struct {
+    uint16_t    track;
+    uint32_t    tick;
+    uint8_t     kind;
+    uint8_t     status;     // Status byte, 0xFF for meta events
+    uint8_t     meta;       // Type of a meta event
+    uint8_t     chan;
+    uint8_t     data[2];    // Data bytes of a channel event
+    uint32_t    tempo;      // Us per quarter note of a tempo event
+} grep_event_t;
+
+/**
+ * Compile expr into prog. Returns 0, or EINVAL with what is wrong in err
+ * (size bytes).
+ */
+int grep_compile(const char *expr, grep_prog_t *prog, char *err, size_t size);
+
+bool grep_eval(const grep_prog_t *prog, const grep_event_t *event);
+
+/**
+ * Decode the midi file read from fp event by event, stopping at the first
+ * event prog matches: *found is set and the event is in *match. Track
+ * chunks are read in order and events are not kept, nothing more of the
+ * file is read after a match.
+ *
+ * Events are decoded by the rules of midi_get_track(): sysex cancels
+ * running status, meta events don't, system messages, chunks other than
+ * MTrk and variable lengths over 4 bytes are errors.
+ *
+ * Returns 0, or EINVAL for a file that isn't midi or can't be decoded up
+ * to a match.
+ */
+int grep_stream(FILE *fp, const grep_prog_t *prog, grep_event_t *match, bool *found);
+
+// One line description of an event: "note_on ch 9 key 49 vel 110"
+void grep_describe(const grep_event_t *event, char *buf, size_t size);
+
+#endif /* __GREP_H__ */
+
+/* vim: set ts=4 sw=4 tw=0 list : */
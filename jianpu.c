@@ -0,0 +1,644 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "jianpu.h"
+
+#define SCORE_OFFSET_SIGNATURE      4
+#define SCORE_OFFSET_SIZE           8
+#define SCORE_OFFSET_DATA           12
+
+#define CACHE_INITIAL               256
+#define CACHE_LINES_MAX             4096    // Flush the line cache beyond this
+
+#define FNV_OFFSET                  2166136261u
+#define FNV_PRIME                   16777619u
+
+typedef struct {
+    uint32_t                first;      // First note
+    uint32_t                count;
+    const jianpu_layout_t * layout;
+} measure_t;
+
+static const char *key_names[] = { "C", "G", "D", "A", "E", "B", "F#", "C#" };
+
+static uint32_t fnv1a(uint32_t hash, const void *data, size_t size)
+{
+    const uint8_t *p = data;
+
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ p[i]) * FNV_PRIME;
+    }
+
+    return hash ? hash : 1;     // 0 marks an empty slot
+}
+
+static int note_octave(NoteSimplified_t note)
+{
+    return (note.octaves & 2) ? (4 - note.octaves) : -note.octaves;
+}
+
+static uint32_t note_16ths(NoteSimplified_t note)
+{
+    return 8 >> note.length;
+}
+
+static NoteSimplified_t glyph_note(const jianpu_glyph_t *glyph)
+{
+    return *(const NoteSimplified_t *)&glyph->note;
+}
+
+jianpu_t *jianpu_new(void)
+{
+    jianpu_t *jp = calloc(1, sizeof *jp);
+
+    if (jp == NULL) {
+        return NULL;
+    }
+
+    jp->layout_size = CACHE_INITIAL;
+    jp->layout = calloc(jp->layout_size, sizeof *jp->layout);
+    jp->line_size = CACHE_INITIAL;
+    jp->line = calloc(jp->line_size, sizeof *jp->line);
+    if (jp->layout == NULL || jp->line == NULL) {
+        jianpu_free(jp);
+        return NULL;
+    }
+
+    return jp;
+}
+
+static void line_flush(jianpu_t *jp)
+{
+    for (uint32_t i = 0; i < jp->line_size; ++i) {
+        free(jp->line[i].out);
+        free(jp->line[i].measures);
+    }
+    memset(jp->line, 0, jp->line_size * sizeof *jp->line);
+    jp->lines = 0;
+}
+
+void jianpu_free(jianpu_t *jp)
+{
+    if (jp == NULL) {
+        return;
+    }
+
+    if (jp->layout) {
+        // Glyphs and notes are allocated with the layout
+        for (uint32_t i = 0; i < jp->layout_size; ++i) {
+            free(jp->layout[i]);
+        }
+    }
+    if (jp->line) {
+        line_flush(jp);
+    }
+    free(jp->layout);
+    free(jp->line);
+    free(jp);
+}
+
+/**
+ * Cache slot for a measure, either holding its layout or empty. Tables are
+ * kept at most half full so there always is an empty slot. A hash is only
+ * a hint, a hit has the same notes.
+ */
+static jianpu_layout_t **layout_slot(jianpu_layout_t **table, uint32_t size, uint32_t hash,
+        const void *notes, uint32_t count)
+{
+    uint32_t i = hash & (size - 1);
+
+    while (table[i] && (table[i]->hash != hash || table[i]->count != count
+                || memcmp(table[i]->notes, notes, count) != 0)) {
+        i = (i + 1) & (size - 1);
+    }
+
+    return &table[i];
+}
+
+static jianpu_line_t *line_slot(jianpu_line_t *table, uint32_t size, uint32_t hash, uint8_t format,
+        const measure_t *measures, uint32_t count)
+{
+    uint32_t i = hash & (size - 1);
+
+    for (; table[i].hash; i = (i + 1) & (size - 1)) {
+        uint32_t m = 0;
+
+        if (table[i].hash != hash || table[i].format != format || table[i].count != count) {
+            continue;
+        }
+        // Layouts never move, the same measures have the same layout
+        while (m < count && table[i].measures[m] == measures[m].layout) {
+            m++;
+        }
+        if (m == count) {
+            break;
+        }
+    }
+
+    return &table[i];
+}
+
+static int layout_grow(jianpu_t *jp)
+{
+    uint32_t size = jp->layout_size * 2;
+    jianpu_layout_t **table = calloc(size, sizeof *table);
+
+    if (table == NULL) {
+        return ENOMEM;
+    }
+
+    for (uint32_t i = 0; i < jp->layout_size; ++i) {
+        jianpu_layout_t *layout = jp->layout[i];
+
+        if (layout) {
+            *layout_slot(table, size, layout->hash, layout->notes, layout->count) = layout;
+        }
+    }
+
+    free(jp->layout);
+    jp->layout = table;
+    jp->layout_size = size;
+
+    return 0;
+}
+
+// Moves the lines to a bigger table, each into the first empty slot of its hash
+static int line_grow(jianpu_t *jp)
+{
+    uint32_t size = jp->line_size * 2;
+    jianpu_line_t *table = calloc(size, sizeof *table);
+
+    if (table == NULL) {
+        return ENOMEM;
+    }
+
+    for (uint32_t i = 0; i < jp->line_size; ++i) {
+        if (jp->line[i].hash) {
+            uint32_t j = jp->line[i].hash & (size - 1);
+
+            while (table[j].hash) {
+                j = (j + 1) & (size - 1);
+            }
+            table[j] = jp->line[i];
+        }
+    }
+
+    free(jp->line);
+    jp->line = table;
+    jp->line_size = size;
+
+    return 0;
+}
+
+/**
+ * Lay a measure out: every note takes a cell of 2 columns (sharp, digit),
+ * a half note is followed by a dash, the bar line closes the measure.
+ */
+static const jianpu_layout_t *measure_layout(jianpu_t *jp, const NoteSimplified_t *notes, uint32_t count)
+{
+    uint32_t hash = fnv1a(FNV_OFFSET, notes, count);
+    jianpu_layout_t **slot = layout_slot(jp->layout, jp->layout_size, hash, notes, count);
+    jianpu_layout_t *layout;
+    jianpu_glyph_t *glyph;
+    uint16_t n = 0;
+    uint16_t x = 0;
+
+    if (*slot) {
+        jp->stats.layouts_reused++;
+        return *slot;
+    }
+
+    if ((jp->layouts + 1) * 2 > jp->layout_size) {
+        if (layout_grow(jp)) {
+            return NULL;
+        }
+        slot = layout_slot(jp->layout, jp->layout_size, hash, notes, count);
+    }
+
+    // One allocation: the layout, its glyphs, the notes it was made from
+    layout = malloc(sizeof *layout + (count * 2 + 1) * sizeof *glyph + count);
+    if (layout == NULL) {
+        return NULL;
+    }
+    glyph = (jianpu_glyph_t *)(layout + 1);
+    memcpy(&glyph[count * 2 + 1], notes, count);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        glyph[n].x = x;
+        glyph[n].kind = JIANPU_GLYPH_NOTE;
+        glyph[n].note = *(const uint8_t *)&notes[i];
+        n++;
+        x += 2;
+
+        if (notes[i].length == NOTE_LENGTH_HALF) {
+            glyph[n].x = x;
+            glyph[n].kind = JIANPU_GLYPH_DASH;
+            glyph[n].note = 0;
+            n++;
+            x += 2;
+        }
+    }
+    glyph[n].x = x;
+    glyph[n].kind = JIANPU_GLYPH_BAR;
+    glyph[n].note = 0;
+    n++;
+
+    layout->hash = hash;
+    layout->width = x + 2;
+    layout->glyphs = n;
+    layout->glyph = glyph;
+    layout->notes = (const uint8_t *)&glyph[count * 2 + 1];
+    layout->count = count;
+    *slot = layout;
+    jp->layouts++;
+    jp->stats.layouts_built++;
+
+    return layout;
+}
+
+static int underlines(const jianpu_glyph_t *glyph)
+{
+    if (glyph->kind != JIANPU_GLYPH_NOTE) {
+        return 0;
+    }
+
+    switch (glyph_note(glyph).length) {
+        case NOTE_LENGTH_EIGHTH:
+            return 1;
+        case NOTE_LENGTH_16TH:
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Text line, 4 rows: octaves above, notes, underlines, octaves below.
+ * Consecutive underlined notes are beamed. Empty dot rows are left out.
+ */
+static void line_text(FILE *fp, const measure_t *measures, uint32_t count, uint32_t width)
+{
+    char row[4][width + 1];
+    uint32_t base = 0;
+
+    memset(row, ' ', sizeof(row));
+
+    for (uint32_t m = 0; m < count; ++m) {
+        const jianpu_layout_t *layout = measures[m].layout;
+
+        for (uint16_t g = 0; g < layout->glyphs; ++g) {
+            const jianpu_glyph_t *glyph = &layout->glyph[g];
+            uint32_t x = base + glyph->x;
+            NoteSimplified_t note = glyph_note(glyph);
+            int octave = note_octave(note);
+            int under = underlines(glyph);
+
+            switch (glyph->kind) {
+                case JIANPU_GLYPH_NOTE:
+                    row[1][x] = note.sharp ? '#' : ' ';
+                    row[1][x + 1] = '0' + note.note;
+                    if (octave > 0) {
+                        row[0][x + 1] = octave > 1 ? ':' : '.';
+                    } else if (octave < 0) {
+                        row[3][x + 1] = octave < -1 ? ':' : '.';
+                    }
+                    if (under) {
+                        row[2][x + 1] = under > 1 ? '=' : '_';
+                        if (g > 0 && underlines(glyph - 1)) {
+                            row[2][x] = (under > 1 && underlines(glyph - 1) > 1) ? '=' : '_';
+                        }
+                    }
+                    break;
+                case JIANPU_GLYPH_DASH:
+                    row[1][x + 1] = '-';
+                    break;
+                case JIANPU_GLYPH_BAR:
+                    row[1][x + 1] = '|';
+                    break;
+            }
+        }
+        base += layout->width;
+    }
+
+    for (int r = 0; r < 4; ++r) {
+        int len = width;
+
+        while (len > 0 && row[r][len - 1] == ' ') {
+            len--;
+        }
+        if (len == 0 && r != 1) {
+            continue;
+        }
+        fprintf(fp, "%.*s\n", len, row[r]);
+    }
+    fputc('\n', fp);
+}
+
+static void svg_dots(FILE *fp, uint32_t cx, int dots, int y, int step)
+{
+    for (int i = 0; i < dots; ++i) {
+        fprintf(fp, "<circle cx=\"%u\" cy=\"%d\" r=\"1.5\"/>", cx, y + i * step);
+    }
+}
+
+/**
+ * SVG line, drawn at y = 0. Placed on the page by the caller.
+ */
+static void line_svg(FILE *fp, const measure_t *measures, uint32_t count)
+{
+    uint32_t base = 0;
+
+    for (uint32_t m = 0; m < count; ++m) {
+        const jianpu_layout_t *layout = measures[m].layout;
+
+        for (uint16_t g = 0; g < layout->glyphs; ++g) {
+            const jianpu_glyph_t *glyph = &layout->glyph[g];
+            uint32_t x = (base + glyph->x) * JIANPU_SVG_COLUMN;
+            uint32_t cx = x + JIANPU_SVG_COLUMN * 3 / 2;
+            NoteSimplified_t note = glyph_note(glyph);
+            int octave = note_octave(note);
+            int under = underlines(glyph);
+
+            switch (glyph->kind) {
+                case JIANPU_GLYPH_NOTE:
+                    fprintf(fp, "<text x=\"%u\" y=\"32\">%d</text>", cx, note.note);
+                    if (note.sharp) {
+                        fprintf(fp, "<text class=\"s\" x=\"%u\" y=\"24\">#</text>", x + JIANPU_SVG_COLUMN / 2);
+                    }
+                    if (octave > 0) {
+                        svg_dots(fp, cx, octave, 14, -5);
+                    } else if (octave < 0) {
+                        svg_dots(fp, cx, -octave, under ? 37 + under * 4 + 3 : 40, 5);
+                    }
+                    for (int u = 0; u < under; ++u) {
+                        // Beam back to the previous note when it is underlined too
+                        uint32_t x1 = (g > 0 && underlines(glyph - 1) > u) ? x : x + JIANPU_SVG_COLUMN;
+
+                        fprintf(fp, "<line x1=\"%u\" y1=\"%d\" x2=\"%u\" y2=\"%d\"/>",
+                                x1, 36 + u * 4, x + JIANPU_SVG_COLUMN * 2, 36 + u * 4);
+                    }
+                    break;
+                case JIANPU_GLYPH_DASH:
+                    fprintf(fp, "<text x=\"%u\" y=\"32\">-</text>", cx);
+                    break;
+                case JIANPU_GLYPH_BAR:
+                    fprintf(fp, "<line x1=\"%u\" y1=\"16\" x2=\"%u\" y2=\"38\"/>", cx, cx);
+                    break;
+            }
+        }
+        base += layout->width;
+    }
+    fputc('\n', fp);
+}
+
+static const jianpu_line_t *line_render(jianpu_t *jp, const measure_t *measures, uint32_t count,
+        uint32_t width, uint8_t format)
+{
+    uint32_t hash = fnv1a(FNV_OFFSET, &format, 1);
+    jianpu_line_t *slot;
+    FILE *fp;
+
+    for (uint32_t m = 0; m < count; ++m) {
+        hash = fnv1a(hash, &measures[m].layout->hash, sizeof(uint32_t));
+    }
+
+    slot = line_slot(jp->line, jp->line_size, hash, format, measures, count);
+    if (slot->hash) {
+        jp->stats.lines_reused++;
+        return slot;
+    }
+
+    if (jp->lines >= CACHE_LINES_MAX) {
+        line_flush(jp);
+        slot = line_slot(jp->line, jp->line_size, hash, format, measures, count);
+    } else if ((jp->lines + 1) * 2 > jp->line_size) {
+        if (line_grow(jp)) {
+            return NULL;
+        }
+        slot = line_slot(jp->line, jp->line_size, hash, format, measures, count);
+    }
+
+    slot->measures = malloc(count * sizeof *slot->measures);
+    if (slot->measures == NULL) {
+        return NULL;
+    }
+    fp = open_memstream(&slot->out, &slot->len);
+    if (fp == NULL) {
+        free(slot->measures);
+        slot->measures = NULL;
+        return NULL;
+    }
+    if (format == JIANPU_FORMAT_SVG) {
+        line_svg(fp, measures, count);
+    } else {
+        line_text(fp, measures, count, width);
+    }
+    if (fclose(fp) != 0) {
+        free(slot->out);
+        free(slot->measures);
+        slot->out = NULL;
+        slot->measures = NULL;
+        return NULL;
+    }
+
+    for (uint32_t m = 0; m < count; ++m) {
+        slot->measures[m] = measures[m].layout;
+    }
+    slot->hash = hash;
+    slot->format = format;
+    slot->count = count;
+    jp->lines++;
+    jp->stats.lines_built++;
+
+    return slot;
+}
+
+static void page_begin(const ScoreSimplified_t *score, const jianpu_page_t *page, FILE *fp,
+        uint32_t num, uint32_t lines)
+{
+    char header[32];
+
+    snprintf(header, sizeof(header), "1=%s %d/%d", key_names[score->ks.signature],
+            score->ts.upper, 1 << score->ts.lower);
+
+    if (page->format == JIANPU_FORMAT_SVG) {
+        uint32_t width = page->width * JIANPU_SVG_COLUMN + JIANPU_SVG_COLUMN * 2;
+        uint32_t height = (lines + (num == 0)) * JIANPU_SVG_LINE + JIANPU_SVG_LINE / 2;
+
+        fprintf(fp, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%u\" height=\"%u\">\n"
+                "<style>text{font:16px monospace;text-anchor:middle}"
+                ".s{font-size:10px}.h{text-anchor:start}line{stroke:#000}</style>\n",
+                width, height);
+        if (num == 0) {
+            fprintf(fp, "<text class=\"h\" x=\"%d\" y=\"32\">%s</text>\n", JIANPU_SVG_COLUMN, header);
+        }
+    } else {
+        if (num > 0) {
+            fputs("\f", fp);
+        } else {
+            fprintf(fp, "%s\n\n", header);
+        }
+    }
+}
+
+static void page_end(const jianpu_page_t *page, FILE *fp)
+{
+    if (page->format == JIANPU_FORMAT_SVG) {
+        fputs("</svg>\n", fp);
+    }
+}
+
+/**
+ * Split notes into measures by the time signature. A note running over the
+ * bar line stays in its measure, the last measure may be short.
+ */
+static uint32_t split_measures(const ScoreSimplified_t *score, measure_t *measures)
+{
+    uint32_t length = (score->ts.upper ? score->ts.upper : 4) * 16 >> score->ts.lower;
+    uint32_t count = 0;
+    uint32_t filled = 0;
+
+    for (uint32_t i = 0; i < score->size; ++i) {
+        if (filled == 0) {
+            measures[count].first = i;
+            measures[count].count = 0;
+            count++;
+        }
+        measures[count - 1].count++;
+        filled += note_16ths(score->notes[i]);
+        if (filled >= length) {
+            filled = 0;
+        }
+    }
+
+    return count;
+}
+
+/**
+ * Greedy line break, at least one measure per line. Returns the number of
+ * lines, line i starting at measure starts[i].
+ */
+static uint32_t break_lines(const measure_t *measures, uint32_t count, uint32_t width, uint32_t *starts)
+{
+    uint32_t lines = 0;
+    uint32_t used = 0;
+
+    for (uint32_t m = 0; m < count; ++m) {
+        if (m == 0 || used + measures[m].layout->width > width) {
+            starts[lines++] = m;
+            used = 0;
+        }
+        used += measures[m].layout->width;
+    }
+    starts[lines] = count;
+
+    return lines;
+}
+
+int jianpu_render(jianpu_t *jp, const ScoreSimplified_t *score, const jianpu_page_t *page,
+        FILE *(*page_cb)(uint32_t page, void *arg), void *arg)
+{
+    measure_t *measures;
+    uint32_t *starts;
+    uint32_t count;
+    uint32_t lines;
+    uint32_t per_page;
+    int status = 0;
+
+    memset(&jp->stats, 0, sizeof(jp->stats));
+
+    measures = malloc((score->size + 1) * sizeof *measures);
+    starts = malloc((score->size + 2) * sizeof *starts);
+    if (measures == NULL || starts == NULL) {
+        free(measures);
+        free(starts);
+        return ENOMEM;
+    }
+
+    count = split_measures(score, measures);
+    for (uint32_t m = 0; m < count && status == 0; ++m) {
+        measures[m].layout = measure_layout(jp, score->notes + measures[m].first, measures[m].count);
+        if (measures[m].layout == NULL) {
+            status = ENOMEM;
+        }
+    }
+
+    lines = status ? 0 : break_lines(measures, count, page->width, starts);
+    per_page = page->lines ? page->lines : (lines ? lines : 1);
+
+    // At least one page, even for an empty score
+    for (uint32_t num = 0; status == 0 && (num == 0 || num * per_page < lines); ++num) {
+        uint32_t first = num * per_page;
+        uint32_t last = first + per_page < lines ? first + per_page : lines;
+        FILE *fp = page_cb ? page_cb(num, arg) : stdout;
+
+        if (fp == NULL) {
+            status = errno ? errno : EIO;
+            break;
+        }
+
+        page_begin(score, page, fp, num, last - first);
+
+        for (uint32_t l = first; l < last; ++l) {
+            uint32_t width = 0;
+            const jianpu_line_t *rendered;
+
+            for (uint32_t m = starts[l]; m < starts[l + 1]; ++m) {
+                width += measures[m].layout->width;
+            }
+
+            rendered = line_render(jp, measures + starts[l], starts[l + 1] - starts[l], width, page->format);
+            if (rendered == NULL) {
+                status = ENOMEM;
+                break;
+            }
+
+            if (page->format == JIANPU_FORMAT_SVG) {
+                // Lines are cached at y = 0, placed here; the header takes a line on page 0
+                fprintf(fp, "<g transform=\"translate(%d,%u)\">", JIANPU_SVG_COLUMN,
+                        (l - first + (num == 0)) * JIANPU_SVG_LINE);
+                fwrite(rendered->out, 1, rendered->len, fp);
+                fputs("</g>\n", fp);
+            } else {
+                fwrite(rendered->out, 1, rendered->len, fp);
+            }
+        }
+
+        page_end(page, fp);
+        if (status == 0 && ferror(fp)) {
+            status = EIO;
+        }
+    }
+
+    free(measures);
+    free(starts);
+
+    return status;
+}
+
+int jianpu_read_ssc(const uint8_t *buf, size_t size, ScoreSimplified_t *score)
+{
+    uint32_t count;
+
+    if (size < SCORE_OFFSET_DATA || memcmp(buf, "MSSC", 4) != 0) {
+        return EINVAL;
+    }
+
+    count = buf[SCORE_OFFSET_SIZE] << 8 | buf[SCORE_OFFSET_SIZE + 1];
+    if (SCORE_OFFSET_DATA + count > size) {
+        return EINVAL;
+    }
+
+    memcpy(&score->clef, &buf[SCORE_OFFSET_SIGNATURE], 1);
+    memcpy(&score->ks, &buf[SCORE_OFFSET_SIGNATURE + 1], 1);
+    memcpy(&score->ts, &buf[SCORE_OFFSET_SIGNATURE + 2], 1);
+    score->size = count;
+    score->notes = (const NoteSimplified_t *)&buf[SCORE_OFFSET_DATA];
+
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
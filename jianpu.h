@@ -0,0 +1,116 @@
+#ifndef __JIANPU_H__
+#define __JIANPU_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "note.h"
+
+/**
+ * Numbered Musical Notation (Jianpu) Engraver
+ *
+ * Lays a simplified score out into lines and pages of numbered notation,
+ * as text or SVG:
+ *
+ *        .                 <- octave above (':' two octaves)
+ *   1=G 4/4
+ *   | 1  1  5  5 | 6  6  5  - | #4 3 3  2 |
+ *         _  _                    =            <- eighth / 16th underlines
+ *                                 .            <- octave below
+ *
+ * Layout happens in two cached steps:
+ * - Measures are laid out once per distinct content (glyph positions and
+ *   width), keyed by a hash of their notes
+ * - Measures are broken into lines to fit the page width, and every line is
+ *   rendered once per distinct list of measures
+ *
+ * The caches live in the engraver, so rendering an edited score or the same
+ * score at another width with the same engraver only lays out the measures
+ * that changed and renders the lines whose content changed.
+ *
+ * Reference:
+ * - https://en.wikipedia.org/wiki/Numbered_musical_notation
+ */
+
+enum {
+    JIANPU_FORMAT_TEXT,
+    JIANPU_FORMAT_SVG
+};
+
+#define JIANPU_SVG_COLUMN       8       // SVG pixels per column
+#define JIANPU_SVG_LINE         64      // SVG pixels per line
+
+enum {
+    JIANPU_GLYPH_NOTE,
+    JIANPU_GLYPH_DASH,      // Half note extension
+    JIANPU_GLYPH_BAR
+};
+
+typedef struct {
+    uint16_t    x;          // Column from the start of the measure
+    uint8_t     kind;
+    uint8_t     note;       // NoteSimplified_t byte for notes
+} jianpu_glyph_t;
+
+typedef struct {
+    uint32_t            hash;
+    uint16_t            width;      // Columns, bar line included
+    uint16_t            glyphs;
+    jianpu_glyph_t *    glyph;
+    const uint8_t *     notes;      // NoteSimplified_t bytes laid out, a hit must match them
+    uint32_t            count;
+} jianpu_layout_t;
+
+typedef struct {
+    uint32_t                    hash;
+    uint8_t                     format;
+    const jianpu_layout_t **    measures;   // Layouts of the line, a hit must match them
+    uint32_t                    count;
+    char *                      out;
+    size_t                      len;
+} jianpu_line_t;
+
+typedef struct {
+    uint32_t    layouts_built;
+    uint32_t    layouts_reused;
+    uint32_t    lines_built;
+    uint32_t    lines_reused;
+} jianpu_stats_t;
+
+typedef struct {
+    uint8_t     format;
+    uint16_t    width;          // Page width in columns
+    uint16_t    lines;          // Lines per page, 0 = one page
+} jianpu_page_t;
+
+typedef struct {
+    jianpu_layout_t **  layout;     // Open addressing, keyed by measure hash. Layouts never move
+    uint32_t            layouts;
+    uint32_t            layout_size;
+    jianpu_line_t *     line;       // Open addressing, keyed by line hash
+    uint32_t            lines;
+    uint32_t            line_size;
+    jianpu_stats_t      stats;      // Of the last render
+} jianpu_t;
+
+jianpu_t *jianpu_new(void);
+void jianpu_free(jianpu_t *jp);
+
+/**
+ * Render a score. For SVG every page is a complete document; page_cb is
+ * called before each page so the caller can switch the output file, it may
+ * be NULL.
+ *
+ * Returns 0 or a POSIX errno.
+ */
+int jianpu_render(jianpu_t *jp, const ScoreSimplified_t *score, const jianpu_page_t *page,
+        FILE *(*page_cb)(uint32_t page, void *arg), void *arg);
+
+/**
+ * Read a score file (.ssc) into score. The notes point into buf.
+ */
+int jianpu_read_ssc(const uint8_t *buf, size_t size, ScoreSimplified_t *score);
+
+#endif /* __JIANPU_H__ */
+
+/* vim: set ts=4 sw=4 tw=0 list : */
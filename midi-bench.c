@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "midi.h"
+
+/**
+ * Track decoding benchmark
+ *
+ * Decodes every track of the given files serially and in parallel (see
+ * midi_set_jobs()), checks the events come out the same and prints the
+ * times:
+ *
+ *   midi-bench -j 8 live.mid
+ *
+ * -g <MB> first writes a synthetic format 0 file with one track of about
+ * that size to the first file name, notes with running status and the odd
+ * meta and sysex event, to benchmark giant tracks:
+ *
+ *   midi-bench -g 50 -j 8 giant.mid
+ */
+
+#define BENCH_SEED      12345u
+
+static uint32_t bench_rand(uint32_t *state)
+{
+    *state = *state * 1103515245u + 12345u;
+
+    return *state >> 8;
+}
+
+static size_t bench_vlq(uint8_t *p, uint32_t v)
+{
+    uint8_t tmp[4];
+    size_t n = 0;
+
+    do {
+        tmp[n++] = v & 0x7F;
+        v >>= 7;
+    } while (v);
+
+    for (size_t i = 0; i < n; ++i) {
+        p[i] = tmp[n - 1 - i] | (i + 1 < n ? 0x80 : 0);
+    }
+
+    return n;
+}
+
+static int bench_generate(const char *path, uint32_t mb)
+{
+    static const uint8_t header[] = { 'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, 0x01, 0xE0 };
+    uint32_t state = BENCH_SEED;
+    uint32_t size = 0;
+    uint8_t ev[32];
+    uint8_t running = 0;
+    uint8_t len[4];
+    FILE *fp = fopen(path, "wb");
+
+    if (fp == NULL) {
+        return errno;
+    }
+
+    // Chunk length is patched in at the end
+    fwrite(header, sizeof(header), 1, fp);
+    fwrite("MTrk\0\0\0\0", 8, 1, fp);
+
+    while (size < mb * 1024u * 1024u) {
+        uint32_t r = bench_rand(&state);
+        size_t n = bench_vlq(ev, r % 8 ? r % 240 : 0);
+
+        if (r % 4096 == 0) {
+            // Marker
+            memcpy(ev + n, "\xFF\x06\x05" "bench", 8);
+            n += 8;
+        } else if (r % 4096 == 1) {
+            // Sysex, cancels running status
+            memcpy(ev + n, "\xF0\x05\x7E\x7F\x09\x01\xF7", 7);
+            n += 7;
+            running = 0;
+        } else {
+            uint8_t status = (r % 3 ? 0x90 : 0x80) | (r >> 20) % 2;
+
+            if (r % 512 == 2) {
+                status = 0xC0;
+            }
+            if (status != running) {
+                ev[n++] = status;
+                running = status;
+            }
+            ev[n++] = 36 + (r >> 10) % 60;
+            if (status != 0xC0) {
+                ev[n++] = (r >> 4) % 127 + 1;
+            }
+        }
+
+        fwrite(ev, n, 1, fp);
+        size += n;
+    }
+
+    memcpy(ev, "\x00\xFF\x2F\x00", 4);
+    fwrite(ev, 4, 1, fp);
+    size += 4;
+
+    len[0] = size >> 24;
+    len[1] = size >> 16;
+    len[2] = size >> 8;
+    len[3] = size;
+    fseek(fp, sizeof(header) + 4, SEEK_SET);
+    fwrite(len, 4, 1, fp);
+
+    return fclose(fp) == 0 ? 0 : errno;
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Decode track n, best of runs, *track is the last decode
+static double bench_decode(midi_t *midi, int n, int runs, midi_track_t **track)
+{
+    double best = 0;
+
+    *track = NULL;
+    for (int r = 0; r < runs; ++r) {
+        double start = bench_now();
+
+        midi_free_track(*track);
+        *track = midi_get_track(midi, n);
+        if (*track == NULL) {
+            return -1;
+        }
+
+        double t = bench_now() - start;
+        best = (r == 0 || t < best) ? t : best;
+    }
+
+    return best;
+}
+
+static bool bench_same(const midi_track_t *a, const midi_track_t *b)
+{
+    const midi_event_node_t *x = a->head;
+    const midi_event_node_t *y = b->head;
+
+    if (a->events != b->events) {
+        return false;
+    }
+
+    for (; x != NULL && y != NULL; x = x->next, y = y->next) {
+        if (x->tick != y->tick || x->event.delta_time != y->event.delta_time || x->event.type != y->event.type
+                || x->event.cmd != y->event.cmd || x->event.chan != y->event.chan || x->event.size != y->event.size
+                || memcmp(x->event.data, y->event.data, x->event.size) != 0) {
+            return false;
+        }
+    }
+
+    return x == NULL && y == NULL;
+}
+
+static int bench_file(const char *path, uint16_t jobs, int runs)
+{
+    midi_t *midi;
+    int status = midi_open(path, &midi);
+
+    if (status) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(status));
+        return 1;
+    }
+
+    printf("%s\n", path);
+
+    for (int i = 0; i < midi->hdr.tracks; ++i) {
+        midi_track_t *serial;
+        midi_track_t *parallel;
+        double t_serial;
+        double t_parallel;
+
+        midi_set_jobs(midi, 1);
+        t_serial = bench_decode(midi, i, runs, &serial);
+        midi_set_jobs(midi, jobs);
+        t_parallel = bench_decode(midi, i, runs, &parallel);
+
+        if (serial == NULL || parallel == NULL) {
+            fprintf(stderr, "%s: track %d: %s\n", path, i, midi_get_errmsg(midi));
+            midi_free_track(serial);
+            midi_free_track(parallel);
+            status = 1;
+            break;
+        }
+
+        printf("  track %d: %u events, %u bytes, serial %.1f ms, parallel %.1f ms (x%.2f)%s\n",
+                i, serial->events, serial->hdr.size, t_serial * 1e3, t_parallel * 1e3,
+                t_parallel > 0 ? t_serial / t_parallel : 0,
+                bench_same(serial, parallel) ? "" : ", EVENTS DIFFER");
+        if (!bench_same(serial, parallel)) {
+            status = 1;
+        }
+
+        midi_free_track(serial);
+        midi_free_track(parallel);
+    }
+
+    midi_close(midi);
+
+    return status;
+}
+
+int main(int argc, char **argv)
+{
+    uint16_t jobs = 0;
+    uint32_t generate = 0;
+    int runs = 3;
+    int failed = 0;
+    int opt_char;
+
+    while ((opt_char = getopt(argc, argv, "g:j:n:")) != -1) {
+        switch (opt_char) {
+            case 'g':
+                generate = strtoul(optarg, NULL, 10);
+                break;
+            case 'j':
+                jobs = strtoul(optarg, NULL, 10);
+                break;
+            case 'n':
+                runs = atoi(optarg);
+                break;
+            default:
+                optind = argc;
+                runs = 0;
+                break;
+        }
+    }
+
+    if (optind >= argc || runs < 1) {
+        fprintf(stderr, "Usage: %s [-g MB] [-j jobs] [-n runs] filename.mid ...\n\n", argv[0]);
+        return 1;
+    }
+
+    if (generate) {
+        int status = bench_generate(argv[optind], generate);
+
+        if (status) {
+            fprintf(stderr, "Failed to write %s: %s\n", argv[optind], strerror(status));
+            return 1;
+        }
+    }
+
+    for (int i = optind; i < argc; ++i) {
+        failed += bench_file(argv[i], jobs, runs);
+    }
+
+    return failed ? 1 : 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
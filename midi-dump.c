@@ -1,26 +1,40 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
 
 #include "midi.h"
 
-static int midi_dump(char * midi_file);
+static int midi_dump(char * midi_file, bool recover);
 
 int main(int argc, char**argv)
 {
+    bool recover = false;
+    int opt_char;
+
+    // -r: recovery mode, list damaged byte ranges instead of failing
+    while ((opt_char = getopt(argc, argv, "r")) != -1) {
+        if (opt_char == 'r') {
+            recover = true;
+        } else {
+            optind = argc;
+            break;
+        }
+    }
 
     char * midi_file;
-    if (argc != 2 || strlen(argv[1]) < 1) {
-        fprintf(stderr, "Usage: %s filename.mid\n\n", argv[0]);
+    if (argc - optind != 1 || strlen(argv[optind]) < 1) {
+        fprintf(stderr, "Usage: %s [-r] filename.mid\n\n", argv[0]);
         return 1;
     }
 
-    midi_file = argv[1];
+    midi_file = argv[optind];
 
-    return midi_dump(midi_file);
+    return midi_dump(midi_file, recover);
 }
 
-static int midi_dump(char * midi_file)
+static int midi_dump(char * midi_file, bool recover)
 {
     midi_t *midi;
     int status;
@@ -32,6 +46,7 @@ static int midi_dump(char * midi_file)
         return 1;
     }
 
+    midi_set_recover(midi, recover);
     midi_print_info(midi);
 
     midi_close(midi);
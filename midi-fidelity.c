@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "corpus.h"
+#include "fidelity.h"
+
+/**
+ * Measure what the conversion to score files loses, over a corpus of midi
+ * files and archives (see fidelity.h):
+ *
+ *   midi-fidelity -j 8 corpus.tar.gz
+ *
+ * prints a line per file and the totals: mean and worst onset and length
+ * error, worst drift, pitch mismatches, notes dropped and the conversion
+ * time. Files are measured in parallel, -j jobs (default one per CPU), and
+ * printed in the order given. -v also prints every note, -T sets the
+ * length tolerance of the ssc emitter (see emitter.h) to tune it.
+ */
+
+#define QUEUE_MAX           64      // Files read ahead of the workers
+
+typedef struct {
+    char *          name;
+    char *          archive;    // NULL for files
+    uint8_t *       data;       // Member bytes, NULL for files
+    size_t          size;
+    int             status;
+    fidelity_t      result;
+    char *          notes;      // Per note lines, with -v
+    size_t          notes_len;
+} fidelity_job_t;
+
+typedef struct {
+    fidelity_job_t **       jobs;       // Stay put while the array grows
+    uint32_t                count;
+    uint32_t                cap;
+    uint32_t                next;       // Next job to measure
+    uint32_t                done;
+    bool                    closed;     // No more jobs coming
+    const emitter_options_t *opt;
+    bool                    verbose;
+    pthread_mutex_t         lock;
+    pthread_cond_t          more;       // A job was added, or the corpus closed
+    pthread_cond_t          room;       // A job was done
+} fidelity_queue_t;
+
+static void print_note(const fidelity_note_t *n, void *arg)
+{
+    fprintf(arg, "  %2u %5u  key %3u -> %3u  start %12.1f -> %12.1f  length %10.1f -> %10.1f us\n", n->song,
+            n->index, n->source_key, n->score_key, n->source_start, n->score_start, n->source_length,
+            n->score_length);
+}
+
+static void print_result(const char *name, const fidelity_t *r)
+{
+    uint32_t kept = r->notes - r->dropped;
+
+    printf("%s: %u notes, %u dropped, onset %.1f / %.1f ms, length %.1f / %.1f ms, drift %.1f ms at most, "
+            "%.1f at the end, %u pitch mismatches, rests %.1f ms, converted in %.2f ms\n",
+            name, r->notes, r->dropped, kept ? r->onset_error / kept / 1e3 : 0, r->onset_error_max / 1e3,
+            kept ? r->length_error / kept / 1e3 : 0, r->length_error_max / 1e3, r->drift_max / 1e3,
+            r->drift_end / 1e3, r->pitch_mismatches, r->rests / 1e3, r->convert_ns / 1e6);
+}
+
+static void *fidelity_worker(void *arg)
+{
+    fidelity_queue_t *q = arg;
+
+    for (;;) {
+        fidelity_job_t *job;
+        FILE *fp = NULL;
+
+        pthread_mutex_lock(&q->lock);
+        while (q->next == q->count && !q->closed) {
+            pthread_cond_wait(&q->more, &q->lock);
+        }
+        if (q->next == q->count) {
+            pthread_mutex_unlock(&q->lock);
+            break;
+        }
+        job = q->jobs[q->next++];
+        pthread_mutex_unlock(&q->lock);
+
+        // An input that failed to read is reported, not measured
+        if (job->status == 0) {
+            if (q->verbose) {
+                fp = open_memstream(&job->notes, &job->notes_len);
+            }
+            job->status = fidelity_measure(job->name, job->data, job->size, q->opt, fp ? print_note : NULL, fp,
+                    &job->result);
+        }
+
+        if (fp != NULL) {
+            fclose(fp);
+        }
+        free(job->data);
+        job->data = NULL;
+
+        pthread_mutex_lock(&q->lock);
+        q->done++;
+        pthread_cond_signal(&q->room);
+        pthread_mutex_unlock(&q->lock);
+    }
+
+    return NULL;
+}
+
+static void fidelity_job_free(fidelity_job_t *job)
+{
+    free(job->name);
+    free(job->archive);
+    free(job->data);
+    free(job->notes);
+    free(job);
+}
+
+// Queue one input, waiting while the workers are too far behind
+static int fidelity_queue_add(fidelity_queue_t *q, const corpus_entry_t *entry)
+{
+    fidelity_job_t *job = calloc(1, sizeof(*job));
+
+    if (job == NULL) {
+        return ENOMEM;
+    }
+    job->name = strdup(entry->name);
+    job->archive = entry->archive ? strdup(entry->archive) : NULL;
+    job->status = entry->status;
+    job->size = entry->size;
+    if (entry->data && entry->status == 0) {
+        job->data = malloc(entry->size ? entry->size : 1);
+        if (job->data != NULL) {
+            memcpy(job->data, entry->data, entry->size);
+        }
+    }
+    if (job->name == NULL || (entry->archive && job->archive == NULL)
+            || (entry->data && entry->status == 0 && job->data == NULL)) {
+        fidelity_job_free(job);
+        return ENOMEM;
+    }
+
+    pthread_mutex_lock(&q->lock);
+    while (q->count - q->done >= QUEUE_MAX) {
+        pthread_cond_wait(&q->room, &q->lock);
+    }
+    if (q->count == q->cap) {
+        uint32_t cap = q->cap ? q->cap * 2 : 256;
+        fidelity_job_t **jobs = realloc(q->jobs, cap * sizeof(*jobs));
+
+        if (jobs == NULL) {
+            pthread_mutex_unlock(&q->lock);
+            fidelity_job_free(job);
+            return ENOMEM;
+        }
+        q->jobs = jobs;
+        q->cap = cap;
+    }
+    q->jobs[q->count++] = job;
+    pthread_cond_signal(&q->more);
+    pthread_mutex_unlock(&q->lock);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    emitter_options_t opt = { .jobs = 1 };
+    fidelity_queue_t q;
+    fidelity_t total;
+    corpus_t corpus;
+    corpus_entry_t entry;
+    pthread_t *threads;
+    long threads_n = 0;
+    bool verbose = false;
+    uint32_t measured = 0;
+    int failed = 0;
+    int opt_char;
+
+    while ((opt_char = getopt(argc, argv, "j:rT:v")) != -1) {
+        switch (opt_char) {
+            case 'j':
+                threads_n = strtol(optarg, NULL, 10);
+                break;
+            case 'r':
+                opt.recover = true;
+                break;
+            case 'T':
+                opt.tolerance = strtof(optarg, NULL);
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                threads_n = -1;
+                break;
+        }
+    }
+
+    if (optind >= argc || threads_n < 0 || opt.tolerance < 0) {
+        fprintf(stderr, "Usage: %s [-j jobs] [-r] [-T tolerance] [-v] filename.mid|archive ...\n\n", argv[0]);
+        return 1;
+    }
+    if (threads_n == 0) {
+        threads_n = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (threads_n < 1) {
+        threads_n = 1;
+    }
+
+    memset(&q, 0, sizeof(q));
+    q.opt = &opt;
+    q.verbose = verbose;
+    pthread_mutex_init(&q.lock, NULL);
+    pthread_cond_init(&q.more, NULL);
+    pthread_cond_init(&q.room, NULL);
+
+    threads = calloc(threads_n, sizeof(*threads));
+    if (threads == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    for (long i = 0; i < threads_n; ++i) {
+        if (pthread_create(&threads[i], NULL, fidelity_worker, &q) != 0) {
+            threads_n = i;
+            break;
+        }
+    }
+    if (threads_n == 0) {
+        fprintf(stderr, "Failed to start workers\n");
+        return 1;
+    }
+
+    corpus_init(&corpus, &argv[optind], argc - optind);
+    while (corpus_next(&corpus, &entry)) {
+        if (fidelity_queue_add(&q, &entry) != 0) {
+            fprintf(stderr, "Out of memory at %s\n", entry.name);
+            failed++;
+            break;
+        }
+    }
+    corpus_close(&corpus);
+
+    pthread_mutex_lock(&q.lock);
+    q.closed = true;
+    pthread_cond_broadcast(&q.more);
+    pthread_mutex_unlock(&q.lock);
+    for (long i = 0; i < threads_n; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    memset(&total, 0, sizeof(total));
+    for (uint32_t i = 0; i < q.count; ++i) {
+        fidelity_job_t *job = q.jobs[i];
+        char name[1024];
+
+        if (job->archive) {
+            snprintf(name, sizeof(name), "%s:%s", job->archive, job->name);
+        } else {
+            snprintf(name, sizeof(name), "%s", job->name);
+        }
+
+        if (job->status) {
+            fprintf(stderr, "Failed to measure %s: %s\n", name, strerror(job->status));
+            failed++;
+        } else {
+            print_result(name, &job->result);
+            if (job->notes) {
+                fwrite(job->notes, 1, job->notes_len, stdout);
+            }
+            fidelity_add(&total, &job->result);
+            measured++;
+        }
+
+        fidelity_job_free(job);
+    }
+
+    if (measured > 1) {
+        print_result("total", &total);
+    }
+
+    pthread_cond_destroy(&q.room);
+    pthread_cond_destroy(&q.more);
+    pthread_mutex_destroy(&q.lock);
+    free(q.jobs);
+    free(threads);
+
+    return failed ? 1 : 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
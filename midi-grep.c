@@ -0,0 +1,358 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+#include "corpus.h"
+#include "zfile.h"
+#include "grep.h"
+
+/**
+ * Search midi files for an event (see grep.h for the expressions):
+ *
+ *   midi-grep 'note_on ch 9 key 49 vel > 100' songs/ corpus.tar.gz
+ *   midi-grep -l 'tempo < 60 bpm' songs/
+ *
+ * prints the first event of every file that matches, as
+ *
+ *   name: track T tick K: event
+ *
+ * with name archive:member for archive members. Directories are searched
+ * for midi files, tar, zip and midi-pack archives member by member.
+ *
+ * Each file is decoded as it is read and only up to its first match, a
+ * compressed file is only decompressed that far. Files are searched in
+ * parallel, -j jobs (default one per CPU), and printed in the order
+ * found. -l only prints the names of the files matching, -L those of the
+ * files not matching.
+ *
+ * Exits 0 if a file matched, 1 if none did, 2 on errors.
+ */
+
+#define QUEUE_MAX           64      // Files read ahead of the printer
+#define GREP_MAX_OPEN_DIRS  16
+
+enum {
+    PRINT_EVENTS,
+    PRINT_MATCHING,     // -l
+    PRINT_NOT_MATCHING, // -L
+};
+
+typedef struct {
+    char *          name;
+    char *          archive;    // NULL for files
+    uint8_t *       data;       // Member bytes, NULL for files
+    size_t          size;
+    int             status;
+    bool            done;
+    bool            found;
+    grep_event_t    match;
+} grep_job_t;
+
+typedef struct {
+    grep_job_t *            jobs[QUEUE_MAX];    // Ring, job i at i % QUEUE_MAX
+    uint64_t                count;
+    uint64_t                next;       // Next job to search
+    uint64_t                printed;
+    bool                    closed;     // No more jobs coming
+    const grep_prog_t *     prog;
+    pthread_mutex_t         lock;
+    pthread_cond_t          more;       // A job was added, or the input closed
+    pthread_cond_t          done;       // A job was searched
+} grep_queue_t;
+
+static struct {
+    grep_queue_t    queue;
+    int             print;
+    uint32_t        matched;
+    int             failed;
+} options;
+
+static int grep_job(grep_job_t *job, const grep_prog_t *prog)
+{
+    FILE *fp;
+    int status;
+
+    fp = job->data ? fmemopen(job->data, job->size ? job->size : 1, "rb") : zfile_open(job->name);
+    if (fp == NULL) {
+        return errno ? errno : EIO;
+    }
+    // Only this thread reads it, grep_stream() uses the unlocked stdio calls
+    flockfile(fp);
+    status = grep_stream(fp, prog, &job->match, &job->found);
+    funlockfile(fp);
+    fclose(fp);
+
+    return status;
+}
+
+static void *grep_worker(void *arg)
+{
+    grep_queue_t *q = arg;
+
+    for (;;) {
+        grep_job_t *job;
+
+        pthread_mutex_lock(&q->lock);
+        while (q->next == q->count && !q->closed) {
+            pthread_cond_wait(&q->more, &q->lock);
+        }
+        if (q->next == q->count) {
+            pthread_mutex_unlock(&q->lock);
+            break;
+        }
+        job = q->jobs[q->next++ % QUEUE_MAX];
+        pthread_mutex_unlock(&q->lock);
+
+        // An input that failed to read is reported, not searched
+        if (job->status == 0) {
+            job->status = grep_job(job, q->prog);
+        }
+        free(job->data);
+        job->data = NULL;
+
+        pthread_mutex_lock(&q->lock);
+        job->done = true;
+        pthread_cond_broadcast(&q->done);
+        pthread_mutex_unlock(&q->lock);
+    }
+
+    return NULL;
+}
+
+static void grep_job_free(grep_job_t *job)
+{
+    free(job->name);
+    free(job->archive);
+    free(job->data);
+    free(job);
+}
+
+static void grep_print(const grep_job_t *job)
+{
+    char name[1024];
+    char event[128];
+
+    if (job->archive) {
+        snprintf(name, sizeof(name), "%s:%s", job->archive, job->name);
+    } else {
+        snprintf(name, sizeof(name), "%s", job->name);
+    }
+
+    if (job->status) {
+        fprintf(stderr, "Failed to search %s: %s\n", name, strerror(job->status));
+        options.failed++;
+        return;
+    }
+    options.matched += job->found;
+
+    switch (options.print) {
+        case PRINT_EVENTS:
+            if (job->found) {
+                grep_describe(&job->match, event, sizeof(event));
+                printf("%s: track %u tick %u: %s\n", name, job->match.track, job->match.tick, event);
+            }
+            break;
+        case PRINT_MATCHING:
+        case PRINT_NOT_MATCHING:
+            if (job->found == (options.print == PRINT_MATCHING)) {
+                printf("%s\n", name);
+            }
+            break;
+    }
+}
+
+// Wait for the oldest job to be searched, print and free it
+static void grep_print_next(grep_queue_t *q)
+{
+    grep_job_t *job;
+
+    pthread_mutex_lock(&q->lock);
+    job = q->jobs[q->printed % QUEUE_MAX];
+    while (!job->done) {
+        pthread_cond_wait(&q->done, &q->lock);
+    }
+    q->printed++;
+    pthread_mutex_unlock(&q->lock);
+
+    grep_print(job);
+    grep_job_free(job);
+}
+
+// Queue one input, printing the results before it as they come
+static int grep_queue_add(grep_queue_t *q, const corpus_entry_t *entry)
+{
+    grep_job_t *job = calloc(1, sizeof(*job));
+
+    if (job == NULL) {
+        return ENOMEM;
+    }
+    job->name = strdup(entry->name);
+    job->archive = entry->archive ? strdup(entry->archive) : NULL;
+    job->status = entry->status;
+    job->size = entry->size;
+    if (entry->data && entry->status == 0) {
+        job->data = malloc(entry->size ? entry->size : 1);
+        if (job->data != NULL) {
+            memcpy(job->data, entry->data, entry->size);
+        }
+    }
+    if (job->name == NULL || (entry->archive && job->archive == NULL)
+            || (entry->data && entry->status == 0 && job->data == NULL)) {
+        grep_job_free(job);
+        return ENOMEM;
+    }
+
+    // Only this thread prints and adds, the ring can't fill up meanwhile
+    while (q->count - q->printed >= QUEUE_MAX) {
+        grep_print_next(q);
+    }
+    for (;;) {
+        bool ready;
+
+        pthread_mutex_lock(&q->lock);
+        ready = q->printed < q->count && q->jobs[q->printed % QUEUE_MAX]->done;
+        pthread_mutex_unlock(&q->lock);
+        if (!ready) {
+            break;
+        }
+        grep_print_next(q);
+    }
+
+    pthread_mutex_lock(&q->lock);
+    q->jobs[q->count++ % QUEUE_MAX] = job;
+    pthread_cond_signal(&q->more);
+    pthread_mutex_unlock(&q->lock);
+
+    return 0;
+}
+
+// A file, or the midi members of an archive
+static void grep_path(const char *path)
+{
+    corpus_t corpus;
+    corpus_entry_t entry;
+    char *paths[] = { (char *)path };
+
+    corpus_init(&corpus, paths, 1);
+    while (corpus_next(&corpus, &entry)) {
+        if (grep_queue_add(&options.queue, &entry) != 0) {
+            fprintf(stderr, "Out of memory at %s\n", entry.name);
+            options.failed++;
+            break;
+        }
+    }
+    corpus_close(&corpus);
+}
+
+static int walk_entry(const char *path, const struct stat *sb, int type, struct FTW *ftw)
+{
+    (void)sb;
+    (void)ftw;
+
+    if (type == FTW_F && corpus_is_midi_file(path)) {
+        grep_path(path);
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    grep_queue_t *q = &options.queue;
+    grep_prog_t prog;
+    pthread_t *threads;
+    long threads_n = 0;
+    struct stat sb;
+    char err[256];
+    int opt_char;
+
+    options.print = PRINT_EVENTS;
+
+    while ((opt_char = getopt(argc, argv, "j:lL")) != -1) {
+        switch (opt_char) {
+            case 'j':
+                threads_n = strtol(optarg, NULL, 10);
+                break;
+            case 'l':
+                options.print = PRINT_MATCHING;
+                break;
+            case 'L':
+                options.print = PRINT_NOT_MATCHING;
+                break;
+            default:
+                threads_n = -1;
+                break;
+        }
+    }
+
+    if (optind + 1 >= argc || threads_n < 0) {
+        fprintf(stderr, "Usage: %s [-j jobs] [-l|-L] expression filename.mid|directory|archive ...\n\n", argv[0]);
+        return 2;
+    }
+    if (grep_compile(argv[optind], &prog, err, sizeof(err)) != 0) {
+        fprintf(stderr, "Bad expression: %s\n", err);
+        return 2;
+    }
+    if (threads_n == 0) {
+        threads_n = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (threads_n < 1) {
+        threads_n = 1;
+    }
+
+    q->prog = &prog;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->more, NULL);
+    pthread_cond_init(&q->done, NULL);
+
+    threads = calloc(threads_n, sizeof(*threads));
+    if (threads == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 2;
+    }
+    for (long i = 0; i < threads_n; ++i) {
+        if (pthread_create(&threads[i], NULL, grep_worker, q) != 0) {
+            threads_n = i;
+            break;
+        }
+    }
+    if (threads_n == 0) {
+        fprintf(stderr, "Failed to start workers\n");
+        return 2;
+    }
+
+    for (int i = optind + 1; i < argc; ++i) {
+        if (stat(argv[i], &sb) == 0 && S_ISDIR(sb.st_mode)) {
+            nftw(argv[i], walk_entry, GREP_MAX_OPEN_DIRS, FTW_PHYS);
+        } else {
+            grep_path(argv[i]);
+        }
+    }
+
+    pthread_mutex_lock(&q->lock);
+    q->closed = true;
+    pthread_cond_broadcast(&q->more);
+    pthread_mutex_unlock(&q->lock);
+    while (q->printed < q->count) {
+        grep_print_next(q);
+    }
+    for (long i = 0; i < threads_n; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&q->done);
+    pthread_cond_destroy(&q->more);
+    pthread_mutex_destroy(&q->lock);
+    free(threads);
+
+    return options.failed ? 2 : options.matched ? 0 : 1;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
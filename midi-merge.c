@@ -0,0 +1,358 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "midi.h"
+#include "stream.h"
+#include "smf.h"
+#include "resample.h"
+
+/**
+ * Merge midi files into one multi-track (format 1) file, at the chunk
+ * level:
+ *
+ *   midi-merge -o band.mid drums.mid bass.mid keys.mid.gz
+ *
+ * - The conductor tracks (track 0 of format 1 files) are decoded and
+ *   merged into one, through the k-way merge of stream.h, which becomes
+ *   track 0. A single conductor of the output division is copied as is.
+ * - Every other track, and the one track of a format 0 file, is copied
+ *   byte for byte (midi_copy_track_chunk) when its file has the output
+ *   division. Otherwise only its delta times are decoded and rescaled, the
+ *   events themselves are copied as they are.
+ *
+ * The output division is the one of the first file, or -d (see resample.h:
+ * absolute times are rounded once and never drift). With a single file,
+ * this resamples it:
+ *
+ *   midi-merge -d 480 -o a.480.mid a.mid
+ *
+ * Time code divisions can't be rescaled, files with one must all have the
+ * same. Format 2 files (songs) are not merged.
+ *
+ * Meta and sysex events of merged conductor tracks are cut at 255 bytes, as
+ * midi.c decodes them.
+ */
+
+#define MERGE_MAX_TRACKS    0xFFFF  // Of the output, the header count is 16 bit
+#define MERGE_MAX_IN_TRACKS 256     // Of an input, the track API numbers them in 8 bits
+
+typedef struct {
+    const char *    name;
+    midi_t *        midi;
+    bool            rescale;
+} merge_input_t;
+
+static int merge_copy_rescaled(const merge_input_t *in, uint8_t track, uint16_t division, int fd)
+{
+    resample_t r;
+    uint8_t *data;
+    uint8_t *out;
+    uint32_t size;
+    uint32_t out_size;
+    int status;
+
+    status = midi_read_track_chunk(in->midi, track, &data, &size);
+    if (status) {
+        return status;
+    }
+
+    resample_init(&r, in->midi->hdr.division, division);
+    status = resample_track(data, size, &r, &out, &out_size);
+    if (status == 0) {
+        status = smf_write_track(fd, out, out_size);
+    }
+
+    free(out);
+    free(data);
+
+    return status;
+}
+
+// Resample the delta times of a decoded track in place
+static int merge_rescale_track(midi_track_t *trk, uint16_t from, uint16_t to)
+{
+    uint32_t *ticks = malloc((trk->events + 1) * sizeof(*ticks));
+    uint32_t *out = malloc((trk->events + 1) * sizeof(*out));
+    resample_t r;
+    uint32_t last = 0;
+    uint32_t n = 0;
+    int status = 0;
+
+    if (ticks == NULL || out == NULL) {
+        free(ticks);
+        free(out);
+        return ENOMEM;
+    }
+
+    for (midi_event_node_t *node = trk->head; node != NULL && n <= trk->events; node = node->next) {
+        ticks[n++] = node->tick;
+    }
+
+    resample_init(&r, from, to);
+    if (!resample_ticks(ticks, out, n, &r)) {
+        status = EOVERFLOW;
+    }
+
+    n = 0;
+    for (midi_event_node_t *node = trk->head; node != NULL && status == 0; node = node->next, ++n) {
+        if (out[n] - last > SMF_VLQ_MAX) {
+            status = EOVERFLOW;
+        }
+        node->event.delta_time = out[n] - last;
+        node->tick = out[n];
+        last = out[n];
+    }
+
+    free(ticks);
+    free(out);
+
+    return status;
+}
+
+// Encode the merged stream of the conductor tracks, one End of Track last
+static int merge_encode_conductor(midi_stream_t *stream, int fd)
+{
+    uint8_t ev[8 + 255];
+    uint32_t last = 0;
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *fp = open_memstream(&buf, &size);
+    int status = 0;
+
+    if (fp == NULL) {
+        return errno;
+    }
+
+    while (midi_stream_has_next(stream)) {
+        uint32_t tick;
+        midi_event_t *event = midi_stream_next(stream, &tick, NULL);
+        size_t n;
+
+        if (event->type == MIDI_EVENT_TYPE_META && event->cmd == MIDI_META_END_TRACK) {
+            continue;
+        }
+
+        n = smf_vlq(ev, tick - last);
+        last = tick;
+        if (event->type == MIDI_EVENT_TYPE_META) {
+            ev[n++] = 0xFF;
+            ev[n++] = event->cmd;
+            n += smf_vlq(ev + n, event->size);
+        } else if (event->type == MIDI_EVENT_TYPE_SYSEX) {
+            ev[n++] = event->cmd;
+            n += smf_vlq(ev + n, event->size);
+        } else {
+            ev[n++] = event->cmd << 4 | event->chan;
+        }
+        memcpy(ev + n, event->data, event->size);
+        fwrite(ev, n + event->size, 1, fp);
+    }
+    fwrite("\x00\xFF\x2F\x00", 4, 1, fp);
+
+    if (fclose(fp) != 0) {
+        status = errno;
+    }
+    if (status == 0) {
+        status = smf_write_track(fd, (uint8_t *)buf, size);
+    }
+    free(buf);
+
+    return status;
+}
+
+static int merge_conductors(const merge_input_t *inputs, int count, uint16_t division, int fd)
+{
+    midi_track_t **trk = calloc(count, sizeof(*trk));
+    midi_stream_t *stream = NULL;
+    uint16_t n = 0;
+    int status = 0;
+
+    if (trk == NULL) {
+        return ENOMEM;
+    }
+
+    for (int i = 0; i < count && status == 0; ++i) {
+        const midi_t *midi = inputs[i].midi;
+
+        if (midi->hdr.format != MIDI_FORMAT_MULTI) {
+            continue;
+        }
+        trk[n] = midi_get_track(midi, 0);
+        if (trk[n] == NULL) {
+            status = midi_get_errno(midi) ? midi_get_errno(midi) : EINVAL;
+            break;
+        }
+        if (inputs[i].rescale) {
+            status = merge_rescale_track(trk[n], midi->hdr.division, division);
+        }
+        n++;
+    }
+
+    if (status == 0) {
+        stream = midi_stream_new(trk, n);
+        status = stream ? merge_encode_conductor(stream, fd) : ENOMEM;
+    }
+
+    midi_stream_close(stream);
+    for (uint16_t i = 0; i < n; ++i) {
+        midi_free_track(trk[i]);
+    }
+    free(trk);
+
+    return status;
+}
+
+static int merge(const char *out_name, merge_input_t *inputs, int count, int division)
+{
+    uint32_t conductors = 0;
+    uint32_t tracks = 0;
+    uint32_t rescaled = 0;
+    int conductor = -1;
+    int status = 0;
+    int fd;
+
+    for (int i = 0; i < count; ++i) {
+        const midi_t *midi = inputs[i].midi;
+
+        if (midi->hdr.format == MIDI_FORMAT_SONGS) {
+            fprintf(stderr, "%s holds songs (format 2), can't merge it\n", inputs[i].name);
+            return EINVAL;
+        }
+        if (midi->hdr.tracks > MERGE_MAX_IN_TRACKS) {
+            fprintf(stderr, "%s has %u tracks, can't merge more than %d\n", inputs[i].name, midi->hdr.tracks, MERGE_MAX_IN_TRACKS);
+            return EINVAL;
+        }
+        if (division < 0) {
+            division = (uint16_t)midi->hdr.division;
+        }
+
+        inputs[i].rescale = (uint16_t)midi->hdr.division != division;
+        if (inputs[i].rescale && ((midi->hdr.division & 0x8000) || (division & 0x8000) || midi->hdr.division == 0)) {
+            fprintf(stderr, "Can't rescale the division of %s\n", inputs[i].name);
+            return EINVAL;
+        }
+
+        if (midi->hdr.format == MIDI_FORMAT_MULTI) {
+            conductors++;
+            conductor = i;
+            tracks += midi->hdr.tracks - 1;
+        } else {
+            tracks += midi->hdr.tracks;
+        }
+    }
+    tracks += conductors ? 1 : 0;
+    if (tracks > MERGE_MAX_TRACKS) {
+        fprintf(stderr, "Too many tracks: %u\n", tracks);
+        return EINVAL;
+    }
+
+    fd = open(out_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        status = errno;
+        fprintf(stderr, "Failed to create %s: %s\n", out_name, strerror(status));
+        return status;
+    }
+
+    status = smf_write_header(fd, MIDI_FORMAT_MULTI, tracks, division);
+
+    if (status == 0 && conductors == 1 && !inputs[conductor].rescale) {
+        status = midi_copy_track_chunk(inputs[conductor].midi, 0, fd);
+    } else if (status == 0 && conductors > 0) {
+        status = merge_conductors(inputs, count, division, fd);
+    }
+    if (status) {
+        fprintf(stderr, "Failed to merge the conductor tracks: %s\n", strerror(status));
+    }
+
+    for (int i = 0; i < count && status == 0; ++i) {
+        const midi_t *midi = inputs[i].midi;
+
+        for (int t = midi->hdr.format == MIDI_FORMAT_MULTI ? 1 : 0; t < midi->hdr.tracks && status == 0; ++t) {
+            if (inputs[i].rescale) {
+                status = merge_copy_rescaled(&inputs[i], t, division, fd);
+                rescaled++;
+            } else {
+                status = midi_copy_track_chunk(midi, t, fd);
+            }
+            if (status) {
+                fprintf(stderr, "Failed to copy track %d of %s: %s\n", t, inputs[i].name, strerror(status));
+            }
+        }
+    }
+
+    if (close(fd) != 0 && status == 0) {
+        status = errno;
+    }
+    if (status) {
+        unlink(out_name);
+        return status;
+    }
+
+    printf("%s: %u tracks, %u conductors merged, %u tracks rescaled\n", out_name, tracks, conductors, rescaled);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *out_name = NULL;
+    merge_input_t *inputs;
+    int division = -1;
+    int count;
+    int status = 0;
+    int opt_char;
+
+    while ((opt_char = getopt(argc, argv, "d:o:")) != -1) {
+        switch (opt_char) {
+            case 'd':
+                division = strtol(optarg, NULL, 10);
+                break;
+            case 'o':
+                out_name = optarg;
+                break;
+            default:
+                out_name = NULL;
+                optind = argc;
+                break;
+        }
+    }
+
+    if (optind >= argc || out_name == NULL || division == 0 || division > 0x7FFF) {
+        fprintf(stderr, "Usage: %s [-d division] -o out.mid filename.mid ...\n\n", argv[0]);
+        return 1;
+    }
+
+    count = argc - optind;
+    inputs = calloc(count, sizeof(*inputs));
+    if (inputs == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    for (int i = 0; i < count && status == 0; ++i) {
+        inputs[i].name = argv[optind + i];
+        status = midi_open(inputs[i].name, &inputs[i].midi);
+        if (status) {
+            fprintf(stderr, "Failed to open %s: %s\n", inputs[i].name, strerror(status));
+        }
+    }
+
+    if (status == 0) {
+        status = merge(out_name, inputs, count, division);
+    }
+
+    for (int i = 0; i < count; ++i) {
+        midi_close(inputs[i].midi);
+    }
+    free(inputs);
+
+    return status ? 1 : 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
@@ -0,0 +1,409 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+#include "midi.h"
+#include "zfile.h"
+#include "corpus.h"
+
+/**
+ * Pack a corpus of midi files into one midi-pack archive, or list one (see
+ * archive.h):
+ *
+ *   midi-pack -o corpus.mpk songs/ more.tar.gz single.mid
+ *   midi-pack -l corpus.mpk
+ *
+ * Every member is parsed once when packing, for the feature sketch of the
+ * pack. -q lists only the members a query matches, from the sketch alone,
+ * without reading any of them:
+ *
+ *   midi-pack -l corpus.mpk -q chan=9,prog=0-7,bpm=100-140,meta=lyrics
+ *
+ * A query is a list of conditions, all of which must hold:
+ *   chan=<0-15>        uses the channel, numbered as midi-grep and
+ *                      midi-dump do (9 is the GM drums)
+ *   prog=<a>[-<b>]     uses one of the GM programs (0 - 127)
+ *   pitch=<a>-<b>      has a note in the range
+ *   bpm=<a>-<b>        has a tempo in the range
+ *   meta=<type>        has a meta event of the type, a number or one of
+ *                      text, copyright, name, instrument, lyrics, marker,
+ *                      cue, tempo, time, key
+ *
+ * Files are taken as given or from below directories, archives member by
+ * member. The pack is then given to the batch tools like any archive:
+ *
+ *   midi2score -o scores.tar corpus.mpk
+ */
+
+#define PACK_MAX_OPEN_DIRS      16
+#define PACK_FILE_MAX           (256 * 1024 * 1024)
+#define PACK_DEFAULT_TEMPO      500000
+#define PACK_DRUM_CHANNEL       9
+
+static struct {
+    pack_t *    pack;
+    uint8_t *   buf;        // Contents of a plain file
+    size_t      cap;
+    uint32_t    files;
+    int         failed;
+} options;
+
+// Names in the pack are relative, like archive members
+static const char *pack_name(const char *path)
+{
+    const char *base = strrchr(path, '/');
+
+    while (path[0] == '/' || strncmp(path, "./", 2) == 0) {
+        path += path[0] == '/' ? 1 : 2;
+    }
+
+    return strstr(path, "..") ? (base ? base + 1 : path) : path;
+}
+
+static int read_file(const char *path, size_t *size)
+{
+    FILE *fp = zfile_open(path);
+    size_t n;
+
+    if (fp == NULL) {
+        return errno;
+    }
+
+    *size = 0;
+    do {
+        if (*size == options.cap) {
+            size_t cap = options.cap ? options.cap * 2 : 64 * 1024;
+            uint8_t *buf = cap <= PACK_FILE_MAX ? realloc(options.buf, cap) : NULL;
+
+            if (buf == NULL) {
+                fclose(fp);
+                return cap <= PACK_FILE_MAX ? ENOMEM : EFBIG;
+            }
+            options.buf = buf;
+            options.cap = cap;
+        }
+        n = fread(options.buf + *size, 1, options.cap - *size, fp);
+        *size += n;
+    } while (n > 0);
+
+    fclose(fp);
+
+    return 0;
+}
+
+static void features_track(midi_track_t *track, pack_features_t *f, uint8_t *program, bool *tempo)
+{
+    midi_iter_track(track);
+    while (midi_track_has_next(track)) {
+        midi_event_t *event = midi_track_next(track);
+
+        if (event->type == MIDI_EVENT_TYPE_META) {
+            f->metas |= pack_meta_bit(event->cmd);
+            if (event->cmd == MIDI_META_TEMPO_CHANGE && event->size >= 3) {
+                uint32_t us = event->data[0] << 16 | event->data[1] << 8 | event->data[2];
+
+                f->tempo_min = (*tempo && f->tempo_min < us) ? f->tempo_min : us;
+                f->tempo_max = (*tempo && f->tempo_max > us) ? f->tempo_max : us;
+                *tempo = true;
+            }
+        } else if (event->type == MIDI_EVENT_TYPE_EVENT) {
+            if (event->cmd == MIDI_EVENT_PROGRAM_CHANGE) {
+                program[event->chan] = event->data[0] & 0x7F;
+            } else if (event->cmd == MIDI_EVENT_NOTE_ON && event->data[1]) {
+                uint8_t p = program[event->chan];
+
+                f->channels |= 1 << event->chan;
+                f->pitch_lo = event->data[0] < f->pitch_lo ? event->data[0] : f->pitch_lo;
+                f->pitch_hi = event->data[0] > f->pitch_hi ? event->data[0] : f->pitch_hi;
+                if (event->chan != PACK_DRUM_CHANNEL) {
+                    f->programs[p >> 6] |= 1ull << (p & 63);
+                }
+            }
+        }
+    }
+}
+
+// Features of the file in data, false if it can't be parsed
+static bool features(const uint8_t *data, size_t size, pack_features_t *f)
+{
+    uint8_t program[16] = { 0 };
+    bool tempo = false;
+    midi_t *midi;
+
+    if (midi_open_mem(data, size, &midi) != 0) {
+        return false;
+    }
+
+    memset(f, 0, sizeof(*f));
+    f->pitch_lo = 255;
+
+    for (int i = 0; i < midi->hdr.tracks; ++i) {
+        midi_track_t *track = midi_get_track(midi, i);
+
+        if (track == NULL) {
+            midi_close(midi);
+            return false;
+        }
+        features_track(track, f, program, &tempo);
+        midi_free_track(track);
+    }
+
+    if (!tempo) {
+        f->tempo_min = f->tempo_max = PACK_DEFAULT_TEMPO;
+    }
+
+    midi_close(midi);
+
+    return true;
+}
+
+static void pack_path(const char *path)
+{
+    corpus_t corpus;
+    corpus_entry_t entry;
+    char *paths[] = { (char *)path };
+
+    corpus_init(&corpus, paths, 1);
+    while (corpus_next(&corpus, &entry)) {
+        const uint8_t *data = entry.data;
+        size_t size = entry.size;
+        int status = entry.status;
+        char name[1024];
+
+        snprintf(name, sizeof(name), "%s", entry.name);
+        if (status == 0 && data == NULL) {
+            status = read_file(entry.name, &size);
+            data = options.buf;
+            // Packed decompressed, under the name the readers look for
+            name[strlen(name) - corpus_compressed_suffix(name)] = '\0';
+        }
+        if (status == 0) {
+            pack_features_t f;
+
+            status = pack_add(options.pack, pack_name(name), data, size, features(data, size, &f) ? &f : NULL);
+        }
+
+        if (status) {
+            if (entry.archive) {
+                fprintf(stderr, "Failed to pack %s in %s: %s\n", entry.name, entry.archive, strerror(status));
+            } else {
+                fprintf(stderr, "Failed to pack %s: %s\n", entry.name, strerror(status));
+            }
+            options.failed++;
+        } else {
+            options.files++;
+        }
+    }
+    corpus_close(&corpus);
+}
+
+static int walk_entry(const char *path, const struct stat *sb, int type, struct FTW *ftw)
+{
+    (void)sb;
+    (void)ftw;
+
+    if (type == FTW_F && corpus_is_midi_file(path)) {
+        pack_path(path);
+    }
+
+    return 0;
+}
+
+static const struct {
+    const char *    name;
+    uint8_t         type;
+} meta_names[] = {
+    { "text",       MIDI_META_TEXT_EVNT },
+    { "copyright",  MIDI_META_COPYRIGHT_NOTICE },
+    { "name",       MIDI_META_SEQUENCE_NAME },
+    { "instrument", MIDI_META_INSTRUMENT_NAME },
+    { "lyrics",     MIDI_META_LYRICS },
+    { "marker",     MIDI_META_MARKER },
+    { "cue",        MIDI_META_CUE_POINT },
+    { "tempo",      MIDI_META_TEMPO_CHANGE },
+    { "time",       MIDI_META_TIME_SIGNATURE },
+    { "key",        MIDI_META_KEY_SIGNATURE },
+};
+
+// "<a>" or "<a>-<b>", each in 0 - max
+static bool parse_range(const char *s, unsigned long max, unsigned long *a, unsigned long *b)
+{
+    char *end;
+
+    *a = strtoul(s, &end, 10);
+    *b = *a;
+    if (*end == '-') {
+        *b = strtoul(end + 1, &end, 10);
+    }
+
+    return end != s && *end == '\0' && *a <= *b && *b <= max;
+}
+
+static bool parse_query(char *text, pack_query_t *query)
+{
+    pack_query_init(query);
+
+    for (char *term = strtok(text, ","); term != NULL; term = strtok(NULL, ",")) {
+        char *value = strchr(term, '=');
+        unsigned long a, b;
+
+        if (value == NULL) {
+            return false;
+        }
+        *value++ = '\0';
+
+        if (!strcmp(term, "chan") && parse_range(value, 15, &a, &b) && a == b) {
+            query->channels |= 1 << a;
+        } else if (!strcmp(term, "prog") && parse_range(value, 127, &a, &b)) {
+            for (unsigned long p = a; p <= b; ++p) {
+                query->programs[p >> 6] |= 1ull << (p & 63);
+            }
+        } else if (!strcmp(term, "pitch") && parse_range(value, 127, &a, &b)) {
+            query->pitch_lo = a;
+            query->pitch_hi = b;
+        } else if (!strcmp(term, "bpm") && parse_range(value, 60000000, &a, &b) && a > 0) {
+            // Faster is fewer us per quarter note
+            query->tempo_min = 60000000 / b;
+            query->tempo_max = 60000000 / a;
+        } else if (!strcmp(term, "meta")) {
+            size_t i = 0;
+
+            while (i < sizeof(meta_names) / sizeof(meta_names[0]) && strcmp(value, meta_names[i].name)) {
+                i++;
+            }
+            if (i < sizeof(meta_names) / sizeof(meta_names[0])) {
+                query->metas |= pack_meta_bit(meta_names[i].type);
+            } else if (parse_range(value, 127, &a, &b) && a == b) {
+                query->metas |= pack_meta_bit(a);
+            } else {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void print_summary(const pack_summary_t *summary, void *arg)
+{
+    const uint8_t *match = arg;
+
+    if (match != NULL && !match[summary->index]) {
+        return;
+    }
+
+    printf("%12llu %8u  format %u, %3u tracks, division %5u  %s\n", (unsigned long long)summary->offset,
+            summary->size, summary->format, summary->tracks, summary->division, summary->name);
+}
+
+static int list(const char *file, char *query_text)
+{
+    pack_sketch_t sketch;
+    pack_query_t query;
+    uint8_t *match = NULL;
+    uint32_t count = 0;
+    int status = 0;
+
+    if (query_text != NULL) {
+        if (!parse_query(query_text, &query)) {
+            fprintf(stderr, "Bad query\n");
+            return 1;
+        }
+
+        // Members are picked from the sketch, the directory only names them
+        status = pack_sketch_read(file, &sketch);
+        if (status == 0) {
+            match = malloc(sketch.count ? sketch.count : 1);
+            status = match ? 0 : ENOMEM;
+        }
+        if (status == 0) {
+            count = pack_query_run(&sketch, &query, match);
+        }
+        pack_sketch_free(&sketch);
+    }
+
+    if (status == 0 && (match == NULL || count > 0)) {
+        status = pack_list(file, print_summary, match);
+    }
+    free(match);
+
+    if (status) {
+        fprintf(stderr, "Failed to list %s: %s\n", file, strerror(status));
+        return 1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *out_file = NULL;
+    const char *list_file = NULL;
+    char *query_text = NULL;
+    struct stat sb;
+    int status;
+    int opt_char;
+
+    while ((opt_char = getopt(argc, argv, "o:l:q:")) != -1) {
+        switch (opt_char) {
+            case 'o':
+                out_file = optarg;
+                break;
+            case 'l':
+                list_file = optarg;
+                break;
+            case 'q':
+                query_text = optarg;
+                break;
+            default:
+                argc = 0;
+                break;
+        }
+    }
+
+    if ((out_file == NULL) == (list_file == NULL) || (out_file != NULL && optind >= argc)
+            || (list_file != NULL && optind != argc) || (query_text != NULL && list_file == NULL)) {
+        fprintf(stderr, "Usage: %s -o corpus.mpk filename.mid|archive|directory ...\n"
+                "       %s -l corpus.mpk [-q query]\n\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    if (list_file != NULL) {
+        return list(list_file, query_text);
+    }
+
+    options.pack = pack_create(out_file);
+    if (options.pack == NULL) {
+        fprintf(stderr, "Failed to create %s: %s\n", out_file, strerror(errno));
+        return 1;
+    }
+
+    for (int i = optind; i < argc; ++i) {
+        if (stat(argv[i], &sb) == 0 && S_ISDIR(sb.st_mode)) {
+            nftw(argv[i], walk_entry, PACK_MAX_OPEN_DIRS, FTW_PHYS);
+        } else {
+            pack_path(argv[i]);
+        }
+    }
+
+    status = pack_close(options.pack);
+    free(options.buf);
+    if (status) {
+        fprintf(stderr, "Failed to write %s: %s\n", out_file, strerror(status));
+        return 1;
+    }
+
+    printf("%s: %u files\n", out_file, options.files);
+
+    return options.failed ? 1 : 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "midi.h"
+#include "stream.h"
+#include "synth.h"
+
+/**
+ * Render midi files to WAV previews with the built-in synth.
+ *
+ * Each file is rendered on its own thread (one per core by default) into
+ * <file>.wav as 16-bit mono PCM.
+ */
+
+#define RENDER_RATE         44100
+#define RENDER_TAIL_SECONDS 3           // Longest release tail after the last event
+#define RENDER_BUFFER       4096        // Frames per fwrite()
+
+typedef struct {
+    char **         files;
+    int             count;
+    int             next;
+    int             failed;
+    uint32_t        rate;
+    pthread_mutex_t lock;
+} render_jobs_t;
+
+static int midi_render(const char *midi_file, uint32_t rate);
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+}
+
+/**
+ * RIFF / WAVE header for 16-bit mono PCM
+ */
+static void wav_header(uint8_t hdr[44], uint32_t rate, uint32_t frames)
+{
+    uint32_t data = frames * 2;
+
+    memcpy(hdr + 0, "RIFF", 4);
+    put_le32(hdr + 4, 36 + data);
+    memcpy(hdr + 8, "WAVE", 4);
+    memcpy(hdr + 12, "fmt ", 4);
+    put_le32(hdr + 16, 16);
+    put_le16(hdr + 20, 1);          // PCM
+    put_le16(hdr + 22, 1);          // Mono
+    put_le32(hdr + 24, rate);
+    put_le32(hdr + 28, rate * 2);   // Bytes per second
+    put_le16(hdr + 32, 2);          // Block align
+    put_le16(hdr + 34, 16);         // Bits per sample
+    memcpy(hdr + 36, "data", 4);
+    put_le32(hdr + 40, data);
+}
+
+// Returns 0 or a POSIX errno
+static int render_frames(synth_t *synth, FILE *fp, int16_t *buf, uint64_t frames)
+{
+    while (frames > 0) {
+        uint32_t n = frames < RENDER_BUFFER ? frames : RENDER_BUFFER;
+
+        synth_render(synth, buf, n);
+        for (uint32_t i = 0; i < n; ++i) {
+            uint8_t *p = (uint8_t *)&buf[i];
+            uint16_t v = (uint16_t)buf[i];
+
+            put_le16(p, v);
+        }
+        if (fwrite(buf, sizeof *buf, n, fp) != n) {
+            return errno ? errno : EIO;
+        }
+        frames -= n;
+    }
+
+    return 0;
+}
+
+static int midi_render(const char *midi_file, uint32_t rate)
+{
+    midi_t *midi;
+    midi_stream_t *stream;
+    midi_event_t *event;
+    synth_t *synth;
+    int16_t *buf;
+    uint8_t hdr[44];
+    char file_name[1024];
+    FILE *fp;
+    uint32_t tempo = 500000;
+    uint32_t tick, last_tick = 0;
+    uint64_t time = 0;          // Elapsed time in us * ppq
+    uint64_t frames = 0;        // Frames written
+    int err = 0;                // Write error
+    int status;
+
+    status = midi_open(midi_file, &midi);
+
+    if (status) {
+        fprintf(stderr, "Failed open midi file %s: %s\n", midi_file, strerror(status));
+        return 1;
+    }
+
+    if (midi->ppq == 0) {
+        fprintf(stderr, "Invalid division in %s\n", midi_file);
+        midi_close(midi);
+        return 1;
+    }
+
+    stream = midi_stream_open(midi);
+    if (stream == NULL) {
+        fprintf(stderr, "Failed to read tracks of %s: %s\n", midi_file, midi_get_errmsg(midi));
+        midi_close(midi);
+        return 1;
+    }
+
+    snprintf(file_name, sizeof(file_name), "%s.wav", midi_file);
+    fp = fopen(file_name, "wb");
+    synth = malloc(sizeof *synth);
+    buf = malloc(RENDER_BUFFER * sizeof *buf);
+
+    if (fp == NULL || synth == NULL || buf == NULL) {
+        fprintf(stderr, "Failed to create %s\n", file_name);
+        status = 1;
+        goto cleanup;
+    }
+
+    synth_init(synth, rate);
+
+    // Sizes are patched once the length is known
+    wav_header(hdr, rate, 0);
+    if (fwrite(hdr, sizeof(hdr), 1, fp) != 1) {
+        err = errno ? errno : EIO;
+    }
+
+    while (err == 0 && midi_stream_has_next(stream)) {
+        uint64_t target;
+
+        event = midi_stream_next(stream, &tick, NULL);
+
+        time += (uint64_t)(tick - last_tick) * tempo;
+        last_tick = tick;
+
+        target = time * rate / ((uint64_t)midi->ppq * 1000000);
+        if (target > frames) {
+            err = render_frames(synth, fp, buf, target - frames);
+            frames = target;
+        }
+
+        if (event->type == MIDI_EVENT_TYPE_META) {
+            if (event->cmd == MIDI_META_TEMPO_CHANGE && event->size >= 3) {
+                tempo = event->data[0] << 16 | event->data[1] << 8 | event->data[2];
+            }
+            continue;
+        }
+
+        switch (event->cmd) {
+            case MIDI_EVENT_NOTE_ON:
+                synth_note_on(synth, event->chan, event->data[0], event->data[1]);
+                break;
+            case MIDI_EVENT_NOTE_OFF:
+                synth_note_off(synth, event->chan, event->data[0]);
+                break;
+            case MIDI_EVENT_CONTROL_CHANGE:
+                synth_control(synth, event->chan, event->data[0], event->data[1]);
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Let the voices ring out
+    for (int i = 0; i < 16; ++i) {
+        synth_control(synth, i, MIDI_CTRL_HOLD_PEDAL, 0);
+        synth_control(synth, i, MIDI_CTRL_ALL_NOTES_OFF, 0);
+    }
+    for (uint32_t left = rate * RENDER_TAIL_SECONDS; err == 0 && left > 0 && synth_active(synth) > 0; ) {
+        uint32_t n = left < SYNTH_BLOCK ? left : SYNTH_BLOCK;
+
+        err = render_frames(synth, fp, buf, n);
+        frames += n;
+        left -= n;
+    }
+
+    wav_header(hdr, rate, frames);
+    if (err == 0 && fseek(fp, 0, SEEK_SET) != 0) {
+        err = errno;
+    }
+    if (err == 0 && fwrite(hdr, sizeof(hdr), 1, fp) != 1) {
+        err = errno ? errno : EIO;
+    }
+    status = 0;
+
+cleanup:
+    if (fp != NULL && fclose(fp) != 0 && err == 0) {
+        err = errno;
+    }
+    if (err) {
+        // A cut short file would claim the full length
+        fprintf(stderr, "Failed to write %s: %s\n", file_name, strerror(err));
+        remove(file_name);
+        status = 1;
+    }
+    free(buf);
+    free(synth);
+    midi_stream_close(stream);
+    midi_close(midi);
+
+    return status;
+}
+
+static void *render_worker(void *arg)
+{
+    render_jobs_t *jobs = arg;
+
+    for (;;) {
+        int i;
+
+        pthread_mutex_lock(&jobs->lock);
+        i = jobs->next++;
+        pthread_mutex_unlock(&jobs->lock);
+
+        if (i >= jobs->count) {
+            break;
+        }
+
+        if (midi_render(jobs->files[i], jobs->rate)) {
+            pthread_mutex_lock(&jobs->lock);
+            jobs->failed++;
+            pthread_mutex_unlock(&jobs->lock);
+        }
+    }
+
+    return NULL;
+}
+
+int main(int argc, char**argv)
+{
+    render_jobs_t jobs;
+    pthread_t *threads;
+    long threads_n = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+
+    memset(&jobs, 0, sizeof(jobs));
+    jobs.rate = RENDER_RATE;
+
+    while ((opt = getopt(argc, argv, "r:j:")) != -1) {
+        switch (opt) {
+            case 'r':
+                jobs.rate = strtoul(optarg, NULL, 10);
+                break;
+            case 'j':
+                threads_n = strtol(optarg, NULL, 10);
+                break;
+            default:
+                jobs.rate = 0;
+                break;
+        }
+    }
+
+    if (optind >= argc || jobs.rate == 0) {
+        fprintf(stderr, "Usage: %s [-r rate] [-j jobs] filename.mid ...\n\n", argv[0]);
+        return 1;
+    }
+
+    jobs.files = &argv[optind];
+    jobs.count = argc - optind;
+    pthread_mutex_init(&jobs.lock, NULL);
+
+    if (threads_n < 1) {
+        threads_n = 1;
+    }
+    if (threads_n > jobs.count) {
+        threads_n = jobs.count;
+    }
+
+    threads = calloc(threads_n, sizeof *threads);
+    if (threads == NULL) {
+        return 1;
+    }
+
+    for (long i = 0; i < threads_n; ++i) {
+        if (pthread_create(&threads[i], NULL, render_worker, &jobs) != 0) {
+            threads_n = i;
+            break;
+        }
+    }
+    // Without any thread the files are rendered here
+    if (threads_n == 0) {
+        render_worker(&jobs);
+    }
+    for (long i = 0; i < threads_n; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    free(threads);
+    pthread_mutex_destroy(&jobs.lock);
+
+    return jobs.failed ? 1 : 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
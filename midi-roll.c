@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+#include "midi.h"
+#include "corpus.h"
+#include "timeline.h"
+#include "roll.h"
+
+/**
+ * Render piano roll thumbnails.
+ *
+ * Every midi file given, or found below a directory given, is drawn into
+ * <file>.ppm (or <file>.png with -p, in builds with zlib). With -t each
+ * tile is written to its own file <file>.<x>_<y>.ppm instead.
+ *
+ * The midi members of tar, zip and midi-pack archives are drawn from memory,
+ * into <member>.ppm below the current directory.
+ */
+
+#define ROLL_WIDTH              1024
+#define ROLL_HEIGHT             256
+#define ROLL_MAX_OPEN_DIRS      16
+
+#ifdef MIDI_HAVE_ZLIB
+#define ROLL_OPT_PNG            "p"
+#define ROLL_USAGE_PNG          " [-p]"
+#else
+#define ROLL_OPT_PNG            ""
+#define ROLL_USAGE_PNG          ""
+#endif
+
+static struct {
+    uint32_t    width;
+    uint32_t    height;
+    int         threads;
+    bool        png;
+    bool        tiles;
+    int         failed;
+} options;
+
+// Drawing pass over the notes, stopped by the first error
+typedef struct {
+    roll_t *    roll;
+    int         status;
+} roll_pass_t;
+
+static void add_note(const midi_note_t *note, void *arg)
+{
+    roll_pass_t *pass = arg;
+
+    if (pass->status == 0) {
+        pass->status = roll_add_note(pass->roll, note);
+    }
+}
+
+static int write_image(roll_t *roll, const char *midi_file, int tile_x, int tile_y)
+{
+    const char *ext = options.png ? "png" : "ppm";
+    char file_name[1024];
+
+    if (tile_x < 0) {
+        snprintf(file_name, sizeof(file_name), "%s.%s", midi_file, ext);
+    } else {
+        snprintf(file_name, sizeof(file_name), "%s.%d_%d.%s", midi_file, tile_x, tile_y, ext);
+    }
+
+#ifdef MIDI_HAVE_ZLIB
+    if (options.png) {
+        return roll_write_png(roll, file_name, tile_x, tile_y);
+    }
+#endif
+
+    return roll_write_ppm(roll, file_name, tile_x, tile_y);
+}
+
+// Create the directories of path, for images of archive members
+static int make_dirs(const char *path)
+{
+    char dir[1024];
+
+    snprintf(dir, sizeof(dir), "%s", path);
+    for (char *p = strchr(dir + 1, '/'); p != NULL; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+            return errno;
+        }
+        *p = '/';
+    }
+
+    return 0;
+}
+
+// Draw midi_file, read from data (size bytes) when not NULL
+static int midi_roll(const char *midi_file, const void *data, size_t size)
+{
+    midi_t *midi;
+    midi_track_t *track;
+    roll_t *roll;
+    roll_pass_t pass;
+    uint32_t ticks = 0;
+    uint8_t key_lo = 127, key_hi = 0;
+    int status;
+
+    status = data ? midi_open_mem(data, size, &midi) : midi_open(midi_file, &midi);
+
+    if (status) {
+        fprintf(stderr, "Failed open midi file %s: %s\n", midi_file, strerror(status));
+        return 1;
+    }
+
+    /**
+     * First pass: length and key range, one track in memory at a time
+     */
+    for (int i = 0; i < midi->hdr.tracks; ++i) {
+        uint32_t tick = 0;
+
+        track = midi_get_track(midi, i);
+        if (track == NULL) {
+            fprintf(stderr, "Failed to read track %d of %s: %s\n", i, midi_file, midi_get_errmsg(midi));
+            midi_close(midi);
+            return 1;
+        }
+
+        midi_iter_track(track);
+        while (midi_track_has_next(track)) {
+            midi_event_t *event = midi_track_next(track);
+
+            tick += event->delta_time;
+            if (event->type == MIDI_EVENT_TYPE_EVENT && event->cmd == MIDI_EVENT_NOTE_ON && event->data[1]) {
+                key_lo = event->data[0] < key_lo ? event->data[0] : key_lo;
+                key_hi = event->data[0] > key_hi ? event->data[0] : key_hi;
+            }
+        }
+        ticks = tick > ticks ? tick : ticks;
+
+        midi_free_track(track);
+    }
+
+    if (key_lo > key_hi) {
+        // No notes, draw an empty middle octave
+        key_lo = 60;
+        key_hi = 71;
+    }
+
+    roll = roll_new(options.width, options.height, ticks, key_lo, key_hi, options.threads);
+    if (roll == NULL) {
+        midi_close(midi);
+        return 1;
+    }
+
+    /**
+     * Second pass: draw
+     */
+    pass.roll = roll;
+    pass.status = 0;
+    for (int i = 0; i < midi->hdr.tracks && pass.status == 0; ++i) {
+        track = midi_get_track(midi, i);
+        if (track == NULL) {
+            continue;
+        }
+        midi_track_notes(track, add_note, &pass);
+        midi_free_track(track);
+    }
+
+    status = pass.status ? pass.status : roll_flush(roll);
+    if (status == 0 && data != NULL) {
+        status = make_dirs(midi_file);
+    }
+
+    if (status == 0 && options.tiles) {
+        for (uint32_t y = 0; y < roll->tiles_y && status == 0; ++y) {
+            for (uint32_t x = 0; x < roll->tiles_x && status == 0; ++x) {
+                status = write_image(roll, midi_file, x, y);
+            }
+        }
+    } else if (status == 0) {
+        status = write_image(roll, midi_file, -1, -1);
+    }
+
+    if (status) {
+        fprintf(stderr, "Failed to write piano roll of %s: %s\n", midi_file, strerror(status));
+    }
+
+    roll_free(roll);
+    midi_close(midi);
+
+    return status ? 1 : 0;
+}
+
+static int walk_entry(const char *path, const struct stat *sb, int type, struct FTW *ftw)
+{
+    (void)sb;
+    (void)ftw;
+
+    if (type == FTW_F && corpus_is_midi_file(path)) {
+        options.failed += midi_roll(path, NULL, 0);
+    }
+
+    return 0;
+}
+
+// A file, or the midi members of an archive
+static void roll_path(const char *path)
+{
+    corpus_t corpus;
+    corpus_entry_t entry;
+    char *paths[] = { (char *)path };
+
+    corpus_init(&corpus, paths, 1);
+    while (corpus_next(&corpus, &entry)) {
+        if (entry.status) {
+            fprintf(stderr, "Failed to read %s: %s\n", entry.name, strerror(entry.status));
+            options.failed++;
+        } else {
+            options.failed += midi_roll(entry.name, entry.data, entry.size);
+        }
+    }
+    corpus_close(&corpus);
+}
+
+int main(int argc, char**argv)
+{
+    struct stat sb;
+    int opt;
+
+    options.width = ROLL_WIDTH;
+    options.height = ROLL_HEIGHT;
+    options.threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    while ((opt = getopt(argc, argv, "w:h:j:t" ROLL_OPT_PNG)) != -1) {
+        switch (opt) {
+            case 'w':
+                options.width = strtoul(optarg, NULL, 10);
+                break;
+            case 'h':
+                options.height = strtoul(optarg, NULL, 10);
+                break;
+            case 'j':
+                options.threads = strtol(optarg, NULL, 10);
+                break;
+            case 'p':
+                options.png = true;
+                break;
+            case 't':
+                options.tiles = true;
+                break;
+            default:
+                options.width = 0;
+                break;
+        }
+    }
+
+    if (optind >= argc || options.width == 0 || options.height == 0) {
+        fprintf(stderr, "Usage: %s [-w width] [-h height] [-j jobs]" ROLL_USAGE_PNG " [-t] filename.mid|directory|archive ...\n\n", argv[0]);
+        return 1;
+    }
+
+    for (int i = optind; i < argc; ++i) {
+        if (stat(argv[i], &sb) == 0 && S_ISDIR(sb.st_mode)) {
+            nftw(argv[i], walk_entry, ROLL_MAX_OPEN_DIRS, FTW_PHYS);
+        } else {
+            roll_path(argv[i]);
+        }
+    }
+
+    return options.failed ? 1 : 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
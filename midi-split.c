@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "midi.h"
+#include "smf.h"
+
+/**
+ * Split the tracks of midi files into files of their own, without decoding
+ * a single event: the track chunks are located through the track index
+ * and copied byte for byte by the kernel (midi_copy_track_chunk), behind a
+ * new header:
+ *
+ *   midi-split -t 1,3-4 a.mid
+ *
+ * writes a.mid.track1.mid, a.mid.track3.mid and a.mid.track4.mid. Tracks
+ * are numbered from 0, as midi-dump shows them, all but the conductor by
+ * default.
+ *
+ * A track of a format 1 file gets the conductor track (0) before it, for
+ * its tempo and signatures. The tracks of a format 2 file are songs of
+ * their own, each becomes a format 0 file.
+ */
+
+#define SPLIT_MAX_TRACKS    256
+
+// Parse "1,3-5" into tracks, false if malformed
+static bool parse_tracks(const char *list, bool *tracks)
+{
+    const char *p = list;
+
+    while (*p) {
+        char *end;
+        unsigned long from = strtoul(p, &end, 10);
+        unsigned long to = from;
+
+        if (end == p) {
+            return false;
+        }
+        if (*end == '-') {
+            p = end + 1;
+            to = strtoul(p, &end, 10);
+            if (end == p) {
+                return false;
+            }
+        }
+        if (from > to || to >= SPLIT_MAX_TRACKS || (*end != ',' && *end != '\0')) {
+            return false;
+        }
+        for (unsigned long t = from; t <= to; ++t) {
+            tracks[t] = true;
+        }
+        p = *end ? end + 1 : end;
+    }
+
+    return true;
+}
+
+static int split_track(const char *midi_file, const midi_t *midi, uint8_t track)
+{
+    bool songs = midi->hdr.format == MIDI_FORMAT_SONGS;
+    bool conductor = !songs && track != 0;
+    uint16_t format = songs ? MIDI_FORMAT_SINGLE : MIDI_FORMAT_MULTI;
+    uint16_t tracks = conductor ? 2 : 1;
+    char out_name[1024];
+    int status;
+    int out;
+
+    snprintf(out_name, sizeof(out_name), "%s.track%u.mid", midi_file, track);
+    out = open(out_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (out < 0) {
+        return errno;
+    }
+
+    status = smf_write_header(out, format, tracks, midi->hdr.division);
+    if (status == 0 && conductor) {
+        status = midi_copy_track_chunk(midi, 0, out);
+    }
+    if (status == 0) {
+        status = midi_copy_track_chunk(midi, track, out);
+    }
+
+    if (close(out) != 0 && status == 0) {
+        status = errno;
+    }
+    if (status) {
+        unlink(out_name);
+    }
+
+    return status;
+}
+
+static int split_file(const char *midi_file, const bool *selected, bool all)
+{
+    midi_t *midi;
+    int failed = 0;
+    int status;
+
+    status = midi_open(midi_file, &midi);
+    if (status) {
+        fprintf(stderr, "Failed to open %s: %s\n", midi_file, strerror(status));
+        return 1;
+    }
+
+    if (midi->hdr.tracks < 2) {
+        fprintf(stderr, "%s has a single track, nothing to split\n", midi_file);
+    }
+
+    for (int t = 0; t < midi->hdr.tracks && t < SPLIT_MAX_TRACKS && midi->hdr.tracks > 1; ++t) {
+        bool pick = all ? (t != 0 || midi->hdr.format == MIDI_FORMAT_SONGS) : selected[t];
+
+        if (!pick) {
+            continue;
+        }
+
+        status = split_track(midi_file, midi, t);
+        if (status) {
+            fprintf(stderr, "Failed to split track %d of %s: %s\n", t, midi_file, strerror(status));
+            failed++;
+        }
+    }
+
+    midi_close(midi);
+
+    return failed;
+}
+
+int main(int argc, char **argv)
+{
+    bool selected[SPLIT_MAX_TRACKS] = { false };
+    bool all = true;
+    bool usage = false;
+    int failed = 0;
+    int opt_char;
+
+    while ((opt_char = getopt(argc, argv, "t:")) != -1) {
+        switch (opt_char) {
+            case 't':
+                all = false;
+                usage = !parse_tracks(optarg, selected);
+                break;
+            default:
+                usage = true;
+                break;
+        }
+    }
+
+    if (optind >= argc || usage) {
+        fprintf(stderr, "Usage: %s [-t tracks] filename.mid ...\n\n", argv[0]);
+        return 1;
+    }
+
+    for (int i = optind; i < argc; ++i) {
+        failed += split_file(argv[i], selected, all);
+    }
+
+    return failed ? 1 : 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
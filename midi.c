@@ -4,14 +4,61 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/sendfile.h>
 
 #include "midi.h"
+#include "zfile.h"
 
 #define DEBUG       0
 
+#define MIDI_CHUNK_STEP     (64 * 1024)     // Track bytes read at a time
+#define MIDI_RESYNC_MAX     (1024 * 1024)   // Bytes searched for a misplaced track header
+
+#define MIDI_SPLIT_STEP     (256 * 1024)    // Chunk bytes per segment of a parallel decode
+#define MIDI_SPLIT_MIN      (1024 * 1024)   // Smaller chunks are decoded serially
+
+#define MIDI_FNV_OFFSET     0xcbf29ce484222325ULL
+#define MIDI_FNV_PRIME      0x100000001b3ULL
+
 const uint8_t MIDI_HEADER_MAGIC[] = { 'M', 'T', 'h', 'd' };
 const uint8_t MIDI_TRACK_MAGIC[]  = { 'M', 'T', 'r', 'k' };
 
+typedef struct {
+    const uint8_t * buf;        // Track chunk data
+    uint32_t        size;
+    uint32_t        pos;
+    uint8_t         running;    // Running status
+    bool            resync;     // Next event starts at its status byte, no delta time
+} midi_reader_t;
+
+// Where a segment of a parallel decode starts: an event start, and the running status there
+typedef struct {
+    uint32_t        pos;
+    uint8_t         running;
+} midi_split_t;
+
+typedef struct {
+    midi_event_node_t * head;
+    midi_event_node_t * tail;
+    uint32_t            events;
+    uint32_t            ticks;      // Sum of the delta times
+    int                 err;
+} midi_segment_t;
+
+typedef struct {
+    const midi_t *          midi;
+    const uint8_t *         buf;
+    uint32_t                size;
+    const midi_split_t *    splits;
+    midi_segment_t *        segs;
+    uint32_t                count;
+    uint32_t                next;       // Next segment to take
+    bool                    rebase;     // Second pass: add the tick of the segment start
+    pthread_mutex_t         lock;
+} midi_decode_job_t;
+
 static inline uint16_t btol_16(const uint16_t n)
 {
     return ((n >> 8) | (n << 8));
@@ -24,18 +71,26 @@ static inline uint32_t btol_32(const uint32_t n)
 
 static bool midi_parse_hdr(midi_t *const);
 static bool midi_parse_track(const midi_t *const midi, midi_track_t *);
+static uint8_t *midi_read_chunk(FILE *fp, uint32_t size, size_t *got);
 static bool midi_parse_track_hdr(const midi_t *const, midi_track_hdr_t *);
+static bool midi_seek_track(const midi_t *const midi, uint8_t track_idx);
 static void midi_set_error(midi_t *, int, const char *const, ...);
 static void midi_prefix_errmsg(midi_t *, const char *const, ...);
 
 static bool midi_check_magic(const uint8_t *const, const uint8_t *const, const size_t);
 
+static int midi_open_stream(FILE *file, midi_t **midi);
 static uint16_t midi_parse_division(const midi_hdr_t *const);
-static inline midi_event_node_t * midi_parse_event(const midi_t *const, unsigned int * const bytes);
-static inline uint32_t midi_parse_delta_time(FILE * file, unsigned int * const bytes);
+static inline midi_event_node_t *midi_decode_event(const midi_t *const, midi_reader_t *rd, int *err);
+static void midi_track_damage(midi_track_t *trk, uint32_t offset, uint32_t size);
+static uint32_t midi_resync(const midi_reader_t *rd, uint32_t from);
+static inline bool midi_read_vlq(midi_reader_t *rd, uint32_t *value);
+static int midi_decode_parallel(const midi_t *const midi, midi_track_t *trk, const uint8_t *buf, uint32_t size);
 
 /**
- * Open a midi file given by the midi_file parameter.
+ * Open a midi file given by the midi_file parameter. gzip and zstd
+ * compressed files are read transparently when support is compiled in
+ * (MIDI_HAVE_ZLIB, MIDI_HAVE_ZSTD).
  *
  * On success, 0 is returned and *midi = a (midi_t *) handle to the opened midi
  * file. On error, a POSIX errno is returned and *midi is NULL;
@@ -45,15 +100,40 @@ static inline uint32_t midi_parse_delta_time(FILE * file, unsigned int * const b
 int midi_open(const char *const midi_file, midi_t **midi)
 {
     FILE *file = NULL;
-    int status;
 
     *midi = NULL;
 
-    file = fopen(midi_file, "r");
+    // Plain, or compressed and decompressed on the fly (see zfile.h)
+    file = zfile_open(midi_file);
+    if (file == NULL) {
+        return errno;
+    }
+
+    return midi_open_stream(file, midi);
+}
+
+/**
+ * Open a midi file held in memory, e.g. an archive member. buf must stay
+ * valid until midi_close().
+ */
+int midi_open_mem(const void *buf, size_t size, midi_t **midi)
+{
+    FILE *file = NULL;
+
+    *midi = NULL;
+
+    file = fmemopen((void *)buf, size, "r");
     if (file == NULL) {
         return errno;
     }
 
+    return midi_open_stream(file, midi);
+}
+
+static int midi_open_stream(FILE *file, midi_t **midi)
+{
+    int status;
+
     *midi = calloc(sizeof **midi, 1);
 
     if (*midi == NULL) {
@@ -62,9 +142,11 @@ int midi_open(const char *const midi_file, midi_t **midi)
     }
 
     (*midi)->midi_file = file;
+    (*midi)->jobs = 1;
 
     if (!midi_parse_hdr(*midi)) {
         midi_close(*midi);
+        *midi = NULL;
 
         return EINVAL;
     }
@@ -74,13 +156,26 @@ int midi_open(const char *const midi_file, midi_t **midi)
     // Just in case there are additional bytes in the header?
     status = fseek((*midi)->midi_file, (*midi)->hdr.length - (MIDI_HEADER_SIZE - 4 - 4), SEEK_CUR);
 
-    if (status != -1) {
-        (*midi)->trk_offset = ftell((*midi)->midi_file);
+    if (status == -1) {
+        status = errno;
+        midi_close(*midi);
+        *midi = NULL;
+
+        return status;
+    }
+
+    (*midi)->trk_offset = ftell((*midi)->midi_file);
+
+    (*midi)->trk_index = calloc((*midi)->hdr.tracks + 1, sizeof *(*midi)->trk_index);
+    if ((*midi)->trk_index == NULL) {
+        midi_close(*midi);
+        *midi = NULL;
 
-        return 0;
+        return ENOMEM;
     }
+    (*midi)->trk_index[0] = (*midi)->trk_offset;
 
-    return errno;
+    return 0;
 }
 
 void midi_close(midi_t *midi)
@@ -89,6 +184,9 @@ void midi_close(midi_t *midi)
         fclose(midi->midi_file);
     }
 
+    if (midi != NULL) {
+        free(midi->trk_index);
+    }
     free(midi);
 }
 
@@ -158,41 +256,67 @@ static uint16_t midi_parse_division(const midi_hdr_t *const hdr)
 }
 
 /**
- * Retrieve a MIDI track (midi_track_t*) including the track header.
- * Suitable for iteration with midi_iter_track.
+ * Seek to the header of track track_idx, through the offsets found so far,
+ * recording the ones of the tracks skipped on the way.
  */
-midi_track_t *midi_get_track(const midi_t *const midi, uint8_t track_idx)
+static bool midi_seek_track(const midi_t *const midi, uint8_t track_idx)
 {
     int status;
-    midi_track_t *track = NULL;
+    int i = track_idx < midi->hdr.tracks ? track_idx : midi->hdr.tracks;
 
-    // TODO
-    status = fseek(midi->midi_file, midi->trk_offset, SEEK_SET);
+    // trk_index[0] is always known
+    while (midi->trk_index[i] == 0) {
+        i--;
+    }
+
+    status = fseek(midi->midi_file, midi->trk_index[i], SEEK_SET);
 
     if (status == -1) {
         midi_set_error((midi_t*)midi, errno, "fseek() failed.");
-        return NULL;
+        return false;
     }
 
     midi_track_hdr_t trkhdr;
 
-    for (int i = 0; i < track_idx; ++i) {
+    for (; i < track_idx; ++i) {
         if (midi_parse_track_hdr(midi, &trkhdr)) {
             // Seek past the track.
             status = fseek(midi->midi_file, trkhdr.size, SEEK_CUR);
 
             if (status == -1) {
                 midi_set_error((midi_t*)midi, errno, "fseek() failed to seek past track %d header.", track_idx);
-                return NULL;
+                return false;
             }
 
+            if (i + 1 <= midi->hdr.tracks) {
+                midi->trk_index[i + 1] = ftell(midi->midi_file);
+            }
         } else {
             midi_prefix_errmsg((midi_t*)midi, "Failed to parse track %d header");
-            return NULL;
+            return false;
         }
     }
 
-    track = malloc(sizeof *track);
+    return true;
+}
+
+/**
+ * Retrieve a MIDI track (midi_track_t*) including the track header.
+ * Suitable for iteration with midi_iter_track.
+ *
+ * Track offsets are indexed as they are found, so a track is fetched by
+ * seeking straight to it, or from the last indexed track before it. For a
+ * compressed file, only as much as the track needs is decompressed.
+ */
+midi_track_t *midi_get_track(const midi_t *const midi, uint8_t track_idx)
+{
+    midi_track_t *track = NULL;
+
+    if (!midi_seek_track(midi, track_idx)) {
+        return NULL;
+    }
+
+    track = calloc(1, sizeof *track);
     if (track != NULL) {
         track->num = track_idx;
 
@@ -205,6 +329,177 @@ midi_track_t *midi_get_track(const midi_t *const midi, uint8_t track_idx)
     return track;
 }
 
+/**
+ * FNV-1a over the chunk data of track track_idx, read in steps without
+ * decoding it. The offset of the next track is recorded on the way, so
+ * hashing all the tracks is the index pass of the file.
+ */
+int midi_get_track_hash(const midi_t *const midi, uint8_t track_idx, uint64_t *hash)
+{
+    midi_track_hdr_t trkhdr;
+    uint8_t buf[4096];
+    uint64_t h = MIDI_FNV_OFFSET;
+    uint32_t left;
+
+    if (track_idx >= midi->hdr.tracks) {
+        return EINVAL;
+    }
+
+    if (!midi_seek_track(midi, track_idx) || !midi_parse_track_hdr(midi, &trkhdr)) {
+        return midi->errnum ? midi->errnum : EINVAL;
+    }
+
+    for (left = trkhdr.size; left > 0; ) {
+        size_t n = fread(buf, 1, left < sizeof(buf) ? left : sizeof(buf), midi->midi_file);
+
+        if (n == 0) {
+            break;
+        }
+        for (size_t k = 0; k < n; ++k) {
+            h = (h ^ buf[k]) * MIDI_FNV_PRIME;
+        }
+        left -= n;
+    }
+
+    if (left > 0 && !midi->recover) {
+        midi_set_error((midi_t*)midi, EINVAL, "track %d truncated.", track_idx);
+        return EINVAL;
+    }
+
+    if (track_idx + 1 <= midi->hdr.tracks && left == 0) {
+        midi->trk_index[track_idx + 1] = ftell(midi->midi_file);
+    }
+
+    *hash = h;
+
+    return 0;
+}
+
+/**
+ * Locate the chunk of track track_idx through the track index, reading only
+ * its header. The offset of the next track is recorded on the way.
+ */
+int midi_get_track_chunk(const midi_t *const midi, uint8_t track_idx, long *offset, uint32_t *size)
+{
+    midi_track_hdr_t trkhdr;
+    long pos;
+
+    if (track_idx >= midi->hdr.tracks) {
+        return EINVAL;
+    }
+
+    if (!midi_seek_track(midi, track_idx) || !midi_parse_track_hdr(midi, &trkhdr)) {
+        return midi->errnum ? midi->errnum : EINVAL;
+    }
+
+    // In recovery mode the header may have been found further on
+    pos = ftell(midi->midi_file);
+    if (pos == -1) {
+        return errno;
+    }
+
+    *offset = pos - MIDI_TRACK_HEADER_SIZE;
+    *size = MIDI_TRACK_HEADER_SIZE + trkhdr.size;
+    midi->trk_index[track_idx + 1] = pos + trkhdr.size;
+
+    return 0;
+}
+
+/**
+ * Copy the chunk of track track_idx, header included, to the end of fd.
+ * From a plain file the kernel copies the bytes: copy_file_range(), which
+ * may share extents, or sendfile() across file systems. From a compressed
+ * file or memory they go through a buffer.
+ */
+int midi_copy_track_chunk(const midi_t *const midi, uint8_t track_idx, int fd)
+{
+    uint8_t buf[MIDI_CHUNK_STEP];
+    int in = fileno(midi->midi_file);
+    bool ranges = true;
+    long offset;
+    uint32_t size;
+    int status;
+
+    status = midi_get_track_chunk(midi, track_idx, &offset, &size);
+    if (status) {
+        return status;
+    }
+
+    if (in < 0 && fseek(midi->midi_file, offset, SEEK_SET) != 0) {
+        return errno;
+    }
+
+    while (size > 0) {
+        uint32_t step = size < sizeof(buf) ? size : sizeof(buf);
+        off_t off = offset;
+        ssize_t n;
+
+        if (in < 0) {
+            n = fread(buf, 1, step, midi->midi_file);
+            if (n > 0 && write(fd, buf, n) != n) {
+                return errno ? errno : EIO;
+            }
+        } else if (ranges) {
+            n = copy_file_range(in, &off, fd, NULL, size, 0);
+            if (n < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)) {
+                ranges = false;
+                continue;
+            }
+        } else {
+            n = sendfile(fd, in, &off, size);
+        }
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+        if (n == 0) {
+            midi_set_error((midi_t*)midi, EINVAL, "track %d truncated.", track_idx);
+            return EINVAL;
+        }
+        offset += n;
+        size -= n;
+    }
+
+    return 0;
+}
+
+/**
+ * Read the data of the chunk of track track_idx without decoding it, into
+ * *data (free() it) of *size bytes.
+ */
+int midi_read_track_chunk(const midi_t *const midi, uint8_t track_idx, uint8_t **data, uint32_t *size)
+{
+    long offset;
+    uint32_t chunk;
+    size_t got;
+    int status;
+
+    status = midi_get_track_chunk(midi, track_idx, &offset, &chunk);
+    if (status) {
+        return status;
+    }
+    if (fseek(midi->midi_file, offset + MIDI_TRACK_HEADER_SIZE, SEEK_SET) != 0) {
+        return errno;
+    }
+
+    *size = chunk - MIDI_TRACK_HEADER_SIZE;
+    *data = midi_read_chunk(midi->midi_file, *size, &got);
+    if (*data == NULL) {
+        return ENOMEM;
+    }
+    if (got < *size) {
+        free(*data);
+        *data = NULL;
+        midi_set_error((midi_t*)midi, EINVAL, "track %d truncated.", track_idx);
+        return EINVAL;
+    }
+
+    return 0;
+}
+
 /**
  * Free a track previously allocated with midi_get_track()
  */
@@ -250,141 +545,639 @@ static bool midi_parse_hdr(midi_t *const midi)
     return true;
 }
 
+/**
+ * Recovery: a track header is not where the previous chunk length says,
+ * look for the next "MTrk" within MIDI_RESYNC_MAX bytes. buf holds the
+ * misplaced header and gets the one found.
+ */
+static bool midi_find_track_hdr(const midi_t *const midi, uint8_t *buf)
+{
+    for (long skipped = 0; skipped < MIDI_RESYNC_MAX; ++skipped) {
+        int c;
+
+        if (midi_check_magic(MIDI_TRACK_MAGIC, buf, sizeof(MIDI_TRACK_MAGIC))) {
+            return true;
+        }
+
+        c = fgetc(midi->midi_file);
+        if (c == EOF) {
+            return false;
+        }
+        memmove(buf, buf + 1, MIDI_TRACK_HEADER_SIZE - 1);
+        buf[MIDI_TRACK_HEADER_SIZE - 1] = c;
+    }
+
+    return false;
+}
+
+/**
+ * Recovery: check the length of the chunk whose data starts at the current
+ * position. Unless it ends right before a track header or at the end of
+ * the file, it is cut at the first "MTrk" inside it, or at the end of the
+ * file. The bytes cut go to hdr->cut, the position is left at the data.
+ */
+static void midi_clamp_chunk(const midi_t *const midi, midi_track_hdr_t *hdr)
+{
+    FILE *fp = midi->midi_file;
+    uint8_t buf[1 + sizeof(MIDI_TRACK_MAGIC)];
+    long pos = ftell(fp);
+    uint32_t len;
+    size_t n;
+
+    if (pos == -1 || hdr->size == 0) {
+        return;
+    }
+
+    // The last byte of the chunk, then nothing or the next header
+    if (fseek(fp, pos + (long)hdr->size - 1, SEEK_SET) == 0) {
+        n = fread(buf, 1, sizeof(buf), fp);
+        if (n == 1 || (n == sizeof(buf) && midi_check_magic(MIDI_TRACK_MAGIC, buf + 1, sizeof(MIDI_TRACK_MAGIC)))) {
+            fseek(fp, pos, SEEK_SET);
+            return;
+        }
+    }
+
+    fseek(fp, pos, SEEK_SET);
+    memset(buf, 0, sizeof(buf));
+    for (len = 0; len < hdr->size; ++len) {
+        int c = fgetc(fp);
+
+        if (c == EOF) {
+            break;
+        }
+        memmove(buf, buf + 1, sizeof(buf) - 1);
+        buf[sizeof(buf) - 1] = c;
+        if (len + 1 >= sizeof(MIDI_TRACK_MAGIC) && midi_check_magic(MIDI_TRACK_MAGIC, buf + 1, sizeof(MIDI_TRACK_MAGIC))) {
+            len -= sizeof(MIDI_TRACK_MAGIC) - 1;
+            break;
+        }
+    }
+
+    hdr->cut = hdr->size - len;
+    hdr->size = len;
+    fseek(fp, pos, SEEK_SET);
+}
+
 static bool midi_parse_track_hdr(const midi_t *const midi, midi_track_hdr_t *hdr)
 {
     uint8_t buf[MIDI_TRACK_HEADER_SIZE] = { 0 };
+    long pos = ftell(midi->midi_file);
     size_t ret = fread(buf, MIDI_TRACK_HEADER_SIZE, 1, midi->midi_file);
 
+    hdr->cut = 0;
+    hdr->missing = false;
+
     if (ret != 1) {
         midi_set_error((midi_t*)midi, errno, "fread() failed to read track header.");
+    } else if (!midi_check_magic(MIDI_TRACK_MAGIC, buf + MIDI_TRACK_HEADER_MAGIC_OFFSET, sizeof(MIDI_TRACK_MAGIC))
+            && (!midi->recover || !midi_find_track_hdr(midi, buf))) {
+        midi_set_error((midi_t*)midi, EINVAL, "track has bad magic.");
+        ret = 0;
+    }
 
-        return false;
+    if (ret != 1) {
+        // Recovery: an empty track in place of the missing one, the next
+        // ones are looked for from the same place
+        if (!midi->recover || pos == -1 || fseek(midi->midi_file, pos, SEEK_SET) != 0) {
+            return false;
+        }
+        memcpy(hdr->magic, MIDI_TRACK_MAGIC, sizeof(hdr->magic));
+        hdr->size = 0;
+        hdr->missing = true;
+        return true;
     }
 
     memcpy(hdr->magic, buf + MIDI_TRACK_HEADER_MAGIC_OFFSET, sizeof(hdr->magic));
     hdr->size = btol_32(*(uint32_t*)(buf + MIDI_TRACK_HEADER_SIZE_OFFSET));
 
-    if (!midi_check_magic(MIDI_TRACK_MAGIC, hdr->magic, sizeof(MIDI_TRACK_MAGIC))) {
-        midi_set_error((midi_t*)midi, errno, "track has bad magic.");
-        return false;
+    if (midi->recover) {
+        midi_clamp_chunk(midi, hdr);
     }
 
     return true;
 }
 
+/**
+ * A track chunk is read into memory in one go and decoded from there.
+ *
+ * In recovery mode (midi_set_recover) a bad event doesn't lose the track:
+ * the bytes up to the next plausible status byte are skipped and recorded
+ * as damaged, and decoding goes on from there. A chunk cut short by the end
+ * of the file keeps the events read so far. Without errors, decoding is the
+ * same either way.
+ */
 static bool midi_parse_track(const midi_t *const midi, midi_track_t *trk)
 {
-    midi_event_node_t *node;
-    bool parsed = midi_parse_track_hdr(midi, &trk->hdr);
+    midi_event_node_t **tail = &trk->head;
+    midi_reader_t rd;
+    uint8_t *buf;
+    size_t got;
+    uint32_t tick = 0;
+    int err = 0;
+
+    trk->head = NULL;
+    trk->cur = NULL;
+    trk->events = 0;
+    trk->damaged = 0;
 
-    if (!parsed) {
+    if (!midi_parse_track_hdr(midi, &trk->hdr)) {
         return false;
     }
+    if (trk->hdr.missing) {
+        midi_track_damage(trk, 0, 0);
+    } else if (trk->hdr.cut) {
+        midi_track_damage(trk, trk->hdr.size, trk->hdr.cut);
+    }
 
-    unsigned int bytes = 0;
-    trk->events = 0;
+    buf = midi_read_chunk(midi->midi_file, trk->hdr.size, &got);
+    if (buf == NULL) {
+        midi_set_error((midi_t*)midi, ENOMEM, "malloc() failed");
+        return false;
+    }
+
+    if (got < trk->hdr.size) {
+        if (!midi->recover) {
+            midi_set_error((midi_t*)midi, EINVAL, "track %d truncated, %u of %u bytes.",
+                    trk->num, (unsigned)got, trk->hdr.size);
+            free(buf);
+            return false;
+        }
+        midi_track_damage(trk, got, trk->hdr.size - got);
+    }
 
-    node = midi_parse_event(midi, &bytes);
+    rd.buf = buf;
+    rd.size = got;
+    rd.pos = 0;
+    rd.running = 0;
+    rd.resync = false;
+
+    // A big chunk with no damage to recover from is decoded in segments, on
+    // several threads. Anything it can't do is left to the serial decode
+    if (!midi->recover && midi->jobs != 1 && got >= MIDI_SPLIT_MIN) {
+        err = midi_decode_parallel(midi, trk, buf, got);
+        if (err >= 0) {
+            free(buf);
+            if (err) {
+                midi_set_error((midi_t*)midi, err, "malloc() failed");
+                return false;
+            }
+            trk->cur = trk->head;
+            return true;
+        }
+        err = 0;
+    }
 
-    if (node == NULL) {
-        return false;
+    while (rd.pos < rd.size) {
+        uint32_t start = rd.pos;
+        midi_event_node_t *node = midi_decode_event(midi, &rd, &err);
+
+        if (node == NULL) {
+            if (err == ENOMEM || !midi->recover) {
+                break;
+            }
+
+            // Skip to the next status byte, the delta time before it is lost
+            rd.pos = midi_resync(&rd, start + 1);
+            rd.running = 0;
+            rd.resync = true;
+            midi_track_damage(trk, start, rd.pos - start);
+            err = 0;
+            continue;
+        }
+
+        tick += node->event.delta_time;
+        node->tick = tick;
+        *tail = node;
+        tail = &node->next;
+        trk->events++;
     }
 
-    trk->head = node;
+    *tail = NULL;
     trk->cur = trk->head;
-    trk->events += 1;
+    free(buf);
+
+    if (err) {
+        midi_set_error((midi_t*)midi, err, err == ENOMEM ? "malloc() failed" :
+                "track %d: bad event at byte %u.", trk->num, rd.pos);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Pre-scan of a chunk for parallel decoding: walks the events by their
+ * lengths only, without decoding them, and records a split point about
+ * every step bytes, where an event starts and the running status is known.
+ *
+ * Returns the number of splits, the first is the chunk start. 0 if the
+ * chunk is malformed, the serial decode reports where.
+ */
+static uint32_t midi_scan_splits(const uint8_t *buf, uint32_t size, uint32_t step, midi_split_t *splits, uint32_t max)
+{
+    midi_reader_t rd = { buf, size, 0, 0, false };
+    uint32_t next = step;
+    uint32_t n = 0;
+    uint32_t value;
+
+    splits[n].pos = 0;
+    splits[n++].running = 0;
+
+    while (rd.pos < rd.size) {
+        if (rd.pos >= next && n < max) {
+            splits[n].pos = rd.pos;
+            splits[n++].running = rd.running;
+            next = rd.pos + step;
+        }
 
-    node = trk->head;
+        if (!midi_read_vlq(&rd, &value) || rd.pos >= rd.size) {
+            return 0;
+        }
 
-    while (bytes < trk->hdr.size) {
-        node->next = midi_parse_event(midi, &bytes);
-        if (node->next != NULL) {
-            node = node->next;
-            trk->events++;
+        uint8_t b = rd.buf[rd.pos];
+
+        if (b == 0xFF || b == 0xF0 || b == 0xF7) {
+            rd.pos++;
+            if (b == 0xFF) {
+                if (rd.pos >= rd.size || (rd.buf[rd.pos] & 0x80)) {
+                    return 0;
+                }
+                rd.pos++;
+            } else {
+                rd.running = 0;
+            }
+            if (!midi_read_vlq(&rd, &value) || value > rd.size - rd.pos) {
+                return 0;
+            }
+            rd.pos += value;
         } else {
-            // Something wrong
-            return false;
+            if (b & 0x80) {
+                rd.pos++;
+                rd.running = b;
+            }
+
+            uint8_t cmd = (rd.running >> 4) & 0x0F;
+            uint32_t argn = (cmd == MIDI_EVENT_PROGRAM_CHANGE || cmd == MIDI_EVENT_CHANNEL_PRESSURE) ? 1 : 2;
+
+            if (!(cmd & 0x08) || cmd == 0x0F || argn > rd.size - rd.pos) {
+                return 0;
+            }
+            rd.pos += argn;
         }
     }
 
-    node->next = NULL;
+    return n;
+}
 
-    return true;
+static void midi_decode_segment(midi_decode_job_t *job, uint32_t k)
+{
+    midi_segment_t *seg = &job->segs[k];
+    midi_reader_t rd;
+    uint32_t tick = 0;
+
+    if (job->rebase) {
+        // The segments before this one end at seg->ticks, see midi_decode_parallel()
+        // Segments are joined by now, the walk ends at the tail
+        for (midi_event_node_t *node = seg->head; node != NULL; node = node->next) {
+            node->tick += seg->ticks;
+            if (node == seg->tail) {
+                break;
+            }
+        }
+        return;
+    }
+
+    rd.buf = job->buf;
+    rd.size = k + 1 < job->count ? job->splits[k + 1].pos : job->size;
+    rd.pos = job->splits[k].pos;
+    rd.running = job->splits[k].running;
+    rd.resync = false;
+
+    while (rd.pos < rd.size) {
+        midi_event_node_t *node = midi_decode_event(job->midi, &rd, &seg->err);
+
+        if (node == NULL) {
+            break;
+        }
+
+        // Ticks from the segment start until the rebase
+        tick += node->event.delta_time;
+        node->tick = tick;
+        if (seg->tail != NULL) {
+            seg->tail->next = node;
+        } else {
+            seg->head = node;
+        }
+        seg->tail = node;
+        seg->events++;
+    }
+
+    seg->ticks = tick;
 }
 
-static inline midi_event_node_t *midi_parse_event(const midi_t *const midi, unsigned int *const bytes)
+static void *midi_decode_worker(void *arg)
 {
-    /**
-     * Per midi format, sometimes events may not contain  a command byte
-     * And in this case, the "running command" from the last command byte is used.
-     */
-    static uint8_t running_cmd = 0;
+    midi_decode_job_t *job = arg;
 
-#if DEBUG
-    printf("Event: ");
-#endif
-    uint32_t delta_time = midi_parse_delta_time(midi->midi_file, bytes);
+    for (;;) {
+        uint32_t k;
 
-    midi_event_node_t * node;
+        pthread_mutex_lock(&job->lock);
+        k = job->next++;
+        pthread_mutex_unlock(&job->lock);
 
-    uint8_t cmdchan = 0;
+        if (k >= job->count) {
+            break;
+        }
+        midi_decode_segment(job, k);
+    }
 
-    *bytes += fread(&cmdchan, 1, 1, midi->midi_file);
-#if DEBUG
-    printf(" %02x", cmdchan);
-#endif
+    return NULL;
+}
 
-    // 0xFF = meta event.
-    // TODO: split this out into a function for meta / event
-    if (cmdchan == 0xFF)  {
-        uint8_t cmd ;
-        uint8_t size ;
+// Run the segments of job on threads_n threads and this one
+static void midi_decode_run(midi_decode_job_t *job, pthread_t *threads, long threads_n)
+{
+    job->next = 0;
 
-        // xx, nn, dd = command, length, data...
-        // Skip the command.
-        *bytes += fread(&cmd, 1, 1, midi->midi_file);
-        *bytes += fread(&size, 1, 1, midi->midi_file);
-#if DEBUG
-        printf(" %02x %02x", cmd, size);
-#endif
+    for (long i = 0; i < threads_n; ++i) {
+        if (pthread_create(&threads[i], NULL, midi_decode_worker, job) != 0) {
+            threads_n = i;
+            break;
+        }
+    }
+    midi_decode_worker(job);
+    for (long i = 0; i < threads_n; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+}
 
-        node = malloc((sizeof *node) + size);
-        if (node == NULL) {
-            midi_set_error((midi_t*)midi, EINVAL, "malloc() failed");
+/**
+ * Decode a chunk in segments on several threads. Segments are decoded with
+ * ticks from their own start, then joined in order, and the absolute tick
+ * of every segment start (a prefix sum of the segment lengths in ticks) is
+ * added on in a second parallel pass. The events are the same as decoded
+ * serially.
+ *
+ * Returns 0, ENOMEM, or -1 when the chunk is left to the serial decode.
+ */
+static int midi_decode_parallel(const midi_t *const midi, midi_track_t *trk, const uint8_t *buf, uint32_t size)
+{
+    midi_decode_job_t job;
+    uint32_t max = size / MIDI_SPLIT_STEP + 1;
+    long threads_n = midi->jobs ? midi->jobs : sysconf(_SC_NPROCESSORS_ONLN);
+    midi_split_t *splits;
+    pthread_t *threads;
+    uint32_t base = 0;
+    int err = 0;
+
+    if (threads_n < 2) {
+        return -1;
+    }
+
+    splits = malloc(max * sizeof *splits);
+    if (splits == NULL) {
+        return -1;
+    }
+
+    memset(&job, 0, sizeof(job));
+    job.midi = midi;
+    job.buf = buf;
+    job.size = size;
+    job.splits = splits;
+    job.count = midi_scan_splits(buf, size, MIDI_SPLIT_STEP, splits, max);
+    if (job.count < 2) {
+        free(splits);
+        return -1;
+    }
+
+    if (threads_n > job.count) {
+        threads_n = job.count;
+    }
+    // This thread takes segments too
+    threads_n--;
+
+    job.segs = calloc(job.count, sizeof *job.segs);
+    threads = calloc(threads_n ? threads_n : 1, sizeof *threads);
+    if (job.segs == NULL || threads == NULL) {
+        free(job.segs);
+        free(threads);
+        free(splits);
+        return -1;
+    }
+
+    pthread_mutex_init(&job.lock, NULL);
+
+    midi_decode_run(&job, threads, threads_n);
+
+    // Join the segments, turning their lengths into start ticks
+    trk->head = NULL;
+    for (uint32_t k = 0; k < job.count; ++k) {
+        midi_segment_t *seg = &job.segs[k];
+        uint32_t ticks = seg->ticks;
+
+        if (seg->err && err == 0) {
+            err = seg->err;
+        }
+        if (seg->head != NULL) {
+            if (trk->head == NULL) {
+                trk->head = seg->head;
+            } else {
+                job.segs[k - 1].tail->next = seg->head;
+            }
+        } else if (k > 0) {
+            // Keep the tail to join the next segment to
+            seg->tail = job.segs[k - 1].tail;
+        }
+        trk->events += seg->events;
+
+        seg->ticks = base;
+        base += ticks;
+    }
+
+    if (err == 0) {
+        job.rebase = true;
+        midi_decode_run(&job, threads, threads_n);
+    }
+
+    pthread_mutex_destroy(&job.lock);
+    free(job.segs);
+    free(threads);
+    free(splits);
+
+    return err;
+}
+
+/**
+ * Read up to size bytes, growing the buffer as data arrives so a bogus chunk
+ * length costs no more memory than the file has. NULL if out of memory.
+ */
+static uint8_t *midi_read_chunk(FILE *fp, uint32_t size, size_t *got)
+{
+    size_t cap = size < MIDI_CHUNK_STEP ? size : MIDI_CHUNK_STEP;
+    uint8_t *buf = malloc(cap ? cap : 1);
+
+    *got = 0;
+    while (buf != NULL) {
+        size_t n = fread(buf + *got, 1, cap - *got, fp);
+
+        *got += n;
+        if (*got < cap || cap == size) {
+            break;
+        }
+
+        uint8_t *grown = realloc(buf, cap = (size - cap < cap) ? size : cap * 2);
+        if (grown == NULL) {
+            free(buf);
             return NULL;
         }
+        buf = grown;
+    }
 
-        fread(node->event.data, size, 1, midi->midi_file);
-        *bytes += size;
-#if DEBUG
-        for (int i = 0; i < size; i++) {
-            printf(" %02x", node->event.data[i]);
+    return buf;
+}
+
+static void midi_track_damage(midi_track_t *trk, uint32_t offset, uint32_t size)
+{
+    if (trk->damaged < MIDI_DAMAGE_MAX) {
+        trk->damage[trk->damaged].offset = offset;
+        trk->damage[trk->damaged].size = size;
+    }
+    trk->damaged++;
+}
+
+// A channel status, or a meta / sysex event start
+static uint32_t midi_resync(const midi_reader_t *rd, uint32_t from)
+{
+    for (uint32_t q = from; q < rd->size; ++q) {
+        uint8_t b = rd->buf[q];
+
+        if ((b >= 0x80 && b <= 0xEF) || b == 0xF0
+                || (b == 0xFF && q + 1 < rd->size && rd->buf[q + 1] < 0x80)) {
+            return q;
         }
-#endif
+    }
 
-        node->event.size = size;
-        node->event.cmd = cmd;
-        node->event.delta_time = delta_time;
-        node->event.chan = 0;
-        node->event.type = MIDI_EVENT_TYPE_META;
+    return rd->size;
+}
 
-    } else {
+static inline bool midi_read_vlq(midi_reader_t *rd, uint32_t *value)
+{
+    uint32_t v = 0;
+
+    for (int i = 0; i < 4; ++i) {
+        if (rd->pos >= rd->size) {
+            return false;
+        }
+
+        uint8_t b = rd->buf[rd->pos++];
+
+        v = (v << 7) | (b & 0x7F);
+        if (!(b & 0x80)) {
+            *value = v;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Decode a meta or sysex event at rd->pos (after its status byte): a type
+ * byte for meta events, a variable length and the data. Data past 255
+ * bytes is skipped.
+ */
+static midi_event_node_t *midi_decode_data_event(midi_reader_t *rd, uint8_t type, uint8_t cmd, int *err)
+{
+    midi_event_node_t *node;
+    uint32_t len;
+    uint8_t size;
+
+    if (type == MIDI_EVENT_TYPE_META) {
+        if (rd->pos >= rd->size || (rd->buf[rd->pos] & 0x80)) {
+            *err = EINVAL;
+            return NULL;
+        }
+        cmd = rd->buf[rd->pos++];
+    }
+
+    if (!midi_read_vlq(rd, &len) || len > rd->size - rd->pos) {
+        *err = EINVAL;
+        return NULL;
+    }
+
+    size = len > 0xFF ? 0xFF : len;
+    node = malloc(sizeof(*node) + size);
+    if (node == NULL) {
+        *err = ENOMEM;
+        return NULL;
+    }
+
+    memcpy(node->event.data, rd->buf + rd->pos, size);
+    rd->pos += len;
+
+    node->event.size = size;
+    node->event.cmd = cmd;
+    node->event.chan = 0;
+    node->event.type = type;
+
+    return node;
+}
+
+/**
+ * Per midi format, sometimes events may not contain  a command byte
+ * And in this case, the "running command" from the last command byte is used,
+ * both command and channel.
+ *
+ * The running command is kept in the reader, per track (it never carries over
+ * from one track chunk to the next), so tracks of different files can be
+ * parsed from different threads.
+ */
+static inline midi_event_node_t *midi_decode_event(const midi_t *const midi, midi_reader_t *rd, int *err)
+{
+    midi_event_node_t *node;
+    uint32_t delta_time = 0;
+    uint8_t cmdchan;
+
+    if (rd->resync) {
+        rd->resync = false;
+    } else if (!midi_read_vlq(rd, &delta_time)) {
+        *err = EINVAL;
+        return NULL;
+    }
 
-        uint8_t cmd = (cmdchan >> 4) & 0x0F;
-        uint8_t chan = cmdchan & 0x0F;
-        uint8_t args[2];
-        int argc = 0;
+    if (rd->pos >= rd->size) {
+        *err = EINVAL;
+        return NULL;
+    }
+    cmdchan = rd->buf[rd->pos];
+
+    // 0xFF = meta event, 0xF0 / 0xF7 = sysex
+    if (cmdchan == 0xFF) {
+        rd->pos++;
+        node = midi_decode_data_event(rd, MIDI_EVENT_TYPE_META, 0, err);
+    } else if (cmdchan == 0xF0 || cmdchan == 0xF7) {
+        rd->pos++;
+        // Sysex cancels running status
+        rd->running = 0;
+        node = midi_decode_data_event(rd, MIDI_EVENT_TYPE_SYSEX, cmdchan, err);
+    } else {
+        uint8_t status = cmdchan;
+        uint8_t cmd;
         int argn = 2;
 
-        if (!(cmd & 0x08)) {
-            cmd = running_cmd;
-            args[argc++] = cmdchan;
+        if (cmdchan & 0x80) {
+            rd->pos++;
+            rd->running = cmdchan;
         } else {
-            running_cmd = cmd;
+            // Running status carries the channel as well
+            status = rd->running;
         }
 
-        if (!(cmd & 0x08)) {
-            midi_set_error((midi_t*)midi, EINVAL, "Invalid command, but none running :(.");
+        cmd = (status >> 4) & 0x0F;
+        if (!(cmd & 0x08) || cmd == 0x0F) {
+            // Invalid command, but none running, or a system message
+            *err = EINVAL;
             return NULL;
         }
 
@@ -395,60 +1188,52 @@ static inline midi_event_node_t *midi_parse_event(const midi_t *const midi, unsi
             argn--;
         }
 
-        node = malloc(sizeof(*node) + argn);
-        if (node == NULL) {
-            midi_set_error((midi_t*)midi, ENOMEM, "malloc() failed");
+        if (rd->pos + argn > rd->size) {
+            *err = EINVAL;
             return NULL;
         }
-
-        for ( ; argc < argn; ++argc ) {
-            *bytes += fread(&args[argc], 1, 1, midi->midi_file);
-#if DEBUG
-            printf(" %02x", args[argc]);
-#endif
+        // Data bytes are 7 bit, only checked when there is a way to recover
+        if (midi->recover && ((rd->buf[rd->pos] & 0x80) || (argn > 1 && (rd->buf[rd->pos + 1] & 0x80)))) {
+            *err = EINVAL;
+            return NULL;
         }
 
-        for (int i = 0; i < argn; ++i) {
-            node->event.data[i] = args[i];
+        node = malloc(sizeof(*node) + argn);
+        if (node == NULL) {
+            *err = ENOMEM;
+            return NULL;
         }
 
+        memcpy(node->event.data, rd->buf + rd->pos, argn);
+        rd->pos += argn;
+
         node->event.cmd = cmd;
-        node->event.delta_time = delta_time;
-        node->event.size = (uint8_t)argc;
-        node->event.chan = chan;
+        node->event.size = (uint8_t)argn;
+        node->event.chan = status & 0x0F;
         node->event.type = MIDI_EVENT_TYPE_EVENT;
     }
 
+    if (node == NULL) {
+        return NULL;
+    }
+
+    node->event.delta_time = delta_time;
     node->next = NULL;
 #if DEBUG
-    printf("\n");
     midi_print_event(&node->event);
 #endif
 
     return node;
 }
 
-static inline uint32_t midi_parse_delta_time(FILE *file, unsigned int *const bytes)
+void midi_set_recover(midi_t *midi, bool recover)
 {
-    uint8_t tmp[4] = { 0 };
-    uint32_t delta_time = 0;
-    int read = 0;
-    int more;
-
-    do {
-        fread(&tmp[read], 1, 1, file);
-#if DEBUG
-        printf(" %02x", tmp[read]);
-#endif
-        more = tmp[read] & 0x80;
-        tmp[read] &= 0x7F;
-        delta_time = (delta_time << 7) | tmp[read];
-        read++;
-    } while (more && read < 4);
-
-    *bytes += read;
+    midi->recover = recover;
+}
 
-    return delta_time;
+void midi_set_jobs(midi_t *midi, uint16_t jobs)
+{
+    midi->jobs = jobs;
 }
 
 void midi_print_info(midi_t *midi)
@@ -465,10 +1250,12 @@ void midi_print_info(midi_t *midi)
 
     for (int i = 0; i < midi->hdr.tracks; ++i) {
         track =  midi_get_track(midi, i);
-        midi_print_track(track);
-        if (track != NULL) {
-            midi_free_track(track);
+        if (track == NULL) {
+            printf("Track %d - %s\n", i, midi_get_errmsg(midi));
+            break;
         }
+        midi_print_track(track);
+        midi_free_track(track);
     }
 }
 
@@ -479,6 +1266,13 @@ void midi_print_track(midi_track_t *trk)
             trk->hdr.magic[0], trk->hdr.magic[1], trk->hdr.magic[2], trk->hdr.magic[3],
             trk->events,
             trk->hdr.size);
+
+    for (uint32_t i = 0; i < trk->damaged && i < MIDI_DAMAGE_MAX; ++i) {
+        printf("    damaged: %6u bytes at %6u\n", trk->damage[i].size, trk->damage[i].offset);
+    }
+    if (trk->damaged > MIDI_DAMAGE_MAX) {
+        printf("    damaged: %u more ranges\n", trk->damaged - MIDI_DAMAGE_MAX);
+    }
 }
 
 void midi_print_header(midi_hdr_t *hdr)
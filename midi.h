@@ -86,6 +86,12 @@
 #define MIDI_HEADER_TRACKS_OFFSET       10
 #define MIDI_HEADER_DIVISION_OFFSET     12
 
+enum {
+    MIDI_FORMAT_SINGLE  = 0,    // One track
+    MIDI_FORMAT_MULTI   = 1,    // Simultaneous tracks, track 0 is the conductor
+    MIDI_FORMAT_SONGS   = 2     // Independent songs, one per track
+};
+
 typedef struct {
     uint8_t     magic[4];
     uint32_t    length;
@@ -119,11 +125,14 @@ typedef struct {
 typedef struct {
     uint8_t     magic[4];
     uint32_t    size;
+    uint32_t    cut;        // Recovery: bytes a bogus length claimed past the chunk
+    bool        missing;    // Recovery: no header where the track should be, size 0
 } midi_track_hdr_t;
 
 enum {
     MIDI_EVENT_TYPE_EVENT,
-    MIDI_EVENT_TYPE_META
+    MIDI_EVENT_TYPE_META,
+    MIDI_EVENT_TYPE_SYSEX       // cmd is 0xF0 or 0xF7
 };
 
 typedef struct {
@@ -131,29 +140,43 @@ typedef struct {
     uint8_t     type;
     uint8_t     cmd;
     uint8_t     chan;       // Always 0 for meta events.
-    uint8_t     size;       // Size of data
+    uint8_t     size;       // Size of data, meta / sysex data is cut at 255 bytes
     uint8_t     data[];
 } midi_event_t;
 
 
 typedef struct midi_event_node {
     struct midi_event_node *next;
+    uint32_t                tick;   // Absolute, from the start of the track
     midi_event_t            event;
 } midi_event_node_t;
 
 
+#define MIDI_DAMAGE_MAX                 8
+
+// Bytes of a track chunk skipped in recovery mode, offset from the chunk data
+typedef struct {
+    uint32_t    offset;
+    uint32_t    size;
+} midi_damage_t;
+
 typedef struct {
     midi_track_hdr_t    hdr;
     uint32_t            events; // Total count of events in a track chunk
     uint8_t             num;    // No. of track
     midi_event_node_t * head;
     midi_event_node_t * cur;
+    uint32_t            damaged;                    // Damaged ranges, only the first ones are kept
+    midi_damage_t       damage[MIDI_DAMAGE_MAX];
 } midi_track_t;
 
 typedef struct {
     FILE *      midi_file;
     midi_hdr_t  hdr;
     uint8_t     trk_offset;     // Offset to first track
+    long *      trk_index;      // Offsets of the tracks found so far, 0 if not yet
+    bool        recover;        // Skip damaged events instead of failing the track
+    uint16_t    jobs;           // Threads decoding a big track, 0 for one per CPU
     uint16_t    ppq;            // Pulse(ticks) per quarternote / units per beat, unit of time for delta timing
 
     char errmsg[512];
@@ -187,8 +210,46 @@ typedef struct {
  */
 
 int midi_open(const char *const midi_file, midi_t **);
+int midi_open_mem(const void *buf, size_t size, midi_t **);
+/**
+ * Recovery mode for damaged files: a bad event, a truncated chunk or a
+ * track header out of place is skipped over instead of failing, and the
+ * skipped byte ranges are recorded in the track (damaged / damage[]). A
+ * chunk length that runs over the next track header or the end of the file
+ * is cut there, a track whose header is missing is empty, both recorded as
+ * damage too.
+ */
+void midi_set_recover(midi_t *midi, bool recover);
+/**
+ * Threads decoding one big track chunk (1 MiB or more), in segments found
+ * by a pre-scan. The events are the same as decoded serially. 1, the
+ * default, decodes serially, 0 uses one thread per CPU.
+ */
+void midi_set_jobs(midi_t *midi, uint16_t jobs);
 void midi_close(midi_t *midi);
 midi_track_t *midi_get_track(const midi_t *const midi, uint8_t n);
+/**
+ * Hash of the chunk data of track n (64 bit FNV-1a), without parsing it.
+ * Equal hashes mean an unchanged track. Returns 0 or a POSIX errno.
+ */
+int midi_get_track_hash(const midi_t *const midi, uint8_t n, uint64_t *hash);
+/**
+ * Where the chunk of track n is, header included: its offset in the file
+ * (decompressed, for a compressed file) and its size, found through the
+ * track index without decoding the track. Returns 0 or a POSIX errno.
+ */
+int midi_get_track_chunk(const midi_t *const midi, uint8_t n, long *offset, uint32_t *size);
+/**
+ * Copy the chunk of track n byte for byte to the end of the file fd, by the
+ * kernel (copy_file_range / sendfile) for a plain file. Returns 0 or a
+ * POSIX errno.
+ */
+int midi_copy_track_chunk(const midi_t *const midi, uint8_t n, int fd);
+/**
+ * Read the chunk data of track n, undecoded, into *data (free() it) of
+ * *size bytes. Returns 0 or a POSIX errno.
+ */
+int midi_read_track_chunk(const midi_t *const midi, uint8_t n, uint8_t **data, uint32_t *size);
 void midi_free_track(midi_track_t *trk);
 
 /**
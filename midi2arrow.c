@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "midi.h"
+#include "corpus.h"
+#include "timeline.h"
+#include "arrow.h"
+
+/**
+ * Export midi files as Arrow IPC streams (see arrow.h), for pyarrow,
+ * pandas, polars, DuckDB:
+ *
+ *   midi2arrow -o corpus songs.tar.gz more.mid
+ *
+ * writes three tables, joined on file:
+ *
+ *   corpus.files.arrow     file, name, archive, format, tracks, division
+ *   corpus.notes.arrow     file, track, channel, key, velocity, start, end
+ *   corpus.events.arrow    file, track, tick, type, cmd, channel, data
+ *
+ * Ticks are absolute, from the start of the track. Notes are those of the
+ * note timeline (timeline.h), in note off order. An event's type is a
+ * MIDI_EVENT_TYPE_*, its data the data bytes, meta and sysex data cut at
+ * 255 bytes as midi.c decodes them.
+ *
+ *   import pyarrow.ipc as ipc
+ *   notes = ipc.open_stream("corpus.notes.arrow").read_pandas()
+ *
+ * Files are read one by one, tracks decoded one at a time, and the tables
+ * written a record batch of -b rows (65536 by default) at a time, so a
+ * corpus of any size is exported in the memory of a batch per table.
+ *
+ * -r exports damaged files too, skipping the bad events (see
+ * midi_set_recover).
+ */
+
+#define EXPORT_BATCH_ROWS       65536
+
+enum {
+    TABLE_FILES,
+    TABLE_NOTES,
+    TABLE_EVENTS,
+    TABLES
+};
+
+static const arrow_field_t files_fields[] = {
+    { "file", ARROW_UINT32 },
+    { "name", ARROW_UTF8 },
+    { "archive", ARROW_UTF8 },
+    { "format", ARROW_UINT16 },
+    { "tracks", ARROW_UINT16 },
+    { "division", ARROW_UINT16 },
+};
+
+static const arrow_field_t notes_fields[] = {
+    { "file", ARROW_UINT32 },
+    { "track", ARROW_UINT16 },
+    { "channel", ARROW_UINT8 },
+    { "key", ARROW_UINT8 },
+    { "velocity", ARROW_UINT8 },
+    { "start", ARROW_UINT32 },
+    { "end", ARROW_UINT32 },
+};
+
+static const arrow_field_t events_fields[] = {
+    { "file", ARROW_UINT32 },
+    { "track", ARROW_UINT16 },
+    { "tick", ARROW_UINT32 },
+    { "type", ARROW_UINT8 },
+    { "cmd", ARROW_UINT8 },
+    { "channel", ARROW_UINT8 },
+    { "data", ARROW_BINARY },
+};
+
+static const struct {
+    const char *            suffix;
+    const arrow_field_t *   fields;
+    uint16_t                count;
+} tables[TABLES] = {
+    { "files", files_fields, sizeof(files_fields) / sizeof(files_fields[0]) },
+    { "notes", notes_fields, sizeof(notes_fields) / sizeof(notes_fields[0]) },
+    { "events", events_fields, sizeof(events_fields) / sizeof(events_fields[0]) },
+};
+
+static struct {
+    arrow_table_t   tables[TABLES];
+    int             fds[TABLES];
+    uint32_t        file;       // Id of the file being exported
+    bool            recover;
+    int             failed;
+} options;
+
+static void export_note(const midi_note_t *note, void *arg)
+{
+    arrow_value_t row[7] = {
+        { .u = options.file },
+        { .u = note->track },
+        { .u = note->chan },
+        { .u = note->key },
+        { .u = note->velocity },
+        { .u = note->start },
+        { .u = note->end },
+    };
+
+    (void)arg;
+
+    arrow_table_append(&options.tables[TABLE_NOTES], row);
+}
+
+static int export_track(midi_track_t *trk)
+{
+    arrow_value_t row[7] = { { .u = options.file }, { .u = trk->num } };
+    uint32_t tick = 0;
+
+    midi_iter_track(trk);
+    while (midi_track_has_next(trk)) {
+        midi_event_t *event = midi_track_next(trk);
+
+        tick += event->delta_time;
+        row[2].u = tick;
+        row[3].u = event->type;
+        row[4].u = event->cmd;
+        row[5].u = event->chan;
+        row[6].bytes = event->data;
+        row[6].size = event->size;
+        if (arrow_table_append(&options.tables[TABLE_EVENTS], row)) {
+            break;
+        }
+    }
+
+    midi_track_notes(trk, export_note, NULL);
+
+    return options.tables[TABLE_EVENTS].errnum ? options.tables[TABLE_EVENTS].errnum
+                                               : options.tables[TABLE_NOTES].errnum;
+}
+
+static int export_file(const corpus_entry_t *entry)
+{
+    arrow_value_t row[6];
+    midi_t *midi;
+    int status;
+
+    status = entry->data ? midi_open_mem(entry->data, entry->size, &midi) : midi_open(entry->name, &midi);
+    if (status) {
+        fprintf(stderr, "Failed to open %s: %s\n", entry->name, strerror(status));
+        return status;
+    }
+    midi_set_recover(midi, options.recover);
+
+    row[0].u = options.file;
+    row[1].bytes = entry->name;
+    row[1].size = strlen(entry->name);
+    row[2].bytes = entry->archive ? entry->archive : "";
+    row[2].size = strlen(row[2].bytes);
+    row[3].u = midi->hdr.format;
+    row[4].u = midi->hdr.tracks;
+    row[5].u = (uint16_t)midi->hdr.division;
+    status = arrow_table_append(&options.tables[TABLE_FILES], row);
+
+    // midi_get_track() reaches 256 tracks
+    for (int i = 0; i < midi->hdr.tracks && i <= UINT8_MAX && status == 0; ++i) {
+        midi_track_t *trk = midi_get_track(midi, i);
+
+        if (trk == NULL) {
+            status = midi_get_errno(midi) ? midi_get_errno(midi) : EINVAL;
+            fprintf(stderr, "Failed to read track %d of %s: %s\n", i, entry->name, midi_get_errmsg(midi));
+            break;
+        }
+        status = export_track(trk);
+        midi_free_track(trk);
+    }
+
+    midi_close(midi);
+
+    return status;
+}
+
+int main(int argc, char **argv)
+{
+    const char *prefix = "corpus";
+    uint32_t batch_rows = EXPORT_BATCH_ROWS;
+    corpus_t corpus;
+    corpus_entry_t entry;
+    int status = 0;
+    int opt_char;
+
+    while ((opt_char = getopt(argc, argv, "b:o:r")) != -1) {
+        switch (opt_char) {
+            case 'b':
+                batch_rows = strtoul(optarg, NULL, 10);
+                break;
+            case 'o':
+                prefix = optarg;
+                break;
+            case 'r':
+                options.recover = true;
+                break;
+            default:
+                batch_rows = 0;
+                break;
+        }
+    }
+
+    if (optind >= argc || batch_rows == 0) {
+        fprintf(stderr, "Usage: %s [-b rows] [-o prefix] [-r] filename.mid|archive ...\n\n", argv[0]);
+        return 1;
+    }
+
+    for (int i = 0; i < TABLES && status == 0; ++i) {
+        char name[1024];
+
+        snprintf(name, sizeof(name), "%s.%s.arrow", prefix, tables[i].suffix);
+        options.fds[i] = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (options.fds[i] < 0) {
+            status = errno;
+            fprintf(stderr, "Failed to create %s: %s\n", name, strerror(status));
+            break;
+        }
+        status = arrow_table_open(&options.tables[i], options.fds[i], tables[i].fields, tables[i].count, batch_rows);
+        if (status) {
+            fprintf(stderr, "Failed to write %s: %s\n", name, strerror(status));
+        }
+    }
+    if (status) {
+        return 1;
+    }
+
+    corpus_init(&corpus, &argv[optind], argc - optind);
+    while (status == 0 && corpus_next(&corpus, &entry)) {
+        if (entry.status) {
+            fprintf(stderr, "Failed to read %s: %s\n", entry.name, strerror(entry.status));
+            options.failed++;
+            continue;
+        }
+        if (export_file(&entry)) {
+            options.failed++;
+        }
+        options.file++;
+
+        // Only a failed write stops the export
+        for (int i = 0; i < TABLES; ++i) {
+            status = status ? status : options.tables[i].errnum;
+        }
+    }
+    corpus_close(&corpus);
+
+    for (int i = 0; i < TABLES; ++i) {
+        int end = arrow_table_close(&options.tables[i]);
+
+        status = status ? status : end;
+        if (close(options.fds[i]) != 0 && status == 0) {
+            status = errno;
+        }
+        printf("%s.%s.arrow: %lu rows, %u batches\n", prefix, tables[i].suffix,
+                (unsigned long)options.tables[i].total, options.tables[i].batches);
+    }
+    if (status) {
+        fprintf(stderr, "Failed to write the tables: %s\n", strerror(status));
+        return 1;
+    }
+
+    return options.failed ? 1 : 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
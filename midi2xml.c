@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "midi.h"
+#include "emitter.h"
+#include "convert.h"
+
+/**
+ * Export midi files to MusicXML <file>.musicxml
+ *
+ * Same as midi2score -f xml. Every track with notes becomes a part. Tempo,
+ * time and key signature are taken from the first ones found in the file.
+ *
+ * Like midi2score, reads tar / zip archives directly and writes into a tar
+ * archive with -o, and with -b estimates the beat of files without a tempo
+ * event.
+ */
+
+#define XML_DIVISIONS       4       // 16th note grid
+
+int main(int argc, char**argv)
+{
+    const midi_emitter_t *emitters[] = { &midi_emitter_xml };
+    emitter_options_t opt = { .divisions = XML_DIVISIONS };
+    const char *out_archive = NULL;
+    int opt_char;
+
+    while ((opt_char = getopt(argc, argv, "bd:o:")) != -1) {
+        switch (opt_char) {
+            case 'b':
+                opt.beats = true;
+                break;
+            case 'd':
+                opt.divisions = strtoul(optarg, NULL, 10);
+                break;
+            case 'o':
+                out_archive = optarg;
+                break;
+            default:
+                opt.divisions = 0;
+                break;
+        }
+    }
+
+    if (optind >= argc || opt.divisions == 0) {
+        fprintf(stderr, "Usage: %s [-b] [-d divisions] [-o out.tar] filename.mid|archive ...\n\n", argv[0]);
+        return 1;
+    }
+
+    if (midi_convert_corpus(&argv[optind], argc - optind, emitters, 1, &opt, out_archive)) {
+        return 1;
+    }
+
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
@@ -0,0 +1,315 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "note.h"
+#include "midilite.h"
+
+// See midi.h and emitter.c, the lite converter does what they do
+#define LITE_HEADER_SIZE            14
+#define LITE_CHUNK_HEADER_SIZE      8
+
+#define LITE_NOTE_OFF               0x08
+#define LITE_NOTE_ON                0x09
+#define LITE_PROGRAM_CHANGE         0x0C
+#define LITE_CHANNEL_PRESSURE       0x0D
+
+#define LITE_META_TEMPO             0x51
+#define LITE_META_TIME_SIGNATURE    0x58
+#define LITE_META_KEY_SIGNATURE     0x59
+
+#define SCORE_OFFSET_DATA           12
+
+enum {
+    LITE_TRACK_CONDUCTOR = 1,
+    LITE_TRACK_MELODY = 2,
+};
+
+typedef struct {
+    Clef_t              clef;
+    KeySignature_t      ks;
+    TimeSignature_t     ts;
+} lite_signature_t;
+
+static inline uint32_t lite_be_32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static inline uint16_t lite_be_16(const uint8_t *p)
+{
+    return p[0] << 8 | p[1];
+}
+
+static bool lite_read_vlq(midilite_work_t *w, uint32_t end, uint32_t *value)
+{
+    uint32_t v = 0;
+
+    for (int i = 0; i < 4 && w->pos < end; ++i) {
+        uint8_t b = w->buf[w->pos++];
+
+        v = (v << 7) | (b & 0x7F);
+        if (!(b & 0x80)) {
+            *value = v;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Same as midi_parse_division()
+static uint16_t lite_division(uint16_t division)
+{
+    int8_t fps = (int8_t)(division >> 8);
+
+    if ((division & 0x8000) == 0) {
+        return division & 0x7FFF;
+    }
+
+    switch (fps) {
+        case -24:
+        case -25:
+            return (uint16_t)(-fps * (division & 0x7F));
+        case -29:
+        case -30:
+            return (uint16_t)(30 * (division & 0x7F));
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Same as midi_delta_time_to_length() of emitter.c, with the fractions
+ * 3.6, 1.8, 0.9 and 0.45 of a quarter note compared in twentieths.
+ */
+static uint8_t lite_length(uint32_t delta_time, uint32_t base)
+{
+    uint64_t d = (uint64_t)delta_time * 20;
+    uint64_t b = base;
+
+    if (!delta_time || !base) {
+        return NOTE_LENGTH_QUARTER;
+    }
+
+    if (d >= b * 72) {
+        return NOTE_LENGTH_WHOLE;
+    } else if (d >= b * 36) {
+        return NOTE_LENGTH_HALF;
+    } else if (d >= b * 18) {
+        return NOTE_LENGTH_QUARTER;
+    } else if (d >= b * 9) {
+        return NOTE_LENGTH_EIGHTH;
+    }
+
+    return NOTE_LENGTH_16TH;
+}
+
+static void lite_note(midilite_work_t *w, uint8_t key, uint32_t end)
+{
+    NoteSimplified_t simp = NumNotaiton_KeyToNoteSimp(key, lite_length(end - w->last_end, w->ppq));
+
+    w->last_end = end;
+
+    if (SCORE_OFFSET_DATA + w->count >= MIDILITE_SCORE_SIZE) {
+        w->full = true;
+        return;
+    }
+
+    w->score[SCORE_OFFSET_DATA + w->count] = *(uint8_t *)&simp;
+    w->count++;
+}
+
+static void lite_meta(midilite_work_t *w, lite_signature_t *sig, uint8_t type, const uint8_t *data, uint32_t len)
+{
+    switch (type) {
+        case LITE_META_TEMPO:
+            if (len >= 3) {
+                w->tempo = (uint32_t)data[0] << 16 | data[1] << 8 | data[2];
+            }
+            break;
+        case LITE_META_TIME_SIGNATURE:
+            if (len >= 2) {
+                sig->ts.upper = data[0];
+                sig->ts.lower = data[1];
+            }
+            break;
+        case LITE_META_KEY_SIGNATURE:
+            if (len >= 2) {
+                sig->ks.signature = data[0];
+                sig->ks.scale = data[1];
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * Walk the events of the track chunk at w->pos, of end bytes. roles tells
+ * whether its meta events (conductor) and its notes (melody) are used.
+ * Notes are paired like midi_track_walk() does, and handed on at their end.
+ */
+static int lite_track(midilite_work_t *w, uint32_t end, int roles, lite_signature_t *sig)
+{
+    uint32_t tick = 0;
+
+    w->running = 0;
+    memset(w->on, 0, sizeof(w->on));
+
+    while (w->pos < end) {
+        uint32_t delta;
+        uint32_t len;
+        uint8_t b;
+
+        if (!lite_read_vlq(w, end, &delta) || w->pos >= end) {
+            return MIDILITE_ERR_EVENT;
+        }
+        tick += delta;
+        b = w->buf[w->pos];
+
+        if (b == 0xFF || b == 0xF0 || b == 0xF7) {
+            uint8_t type = 0;
+
+            w->pos++;
+            if (b == 0xFF) {
+                if (w->pos >= end || (w->buf[w->pos] & 0x80)) {
+                    return MIDILITE_ERR_EVENT;
+                }
+                type = w->buf[w->pos++];
+            } else {
+                // Sysex cancels running status
+                w->running = 0;
+            }
+            if (!lite_read_vlq(w, end, &len) || len > end - w->pos) {
+                return MIDILITE_ERR_EVENT;
+            }
+            if (b == 0xFF && (roles & LITE_TRACK_CONDUCTOR)) {
+                lite_meta(w, sig, type, w->buf + w->pos, len);
+            }
+            w->pos += len;
+            continue;
+        }
+
+        uint8_t status = b;
+        uint8_t cmd;
+        int argn = 2;
+
+        if (b & 0x80) {
+            w->pos++;
+            w->running = b;
+        } else {
+            status = w->running;
+        }
+
+        cmd = status >> 4;
+        if (!(cmd & 0x08) || cmd == 0x0F) {
+            return MIDILITE_ERR_EVENT;
+        }
+        if (cmd == LITE_PROGRAM_CHANGE || cmd == LITE_CHANNEL_PRESSURE) {
+            argn--;
+        }
+        if (w->pos + argn > end) {
+            return MIDILITE_ERR_EVENT;
+        }
+
+        if ((roles & LITE_TRACK_MELODY) && (cmd == LITE_NOTE_ON || cmd == LITE_NOTE_OFF)) {
+            uint8_t chan = status & 0x0F;
+            uint8_t key = w->buf[w->pos] & 0x7F;
+            uint8_t bit = 1 << (key & 7);
+            bool off = cmd == LITE_NOTE_OFF || w->buf[w->pos + 1] == 0;
+
+            if (w->on[chan][key >> 3] & bit) {
+                w->on[chan][key >> 3] &= ~bit;
+                lite_note(w, key, tick);
+            }
+            if (!off) {
+                w->on[chan][key >> 3] |= bit;
+            }
+        }
+        w->pos += argn;
+    }
+
+    // Close notes left sounding, by channel and key
+    if (roles & LITE_TRACK_MELODY) {
+        for (int chan = 0; chan < 16; ++chan) {
+            for (int key = 0; key < 128; ++key) {
+                if (w->on[chan][key >> 3] & (1 << (key & 7))) {
+                    lite_note(w, key, tick);
+                }
+            }
+        }
+    }
+
+    return MIDILITE_OK;
+}
+
+int midilite_convert(const uint8_t *buf, uint32_t size, midilite_work_t *w, uint8_t *score)
+{
+    lite_signature_t sig;
+    uint32_t hdr_len;
+    uint16_t tracks;
+    int melody;
+
+    memset(w, 0, sizeof(*w));
+    memset(&sig, 0, sizeof(sig));
+    memset(score, 0, MIDILITE_SCORE_SIZE);
+    w->buf = buf;
+    w->size = size;
+    w->score = score;
+    w->tempo = 500000;
+    sig.ts.upper = 4;
+    sig.ts.lower = 2;
+
+    if (size < LITE_HEADER_SIZE || memcmp(buf, "MThd", 4) != 0) {
+        return MIDILITE_ERR_HEADER;
+    }
+    hdr_len = lite_be_32(buf + 4);
+    if (hdr_len < LITE_HEADER_SIZE - LITE_CHUNK_HEADER_SIZE || hdr_len > size - LITE_CHUNK_HEADER_SIZE) {
+        return MIDILITE_ERR_HEADER;
+    }
+    tracks = lite_be_16(buf + 10);
+    w->ppq = lite_division(lite_be_16(buf + 12));
+    w->pos = LITE_CHUNK_HEADER_SIZE + hdr_len;
+
+    // The songs of a format 2 file are converted one by one, this is the first
+    if (lite_be_16(buf + 8) == 2 && tracks > 1) {
+        tracks = 1;
+    }
+    melody = tracks >= 2 ? 1 : 0;
+
+    for (int t = 0; t <= melody && t < tracks; ++t) {
+        uint32_t len;
+        int roles = (t == 0 ? LITE_TRACK_CONDUCTOR : 0) | (t == melody ? LITE_TRACK_MELODY : 0);
+        int status;
+
+        if (size - w->pos < LITE_CHUNK_HEADER_SIZE || memcmp(buf + w->pos, "MTrk", 4) != 0) {
+            return MIDILITE_ERR_TRACK;
+        }
+        len = lite_be_32(buf + w->pos + 4);
+        w->pos += LITE_CHUNK_HEADER_SIZE;
+        if (len > size - w->pos) {
+            return MIDILITE_ERR_TRUNCATED;
+        }
+
+        status = lite_track(w, w->pos + len, roles, &sig);
+        if (status) {
+            return status;
+        }
+    }
+
+    // Header, as ssc_end() writes it
+    score[0] = 'M';
+    score[1] = 'S';
+    score[2] = 'S';
+    score[3] = 'C';
+    score[4] = *(uint8_t *)&sig.clef;
+    score[5] = *(uint8_t *)&sig.ks;
+    score[6] = *(uint8_t *)&sig.ts;
+    score[8] = w->count >> 8;
+    score[9] = w->count & 0xFF;
+
+    return MIDILITE_OK;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
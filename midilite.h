@@ -0,0 +1,67 @@
+#ifndef __MIDILITE_H__
+#define __MIDILITE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Midi to Score, Lite
+ *
+ * The midi file to score file (.ssc) conversion of midi2score for small
+ * targets: it parses a midi file from a buffer the caller gives, keeps
+ * its state in a workspace the caller gives (statically allocated, most
+ * likely) and streams the notes straight into a fixed score buffer. It
+ * allocates nothing, uses no stdio, no floating point, and reports errors
+ * as codes rather than messages.
+ *
+ * static midilite_work_t work;
+ * static uint8_t score[MIDILITE_SCORE_SIZE];
+ *
+ * if (midilite_convert(midi_data, midi_size, &work, score) == MIDILITE_OK) {
+ *     // score holds the same bytes as filename.mid.ssc
+ * }
+ *
+ * Only the tracks the score needs are parsed: the conductor track (tempo,
+ * signatures) and the melody track, see emitter.c. Of a format 2 file the
+ * first song is converted.
+ */
+
+#define MIDILITE_SCORE_SIZE     512
+
+enum {
+    MIDILITE_OK = 0,
+    MIDILITE_ERR_HEADER,        // Not a midi file, or a header too short
+    MIDILITE_ERR_TRUNCATED,     // A chunk runs past the end of the buffer
+    MIDILITE_ERR_TRACK,         // Fewer tracks than the header says
+    MIDILITE_ERR_EVENT,         // An event can't be decoded
+};
+
+typedef struct {
+    // Input
+    const uint8_t * buf;
+    uint32_t        size;
+    uint32_t        pos;
+    uint8_t         running;    // Running status
+
+    // Score
+    uint8_t *       score;
+    uint16_t        ppq;
+    uint32_t        tempo;
+    uint32_t        last_end;   // End of the previous note
+    uint16_t        count;      // Notes in the score
+    bool            full;       // Notes were dropped
+
+    // Keys sounding, a bit per channel and key
+    uint8_t         on[16][128 / 8];
+} midilite_work_t;
+
+/**
+ * Convert the midi file in buf (size bytes) into score, a buffer of
+ * MIDILITE_SCORE_SIZE bytes. Returns MIDILITE_OK or one of the errors
+ * above; work->count and work->full tell how many notes were kept.
+ */
+int midilite_convert(const uint8_t *buf, uint32_t size, midilite_work_t *work, uint8_t *score);
+
+#endif /* __MIDILITE_H__ */
+
+/* vim: set ts=4 sw=4 tw=0 list : */
@@ -0,0 +1,441 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "note.h"
+#include "musicxml.h"
+
+// Append a string literal without strlen()
+#define XW_LIT(w, s)    xw_put((w), (s), sizeof(s) - 1)
+
+static const char *const step_sharp[12] = { "C", "C", "D", "D", "E", "F", "F", "G", "G", "A", "A", "B" };
+static const char *const step_flat[12]  = { "C", "D", "D", "E", "E", "F", "G", "G", "A", "A", "B", "B" };
+static const int8_t alter_sharp[12]     = {  0,   1,   0,   1,   0,   0,   1,   0,   1,   0,   1,   0  };
+static const int8_t alter_flat[12]      = {  0,  -1,   0,  -1,   0,   0,  -1,   0,  -1,   0,  -1,   0  };
+
+static void musicxml_chord(musicxml_t *xml);
+
+static void xw_flush(xml_writer_t *w)
+{
+    if (w->used > 0 && w->errnum == 0) {
+        if (fwrite(w->buf, 1, w->used, w->fp) != w->used) {
+            w->errnum = errno ? errno : EIO;
+        }
+    }
+    w->used = 0;
+}
+
+static void xw_put(xml_writer_t *w, const char *s, size_t n)
+{
+    if (w->used + n > w->size) {
+        xw_flush(w);
+
+        if (n > w->size) {
+            if (w->errnum == 0 && fwrite(s, 1, n, w->fp) != n) {
+                w->errnum = errno ? errno : EIO;
+            }
+            return;
+        }
+    }
+
+    memcpy(w->buf + w->used, s, n);
+    w->used += n;
+}
+
+static void xw_uint(xml_writer_t *w, uint32_t v)
+{
+    char digits[10];
+    int n = 0;
+
+    do {
+        digits[sizeof(digits) - 1 - n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+
+    xw_put(w, digits + sizeof(digits) - n, n);
+}
+
+static void xw_int(xml_writer_t *w, int32_t v)
+{
+    if (v < 0) {
+        XW_LIT(w, "-");
+        v = -v;
+    }
+    xw_uint(w, (uint32_t)v);
+}
+
+// Character data, escaped
+static void xw_text(xml_writer_t *w, const char *s)
+{
+    for (; *s; ++s) {
+        switch (*s) {
+            case '&':  XW_LIT(w, "&amp;");  break;
+            case '<':  XW_LIT(w, "&lt;");   break;
+            case '>':  XW_LIT(w, "&gt;");   break;
+            case '"':  XW_LIT(w, "&quot;"); break;
+            default:
+                if ((unsigned char)*s >= 0x20 || *s == '\t') {
+                    xw_put(w, s, 1);
+                }
+                break;
+        }
+    }
+}
+
+static void musicxml_add_type(musicxml_t *xml, uint32_t num, uint32_t den, const char *name)
+{
+    uint32_t d = xml->grid.divisions;
+
+    // Plain and dotted, if they fit on the grid
+    if ((d * num) % den == 0 && xml->types < MUSICXML_NOTE_TYPES) {
+        xml->type_duration[xml->types] = d * num / den;
+        xml->type_name[xml->types] = name;
+        xml->type_dot[xml->types++] = false;
+    }
+    if ((d * num * 3) % (den * 2) == 0 && xml->types < MUSICXML_NOTE_TYPES) {
+        xml->type_duration[xml->types] = d * num * 3 / (den * 2);
+        xml->type_name[xml->types] = name;
+        xml->type_dot[xml->types++] = true;
+    }
+}
+
+int musicxml_open(musicxml_t *xml, FILE *fp, const quant_grid_t *grid, int8_t fifths)
+{
+    memset(xml, 0, sizeof *xml);
+
+    xml->w.fp = fp;
+    xml->w.size = MUSICXML_BUFFER_SIZE;
+    xml->w.buf = malloc(xml->w.size);
+    if (xml->w.buf == NULL) {
+        return ENOMEM;
+    }
+
+    xml->grid = *grid;
+    xml->fifths = fifths;
+
+    musicxml_add_type(xml, 4, 1, "whole");
+    musicxml_add_type(xml, 2, 1, "half");
+    musicxml_add_type(xml, 1, 1, "quarter");
+    musicxml_add_type(xml, 1, 2, "eighth");
+    musicxml_add_type(xml, 1, 4, "16th");
+    musicxml_add_type(xml, 1, 8, "32nd");
+    musicxml_add_type(xml, 1, 16, "64th");
+
+    // Longest first
+    for (int i = 1; i < xml->types; ++i) {
+        for (int j = i; j > 0 && xml->type_duration[j] > xml->type_duration[j - 1]; --j) {
+            uint32_t duration = xml->type_duration[j];
+            const char *name = xml->type_name[j];
+            bool dot = xml->type_dot[j];
+
+            xml->type_duration[j] = xml->type_duration[j - 1];
+            xml->type_name[j] = xml->type_name[j - 1];
+            xml->type_dot[j] = xml->type_dot[j - 1];
+            xml->type_duration[j - 1] = duration;
+            xml->type_name[j - 1] = name;
+            xml->type_dot[j - 1] = dot;
+        }
+    }
+
+    XW_LIT(&xml->w,
+            "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"no\"?>\n"
+            "<!DOCTYPE score-partwise PUBLIC \"-//Recordare//DTD MusicXML 4.0 Partwise//EN\" "
+            "\"http://www.musicxml.org/dtds/partwise.dtd\">\n"
+            "<score-partwise version=\"4.0\">\n");
+
+    return 0;
+}
+
+int musicxml_close(musicxml_t *xml)
+{
+    int errnum;
+
+    XW_LIT(&xml->w, "</score-partwise>\n");
+    xw_flush(&xml->w);
+
+    errnum = xml->w.errnum;
+    free(xml->w.buf);
+    xml->w.buf = NULL;
+
+    return errnum;
+}
+
+int musicxml_fork(const musicxml_t *xml, musicxml_t *seg, FILE *fp, uint32_t measures)
+{
+    *seg = *xml;
+
+    seg->w.fp = fp;
+    seg->w.used = 0;
+    seg->w.errnum = 0;
+    seg->w.buf = malloc(seg->w.size);
+    if (seg->w.buf == NULL) {
+        return ENOMEM;
+    }
+
+    // All that carries over from one item to the next
+    seg->open = measures > 0;
+    seg->first = measures == 0;
+    seg->chord_n = 0;
+
+    return 0;
+}
+
+int musicxml_fork_close(musicxml_t *seg)
+{
+    musicxml_chord(seg);
+    xw_flush(&seg->w);
+    free(seg->w.buf);
+    seg->w.buf = NULL;
+
+    return seg->w.errnum;
+}
+
+void musicxml_join(musicxml_t *xml, const void *data, size_t size, uint32_t measures)
+{
+    xw_put(&xml->w, data, size);
+
+    xml->open = measures > 0;
+    xml->first = measures == 0;
+}
+
+void musicxml_part_list(musicxml_t *xml, const char *const *names, uint16_t parts)
+{
+    xml_writer_t *w = &xml->w;
+
+    XW_LIT(w, "  <part-list>\n");
+    for (uint16_t i = 0; i < parts; ++i) {
+        XW_LIT(w, "    <score-part id=\"P");
+        xw_uint(w, i + 1);
+        XW_LIT(w, "\">\n      <part-name>");
+        if (names != NULL && names[i] != NULL) {
+            xw_text(w, names[i]);
+        }
+        XW_LIT(w, "</part-name>\n    </score-part>\n");
+    }
+    XW_LIT(w, "  </part-list>\n");
+}
+
+void musicxml_begin_part(musicxml_t *xml, uint16_t part, uint8_t clef, uint32_t tempo)
+{
+    XW_LIT(&xml->w, "  <part id=\"P");
+    xw_uint(&xml->w, part + 1);
+    XW_LIT(&xml->w, "\">\n");
+
+    xml->clef = clef;
+    xml->tempo = tempo;
+    xml->first = true;
+    xml->open = false;
+}
+
+void musicxml_end_part(musicxml_t *xml)
+{
+    musicxml_chord(xml);
+    if (xml->open) {
+        XW_LIT(&xml->w, "    </measure>\n");
+        xml->open = false;
+    }
+    XW_LIT(&xml->w, "  </part>\n");
+}
+
+static void musicxml_measure(musicxml_t *xml, uint32_t measure)
+{
+    xml_writer_t *w = &xml->w;
+
+    if (xml->open) {
+        XW_LIT(w, "    </measure>\n");
+    }
+
+    XW_LIT(w, "    <measure number=\"");
+    xw_uint(w, measure + 1);
+    XW_LIT(w, "\">\n");
+    xml->open = true;
+
+    if (!xml->first) {
+        return;
+    }
+    xml->first = false;
+
+    XW_LIT(w, "      <attributes>\n        <divisions>");
+    xw_uint(w, xml->grid.divisions);
+    XW_LIT(w, "</divisions>\n        <key><fifths>");
+    xw_int(w, xml->fifths);
+    XW_LIT(w, "</fifths></key>\n        <time><beats>");
+    xw_uint(w, xml->grid.beats);
+    XW_LIT(w, "</beats><beat-type>");
+    xw_uint(w, 1u << xml->grid.beat_type);
+    if (xml->clef == CLEF_TYPE_F) {
+        XW_LIT(w, "</beat-type></time>\n        <clef><sign>F</sign><line>4</line></clef>\n      </attributes>\n");
+    } else {
+        XW_LIT(w, "</beat-type></time>\n        <clef><sign>G</sign><line>2</line></clef>\n      </attributes>\n");
+    }
+
+    if (xml->tempo) {
+        XW_LIT(w, "      <direction placement=\"above\">\n        <direction-type><metronome><beat-unit>quarter</beat-unit><per-minute>");
+        xw_uint(w, (60000000 + xml->tempo / 2) / xml->tempo);
+        XW_LIT(w, "</per-minute></metronome></direction-type>\n        <sound tempo=\"");
+        xw_uint(w, (60000000 + xml->tempo / 2) / xml->tempo);
+        XW_LIT(w, "\"/>\n      </direction>\n");
+    }
+}
+
+static void musicxml_note(musicxml_t *xml, const quant_item_t *item, uint32_t duration, int type, bool tie_stop, bool tie_start)
+{
+    xml_writer_t *w = &xml->w;
+
+    XW_LIT(w, "      <note>\n");
+
+    if (item->type == QUANT_REST) {
+        if (type < 0) {
+            XW_LIT(w, "        <rest measure=\"yes\"/>\n");
+        } else {
+            XW_LIT(w, "        <rest/>\n");
+        }
+    } else {
+        uint8_t pc = item->key % 12;
+        int8_t alter = xml->fifths < 0 ? alter_flat[pc] : alter_sharp[pc];
+
+        if (item->chord) {
+            XW_LIT(w, "        <chord/>\n");
+        }
+        XW_LIT(w, "        <pitch><step>");
+        xw_put(w, xml->fifths < 0 ? step_flat[pc] : step_sharp[pc], 1);
+        XW_LIT(w, "</step>");
+        if (alter) {
+            XW_LIT(w, "<alter>");
+            xw_int(w, alter);
+            XW_LIT(w, "</alter>");
+        }
+        XW_LIT(w, "<octave>");
+        xw_int(w, item->key / 12 - 1);
+        XW_LIT(w, "</octave></pitch>\n");
+    }
+
+    XW_LIT(w, "        <duration>");
+    xw_uint(w, duration);
+    XW_LIT(w, "</duration>\n");
+
+    if (tie_stop) {
+        XW_LIT(w, "        <tie type=\"stop\"/>\n");
+    }
+    if (tie_start) {
+        XW_LIT(w, "        <tie type=\"start\"/>\n");
+    }
+
+    XW_LIT(w, "        <voice>1</voice>\n");
+
+    if (type >= 0) {
+        XW_LIT(w, "        <type>");
+        xw_put(w, xml->type_name[type], strlen(xml->type_name[type]));
+        XW_LIT(w, "</type>\n");
+        if (xml->type_dot[type]) {
+            XW_LIT(w, "        <dot/>\n");
+        }
+    }
+
+    if (tie_stop || tie_start) {
+        XW_LIT(w, "        <notations>");
+        if (tie_stop) {
+            XW_LIT(w, "<tied type=\"stop\"/>");
+        }
+        if (tie_start) {
+            XW_LIT(w, "<tied type=\"start\"/>");
+        }
+        XW_LIT(w, "</notations>\n");
+    }
+
+    XW_LIT(w, "      </note>\n");
+}
+
+/**
+ * Write the chord collected, a single note being a chord of one. Its
+ * duration is split into note types once, a chord whose duration has no
+ * note type written as tied pieces with every note in each piece.
+ */
+static void musicxml_chord(musicxml_t *xml)
+{
+    quant_item_t item = xml->chord;
+    uint32_t left = item.duration;
+    bool first = true;
+
+    if (xml->chord_n == 0) {
+        return;
+    }
+
+    while (left > 0) {
+        int type = xml->types - 1;
+
+        for (int i = 0; i < xml->types; ++i) {
+            if (xml->type_duration[i] <= left) {
+                type = i;
+                break;
+            }
+        }
+
+        // Shorter than the shortest type: write it as that type anyway
+        uint32_t piece = xml->type_duration[type] <= left ? xml->type_duration[type] : left;
+
+        left -= piece;
+        for (uint8_t i = 0; i < xml->chord_n; ++i) {
+            item.key = xml->chord_keys[i];
+            item.chord = (i > 0);
+            musicxml_note(xml, &item, piece, type, first ? xml->chord.tie_stop : true,
+                    left > 0 ? true : xml->chord.tie_start);
+        }
+        first = false;
+    }
+
+    xml->chord_n = 0;
+}
+
+/**
+ * Notes are collected into their chord, written when an item that isn't
+ * part of it comes or the part ends. Rests are written as consecutive
+ * rests.
+ */
+void musicxml_item(const quant_item_t *item, void *arg)
+{
+    musicxml_t *xml = arg;
+    uint32_t left = item->duration;
+
+    if (item->type == QUANT_NOTE) {
+        if (!item->chord) {
+            musicxml_chord(xml);
+            xml->chord = *item;
+        }
+        if (xml->chord_n < sizeof(xml->chord_keys)) {
+            xml->chord_keys[xml->chord_n++] = item->key;
+        }
+        return;
+    }
+    musicxml_chord(xml);
+
+    if (item->type == QUANT_MEASURE) {
+        musicxml_measure(xml, item->measure);
+        return;
+    }
+
+    if (item->duration == xml->grid.measure && item->start % xml->grid.measure == 0) {
+        musicxml_note(xml, item, item->duration, -1, false, false);
+        return;
+    }
+
+    while (left > 0) {
+        int type = xml->types - 1;
+
+        for (int i = 0; i < xml->types; ++i) {
+            if (xml->type_duration[i] <= left) {
+                type = i;
+                break;
+            }
+        }
+
+        uint32_t piece = xml->type_duration[type] <= left ? xml->type_duration[type] : left;
+
+        left -= piece;
+        musicxml_note(xml, item, piece, type, false, false);
+    }
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
@@ -0,0 +1,93 @@
+#ifndef __MUSICXML_H__
+#define __MUSICXML_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "quantize.h"
+
+/**
+ * MusicXML Exporter
+ *
+ * Writes a score-partwise document straight from the quantizer stream. There
+ * is no document tree: elements are appended to one buffer, allocated once
+ * when the exporter is opened, which is written out whenever it fills up.
+ *
+ * Usage Sample:
+ *
+ * musicxml_t xml;
+ *
+ * musicxml_open(&xml, fp, &grid, fifths);
+ * musicxml_part_list(&xml, names, parts);
+ * for (int i = 0; i < parts; ++i) {
+ *     musicxml_begin_part(&xml, i, CLEF_TYPE_G, tempo);
+ *     quantize_notes(notes[i], count[i], &grid, musicxml_item, &xml);
+ *     musicxml_end_part(&xml);
+ * }
+ * musicxml_close(&xml);
+ *
+ * Reference:
+ * - https://www.w3.org/2021/06/musicxml40/
+ */
+
+#define MUSICXML_BUFFER_SIZE    (64 * 1024)
+#define MUSICXML_NOTE_TYPES     16
+
+typedef struct {
+    FILE *          fp;
+    char *          buf;
+    size_t          size;
+    size_t          used;
+    int             errnum;
+} xml_writer_t;
+
+typedef struct {
+    xml_writer_t        w;
+    quant_grid_t        grid;
+    int8_t              fifths;         // Key signature, < 0 flats, > 0 sharps
+    uint32_t            tempo;          // us per quarter note, 0 = none
+    uint8_t             clef;           // CLEF_TYPE_G or CLEF_TYPE_F
+    bool                open;           // A measure is open
+    bool                first;          // Next measure is the first of the part
+    uint8_t             types;          // Entries in type_duration
+    uint32_t            type_duration[MUSICXML_NOTE_TYPES];
+    const char *        type_name[MUSICXML_NOTE_TYPES];
+    bool                type_dot[MUSICXML_NOTE_TYPES];
+    quant_item_t        chord;          // Chord being collected, its first note
+    uint8_t             chord_keys[128];
+    uint8_t             chord_n;        // Notes in it, 0 = none
+} musicxml_t;
+
+int musicxml_open(musicxml_t *xml, FILE *fp, const quant_grid_t *grid, int8_t fifths);
+// Flush and free the buffer, returns 0 or the errno of the first failed write
+int musicxml_close(musicxml_t *xml);
+
+void musicxml_part_list(musicxml_t *xml, const char *const *names, uint16_t parts);
+// clef is CLEF_TYPE_G or CLEF_TYPE_F, tempo in us per quarter note is written
+// in the first measure if not 0
+void musicxml_begin_part(musicxml_t *xml, uint16_t part, uint8_t clef, uint32_t tempo);
+void musicxml_end_part(musicxml_t *xml);
+
+/**
+ * Segments of a part (see quantize_split()) are written on their own, each
+ * by a fork of the exporter into its own stream, and joined back in order:
+ *
+ * musicxml_fork(&xml, &seg, memstream, seg->measures);
+ * quantize_segment(notes, count, &grid, seg, last, musicxml_item, &seg);
+ * musicxml_fork_close(&seg);
+ * ...
+ * musicxml_join(&xml, data, size, measures);   // measures after the segment
+ *
+ * Returns 0 or a POSIX errno.
+ */
+int musicxml_fork(const musicxml_t *xml, musicxml_t *seg, FILE *fp, uint32_t measures);
+int musicxml_fork_close(musicxml_t *seg);
+void musicxml_join(musicxml_t *xml, const void *data, size_t size, uint32_t measures);
+
+// quant_cb_t for quantize_notes()
+void musicxml_item(const quant_item_t *item, void *arg);
+
+#endif /* __MUSICXML_H__ */
+
+/* vim: set ts=4 sw=4 tw=0 list : */
@@ -0,0 +1,110 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "player.h"
+
+// 32nd notes of NOTE_LENGTH_HALF, _QUARTER, _EIGHTH, _16TH
+static const uint8_t lengths[] = { 16, 8, 4, 2 };
+
+uint8_t player_note_32nds(NoteSimplified_t note)
+{
+    return lengths[note.length];
+}
+
+uint8_t player_full_note_32nds(Note_t note)
+{
+    uint8_t len = note.len2 ? 32 : lengths[note.length];
+
+    return note.dot ? len + len / 2 : len;
+}
+
+// Press the key of the next note, its length added to the time left
+static void player_next(player_t *p)
+{
+    uint8_t len;
+
+    if (p->full) {
+        Note_t note;
+
+        memcpy(&note, p->notes + p->next * sizeof(Note_t), sizeof(note));
+        p->key = NumNotaiton_NoteToKeyNote(note);
+        len = player_full_note_32nds(note);
+    } else {
+        NoteSimplified_t note;
+
+        memcpy(&note, p->notes + p->next, sizeof(note));
+        p->key = NumNotaiton_NoteSimpToKeyNote(note);
+        len = player_note_32nds(note);
+    }
+
+    p->next++;
+    p->remaining += len * p->unit;
+    if (p->key) {
+        p->key_cb(p->key, true, p->arg);
+    }
+}
+
+static void player_begin(player_t *p, const void *notes, uint16_t count, bool full, uint32_t tempo_us, uint32_t hz,
+        player_key_cb_t key_cb, void *arg)
+{
+    memset(p, 0, sizeof(*p));
+    p->notes = notes;
+    p->count = count;
+    p->full = full;
+    p->unit = (int64_t)tempo_us * hz;
+    p->key_cb = key_cb;
+    p->arg = arg;
+    p->playing = count > 0 && hz > 0;
+
+    if (p->playing) {
+        player_next(p);
+    }
+}
+
+void player_start_simplified(player_t *player, const ScoreSimplified_t *score, uint32_t tempo_us, uint32_t hz,
+        player_key_cb_t key_cb, void *arg)
+{
+    player_begin(player, score->notes, score->size, false, tempo_us, hz, key_cb, arg);
+}
+
+void player_start(player_t *player, const Score_t *score, uint32_t tempo_us, uint32_t hz,
+        player_key_cb_t key_cb, void *arg)
+{
+    player_begin(player, score->notes, score->size, true, tempo_us, hz, key_cb, arg);
+}
+
+bool player_tick(player_t *p)
+{
+    if (!p->playing) {
+        return false;
+    }
+
+    p->tick++;
+    p->remaining -= PLAYER_TICK_UNITS;
+
+    while (p->remaining <= 0) {
+        if (p->key) {
+            p->key_cb(p->key, false, p->arg);
+            p->key = 0;
+        }
+        if (p->next >= p->count) {
+            p->playing = false;
+            return false;
+        }
+        player_next(p);
+    }
+
+    return true;
+}
+
+void player_stop(player_t *p)
+{
+    if (p->playing && p->key) {
+        p->key_cb(p->key, false, p->arg);
+    }
+    p->key = 0;
+    p->playing = false;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
@@ -0,0 +1,72 @@
+#ifndef __PLAYER_H__
+#define __PLAYER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "note.h"
+
+/**
+ * Score Playback
+ *
+ * Plays a score on a device from its tick timer: start a score, then call
+ * player_tick() from the timer interrupt, hz times a second. Keys are
+ * pressed and released through the callback, from within player_tick().
+ *
+ * static player_t player;
+ *
+ * player_start_simplified(&player, &score, 500000, 1000, key_cb, NULL);
+ * // In the 1 kHz timer interrupt:
+ * if (!player_tick(&player)) {
+ *     // Done
+ * }
+ *
+ * Note lengths are counted in 32nd notes and time in units of 1 / (8 hz)
+ * microseconds, where a tick is 8000000 units and a 32nd note tempo_us * hz,
+ * both exact integers: notes start and end on the first tick at or after
+ * their time, never drifting. Every tick is O(1), except that a note shorter
+ * than a tick is ended in the same tick it starts.
+ *
+ * No malloc, no stdio, no floating point.
+ */
+
+#define PLAYER_TICK_UNITS       8000000
+
+typedef void (*player_key_cb_t)(uint8_t key, bool on, void *arg);
+
+typedef struct {
+    const uint8_t *     notes;      // NoteSimplified_t or Note_t
+    uint16_t            count;
+    uint16_t            next;       // Note to start next
+    bool                full;       // Notes are Note_t
+    bool                playing;
+    uint8_t             key;        // Key down, 0 for none (a rest)
+    int64_t             remaining;  // Of the current note, in units
+    int64_t             unit;       // Units of a 32nd note
+    uint32_t            tick;
+    player_key_cb_t     key_cb;
+    void *              arg;
+} player_t;
+
+/**
+ * Start playing score at tempo_us microseconds per quarter note, with a
+ * timer of hz ticks per second. The first key goes down right away.
+ */
+void player_start_simplified(player_t *player, const ScoreSimplified_t *score, uint32_t tempo_us, uint32_t hz,
+        player_key_cb_t key_cb, void *arg);
+void player_start(player_t *player, const Score_t *score, uint32_t tempo_us, uint32_t hz,
+        player_key_cb_t key_cb, void *arg);
+
+// Advance one tick, false once the score has ended
+bool player_tick(player_t *player);
+
+// Stop, releasing the key that is down
+void player_stop(player_t *player);
+
+// Length of a note in 32nd notes
+uint8_t player_note_32nds(NoteSimplified_t note);
+uint8_t player_full_note_32nds(Note_t note);
+
+#endif /* __PLAYER_H__ */
+
+/* vim: set ts=4 sw=4 tw=0 list : */
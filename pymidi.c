@@ -0,0 +1,556 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <pythread.h>
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "midi.h"
+#include "timeline.h"
+
+/**
+ * Python bindings, the pymidi module
+ *
+ * Tracks are decoded into columns, one C array per field, handed to Python
+ * as buffer protocol objects over the C memory: NumPy, memoryview, pyarrow
+ * and the like read them without a copy.
+ *
+ *   import numpy as np, pymidi
+ *
+ *   m = pymidi.open("a.mid")                   # or pymidi.parse(data)
+ *   ev = m.track(1)                            # abs_tick, status, key, velocity
+ *   ticks = np.asarray(ev["abs_tick"])         # uint32, no copy
+ *   notes = m.notes(1)                         # start, end, key, velocity, channel
+ *
+ * status is the status byte of channel events (cmd << 4 | channel), 0xFF
+ * for meta events and 0xF0 / 0xF7 for sysex; key and velocity are the two
+ * data bytes of channel events, 0 where there are none. Notes are those of
+ * the note timeline (timeline.h), in note off order.
+ *
+ * The columns of a track are decoded once and kept by the Midi object, the
+ * columns hold a reference to it: the midi_t and the arrays live as long
+ * as any column, or array made from one, does.
+ *
+ * Opening, parsing and decoding release the GIL, so a thread pool decodes
+ * files in parallel. The tracks of one Midi object are decoded one at a
+ * time, they share its file.
+ *
+ * Built by "make pymidi" into pymidi<extension suffix>, next to the tools.
+ */
+
+typedef struct {
+    uint32_t    events;
+    uint32_t    notes;
+    uint8_t *   block;      // Events columns, then the notes columns, NULL if not decoded
+} pymidi_track_t;
+
+typedef struct {
+    PyObject_HEAD
+    midi_t *            midi;
+    Py_buffer           source;     // Bytes parsed, midi_open_mem() reads them in place
+    bool                has_source;
+    PyThread_type_lock  lock;       // The file of midi is read by one thread at a time
+    pymidi_track_t *    tracks;
+} pymidi_t;
+
+typedef struct {
+    PyObject_HEAD
+    PyObject *          owner;      // The pymidi_t of the memory
+    void *              data;
+    Py_ssize_t          count;
+    Py_ssize_t          itemsize;
+    const char *        format;     // struct module format
+} pymidi_column_t;
+
+typedef struct {
+    midi_note_t *       notes;
+    uint32_t            count;
+    uint32_t            size;
+    bool                failed;
+} pymidi_notes_t;
+
+static PyTypeObject pymidi_type;
+static PyTypeObject pymidi_column_type;
+
+static PyObject *pymidi_error(int status, const char *what)
+{
+    PyObject *args = Py_BuildValue("(is)", status, what);
+
+    if (args != NULL) {
+        PyErr_SetObject(status == ENOMEM ? PyExc_MemoryError : PyExc_OSError, args);
+        Py_DECREF(args);
+    }
+
+    return NULL;
+}
+
+/*
+ * Columns
+ */
+
+static int pymidi_column_getbuffer(PyObject *obj, Py_buffer *view, int flags)
+{
+    static uint8_t empty[8];
+    pymidi_column_t *col = (pymidi_column_t *)obj;
+
+    if (flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "pymidi columns are read-only");
+        view->obj = NULL;
+        return -1;
+    }
+
+    view->obj = obj;
+    Py_INCREF(obj);
+    view->buf = col->data ? col->data : empty;
+    view->len = col->count * col->itemsize;
+    view->readonly = 1;
+    view->itemsize = col->itemsize;
+    view->format = (flags & PyBUF_FORMAT) ? (char *)col->format : NULL;
+    view->ndim = 1;
+    view->shape = (flags & PyBUF_ND) ? &col->count : NULL;
+    view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? &col->itemsize : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+
+    return 0;
+}
+
+static Py_ssize_t pymidi_column_len(PyObject *obj)
+{
+    return ((pymidi_column_t *)obj)->count;
+}
+
+static void pymidi_column_dealloc(PyObject *obj)
+{
+    Py_XDECREF(((pymidi_column_t *)obj)->owner);
+    Py_TYPE(obj)->tp_free(obj);
+}
+
+static PyBufferProcs pymidi_column_buffer = {
+    .bf_getbuffer = pymidi_column_getbuffer,
+};
+
+static PySequenceMethods pymidi_column_sequence = {
+    .sq_length = pymidi_column_len,
+};
+
+static PyTypeObject pymidi_column_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "pymidi.Column",
+    .tp_basicsize = sizeof(pymidi_column_t),
+    .tp_dealloc = pymidi_column_dealloc,
+    .tp_as_sequence = &pymidi_column_sequence,
+    .tp_as_buffer = &pymidi_column_buffer,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Read-only column of a decoded track, over the memory of its Midi object",
+};
+
+// Add a column of count items of data to dict, returns false on error
+static bool pymidi_add_column(PyObject *dict, const char *name, pymidi_t *owner, void *data, uint32_t count,
+        Py_ssize_t itemsize, const char *format)
+{
+    pymidi_column_t *col = PyObject_New(pymidi_column_t, &pymidi_column_type);
+    int status;
+
+    if (col == NULL) {
+        return false;
+    }
+    col->owner = (PyObject *)owner;
+    Py_INCREF(owner);
+    col->data = data;
+    col->count = count;
+    col->itemsize = itemsize;
+    col->format = format;
+
+    status = PyDict_SetItemString(dict, name, (PyObject *)col);
+    Py_DECREF(col);
+
+    return status == 0;
+}
+
+/*
+ * Decoding, without the GIL
+ */
+
+static void pymidi_add_note(const midi_note_t *note, void *arg)
+{
+    pymidi_notes_t *notes = arg;
+
+    if (notes->count == notes->size) {
+        uint32_t size = notes->size ? notes->size * 2 : 256;
+        midi_note_t *grown = realloc(notes->notes, size * sizeof(*grown));
+
+        if (grown == NULL) {
+            notes->failed = true;
+            return;
+        }
+        notes->notes = grown;
+        notes->size = size;
+    }
+
+    notes->notes[notes->count++] = *note;
+}
+
+static inline uint32_t pymidi_align4(uint32_t n)
+{
+    return (n + 3) & ~3u;
+}
+
+// The notes columns of a block, from notes
+static void pymidi_put_notes(uint8_t *block, const pymidi_notes_t *notes)
+{
+    uint32_t n = notes->count;
+    uint32_t *start = (uint32_t *)block;
+    uint32_t *end = start + n;
+    uint8_t *key = (uint8_t *)(end + n);
+    uint8_t *velocity = key + n;
+    uint8_t *channel = velocity + n;
+
+    for (uint32_t i = 0; i < n; ++i) {
+        start[i] = notes->notes[i].start;
+        end[i] = notes->notes[i].end;
+        key[i] = notes->notes[i].key;
+        velocity[i] = notes->notes[i].velocity;
+        channel[i] = notes->notes[i].chan;
+    }
+}
+
+/**
+ * Decode track n into one block:
+ *
+ *   abs_tick[events] status[events] key[events] velocity[events] (pad)
+ *   start[notes] end[notes] key[notes] velocity[notes] channel[notes]
+ *
+ * Returns 0 or a POSIX errno.
+ */
+static int pymidi_decode(midi_t *midi, uint8_t n, pymidi_track_t *out)
+{
+    pymidi_notes_t notes = { 0 };
+    midi_track_t *trk = midi_get_track(midi, n);
+    uint32_t events;
+    uint32_t *abs_tick;
+    uint8_t *status;
+    uint8_t *key;
+    uint8_t *velocity;
+    uint32_t tick = 0;
+    uint32_t i = 0;
+    size_t size;
+
+    if (trk == NULL) {
+        return midi_get_errno(midi) ? midi_get_errno(midi) : EINVAL;
+    }
+
+    midi_track_notes(trk, pymidi_add_note, &notes);
+    if (notes.failed) {
+        free(notes.notes);
+        midi_free_track(trk);
+        return ENOMEM;
+    }
+
+    events = trk->events;
+    size = (size_t)pymidi_align4(events * 7) + (size_t)notes.count * 11;
+    // Zeroed, should the track hold fewer events than it counted
+    out->block = calloc(size ? size : 1, 1);
+    if (out->block == NULL) {
+        free(notes.notes);
+        midi_free_track(trk);
+        return ENOMEM;
+    }
+
+    abs_tick = (uint32_t *)out->block;
+    status = out->block + 4 * events;
+    key = status + events;
+    velocity = key + events;
+
+    midi_iter_track(trk);
+    while (midi_track_has_next(trk) && i < events) {
+        midi_event_t *event = midi_track_next(trk);
+
+        tick += event->delta_time;
+        abs_tick[i] = tick;
+        if (event->type == MIDI_EVENT_TYPE_META) {
+            status[i] = 0xFF;
+        } else if (event->type == MIDI_EVENT_TYPE_SYSEX) {
+            status[i] = event->cmd;
+        } else {
+            status[i] = event->cmd << 4 | event->chan;
+            key[i] = event->size > 0 ? event->data[0] : 0;
+            velocity[i] = event->size > 1 ? event->data[1] : 0;
+        }
+        i++;
+    }
+    out->events = events;
+
+    pymidi_put_notes(out->block + pymidi_align4(events * 7), &notes);
+    out->notes = notes.count;
+
+    free(notes.notes);
+    midi_free_track(trk);
+
+    return 0;
+}
+
+// The decoded track n of self, decoding it first if needed. NULL with an exception set
+static pymidi_track_t *pymidi_get_track(pymidi_t *self, PyObject *args)
+{
+    pymidi_track_t *track;
+    int n;
+    int status = 0;
+
+    if (!PyArg_ParseTuple(args, "i", &n)) {
+        return NULL;
+    }
+    if (n < 0 || n >= self->midi->hdr.tracks || n > UINT8_MAX) {
+        PyErr_SetString(PyExc_IndexError, "track out of range");
+        return NULL;
+    }
+    track = &self->tracks[n];
+
+    Py_BEGIN_ALLOW_THREADS
+    PyThread_acquire_lock(self->lock, WAIT_LOCK);
+    if (track->block == NULL) {
+        status = pymidi_decode(self->midi, n, track);
+    }
+    PyThread_release_lock(self->lock);
+    Py_END_ALLOW_THREADS
+
+    if (status) {
+        pymidi_error(status, midi_get_errmsg(self->midi));
+        return NULL;
+    }
+
+    return track;
+}
+
+/*
+ * Midi objects
+ */
+
+static PyObject *pymidi_track(PyObject *obj, PyObject *args)
+{
+    pymidi_t *self = (pymidi_t *)obj;
+    pymidi_track_t *track = pymidi_get_track(self, args);
+    PyObject *dict;
+    uint32_t n;
+
+    if (track == NULL || (dict = PyDict_New()) == NULL) {
+        return NULL;
+    }
+    n = track->events;
+
+    if (!pymidi_add_column(dict, "abs_tick", self, track->block, n, 4, "I")
+            || !pymidi_add_column(dict, "status", self, track->block + 4 * n, n, 1, "B")
+            || !pymidi_add_column(dict, "key", self, track->block + 5 * n, n, 1, "B")
+            || !pymidi_add_column(dict, "velocity", self, track->block + 6 * n, n, 1, "B")) {
+        Py_DECREF(dict);
+        return NULL;
+    }
+
+    return dict;
+}
+
+static PyObject *pymidi_notes(PyObject *obj, PyObject *args)
+{
+    pymidi_t *self = (pymidi_t *)obj;
+    pymidi_track_t *track = pymidi_get_track(self, args);
+    PyObject *dict;
+    uint8_t *notes;
+    uint32_t n;
+
+    if (track == NULL || (dict = PyDict_New()) == NULL) {
+        return NULL;
+    }
+    notes = track->block + pymidi_align4(track->events * 7);
+    n = track->notes;
+
+    if (!pymidi_add_column(dict, "start", self, notes, n, 4, "I")
+            || !pymidi_add_column(dict, "end", self, notes + 4 * n, n, 4, "I")
+            || !pymidi_add_column(dict, "key", self, notes + 8 * n, n, 1, "B")
+            || !pymidi_add_column(dict, "velocity", self, notes + 9 * n, n, 1, "B")
+            || !pymidi_add_column(dict, "channel", self, notes + 10 * n, n, 1, "B")) {
+        Py_DECREF(dict);
+        return NULL;
+    }
+
+    return dict;
+}
+
+static PyObject *pymidi_get_format(PyObject *obj, void *closure)
+{
+    (void)closure;
+
+    return PyLong_FromLong(((pymidi_t *)obj)->midi->hdr.format);
+}
+
+static PyObject *pymidi_get_tracks(PyObject *obj, void *closure)
+{
+    (void)closure;
+
+    return PyLong_FromLong(((pymidi_t *)obj)->midi->hdr.tracks);
+}
+
+static PyObject *pymidi_get_division(PyObject *obj, void *closure)
+{
+    (void)closure;
+
+    return PyLong_FromLong((uint16_t)((pymidi_t *)obj)->midi->hdr.division);
+}
+
+static void pymidi_dealloc(PyObject *obj)
+{
+    pymidi_t *self = (pymidi_t *)obj;
+
+    if (self->tracks != NULL) {
+        for (uint32_t i = 0; i < self->midi->hdr.tracks; ++i) {
+            free(self->tracks[i].block);
+        }
+        free(self->tracks);
+    }
+    if (self->midi != NULL) {
+        midi_close(self->midi);
+    }
+    if (self->has_source) {
+        PyBuffer_Release(&self->source);
+    }
+    if (self->lock != NULL) {
+        PyThread_free_lock(self->lock);
+    }
+    Py_TYPE(obj)->tp_free(obj);
+}
+
+static PyMethodDef pymidi_methods[] = {
+    { "track", pymidi_track, METH_VARARGS, "track(n) -> dict of the abs_tick, status, key and velocity columns" },
+    { "notes", pymidi_notes, METH_VARARGS, "notes(n) -> dict of the start, end, key, velocity and channel columns" },
+    { NULL, NULL, 0, NULL }
+};
+
+static PyGetSetDef pymidi_getset[] = {
+    { "format", pymidi_get_format, NULL, "0, 1 or 2", NULL },
+    { "tracks", pymidi_get_tracks, NULL, "Number of tracks", NULL },
+    { "division", pymidi_get_division, NULL, "Division of the header", NULL },
+    { NULL, NULL, NULL, NULL, NULL }
+};
+
+static PyTypeObject pymidi_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "pymidi.Midi",
+    .tp_basicsize = sizeof(pymidi_t),
+    .tp_dealloc = pymidi_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "An opened midi file, see pymidi.open() and pymidi.parse()",
+    .tp_methods = pymidi_methods,
+    .tp_getset = pymidi_getset,
+};
+
+/**
+ * A Midi object around a midi_t opened by midi_open() (path) or
+ * midi_open_mem() (source), without the GIL
+ */
+static PyObject *pymidi_new(const char *path, Py_buffer *source)
+{
+    pymidi_t *self = PyObject_New(pymidi_t, &pymidi_type);
+    int status;
+
+    if (self == NULL) {
+        if (source != NULL) {
+            PyBuffer_Release(source);
+        }
+        return NULL;
+    }
+    self->midi = NULL;
+    self->tracks = NULL;
+    self->has_source = source != NULL;
+    if (source != NULL) {
+        self->source = *source;
+    }
+    self->lock = PyThread_allocate_lock();
+    if (self->lock == NULL) {
+        Py_DECREF(self);
+        return PyErr_NoMemory();
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    status = path ? midi_open(path, &self->midi) : midi_open_mem(source->buf, source->len, &self->midi);
+    Py_END_ALLOW_THREADS
+
+    if (status) {
+        Py_DECREF(self);
+        return pymidi_error(status, path ? path : "Failed to parse midi data");
+    }
+
+    self->tracks = calloc(self->midi->hdr.tracks ? self->midi->hdr.tracks : 1, sizeof(*self->tracks));
+    if (self->tracks == NULL) {
+        Py_DECREF(self);
+        return PyErr_NoMemory();
+    }
+
+    return (PyObject *)self;
+}
+
+static PyObject *pymidi_open(PyObject *module, PyObject *args)
+{
+    const char *path;
+
+    (void)module;
+
+    if (!PyArg_ParseTuple(args, "s", &path)) {
+        return NULL;
+    }
+
+    return pymidi_new(path, NULL);
+}
+
+static PyObject *pymidi_parse(PyObject *module, PyObject *args)
+{
+    Py_buffer source;
+
+    (void)module;
+
+    if (!PyArg_ParseTuple(args, "y*", &source)) {
+        return NULL;
+    }
+
+    return pymidi_new(NULL, &source);
+}
+
+static PyMethodDef pymidi_module_methods[] = {
+    { "open", pymidi_open, METH_VARARGS, "open(path) -> Midi, a midi file (.mid, .mid.gz)" },
+    { "parse", pymidi_parse, METH_VARARGS, "parse(data) -> Midi, from a bytes-like object, kept referenced" },
+    { NULL, NULL, 0, NULL }
+};
+
+static struct PyModuleDef pymidi_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "pymidi",
+    .m_doc = "Midi files decoded into zero-copy columns",
+    .m_size = -1,
+    .m_methods = pymidi_module_methods,
+};
+
+PyMODINIT_FUNC PyInit_pymidi(void)
+{
+    PyObject *module;
+
+    if (PyType_Ready(&pymidi_type) < 0 || PyType_Ready(&pymidi_column_type) < 0) {
+        return NULL;
+    }
+
+    module = PyModule_Create(&pymidi_module);
+    if (module == NULL) {
+        return NULL;
+    }
+
+    Py_INCREF(&pymidi_type);
+    if (PyModule_AddObject(module, "Midi", (PyObject *)&pymidi_type) < 0) {
+        Py_DECREF(&pymidi_type);
+        Py_DECREF(module);
+        return NULL;
+    }
+
+    return module;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
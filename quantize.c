@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "quantize.h"
+
+typedef struct {
+    const quant_grid_t *    grid;
+    quant_cb_t              cb;
+    void *                  arg;
+    uint32_t                measures;   // Measures started so far
+} quant_out_t;
+
+void quant_grid_init(quant_grid_t *grid, uint16_t ppq, uint16_t divisions, uint8_t beats, uint8_t beat_type)
+{
+    grid->ppq = ppq ? ppq : 1;
+    grid->divisions = divisions ? divisions : 1;
+    grid->beats = beats;
+    // Denominators past 64ths are broken time signatures, taken as 4
+    grid->beat_type = beat_type <= 6 ? beat_type : 2;
+    grid->measure = (uint32_t)beats * grid->divisions * 4 / (1u << grid->beat_type);
+    grid->shift = 0;
+
+    if (grid->measure == 0) {
+        grid->measure = grid->divisions * 4;
+    }
+}
+
+static inline uint32_t quant_tick(const quant_grid_t *grid, uint32_t tick)
+{
+    return (((uint64_t)tick + grid->shift) * grid->divisions + grid->ppq / 2) / grid->ppq;
+}
+
+static int quant_compare(const void *a, const void *b)
+{
+    const midi_note_t *x = a;
+    const midi_note_t *y = b;
+
+    if (x->start != y->start) {
+        return x->start < y->start ? -1 : 1;
+    }
+
+    return (int)x->key - (int)y->key;
+}
+
+/**
+ * Emit a note / chord / rest, split at bar lines
+ */
+static void quant_emit(quant_out_t *out, uint8_t type, const midi_note_t **chord, uint32_t n, uint32_t start, uint32_t duration)
+{
+    const quant_grid_t *grid = out->grid;
+    quant_item_t item;
+    bool first = true;
+
+    memset(&item, 0, sizeof(item));
+
+    while (duration > 0) {
+        uint32_t measure = start / grid->measure;
+        uint32_t left = (measure + 1) * grid->measure - start;
+        uint32_t piece = duration < left ? duration : left;
+
+        while (out->measures <= measure) {
+            item.type = QUANT_MEASURE;
+            item.measure = out->measures++;
+            item.start = item.measure * grid->measure;
+            item.duration = grid->measure;
+            out->cb(&item, out->arg);
+        }
+
+        item.type = type;
+        item.measure = measure;
+        item.start = start;
+        item.duration = piece;
+
+        for (uint32_t i = 0; i < (type == QUANT_NOTE ? n : 1); ++i) {
+            item.chord = (i > 0);
+            item.key = type == QUANT_NOTE ? chord[i]->key : 0;
+            item.velocity = type == QUANT_NOTE ? chord[i]->velocity : 0;
+            item.tie_stop = (type == QUANT_NOTE && !first);
+            item.tie_start = (type == QUANT_NOTE && piece < duration);
+            out->cb(&item, out->arg);
+        }
+
+        start += piece;
+        duration -= piece;
+        first = false;
+    }
+}
+
+// End of the chord of notes starting at grid position start, from note i on
+static uint32_t quant_chord(const midi_note_t *notes, uint32_t count, const quant_grid_t *grid, uint32_t i,
+        uint32_t start, const midi_note_t **chord, uint32_t *n, uint32_t *j_out)
+{
+    uint32_t end = 0;
+    uint32_t next = UINT32_MAX;
+    bool seen[128] = { false };
+    uint32_t j;
+
+    *n = 0;
+    for (j = i; j < count && quant_tick(grid, notes[j].start) == start; ++j) {
+        uint32_t note_end = quant_tick(grid, notes[j].end);
+
+        note_end = note_end > start ? note_end : start + 1;
+        end = note_end > end ? note_end : end;
+
+        if (chord != NULL && !seen[notes[j].key & 0x7F]) {
+            seen[notes[j].key & 0x7F] = true;
+            chord[(*n)++] = &notes[j];
+        }
+    }
+
+    if (j < count) {
+        next = quant_tick(grid, notes[j].start);
+    }
+    *j_out = j;
+
+    return end < next ? end : next;
+}
+
+uint32_t quantize_segment(const midi_note_t *notes, uint32_t count, const quant_grid_t *grid,
+        const quant_segment_t *seg, bool last, quant_cb_t cb, void *arg)
+{
+    quant_out_t out = { grid, cb, arg, seg->measures };
+    const midi_note_t *chord[128];
+    uint32_t pos = seg->pos;
+    uint32_t i = seg->from;
+
+    while (i < seg->to) {
+        uint32_t start = quant_tick(grid, notes[i].start);
+        uint32_t n;
+        uint32_t j;
+        uint32_t end = quant_chord(notes, count, grid, i, start, chord, &n, &j);
+
+        if (start > pos) {
+            quant_emit(&out, QUANT_REST, NULL, 0, pos, start - pos);
+        }
+        quant_emit(&out, QUANT_NOTE, chord, n, start, end - start);
+
+        pos = end;
+        i = j;
+    }
+
+    // Fill up the last measure, a part has at least one
+    if (last && (pos == 0 || pos % grid->measure)) {
+        quant_emit(&out, QUANT_REST, NULL, 0, pos, grid->measure - pos % grid->measure);
+    }
+
+    return out.measures;
+}
+
+uint32_t quantize_notes(midi_note_t *notes, uint32_t count, const quant_grid_t *grid, quant_cb_t cb, void *arg)
+{
+    quant_segment_t all = { 0, count, 0, 0 };
+
+    qsort(notes, count, sizeof *notes, quant_compare);
+
+    return quantize_segment(notes, count, grid, &all, true, cb, arg);
+}
+
+// First note starting at grid position pos or later, notes sorted
+static uint32_t quant_find(const midi_note_t *notes, uint32_t count, const quant_grid_t *grid, uint32_t pos)
+{
+    uint32_t lo = 0;
+    uint32_t hi = count;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+
+        if (quant_tick(grid, notes[mid].start) < pos) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+quant_segment_t *quantize_split(midi_note_t *notes, uint32_t count, const quant_grid_t *grid,
+        const uint32_t *cuts, uint32_t cuts_n, uint32_t bars, uint32_t *segments)
+{
+    uint32_t measures = 0;
+    uint32_t max;
+    quant_segment_t *segs;
+    uint32_t n = 0;
+    uint32_t from = 0;
+
+    qsort(notes, count, sizeof *notes, quant_compare);
+
+    if (count > 0) {
+        measures = quant_tick(grid, notes[count - 1].start) / grid->measure + 1;
+    }
+    if (cuts_n == 0 && bars == 0) {
+        bars = measures ? measures : 1;
+    }
+
+    max = (cuts_n ? cuts_n : measures / bars) + 1;
+    segs = calloc(max, sizeof *segs);
+    if (segs == NULL) {
+        return NULL;
+    }
+
+    for (uint32_t k = 0; k <= (cuts_n ? cuts_n : measures / bars); ++k) {
+        uint32_t to = count;
+
+        if (cuts_n ? k < cuts_n : k < measures / bars) {
+            // Cuts fall on the bar line at or before them
+            uint32_t bar = cuts_n ? quant_tick(grid, cuts[k]) / grid->measure : (k + 1) * bars;
+
+            to = quant_find(notes, count, grid, bar * grid->measure);
+        }
+        if (to <= from) {
+            continue;
+        }
+
+        segs[n].from = from;
+        segs[n].to = to;
+        if (from > 0) {
+            // The chord sounding at the cut is carried in: where it ends, and
+            // the measures its previous segment has started
+            uint32_t start = quant_tick(grid, notes[from - 1].start);
+            uint32_t g = from - 1;
+            uint32_t n_chord;
+            uint32_t j;
+
+            while (g > 0 && quant_tick(grid, notes[g - 1].start) == start) {
+                g--;
+            }
+            segs[n].pos = quant_chord(notes, count, grid, g, start, NULL, &n_chord, &j);
+            segs[n].measures = segs[n].pos ? (segs[n].pos - 1) / grid->measure + 1 : 0;
+        }
+        n++;
+        from = to;
+    }
+
+    if (n == 0) {
+        // No notes: one empty segment, for the filling rest
+        segs[n++].to = count;
+    }
+
+    *segments = n;
+
+    return segs;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
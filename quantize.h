@@ -0,0 +1,101 @@
+#ifndef __QUANTIZE_H__
+#define __QUANTIZE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "timeline.h"
+
+/**
+ * Quantizer
+ *
+ * Turns the notes of a part into a single voice stream of notes, chords and
+ * rests on a grid of <divisions> per quarter note, cut into measures:
+ *
+ * - Start and end of every note snap to the nearest grid point, notes are
+ *   at least one grid unit long
+ * - Notes starting together form a chord, which lasts until its longest
+ *   note ends or the next onset, whichever comes first
+ * - Gaps become rests
+ * - Anything crossing a bar line is split, notes are tied across it
+ * - The last measure is filled up with a rest
+ *
+ * Items are handed to a callback in time order, preceded by a
+ * QUANT_MEASURE item at the start of every measure.
+ */
+
+enum {
+    QUANT_MEASURE,
+    QUANT_NOTE,
+    QUANT_REST
+};
+
+typedef struct {
+    uint8_t     type;
+    bool        chord;      // Sounds together with the previous note
+    bool        tie_stop;   // Continues a note of the previous measure
+    bool        tie_start;  // Continues in the next measure
+    uint8_t     key;
+    uint8_t     velocity;
+    uint32_t    measure;    // No. of measure, from 0
+    uint32_t    start;      // In divisions, from the start of the part
+    uint32_t    duration;   // In divisions
+} quant_item_t;
+
+typedef struct {
+    uint16_t    ppq;        // Ticks per quarter note of the source
+    uint16_t    divisions;  // Grid units per quarter note
+    uint8_t     beats;      // Time signature, 4 / 4 = { 4, 2 }
+    uint8_t     beat_type;  // Power of two
+    uint32_t    measure;    // Measure length in divisions
+    uint32_t    shift;      // Ticks added before snapping, puts the first beat on a bar line (beat.h)
+} quant_grid_t;
+
+typedef void (*quant_cb_t)(const quant_item_t *item, void *arg);
+
+/**
+ * A stretch of the sorted notes of a part, with the state carried in from
+ * the stretch before it: where its last chord ends, and how many measures
+ * it started. Segments can be quantized in any order, on any thread; their
+ * items handed on in segment order are those of quantize_notes().
+ */
+typedef struct {
+    uint32_t    from;       // Notes [from, to)
+    uint32_t    to;
+    uint32_t    pos;        // Grid position the segment before ends at
+    uint32_t    measures;   // Measures started before the segment
+} quant_segment_t;
+
+void quant_grid_init(quant_grid_t *grid, uint16_t ppq, uint16_t divisions, uint8_t beats, uint8_t beat_type);
+
+/**
+ * Quantize notes of one part. The notes are sorted in place.
+ *
+ * Returns the number of measures.
+ */
+uint32_t quantize_notes(midi_note_t *notes, uint32_t count, const quant_grid_t *grid, quant_cb_t cb, void *arg);
+
+/**
+ * Sort the notes of a part in place and cut them into segments: at the bar
+ * lines at or before the ticks in cuts (ascending, markers or cue points),
+ * or without cuts every <bars> measures. Segments without notes are left
+ * out, there is always at least one.
+ *
+ * Returns the segments (free() them) and their number in *segments, NULL
+ * if out of memory.
+ */
+quant_segment_t *quantize_split(midi_note_t *notes, uint32_t count, const quant_grid_t *grid,
+        const uint32_t *cuts, uint32_t cuts_n, uint32_t bars, uint32_t *segments);
+
+/**
+ * Quantize one segment of notes sorted by quantize_split(), last is set for
+ * the last segment, which fills up the last measure.
+ *
+ * Returns the number of measures started up to the end of the segment.
+ */
+uint32_t quantize_segment(const midi_note_t *notes, uint32_t count, const quant_grid_t *grid,
+        const quant_segment_t *seg, bool last, quant_cb_t cb, void *arg);
+
+#endif /* __QUANTIZE_H__ */
+
+/* vim: set ts=4 sw=4 tw=0 list : */
@@ -0,0 +1,233 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "midi.h"
+#include "smf.h"
+#include "resample.h"
+
+#define RESAMPLE_BLOCK      16
+
+static uint64_t resample_gcd(uint64_t a, uint64_t b)
+{
+    while (b) {
+        uint64_t t = a % b;
+
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+void resample_init(resample_t *r, uint16_t from, uint16_t to)
+{
+    uint64_t g = resample_gcd(from, to);
+
+    memset(r, 0, sizeof(*r));
+    r->from = from;
+    r->to = to;
+    if (g == 0) {
+        return;
+    }
+
+    r->num = to / g;
+    r->den = from / g;
+    r->whole = r->num / r->den;
+    r->frac = ((uint64_t)(r->num % r->den) << 32) / r->den;
+}
+
+/**
+ * The estimate t * whole + round(t * frac / 2^32) is at most one off the
+ * exact round(t * num / den), the fraction being cut short by less than
+ * 2^-32 per tick. The remainder of the rounding, 2 t num + den - 2 q den,
+ * is then small and exact in 32 bits (wrapping), and moves the estimate up
+ * or down by one. No 64 bit compare or 64 x 64 bit product, which SSE2
+ * lacks; an estimate past 32 bits sets *over.
+ */
+static inline uint32_t resample_one(uint32_t t, uint32_t whole, uint32_t frac, uint32_t num2, uint32_t den2,
+        uint32_t *over)
+{
+    uint64_t e = (uint64_t)t * whole + (((uint64_t)t * frac + (1ULL << 31)) >> 32);
+    uint32_t q = (uint32_t)e;
+    int32_t rem = (int32_t)(t * num2 + den2 / 2 - q * den2);
+
+    *over |= (uint32_t)(e >> 32);
+    q += rem >= (int32_t)den2;
+    q -= rem < 0;
+
+    return q;
+}
+
+// One block of a fixed count through restrict pointers: no aliasing check to version the loop on
+static uint32_t resample_block(const uint32_t *restrict in, uint32_t *restrict out, uint32_t whole, uint32_t frac,
+        uint32_t num2, uint32_t den2)
+{
+    uint32_t over = 0;
+
+    for (int k = 0; k < RESAMPLE_BLOCK; ++k) {
+        out[k] = resample_one(in[k], whole, frac, num2, den2, &over);
+    }
+
+    return over;
+}
+
+bool resample_ticks(const uint32_t *ticks, uint32_t *out, size_t n, const resample_t *r)
+{
+    const uint32_t num2 = r->num * 2;
+    const uint32_t den2 = r->den * 2;
+    uint32_t over = 0;
+    size_t i = 0;
+
+    for (; i + RESAMPLE_BLOCK <= n; i += RESAMPLE_BLOCK) {
+        over |= resample_block(ticks + i, out + i, r->whole, r->frac, num2, den2);
+    }
+    for (; i < n; ++i) {
+        out[i] = resample_one(ticks[i], r->whole, r->frac, num2, den2, &over);
+    }
+
+    return over == 0;
+}
+
+static bool resample_read_vlq(const uint8_t *buf, uint32_t size, uint32_t *pos, uint32_t *value)
+{
+    uint32_t v = 0;
+
+    for (int i = 0; i < SMF_VLQ_SIZE && *pos < size; ++i) {
+        uint8_t b = buf[(*pos)++];
+
+        v = (v << 7) | (b & 0x7F);
+        if (!(b & 0x80)) {
+            *value = v;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Walk the events of a chunk: the absolute tick of every event and where
+ * its bytes (after the delta time) start and end. Returns the number of
+ * events, or -1 if the chunk can't be walked.
+ */
+static long resample_scan(const uint8_t *buf, uint32_t size, uint32_t *ticks, uint32_t *start, uint32_t *end)
+{
+    uint32_t pos = 0;
+    uint32_t tick = 0;
+    uint8_t running = 0;
+    long n = 0;
+
+    while (pos < size) {
+        uint32_t delta;
+        uint32_t len;
+        uint8_t b;
+
+        if (!resample_read_vlq(buf, size, &pos, &delta) || pos >= size || tick + delta < tick) {
+            return -1;
+        }
+        tick += delta;
+        ticks[n] = tick;
+        start[n] = pos;
+
+        b = buf[pos];
+        if (b == 0xFF || b == 0xF0 || b == 0xF7) {
+            pos += b == 0xFF ? 2 : 1;
+            if (b != 0xFF) {
+                // Sysex cancels running status
+                running = 0;
+            }
+            if (pos > size || !resample_read_vlq(buf, size, &pos, &len) || len > size - pos) {
+                return -1;
+            }
+            pos += len;
+        } else {
+            uint8_t cmd;
+
+            if (b & 0x80) {
+                running = b;
+                pos++;
+            }
+            cmd = running >> 4;
+            if (!(cmd & 0x08) || cmd == 0x0F) {
+                return -1;
+            }
+            pos += (cmd == MIDI_EVENT_PROGRAM_CHANGE || cmd == MIDI_EVENT_CHANNEL_PRESSURE) ? 1 : 2;
+            if (pos > size) {
+                return -1;
+            }
+        }
+
+        end[n++] = pos;
+    }
+
+    return n;
+}
+
+int resample_track(const uint8_t *buf, uint32_t size, const resample_t *r, uint8_t **out, uint32_t *out_size)
+{
+    // An event takes 2 bytes at least (delta time and a running status data byte)
+    size_t cap = size / 2 + 1;
+    uint32_t *ticks = calloc(cap, sizeof(*ticks));
+    uint32_t *start = malloc(cap * sizeof(*start));
+    uint32_t *end = malloc(cap * sizeof(*end));
+    uint32_t *resampled = malloc(cap * sizeof(*resampled));
+    // A delta time grows by 3 bytes at most
+    uint8_t *data = malloc((size_t)size * 5 / 2 + 1);
+    uint32_t last = 0;
+    uint32_t n = 0;
+    long events = 0;
+    int status = 0;
+
+    *out = NULL;
+    *out_size = 0;
+
+    if (ticks == NULL || start == NULL || end == NULL || resampled == NULL || data == NULL) {
+        status = ENOMEM;
+        goto cleanup;
+    }
+    if (r->den == 0) {
+        status = EINVAL;
+        goto cleanup;
+    }
+
+    events = resample_scan(buf, size, ticks, start, end);
+    if (events < 0) {
+        status = EINVAL;
+        goto cleanup;
+    }
+
+    if (!resample_ticks(ticks, resampled, events, r)) {
+        status = EOVERFLOW;
+        goto cleanup;
+    }
+
+    for (long i = 0; i < events; ++i) {
+        if (resampled[i] - last > SMF_VLQ_MAX) {
+            status = EOVERFLOW;
+            goto cleanup;
+        }
+        n += smf_vlq(data + n, resampled[i] - last);
+        last = resampled[i];
+
+        memcpy(data + n, buf + start[i], end[i] - start[i]);
+        n += end[i] - start[i];
+    }
+
+    *out = data;
+    *out_size = n;
+    data = NULL;
+
+cleanup:
+    free(ticks);
+    free(start);
+    free(end);
+    free(resampled);
+    free(data);
+
+    return status;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
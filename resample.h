@@ -0,0 +1,55 @@
+#ifndef __RESAMPLE_H__
+#define __RESAMPLE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * Division Resampling
+ *
+ * Moves ticks from one division (ticks per quarter note) to another, say
+ * the 480 players want, rounding every absolute tick to the nearest one of
+ * the new division. Deltas are rebuilt from the rounded absolute ticks, so
+ * the rounding error of an event is carried into the next delta and never
+ * adds up: every event stays within half a tick of its exact time.
+ *
+ * resample_t r;
+ *
+ * resample_init(&r, 96, 480);
+ * resample_ticks(ticks, out, n, &r);       // out[i] = round(ticks[i] * 5)
+ *
+ * The ticks are converted in one pass without a division: the ratio is a
+ * whole part and a 32 bit fraction, multiplied and shifted, and the rare
+ * estimate off by one is fixed with a compare, all branch free and in
+ * 32 x 32 bit products so the compiler vectorizes the loop.
+ */
+
+typedef struct {
+    uint16_t    from;
+    uint16_t    to;
+    uint32_t    whole;      // to / from, reduced
+    uint32_t    frac;       // Rest of to / from, in units of 2^-32
+    uint32_t    num;        // to, reduced
+    uint32_t    den;        // from, reduced
+} resample_t;
+
+void resample_init(resample_t *r, uint16_t from, uint16_t to);
+
+// out[i] = ticks[i] * to / from, rounded half up. false if one is past 32 bits
+bool resample_ticks(const uint32_t *ticks, uint32_t *out, size_t n, const resample_t *r);
+
+/**
+ * Resample the events of a track chunk (buf, size bytes of chunk data):
+ * only delta times are decoded and rebuilt, events are copied byte for
+ * byte, running status included. The new chunk data is returned in *out
+ * (free() it) of *out_size bytes.
+ *
+ * Returns 0, EINVAL for a chunk that can't be walked, EOVERFLOW for a delta
+ * time too long for the new division, or ENOMEM.
+ */
+int resample_track(const uint8_t *buf, uint32_t size, const resample_t *r, uint8_t **out, uint32_t *out_size);
+
+#endif /* __RESAMPLE_H__ */
+
+/* vim: set ts=4 sw=4 tw=0 list : */
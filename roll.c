@@ -0,0 +1,422 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+
+#ifdef MIDI_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "roll.h"
+
+/**
+ * One color per channel, shaded by velocity
+ */
+static const uint8_t roll_palette[16][3] = {
+    { 0xE6, 0x4B, 0x3C }, { 0x3C, 0xB4, 0x4B }, { 0x43, 0x63, 0xD8 }, { 0xFF, 0xC8, 0x19 },
+    { 0xF5, 0x82, 0x31 }, { 0x91, 0x1E, 0xB4 }, { 0x42, 0xD4, 0xF4 }, { 0xF0, 0x32, 0xE6 },
+    { 0xBF, 0xEF, 0x45 }, { 0xA9, 0xA9, 0xA9 }, { 0x46, 0x99, 0x90 }, { 0xDC, 0xBE, 0xFF },
+    { 0x9A, 0x63, 0x24 }, { 0xFF, 0xFA, 0xC8 }, { 0xAA, 0xFF, 0xC3 }, { 0x80, 0x80, 0x00 },
+};
+
+// Rows of black keys are drawn darker
+static const bool roll_black_key[12] = { 0, 1, 0, 1, 0, 0, 1, 0, 1, 0, 1, 0 };
+
+typedef struct {
+    roll_t *        roll;
+    uint32_t        next;
+    pthread_mutex_t lock;
+} roll_job_t;
+
+typedef struct {
+    uint32_t x0, x1, y0, y1;    // Pixel box, end exclusive
+} roll_box_t;
+
+roll_t *roll_new(uint32_t width, uint32_t height, uint32_t ticks, uint8_t key_lo, uint8_t key_hi, int threads)
+{
+    roll_t *roll;
+
+    if (width == 0 || height == 0 || key_hi < key_lo) {
+        return NULL;
+    }
+
+    roll = calloc(1, sizeof *roll);
+    if (roll == NULL) {
+        return NULL;
+    }
+
+    roll->width = width;
+    roll->height = height;
+    roll->tiles_x = (width + ROLL_TILE_SIZE - 1) / ROLL_TILE_SIZE;
+    roll->tiles_y = (height + ROLL_TILE_SIZE - 1) / ROLL_TILE_SIZE;
+    roll->ticks = ticks ? ticks : 1;
+    roll->key_lo = key_lo;
+    roll->key_hi = key_hi;
+    roll->threads = threads > 0 ? threads : 1;
+
+    roll->pixels = malloc((size_t)width * height * 3);
+    roll->batch = malloc(ROLL_BATCH_SIZE * sizeof *roll->batch);
+    roll->tile_first = malloc(((size_t)roll->tiles_x * roll->tiles_y + 1) * sizeof *roll->tile_first);
+
+    if (roll->pixels == NULL || roll->batch == NULL || roll->tile_first == NULL) {
+        roll_free(roll);
+        return NULL;
+    }
+
+    return roll;
+}
+
+void roll_free(roll_t *roll)
+{
+    if (roll == NULL) {
+        return;
+    }
+
+    free(roll->pixels);
+    free(roll->batch);
+    free(roll->tile_first);
+    free(roll->tile_notes);
+    free(roll);
+}
+
+static roll_box_t roll_note_box(const roll_t *roll, const midi_note_t *note)
+{
+    uint32_t keys = roll->key_hi - roll->key_lo + 1;
+    uint32_t row = roll->key_hi - note->key;
+    roll_box_t box;
+
+    box.x0 = (uint64_t)note->start * roll->width / roll->ticks;
+    box.x1 = (uint64_t)note->end * roll->width / roll->ticks;
+    box.y0 = (uint64_t)row * roll->height / keys;
+    box.y1 = (uint64_t)(row + 1) * roll->height / keys;
+
+    box.x0 = box.x0 < roll->width ? box.x0 : roll->width - 1;
+    box.x1 = box.x1 > box.x0 ? box.x1 : box.x0 + 1;
+    box.x1 = box.x1 < roll->width ? box.x1 : roll->width;
+    box.y1 = box.y1 > box.y0 ? box.y1 : box.y0 + 1;
+
+    return box;
+}
+
+static void roll_draw_background(roll_t *roll, uint32_t tx, uint32_t ty)
+{
+    uint32_t keys = roll->key_hi - roll->key_lo + 1;
+    uint32_t x0 = tx * ROLL_TILE_SIZE;
+    uint32_t y0 = ty * ROLL_TILE_SIZE;
+    uint32_t x1 = x0 + ROLL_TILE_SIZE < roll->width ? x0 + ROLL_TILE_SIZE : roll->width;
+    uint32_t y1 = y0 + ROLL_TILE_SIZE < roll->height ? y0 + ROLL_TILE_SIZE : roll->height;
+
+    for (uint32_t y = y0; y < y1; ++y) {
+        uint8_t key = roll->key_hi - (uint8_t)((uint64_t)y * keys / roll->height);
+        uint8_t shade = roll_black_key[key % 12] ? 0x14 : 0x1C;
+        uint8_t *p = &roll->pixels[((size_t)y * roll->width + x0) * 3];
+
+        memset(p, shade, (x1 - x0) * 3);
+    }
+}
+
+static void roll_draw_tile(roll_t *roll, uint32_t tile)
+{
+    uint32_t tx = tile % roll->tiles_x;
+    uint32_t ty = tile / roll->tiles_x;
+    uint32_t cx0 = tx * ROLL_TILE_SIZE;
+    uint32_t cy0 = ty * ROLL_TILE_SIZE;
+    uint32_t cx1 = cx0 + ROLL_TILE_SIZE;
+    uint32_t cy1 = cy0 + ROLL_TILE_SIZE;
+
+    if (!roll->drawn) {
+        roll_draw_background(roll, tx, ty);
+    }
+
+    for (uint32_t i = roll->tile_first[tile]; i < roll->tile_first[tile + 1]; ++i) {
+        const midi_note_t *note = &roll->batch[roll->tile_notes[i]];
+        roll_box_t box = roll_note_box(roll, note);
+        const uint8_t *rgb = roll_palette[note->chan & 0x0F];
+        uint32_t level = 90 + 165 * (note->velocity & 0x7F) / 127;
+        uint8_t color[3];
+
+        for (int c = 0; c < 3; ++c) {
+            color[c] = rgb[c] * level / 255;
+        }
+
+        // Clip to the tile
+        box.x0 = box.x0 > cx0 ? box.x0 : cx0;
+        box.y0 = box.y0 > cy0 ? box.y0 : cy0;
+        box.x1 = box.x1 < cx1 ? box.x1 : cx1;
+        box.y1 = box.y1 < cy1 ? box.y1 : cy1;
+
+        for (uint32_t y = box.y0; y < box.y1; ++y) {
+            uint8_t *p = &roll->pixels[((size_t)y * roll->width + box.x0) * 3];
+
+            for (uint32_t x = box.x0; x < box.x1; ++x, p += 3) {
+                // Keep the brighter one where notes overlap
+                p[0] = p[0] > color[0] ? p[0] : color[0];
+                p[1] = p[1] > color[1] ? p[1] : color[1];
+                p[2] = p[2] > color[2] ? p[2] : color[2];
+            }
+        }
+    }
+}
+
+static void *roll_worker(void *arg)
+{
+    roll_job_t *job = arg;
+    roll_t *roll = job->roll;
+    uint32_t tiles = roll->tiles_x * roll->tiles_y;
+
+    for (;;) {
+        uint32_t tile;
+
+        pthread_mutex_lock(&job->lock);
+        tile = job->next++;
+        pthread_mutex_unlock(&job->lock);
+
+        if (tile >= tiles) {
+            break;
+        }
+
+        roll_draw_tile(roll, tile);
+    }
+
+    return NULL;
+}
+
+/**
+ * Counting sort of the batch into per tile buckets. A note spanning several
+ * tiles is put into the bucket of every tile it touches.
+ */
+static int roll_bucket(roll_t *roll)
+{
+    uint32_t tiles = roll->tiles_x * roll->tiles_y;
+    uint32_t total = 0;
+
+    memset(roll->tile_first, 0, (tiles + 1) * sizeof *roll->tile_first);
+
+    for (uint32_t i = 0; i < roll->batch_n; ++i) {
+        roll_box_t box = roll_note_box(roll, &roll->batch[i]);
+
+        for (uint32_t ty = box.y0 / ROLL_TILE_SIZE; ty <= (box.y1 - 1) / ROLL_TILE_SIZE; ++ty) {
+            for (uint32_t tx = box.x0 / ROLL_TILE_SIZE; tx <= (box.x1 - 1) / ROLL_TILE_SIZE; ++tx) {
+                roll->tile_first[ty * roll->tiles_x + tx + 1]++;
+                total++;
+            }
+        }
+    }
+
+    if (total > roll->tile_notes_cap) {
+        uint32_t *notes = realloc(roll->tile_notes, total * sizeof *notes);
+
+        if (notes == NULL) {
+            return ENOMEM;
+        }
+        roll->tile_notes = notes;
+        roll->tile_notes_cap = total;
+    }
+
+    for (uint32_t t = 0; t < tiles; ++t) {
+        roll->tile_first[t + 1] += roll->tile_first[t];
+    }
+
+    // Fill, using tile_first[t] as the write cursor of tile t
+    for (uint32_t i = 0; i < roll->batch_n; ++i) {
+        roll_box_t box = roll_note_box(roll, &roll->batch[i]);
+
+        for (uint32_t ty = box.y0 / ROLL_TILE_SIZE; ty <= (box.y1 - 1) / ROLL_TILE_SIZE; ++ty) {
+            for (uint32_t tx = box.x0 / ROLL_TILE_SIZE; tx <= (box.x1 - 1) / ROLL_TILE_SIZE; ++tx) {
+                roll->tile_notes[roll->tile_first[ty * roll->tiles_x + tx]++] = i;
+            }
+        }
+    }
+
+    // Each cursor ended at the start of the next tile, shift them back
+    for (uint32_t t = tiles; t > 0; --t) {
+        roll->tile_first[t] = roll->tile_first[t - 1];
+    }
+    roll->tile_first[0] = 0;
+
+    return 0;
+}
+
+int roll_flush(roll_t *roll)
+{
+    roll_job_t job;
+    pthread_t threads[roll->threads];
+    int created = 0;
+    int status;
+
+    if (roll->batch_n == 0 && roll->drawn) {
+        return 0;
+    }
+
+    status = roll_bucket(roll);
+    if (status) {
+        return status;
+    }
+
+    job.roll = roll;
+    job.next = 0;
+    pthread_mutex_init(&job.lock, NULL);
+
+    for (int i = 1; i < roll->threads; ++i) {
+        if (pthread_create(&threads[created], NULL, roll_worker, &job) == 0) {
+            created++;
+        }
+    }
+    roll_worker(&job);
+    for (int i = 0; i < created; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&job.lock);
+
+    roll->batch_n = 0;
+    roll->drawn = true;
+
+    return 0;
+}
+
+int roll_add_note(roll_t *roll, const midi_note_t *note)
+{
+    if (note->key < roll->key_lo || note->key > roll->key_hi) {
+        return 0;
+    }
+
+    roll->batch[roll->batch_n++] = *note;
+
+    if (roll->batch_n == ROLL_BATCH_SIZE) {
+        return roll_flush(roll);
+    }
+
+    return 0;
+}
+
+/**
+ * Pixel box of the whole image or of one tile
+ */
+static roll_box_t roll_region(const roll_t *roll, int tile_x, int tile_y)
+{
+    roll_box_t box = { 0, roll->width, 0, roll->height };
+
+    if (tile_x >= 0 && tile_y >= 0) {
+        box.x0 = tile_x * ROLL_TILE_SIZE;
+        box.y0 = tile_y * ROLL_TILE_SIZE;
+        box.x1 = box.x0 + ROLL_TILE_SIZE < roll->width ? box.x0 + ROLL_TILE_SIZE : roll->width;
+        box.y1 = box.y0 + ROLL_TILE_SIZE < roll->height ? box.y0 + ROLL_TILE_SIZE : roll->height;
+    }
+
+    return box;
+}
+
+int roll_write_ppm(roll_t *roll, const char *file_name, int tile_x, int tile_y)
+{
+    roll_box_t box = roll_region(roll, tile_x, tile_y);
+    FILE *fp = fopen(file_name, "wb");
+
+    if (fp == NULL) {
+        return errno;
+    }
+
+    fprintf(fp, "P6\n%u %u\n255\n", box.x1 - box.x0, box.y1 - box.y0);
+    for (uint32_t y = box.y0; y < box.y1; ++y) {
+        fwrite(&roll->pixels[((size_t)y * roll->width + box.x0) * 3], 3, box.x1 - box.x0, fp);
+    }
+
+    fclose(fp);
+
+    return 0;
+}
+
+#ifdef MIDI_HAVE_ZLIB
+static void roll_put_be32(uint8_t *p, uint32_t v)
+{
+    p[0] = (v >> 24) & 0xFF;
+    p[1] = (v >> 16) & 0xFF;
+    p[2] = (v >> 8) & 0xFF;
+    p[3] = v & 0xFF;
+}
+
+static void roll_png_chunk(FILE *fp, const char *type, const uint8_t *data, uint32_t size)
+{
+    uint8_t buf[4];
+    uLong crc = crc32(0L, (const Bytef *)type, 4);
+
+    if (size) {
+        crc = crc32(crc, data, size);
+    }
+
+    roll_put_be32(buf, size);
+    fwrite(buf, 4, 1, fp);
+    fwrite(type, 4, 1, fp);
+    if (size) {
+        fwrite(data, size, 1, fp);
+    }
+    roll_put_be32(buf, (uint32_t)crc);
+    fwrite(buf, 4, 1, fp);
+}
+
+/**
+ * 8-bit RGB PNG, no row filter, one IDAT chunk
+ */
+int roll_write_png(roll_t *roll, const char *file_name, int tile_x, int tile_y)
+{
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    roll_box_t box = roll_region(roll, tile_x, tile_y);
+    uint32_t w = box.x1 - box.x0;
+    uint32_t h = box.y1 - box.y0;
+    size_t raw_size = (size_t)(w * 3 + 1) * h;
+    uLongf packed_size = compressBound(raw_size);
+    uint8_t *raw = malloc(raw_size);
+    uint8_t *packed = malloc(packed_size);
+    uint8_t ihdr[13];
+    FILE *fp;
+
+    if (raw == NULL || packed == NULL) {
+        free(raw);
+        free(packed);
+        return ENOMEM;
+    }
+
+    for (uint32_t y = 0; y < h; ++y) {
+        uint8_t *row = &raw[(size_t)y * (w * 3 + 1)];
+
+        row[0] = 0;
+        memcpy(row + 1, &roll->pixels[((size_t)(box.y0 + y) * roll->width + box.x0) * 3], w * 3);
+    }
+
+    if (compress2(packed, &packed_size, raw, raw_size, Z_DEFAULT_COMPRESSION) != Z_OK) {
+        free(raw);
+        free(packed);
+        return EIO;
+    }
+
+    fp = fopen(file_name, "wb");
+    if (fp == NULL) {
+        free(raw);
+        free(packed);
+        return errno;
+    }
+
+    roll_put_be32(ihdr, w);
+    roll_put_be32(ihdr + 4, h);
+    ihdr[8] = 8;    // Bit depth
+    ihdr[9] = 2;    // RGB
+    ihdr[10] = 0;   // Deflate
+    ihdr[11] = 0;   // Adaptive filtering
+    ihdr[12] = 0;   // No interlace
+
+    fwrite(signature, sizeof(signature), 1, fp);
+    roll_png_chunk(fp, "IHDR", ihdr, sizeof(ihdr));
+    roll_png_chunk(fp, "IDAT", packed, packed_size);
+    roll_png_chunk(fp, "IEND", NULL, 0);
+    fclose(fp);
+
+    free(raw);
+    free(packed);
+
+    return 0;
+}
+#endif
+
+/* vim: set ts=4 sw=4 tw=0 list : */
@@ -0,0 +1,70 @@
+#ifndef __ROLL_H__
+#define __ROLL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "timeline.h"
+
+/**
+ * Piano Roll Rasterizer
+ *
+ * Draws a note timeline into an RGB image: ticks along x, keys along y
+ * (high keys on top), one color per channel shaded by velocity.
+ *
+ *        +--------+--------+--------+
+ *  key   | tile   | tile   | tile   |
+ *   ^    | 0,0    | 1,0    | 2,0    |
+ *   |    +--------+--------+--------+
+ *   |    | tile   | tile   | tile   |
+ *        | 0,1    | 1,1    | 2,1    |
+ *        +--------+--------+--------+
+ *                 -> tick
+ *
+ * Notes are collected into a fixed size batch. When the batch is full the
+ * notes are bucketed by the tiles they touch and the tiles are drawn in
+ * parallel, each thread owning whole tiles, so no locking is needed. Memory
+ * use only depends on the image and batch size, not on the length of the
+ * midi file.
+ */
+
+#define ROLL_TILE_SIZE          128
+#define ROLL_BATCH_SIZE         16384
+
+typedef struct {
+    uint32_t        width;
+    uint32_t        height;
+    uint32_t        tiles_x;
+    uint32_t        tiles_y;
+    uint32_t        ticks;          // Ticks mapped to the full width
+    uint8_t         key_lo;         // Lowest key, bottom row
+    uint8_t         key_hi;         // Highest key, top row
+    int             threads;
+    uint8_t *       pixels;         // RGB, row major
+
+    midi_note_t *   batch;
+    uint32_t        batch_n;
+    uint32_t *      tile_first;     // Per tile offset into tile_notes, tiles + 1 entries
+    uint32_t *      tile_notes;     // Batch indices bucketed by tile
+    uint32_t        tile_notes_cap;
+    bool            drawn;          // Background is drawn
+} roll_t;
+
+roll_t *roll_new(uint32_t width, uint32_t height, uint32_t ticks, uint8_t key_lo, uint8_t key_hi, int threads);
+void roll_free(roll_t *roll);
+
+// Queue a note, drawing the batch when it is full
+int roll_add_note(roll_t *roll, const midi_note_t *note);
+// Draw queued notes
+int roll_flush(roll_t *roll);
+
+// Write the image, or one tile of it, as binary PPM (P6) or PNG (with
+// MIDI_HAVE_ZLIB, for deflate)
+int roll_write_ppm(roll_t *roll, const char *file_name, int tile_x, int tile_y);
+#ifdef MIDI_HAVE_ZLIB
+int roll_write_png(roll_t *roll, const char *file_name, int tile_x, int tile_y);
+#endif
+
+#endif /* __ROLL_H__ */
+
+/* vim: set ts=4 sw=4 tw=0 list : */
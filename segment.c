@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "segment.h"
+
+typedef struct {
+    char *      buf;        // Segment written in memory
+    size_t      len;
+    uint32_t    measures;   // Started up to the end of the segment
+    int         status;
+} segment_out_t;
+
+typedef struct {
+    const musicxml_t *      xml;
+    const midi_note_t *     notes;
+    uint32_t                count;
+    const quant_grid_t *    grid;
+    const quant_segment_t * segs;
+    segment_out_t *         out;
+    uint32_t                segments;
+    uint32_t                next;       // Next segment to write
+    pthread_mutex_t         lock;
+} segment_job_t;
+
+static void segment_write(segment_job_t *job, uint32_t k)
+{
+    segment_out_t *out = &job->out[k];
+    musicxml_t seg;
+    FILE *fp = open_memstream(&out->buf, &out->len);
+
+    if (fp == NULL) {
+        out->status = errno;
+        return;
+    }
+
+    out->status = musicxml_fork(job->xml, &seg, fp, job->segs[k].measures);
+    if (out->status == 0) {
+        out->measures = quantize_segment(job->notes, job->count, job->grid, &job->segs[k],
+                k + 1 == job->segments, musicxml_item, &seg);
+        out->status = musicxml_fork_close(&seg);
+    }
+
+    if (fclose(fp) != 0 && out->status == 0) {
+        out->status = errno;
+    }
+}
+
+static void *segment_worker(void *arg)
+{
+    segment_job_t *job = arg;
+
+    for (;;) {
+        uint32_t k;
+
+        pthread_mutex_lock(&job->lock);
+        k = job->next++;
+        pthread_mutex_unlock(&job->lock);
+
+        if (k >= job->segments) {
+            break;
+        }
+        segment_write(job, k);
+    }
+
+    return NULL;
+}
+
+int segment_musicxml(musicxml_t *xml, midi_note_t *notes, uint32_t count, const quant_grid_t *grid,
+        const segment_opt_t *opt)
+{
+    segment_job_t job;
+    quant_segment_t *segs;
+    uint32_t segments;
+    long threads_n;
+    pthread_t *threads;
+    int status = 0;
+
+    if (count < SEGMENT_MIN_NOTES) {
+        quantize_notes(notes, count, grid, musicxml_item, xml);
+        return 0;
+    }
+
+    segs = quantize_split(notes, count, grid, opt->cuts, opt->count, opt->bars ? opt->bars : SEGMENT_BARS, &segments);
+    if (segs == NULL) {
+        return ENOMEM;
+    }
+
+    if (segments == 1) {
+        quantize_segment(notes, count, grid, &segs[0], true, musicxml_item, xml);
+        free(segs);
+        return 0;
+    }
+
+    memset(&job, 0, sizeof(job));
+    job.xml = xml;
+    job.notes = notes;
+    job.count = count;
+    job.grid = grid;
+    job.segs = segs;
+    job.segments = segments;
+    job.out = calloc(segments, sizeof *job.out);
+
+    threads_n = opt->jobs ? opt->jobs : sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads_n > segments) {
+        threads_n = segments;
+    }
+    if (threads_n < 1) {
+        threads_n = 1;
+    }
+    threads = calloc(threads_n, sizeof *threads);
+
+    if (job.out == NULL || threads == NULL) {
+        free(job.out);
+        free(threads);
+        free(segs);
+        return ENOMEM;
+    }
+
+    pthread_mutex_init(&job.lock, NULL);
+
+    for (long i = 0; i < threads_n; ++i) {
+        if (pthread_create(&threads[i], NULL, segment_worker, &job) != 0) {
+            threads_n = i;
+            break;
+        }
+    }
+    // Whatever no thread took is written here
+    segment_worker(&job);
+    for (long i = 0; i < threads_n; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&job.lock);
+
+    // Stitched in segment order, whichever finished first
+    for (uint32_t k = 0; k < segments; ++k) {
+        if (status == 0) {
+            status = job.out[k].status;
+        }
+        if (status == 0) {
+            musicxml_join(xml, job.out[k].buf, job.out[k].len, job.out[k].measures);
+        }
+        free(job.out[k].buf);
+    }
+
+    free(job.out);
+    free(threads);
+    free(segs);
+
+    return status;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
@@ -0,0 +1,52 @@
+#ifndef __SEGMENT_H__
+#define __SEGMENT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "timeline.h"
+#include "quantize.h"
+#include "musicxml.h"
+
+/**
+ * Segmented Conversion
+ *
+ * A long part, typically the one track of a live recording, is cut into
+ * segments (see quantize_split()): at its marker and cue point events, or
+ * every SEGMENT_BARS measures when it has none. The segments are quantized
+ * and written in parallel, each into memory, and stitched back in segment
+ * order, so the output is the same as written in one go:
+ *
+ * segment_opt_t opt = { cuts, cuts_n, 0, jobs };
+ *
+ * musicxml_begin_part(&xml, ...);
+ * segment_musicxml(&xml, notes, count, &grid, &opt);
+ * musicxml_end_part(&xml);
+ *
+ * What a segment carries over from the one before it is the chord still
+ * sounding at the cut and the measures started. Key and time signature are
+ * the same for the whole part.
+ */
+
+#define SEGMENT_BARS        64      // Measures per segment without cuts
+#define SEGMENT_MIN_NOTES   4096    // Parts with fewer notes are written in one go
+
+typedef struct {
+    const uint32_t *    cuts;       // Ticks to cut at, ascending
+    uint32_t            count;
+    uint32_t            bars;       // Without cuts, 0 for SEGMENT_BARS
+    uint16_t            jobs;       // Threads, 0 for one per CPU
+} segment_opt_t;
+
+/**
+ * Quantize the notes of a part (sorted in place) and write them to xml,
+ * between musicxml_begin_part() and musicxml_end_part().
+ *
+ * Returns 0 or a POSIX errno.
+ */
+int segment_musicxml(musicxml_t *xml, midi_note_t *notes, uint32_t count, const quant_grid_t *grid,
+        const segment_opt_t *opt);
+
+#endif /* __SEGMENT_H__ */
+
+/* vim: set ts=4 sw=4 tw=0 list : */
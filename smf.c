@@ -0,0 +1,66 @@
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "midi.h"
+#include "smf.h"
+
+size_t smf_vlq(uint8_t *p, uint32_t v)
+{
+    uint8_t tmp[SMF_VLQ_SIZE];
+    size_t n = 0;
+
+    do {
+        tmp[n++] = v & 0x7F;
+        v >>= 7;
+    } while (v && n < SMF_VLQ_SIZE);
+
+    for (size_t i = 0; i < n; ++i) {
+        p[i] = tmp[n - 1 - i] | (i + 1 < n ? 0x80 : 0);
+    }
+
+    return n;
+}
+
+static int smf_write(int fd, const void *buf, size_t size)
+{
+    const uint8_t *p = buf;
+
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+        p += n;
+        size -= n;
+    }
+
+    return 0;
+}
+
+int smf_write_header(int fd, uint16_t format, uint16_t tracks, uint16_t division)
+{
+    uint8_t hdr[MIDI_HEADER_SIZE] = {
+        'M', 'T', 'h', 'd', 0, 0, 0, 6,
+        format >> 8, format & 0xFF,
+        tracks >> 8, tracks & 0xFF,
+        division >> 8, division & 0xFF,
+    };
+
+    return smf_write(fd, hdr, sizeof(hdr));
+}
+
+int smf_write_track(int fd, const uint8_t *data, uint32_t size)
+{
+    uint8_t hdr[MIDI_TRACK_HEADER_SIZE] = { 'M', 'T', 'r', 'k', size >> 24, size >> 16, size >> 8, size };
+    int status = smf_write(fd, hdr, sizeof(hdr));
+
+    return status ? status : smf_write(fd, data, size);
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
@@ -0,0 +1,35 @@
+#ifndef __SMF_H__
+#define __SMF_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Standard MIDI File Writer
+ *
+ * The few pieces the tools writing midi files share: variable length
+ * quantities, the header chunk and track chunks, written to a file
+ * descriptor so track chunks copied by the kernel (midi_copy_track_chunk)
+ * can go in between:
+ *
+ * smf_write_header(fd, MIDI_FORMAT_MULTI, 2, 480);
+ * midi_copy_track_chunk(midi, 0, fd);
+ * smf_write_track(fd, data, size);
+ *
+ * Functions return 0 or a POSIX errno.
+ */
+
+#define SMF_VLQ_MAX         0x0FFFFFFF  // Largest value of 4 bytes
+#define SMF_VLQ_SIZE        4
+
+// Write v at p, returns the bytes written
+size_t smf_vlq(uint8_t *p, uint32_t v);
+
+int smf_write_header(int fd, uint16_t format, uint16_t tracks, uint16_t division);
+
+// A track chunk of size bytes of events
+int smf_write_track(int fd, const uint8_t *data, uint32_t size);
+
+#endif /* __SMF_H__ */
+
+/* vim: set ts=4 sw=4 tw=0 list : */
@@ -0,0 +1,397 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "songbook.h"
+
+static const uint8_t SONGBOOK_MAGIC[] = { 'S', 'S', 'C', 'B' };
+
+#define SONGBOOK_VERSION            1
+
+// Score file header, see emitter.c
+#define SCORE_OFFSET_SIZE           8
+#define SCORE_OFFSET_DATA           12
+
+#define FNV_OFFSET                  2166136261u
+#define FNV_PRIME                   16777619u
+
+static inline uint32_t get_32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline uint16_t get_16(const uint8_t *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static inline void put_32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static uint32_t fnv1a(uint32_t hash, const void *data, size_t size)
+{
+    const uint8_t *p = data;
+
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ p[i]) * FNV_PRIME;
+    }
+
+    return hash;
+}
+
+uint32_t songbook_title_hash(const char *title)
+{
+    return fnv1a(FNV_OFFSET, title, strlen(title));
+}
+
+int songbook_open(songbook_t *book, const void *buf, size_t size)
+{
+    const uint8_t *p = buf;
+    uint32_t songs, dir, titles;
+    uint16_t align;
+
+    memset(book, 0, sizeof(*book));
+
+    if (size < SONGBOOK_HEADER_SIZE || memcmp(p, SONGBOOK_MAGIC, sizeof(SONGBOOK_MAGIC)) != 0
+            || get_16(p + 4) != SONGBOOK_VERSION || get_32(p + 24) != size) {
+        return EINVAL;
+    }
+
+    align = get_16(p + 6);
+    songs = get_32(p + 8);
+    dir = get_32(p + 12);
+    titles = get_32(p + 16);
+
+    if (align < 4 || (align & (align - 1)) || dir % 4 || titles % 4
+            || dir > size || songs > (size - dir) / SONGBOOK_ENTRY_SIZE
+            || titles > size || songs > (size - titles) / 4) {
+        return EINVAL;
+    }
+
+    // Checked once here, so lookups can trust the tables
+    for (uint32_t i = 0; i < songs; ++i) {
+        const uint8_t *e = p + dir + i * SONGBOOK_ENTRY_SIZE;
+        uint32_t offset = get_32(e + 8);
+        uint32_t length = get_32(e + 12);
+
+        if ((i > 0 && get_32(e) <= get_32(e - SONGBOOK_ENTRY_SIZE))
+                || offset > size || length > size - offset
+                || get_32(p + titles + i * 4) >= songs) {
+            return EINVAL;
+        }
+    }
+
+    book->buf = p;
+    book->size = size;
+    book->songs = songs;
+    book->dir = p + dir;
+    book->titles = p + titles;
+
+    return 0;
+}
+
+void songbook_entry(const songbook_t *book, uint32_t n, songbook_entry_t *entry)
+{
+    const uint8_t *e = book->dir + n * SONGBOOK_ENTRY_SIZE;
+
+    entry->id = get_32(e);
+    entry->title_hash = get_32(e + 4);
+    entry->offset = get_32(e + 8);
+    entry->length = get_32(e + 12);
+}
+
+static int songbook_score(const songbook_t *book, uint32_t n, const uint8_t **score, size_t *size)
+{
+    songbook_entry_t entry;
+
+    songbook_entry(book, n, &entry);
+    *score = book->buf + entry.offset;
+    *size = entry.length;
+
+    return 0;
+}
+
+int songbook_find(const songbook_t *book, uint32_t id, const uint8_t **score, size_t *size)
+{
+    uint32_t lo = 0;
+    uint32_t hi = book->songs;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        uint32_t mid_id = get_32(book->dir + mid * SONGBOOK_ENTRY_SIZE);
+
+        if (mid_id == id) {
+            return songbook_score(book, mid, score, size);
+        }
+        if (mid_id < id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return ENOENT;
+}
+
+int songbook_find_title(const songbook_t *book, const char *title, const uint8_t **score, size_t *size)
+{
+    uint32_t hash = songbook_title_hash(title);
+    uint32_t lo = 0;
+    uint32_t hi = book->songs;
+
+    // First song with the hash, titles are not stored to compare
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        uint32_t n = get_32(book->titles + mid * 4);
+
+        if (get_32(book->dir + n * SONGBOOK_ENTRY_SIZE + 4) < hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo < book->songs) {
+        uint32_t n = get_32(book->titles + lo * 4);
+
+        if (get_32(book->dir + n * SONGBOOK_ENTRY_SIZE + 4) == hash) {
+            return songbook_score(book, n, score, size);
+        }
+    }
+
+    return ENOENT;
+}
+
+int songbook_map(const char *path, songbook_t *book)
+{
+    struct stat st;
+    void *map;
+    int status;
+    int fd = open(path, O_RDONLY);
+
+    memset(book, 0, sizeof(*book));
+
+    if (fd < 0) {
+        return errno;
+    }
+    if (fstat(fd, &st) != 0) {
+        status = errno;
+        close(fd);
+        return status;
+    }
+    if (st.st_size < SONGBOOK_HEADER_SIZE) {
+        close(fd);
+        return EINVAL;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    status = map == MAP_FAILED ? errno : 0;
+    close(fd);
+    if (status) {
+        return status;
+    }
+
+    status = songbook_open(book, map, st.st_size);
+    if (status) {
+        munmap(map, st.st_size);
+    }
+
+    return status;
+}
+
+void songbook_unmap(songbook_t *book)
+{
+    if (book->buf != NULL) {
+        munmap((void *)book->buf, book->size);
+    }
+    memset(book, 0, sizeof(*book));
+}
+
+/**
+ * Writer
+ */
+
+// qsort() has no argument, what the indexes being sorted refer to is set here
+static const songbook_song_t *sort_songs;
+static const uint32_t *sort_title;
+
+static int songbook_by_id(const void *a, const void *b)
+{
+    uint32_t x = sort_songs[*(const uint32_t *)a].id;
+    uint32_t y = sort_songs[*(const uint32_t *)b].id;
+
+    return x < y ? -1 : x > y;
+}
+
+// Directory entries by title hash, then by id
+static int songbook_by_title(const void *a, const void *b)
+{
+    uint32_t n = *(const uint32_t *)a;
+    uint32_t m = *(const uint32_t *)b;
+
+    if (sort_title[n] != sort_title[m]) {
+        return sort_title[n] < sort_title[m] ? -1 : 1;
+    }
+
+    return n < m ? -1 : n > m;
+}
+
+static uint32_t songbook_align(uint32_t pos)
+{
+    return (pos + SONGBOOK_ALIGN - 1) / SONGBOOK_ALIGN * SONGBOOK_ALIGN;
+}
+
+static int songbook_put(FILE *out, const void *data, size_t size, uint32_t *pos, uint32_t align_to)
+{
+    static const uint8_t zero[SONGBOOK_ALIGN];
+
+    if (size > 0 && fwrite(data, size, 1, out) != 1) {
+        return errno ? errno : EIO;
+    }
+    *pos += size;
+
+    if (align_to > *pos && fwrite(zero, align_to - *pos, 1, out) != 1) {
+        return errno ? errno : EIO;
+    }
+    *pos = align_to > *pos ? align_to : *pos;
+
+    return 0;
+}
+
+int songbook_write(FILE *out, const songbook_song_t *songs, uint32_t count)
+{
+    size_t n_alloc = count ? count : 1;
+    uint32_t *order = calloc(n_alloc, sizeof *order);      // Directory entry -> song
+    uint32_t *length = calloc(n_alloc, sizeof *length);    // Per song: score bytes, no padding
+    uint32_t *offset = calloc(n_alloc, sizeof *offset);
+    uint32_t *owner = calloc(n_alloc, sizeof *owner);      // Song whose copy of the score is stored
+    uint32_t *content = calloc(n_alloc, sizeof *content);
+    uint32_t *title = calloc(n_alloc, sizeof *title);      // Per directory entry
+    uint32_t *titles = calloc(n_alloc, sizeof *titles);    // Title index
+    uint8_t header[SONGBOOK_HEADER_SIZE];
+    uint8_t entry[SONGBOOK_ENTRY_SIZE];
+    uint32_t dir = SONGBOOK_HEADER_SIZE;
+    uint32_t data;
+    uint32_t end;
+    uint32_t pos = 0;
+    int status = 0;
+
+    if (order == NULL || length == NULL || offset == NULL || owner == NULL || content == NULL
+            || title == NULL || titles == NULL) {
+        status = ENOMEM;
+        goto out;
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const uint8_t *d = songs[i].data;
+
+        if (songs[i].size < SCORE_OFFSET_DATA || memcmp(d, "MSSC", 4) != 0) {
+            status = EINVAL;
+            goto out;
+        }
+        length[i] = SCORE_OFFSET_DATA + (d[SCORE_OFFSET_SIZE] << 8 | d[SCORE_OFFSET_SIZE + 1]);
+        if (length[i] > songs[i].size) {
+            status = EINVAL;
+            goto out;
+        }
+        content[i] = fnv1a(FNV_OFFSET, d, length[i]);
+        order[i] = i;
+    }
+
+    sort_songs = songs;
+    qsort(order, count, sizeof *order, songbook_by_id);
+    for (uint32_t n = 1; n < count; ++n) {
+        if (songs[order[n]].id == songs[order[n - 1]].id) {
+            status = EEXIST;
+            goto out;
+        }
+    }
+
+    // Scores are stored in the order given, each distinct one once
+    data = songbook_align(dir + count * SONGBOOK_ENTRY_SIZE + count * 4);
+    end = data;
+    for (uint32_t i = 0; i < count; ++i) {
+        owner[i] = i;
+        for (uint32_t j = 0; j < i; ++j) {
+            if (owner[j] == j && content[j] == content[i] && length[j] == length[i]
+                    && memcmp(songs[j].data, songs[i].data, length[i]) == 0) {
+                owner[i] = j;
+                break;
+            }
+        }
+
+        if (owner[i] == i) {
+            offset[i] = end;
+            end = songbook_align(end + length[i]);
+        } else {
+            offset[i] = offset[owner[i]];
+        }
+    }
+
+    for (uint32_t n = 0; n < count; ++n) {
+        title[n] = songbook_title_hash(songs[order[n]].title ? songs[order[n]].title : "");
+        titles[n] = n;
+    }
+    sort_title = title;
+    qsort(titles, count, sizeof *titles, songbook_by_title);
+
+    memset(header, 0, sizeof(header));
+    memcpy(header, SONGBOOK_MAGIC, sizeof(SONGBOOK_MAGIC));
+    header[4] = SONGBOOK_VERSION;
+    header[6] = SONGBOOK_ALIGN;
+    put_32(header + 8, count);
+    put_32(header + 12, dir);
+    put_32(header + 16, dir + count * SONGBOOK_ENTRY_SIZE);
+    put_32(header + 20, data);
+    put_32(header + 24, end);
+    status = songbook_put(out, header, sizeof(header), &pos, 0);
+
+    for (uint32_t n = 0; n < count && status == 0; ++n) {
+        uint32_t i = order[n];
+
+        put_32(entry, songs[i].id);
+        put_32(entry + 4, title[n]);
+        put_32(entry + 8, offset[i]);
+        put_32(entry + 12, length[i]);
+        status = songbook_put(out, entry, sizeof(entry), &pos, 0);
+    }
+
+    for (uint32_t n = 0; n < count && status == 0; ++n) {
+        put_32(entry, titles[n]);
+        status = songbook_put(out, entry, 4, &pos, n + 1 == count ? data : 0);
+    }
+    if (status == 0 && pos < data) {
+        status = songbook_put(out, NULL, 0, &pos, data);
+    }
+
+    for (uint32_t i = 0; i < count && status == 0; ++i) {
+        if (owner[i] == i) {
+            status = songbook_put(out, songs[i].data, length[i], &pos, songbook_align(pos + length[i]));
+        }
+    }
+
+out:
+    free(order);
+    free(length);
+    free(offset);
+    free(owner);
+    free(content);
+    free(title);
+    free(titles);
+
+    return status;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
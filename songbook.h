@@ -0,0 +1,109 @@
+#ifndef __SONGBOOK_H__
+#define __SONGBOOK_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+/**
+ * Songbook Bundle
+ *
+ * Many score files (.ssc) in one file, to be mapped as a whole (or linked
+ * into flash) and read in place, one open for all songs:
+ *
+ * Byte 0           4           8           12          16
+ *      +-----------+-----------+-----------+-----------+
+ *    0 | S S C B   | Ver | Aln | Songs     | Directory |
+ *      +-----------+-----------+-----------+-----------+
+ *   16 | Titles    | Data      | File size | Reserved  |
+ *      +-----------+-----------+-----------+-----------+
+ *      | Directory, by id:                             |
+ *      | Id        | Title hash| Offset    | Length    |
+ *      | ...                                           |
+ *      +-----------------------------------------------+
+ *      | Titles: directory entry numbers by title hash |
+ *      +-----------------------------------------------+
+ *      | Scores, each aligned to <Aln> bytes           |
+ *      +-----------------------------------------------+
+ *
+ * All numbers are little endian. Both tables are sorted, so a song is found
+ * by id or by title in O(log n). Scores are stored without the padding of
+ * .ssc files, and only once: songs with the same score share it.
+ *
+ * Reading takes no memory besides the songbook_t:
+ *
+ * songbook_t book;
+ * const uint8_t *score;
+ * size_t size;
+ *
+ * if (songbook_open(&book, flash_addr, flash_size) == 0
+ *         && songbook_find(&book, 42, &score, &size) == 0) {
+ *     jianpu_read_ssc(score, size, &ss);
+ * }
+ */
+
+#define SONGBOOK_ALIGN          16
+#define SONGBOOK_HEADER_SIZE    32
+#define SONGBOOK_ENTRY_SIZE     16
+
+typedef struct {
+    const uint8_t * buf;
+    size_t          size;
+    uint32_t        songs;
+    const uint8_t * dir;        // Directory entries
+    const uint8_t * titles;     // Title index
+} songbook_t;
+
+typedef struct {
+    uint32_t    id;
+    uint32_t    title_hash;
+    uint32_t    offset;     // From the start of the bundle
+    uint32_t    length;
+} songbook_entry_t;
+
+// Hash of a title, as stored in the directory
+uint32_t songbook_title_hash(const char *title);
+
+/**
+ * Use the bundle in buf (size bytes), checking its tables.
+ * Returns 0 or EINVAL.
+ */
+int songbook_open(songbook_t *book, const void *buf, size_t size);
+
+/**
+ * The score of song id, or of the first song titled title. Returns 0 or
+ * ENOENT.
+ */
+int songbook_find(const songbook_t *book, uint32_t id, const uint8_t **score, size_t *size);
+int songbook_find_title(const songbook_t *book, const char *title, const uint8_t **score, size_t *size);
+
+// Directory entry n, in id order
+void songbook_entry(const songbook_t *book, uint32_t n, songbook_entry_t *entry);
+
+/**
+ * Map the bundle file path and open it, unmapped with songbook_unmap().
+ * Returns 0 or a POSIX errno.
+ */
+int songbook_map(const char *path, songbook_t *book);
+void songbook_unmap(songbook_t *book);
+
+/**
+ * Bundle Writer
+ *
+ * Writes the given songs, in any order, as a bundle. Scores that are the
+ * same byte for byte are stored once. Returns 0, EEXIST for an id given
+ * twice, EINVAL for something that is not a score, or a POSIX errno.
+ */
+typedef struct {
+    uint32_t        id;
+    const char *    title;
+    const uint8_t * data;       // .ssc file contents
+    size_t          size;
+} songbook_song_t;
+
+int songbook_write(FILE *out, const songbook_song_t *songs, uint32_t count);
+
+#endif /* __SONGBOOK_H__ */
+
+/* vim: set ts=4 sw=4 tw=0 list : */
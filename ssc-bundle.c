@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "songbook.h"
+
+/**
+ * Pack score files (.ssc) into one songbook bundle, list one, or get a
+ * score back out of one (see songbook.h):
+ *
+ *   ssc-bundle -o book.sscb 1-intro.mid.ssc 2-theme.mid.ssc ...
+ *   ssc-bundle -l book.sscb
+ *   ssc-bundle -x 2 book.sscb > 2-theme.mid.ssc
+ *
+ * A song's id is the number its file name starts with, or its place on the
+ * command line (from 1) when there is none. Its title is the file name
+ * without directories, that number and the .ssc / .mid suffixes.
+ */
+
+#define SCORE_SIZE          512
+
+typedef struct {
+    uint8_t             buf[SCORE_SIZE];
+    char                title[256];
+} score_file_t;
+
+static void score_title(const char *path, char *title, size_t size, uint32_t *id)
+{
+    const char *name = strrchr(path, '/');
+    char *dot;
+
+    name = name ? name + 1 : path;
+
+    if (isdigit((unsigned char)*name)) {
+        *id = strtoul(name, (char **)&name, 10);
+        while (*name == '-' || *name == '_' || *name == ' ') {
+            name++;
+        }
+    }
+
+    snprintf(title, size, "%s", name);
+    for (int i = 0; i < 2; ++i) {
+        dot = strrchr(title, '.');
+        if (dot != NULL && (!strcmp(dot, ".ssc") || !strcmp(dot, ".mid") || !strcmp(dot, ".midi"))) {
+            *dot = '\0';
+        }
+    }
+}
+
+static int bundle_create(const char *out_file, char **files, int count)
+{
+    score_file_t *scores = calloc(count, sizeof *scores);
+    songbook_song_t *songs = calloc(count, sizeof *songs);
+    FILE *out;
+    int status = 0;
+
+    if (scores == NULL || songs == NULL) {
+        free(scores);
+        free(songs);
+        return ENOMEM;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        FILE *fp = fopen(files[i], "rb");
+        uint32_t id = i + 1;
+
+        if (fp == NULL) {
+            status = errno;
+            fprintf(stderr, "Failed to open %s: %s\n", files[i], strerror(status));
+            break;
+        }
+        songs[i].size = fread(scores[i].buf, 1, sizeof(scores[i].buf), fp);
+        fclose(fp);
+
+        score_title(files[i], scores[i].title, sizeof(scores[i].title), &id);
+        songs[i].id = id;
+        songs[i].title = scores[i].title;
+        songs[i].data = scores[i].buf;
+    }
+
+    if (status == 0) {
+        out = fopen(out_file, "wb");
+        if (out == NULL) {
+            status = errno;
+            fprintf(stderr, "Failed to create %s: %s\n", out_file, strerror(status));
+        } else {
+            status = songbook_write(out, songs, count);
+            if (fclose(out) != 0 && status == 0) {
+                status = errno;
+            }
+            if (status) {
+                remove(out_file);
+            }
+        }
+    }
+
+    free(scores);
+    free(songs);
+
+    return status;
+}
+
+static int bundle_list(const char *file)
+{
+    songbook_t book;
+    songbook_entry_t entry;
+    int status = songbook_map(file, &book);
+
+    if (status) {
+        return status;
+    }
+
+    printf("%u songs, %zu bytes\n", book.songs, book.size);
+    for (uint32_t i = 0; i < book.songs; ++i) {
+        songbook_entry(&book, i, &entry);
+        printf("%10u  title %08x  offset %8u  %4u bytes\n", entry.id, entry.title_hash, entry.offset, entry.length);
+    }
+
+    songbook_unmap(&book);
+
+    return 0;
+}
+
+static int bundle_extract(const char *file, uint32_t id)
+{
+    static const uint8_t zero[SCORE_SIZE];
+    songbook_t book;
+    const uint8_t *score;
+    size_t size;
+    int status = songbook_map(file, &book);
+
+    if (status) {
+        return status;
+    }
+
+    status = songbook_find(&book, id, &score, &size);
+    if (status == 0) {
+        // Padded back to a score file
+        fwrite(score, size, 1, stdout);
+        if (size < SCORE_SIZE) {
+            fwrite(zero, SCORE_SIZE - size, 1, stdout);
+        }
+        status = fflush(stdout) == 0 ? 0 : errno;
+    }
+
+    songbook_unmap(&book);
+
+    return status;
+}
+
+int main(int argc, char **argv)
+{
+    const char *out_file = NULL;
+    bool list = false;
+    bool extract = false;
+    bool usage = false;
+    uint32_t id = 0;
+    int status;
+    int opt_char;
+
+    while ((opt_char = getopt(argc, argv, "o:lx:")) != -1) {
+        switch (opt_char) {
+            case 'o':
+                out_file = optarg;
+                break;
+            case 'l':
+                list = true;
+                break;
+            case 'x':
+                extract = true;
+                id = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                usage = true;
+                break;
+        }
+    }
+
+    if (usage || optind >= argc || (out_file != NULL) + list + extract != 1
+            || ((list || extract) && argc - optind != 1)) {
+        fprintf(stderr, "Usage: %s -o book.sscb filename.ssc ...\n"
+                "       %s -l book.sscb\n"
+                "       %s -x id book.sscb\n\n", argv[0], argv[0], argv[0]);
+        return 1;
+    }
+
+    if (out_file != NULL) {
+        status = bundle_create(out_file, &argv[optind], argc - optind);
+    } else if (list) {
+        status = bundle_list(argv[optind]);
+    } else {
+        status = bundle_extract(argv[optind], id);
+    }
+
+    if (status) {
+        fprintf(stderr, "Failed: %s\n", status == EEXIST ? "two songs have the same id" : strerror(status));
+        return 1;
+    }
+
+    return 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "jianpu.h"
+#include "songbook.h"
+
+/**
+ * Engrave score files (.ssc) as numbered notation, to stdout as text or to
+ * <file>.<page>.svg with -s.
+ *
+ * All files go through the same engraver, so a file that differs from an
+ * earlier one in a few notes only re-lays out those measures; -v prints what
+ * was built and what came from the cache:
+ *
+ *   ssc-jianpu -v -w 40 a.mid.ssc a-edited.mid.ssc
+ *
+ * With -b the arguments are songs of a songbook bundle (see songbook.h),
+ * by id or by title:
+ *
+ *   ssc-jianpu -b book.sscb 2 theme
+ */
+
+#define DEFAULT_WIDTH       72
+
+typedef struct {
+    const char *    file;
+    FILE *          fp;
+} pages_t;
+
+static FILE *next_page(uint32_t page, void *arg)
+{
+    pages_t *pages = arg;
+    char file_name[1024];
+
+    if (pages->fp != NULL) {
+        fclose(pages->fp);
+    }
+
+    snprintf(file_name, sizeof(file_name), "%s.%u.svg", pages->file, page + 1);
+    pages->fp = fopen(file_name, "w");
+
+    return pages->fp;
+}
+
+// Score of song name (id or title) of book, or of the file name
+static int read_score(const songbook_t *book, const char *name, uint8_t *buf, size_t buf_size,
+        ScoreSimplified_t *score)
+{
+    const uint8_t *data = buf;
+    size_t size;
+    char *end;
+    FILE *fp;
+    int status;
+
+    if (book != NULL) {
+        uint32_t id = strtoul(name, &end, 10);
+
+        status = (*end == '\0' && end != name) ? songbook_find(book, id, &data, &size)
+            : songbook_find_title(book, name, &data, &size);
+        if (status) {
+            return status;
+        }
+    } else {
+        fp = fopen(name, "rb");
+        if (fp == NULL) {
+            return errno;
+        }
+        size = fread(buf, 1, buf_size, fp);
+        fclose(fp);
+    }
+
+    return jianpu_read_ssc(data, size, score);
+}
+
+static int engrave(jianpu_t *jp, const songbook_t *book, const char *file, const jianpu_page_t *page, bool verbose)
+{
+    uint8_t buf[1 << 16];
+    ScoreSimplified_t score;
+    pages_t pages = { file, NULL };
+    int status;
+
+    // Notes point into buf, or into the mapped bundle
+    status = read_score(book, file, buf, sizeof(buf), &score);
+    if (status) {
+        return status;
+    }
+
+    if (page->format == JIANPU_FORMAT_SVG) {
+        status = jianpu_render(jp, &score, page, next_page, &pages);
+        if (pages.fp != NULL && fclose(pages.fp) != 0 && status == 0) {
+            status = errno;
+        }
+    } else {
+        status = jianpu_render(jp, &score, page, NULL, NULL);
+    }
+
+    if (verbose) {
+        fprintf(stderr, "%s: measures %u laid out, %u cached; lines %u rendered, %u cached\n", file,
+                jp->stats.layouts_built, jp->stats.layouts_reused,
+                jp->stats.lines_built, jp->stats.lines_reused);
+    }
+
+    return status;
+}
+
+int main(int argc, char**argv)
+{
+    jianpu_page_t page = { .format = JIANPU_FORMAT_TEXT, .width = DEFAULT_WIDTH, .lines = 0 };
+    const char *book_file = NULL;
+    songbook_t book;
+    bool verbose = false;
+    bool usage = false;
+    jianpu_t *jp;
+    int failed = 0;
+    int opt_char;
+
+    while ((opt_char = getopt(argc, argv, "b:sw:l:v")) != -1) {
+        switch (opt_char) {
+            case 'b':
+                book_file = optarg;
+                break;
+            case 's':
+                page.format = JIANPU_FORMAT_SVG;
+                break;
+            case 'w':
+                page.width = strtoul(optarg, NULL, 10);
+                break;
+            case 'l':
+                page.lines = strtoul(optarg, NULL, 10);
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                usage = true;
+                break;
+        }
+    }
+
+    if (optind >= argc || usage || page.width == 0) {
+        fprintf(stderr, "Usage: %s [-s] [-w columns] [-l lines per page] [-v] filename.ssc ...\n"
+                "       %s -b book.sscb [-s] [-w columns] [-l lines per page] [-v] id|title ...\n\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    if (book_file != NULL) {
+        int status = songbook_map(book_file, &book);
+
+        if (status) {
+            fprintf(stderr, "Failed to open %s: %s\n", book_file, strerror(status));
+            return 1;
+        }
+    }
+
+    jp = jianpu_new();
+    if (jp == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    for (int i = optind; i < argc; ++i) {
+        int status = engrave(jp, book_file ? &book : NULL, argv[i], &page, verbose);
+
+        if (status) {
+            fprintf(stderr, "Failed to engrave %s: %s\n", argv[i], strerror(status));
+            failed++;
+        }
+    }
+
+    jianpu_free(jp);
+    if (book_file != NULL) {
+        songbook_unmap(&book);
+    }
+
+    return failed ? 1 : 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
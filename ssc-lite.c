@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "midilite.h"
+
+/**
+ * Host harness of the lite converter (see midilite.h): converts midi files
+ * to score files filename.mid.ssc the way a device would, from one static
+ * input buffer and one static workspace. The output is the same as
+ * midi2score's.
+ *
+ * With -s it also prints the stack the conversion used at most, measured
+ * by painting the stack below the caller first, see `make footprint`.
+ */
+
+#define LITE_INPUT_MAX      (1024 * 1024)
+#define STACK_PAINT_SIZE    (16 * 1024)
+#define STACK_PAINT         0xA5
+
+static uint8_t input[LITE_INPUT_MAX];
+static midilite_work_t work;
+static uint8_t score[MIDILITE_SCORE_SIZE];
+
+static const char *errors[] = {
+    [MIDILITE_OK] = "no error",
+    [MIDILITE_ERR_HEADER] = "bad header",
+    [MIDILITE_ERR_TRUNCATED] = "track truncated",
+    [MIDILITE_ERR_TRACK] = "track missing",
+    [MIDILITE_ERR_EVENT] = "bad event",
+};
+
+/**
+ * Both run at the same depth, so their arrays cover the same stack, where
+ * midilite_convert() runs in between. The lowest byte it changed marks how
+ * deep it went.
+ */
+static __attribute__((noinline)) void stack_paint(void)
+{
+    volatile uint8_t area[STACK_PAINT_SIZE];
+
+    for (size_t i = 0; i < sizeof(area); ++i) {
+        area[i] = STACK_PAINT;
+    }
+}
+
+static __attribute__((noinline)) size_t stack_used(void)
+{
+    volatile uint8_t area[STACK_PAINT_SIZE];
+    volatile uint8_t *p = area;     // Read as left on the stack, on purpose
+    size_t i = 0;
+
+    while (i < sizeof(area) && p[i] == STACK_PAINT) {
+        i++;
+    }
+
+    return sizeof(area) - i;
+}
+
+static int convert(const char *midi_file, bool stack)
+{
+    char file_name[1024];
+    size_t used = 0;
+    size_t size;
+    FILE *fp;
+    int status;
+
+    fp = fopen(midi_file, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "Failed to open %s: %s\n", midi_file, strerror(errno));
+        return 1;
+    }
+    size = fread(input, 1, sizeof(input), fp);
+    if (size == sizeof(input) && fgetc(fp) != EOF) {
+        fprintf(stderr, "Failed to convert %s: larger than %d bytes\n", midi_file, LITE_INPUT_MAX);
+        fclose(fp);
+        return 1;
+    }
+    fclose(fp);
+
+    stack_paint();
+    status = midilite_convert(input, size, &work, score);
+    used = stack_used();
+
+    if (status) {
+        fprintf(stderr, "Failed to convert %s: %s\n", midi_file, errors[status]);
+        return 1;
+    }
+
+    if (stack) {
+        printf("%s: %u notes%s, stack %zu bytes, workspace %zu bytes\n", midi_file, work.count,
+                work.full ? " (score full)" : "", used, sizeof(work));
+    }
+
+    snprintf(file_name, sizeof(file_name), "%s.ssc", midi_file);
+    fp = fopen(file_name, "wb");
+    if (fp == NULL || fwrite(score, sizeof(score), 1, fp) != 1) {
+        fprintf(stderr, "Failed to write %s: %s\n", file_name, strerror(errno));
+        if (fp != NULL) {
+            fclose(fp);
+        }
+        return 1;
+    }
+    fclose(fp);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    bool stack = false;
+    int failed = 0;
+    int opt_char;
+
+    while ((opt_char = getopt(argc, argv, "s")) != -1) {
+        switch (opt_char) {
+            case 's':
+                stack = true;
+                break;
+            default:
+                optind = argc;
+                break;
+        }
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [-s] filename.mid ...\n\n", argv[0]);
+        return 1;
+    }
+
+    for (int i = optind; i < argc; ++i) {
+        failed += convert(argv[i], stack);
+    }
+
+    return failed ? 1 : 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "jianpu.h"
+#include "player.h"
+
+/**
+ * Host simulator of the score player (see player.h): plays score files on
+ * a simulated tick timer and logs every key event with its time, then how
+ * far the events were from their exact time and what a tick cost:
+ *
+ *   ssc-play -t 100 -r 1000 a.mid.ssc
+ *
+ * The score file holds no tempo, -t gives it in beats per minute (120 by
+ * default), -r the timer rate in Hz (1000 by default). -q prints the
+ * summary only.
+ */
+
+#define DEFAULT_BPM         120
+#define DEFAULT_HZ          1000
+
+typedef struct {
+    uint32_t    tick;
+    uint8_t     key;
+    bool        on;
+    double      exact_us;   // When the event should be
+} play_event_t;
+
+typedef struct {
+    play_event_t *  events;
+    uint32_t        count;
+    uint32_t        cap;
+    const ScoreSimplified_t *score;
+    uint32_t        note;       // Note whose key is down next
+    double          tempo_us;
+    double          start_us;   // Exact start of the note being played
+    double          end_us;
+} play_log_t;
+
+static void on_key(uint8_t key, bool on, void *arg)
+{
+    play_log_t *log = arg;
+    play_event_t *ev;
+
+    if (log->count == log->cap) {
+        return;
+    }
+
+    // Exact times from the note lengths, in floating point, to check against
+    if (on) {
+        while (log->note < log->score->size) {
+            NoteSimplified_t note = log->score->notes[log->note++];
+
+            log->start_us = log->end_us;
+            log->end_us += player_note_32nds(note) * log->tempo_us / 8;
+            if (NumNotaiton_NoteSimpToKeyNote(note) == key) {
+                break;
+            }
+        }
+    }
+
+    ev = &log->events[log->count++];
+    ev->key = key;
+    ev->on = on;
+    ev->exact_us = on ? log->start_us : log->end_us;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int play(const char *file, uint32_t bpm, uint32_t hz, bool quiet)
+{
+    uint8_t buf[1 << 16];
+    ScoreSimplified_t score;
+    player_t player;
+    play_log_t log;
+    double tick_us = 1e6 / hz;
+    double error_max = 0;
+    double busy = 0;
+    double busy_max = 0;
+    size_t size;
+    FILE *fp;
+    int status;
+
+    fp = fopen(file, "rb");
+    if (fp == NULL) {
+        return errno;
+    }
+    size = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+
+    status = jianpu_read_ssc(buf, size, &score);
+    if (status) {
+        return status;
+    }
+
+    memset(&log, 0, sizeof(log));
+    log.score = &score;
+    log.tempo_us = 60e6 / bpm;
+    log.cap = score.size * 2;
+    log.events = calloc(log.cap ? log.cap : 1, sizeof(*log.events));
+    if (log.events == NULL) {
+        return ENOMEM;
+    }
+
+    player_start_simplified(&player, &score, 60000000 / bpm, hz, on_key, &log);
+
+    // The timer: every tick timed on its own, for the worst one
+    for (;;) {
+        uint32_t first = log.count;
+        double start = now_ns();
+        bool more = player_tick(&player);
+        double t = now_ns() - start;
+
+        busy += t;
+        busy_max = t > busy_max ? t : busy_max;
+        for (uint32_t i = first; i < log.count; ++i) {
+            log.events[i].tick = player.tick;
+        }
+        if (!more) {
+            break;
+        }
+    }
+
+    for (uint32_t i = 0; i < log.count; ++i) {
+        const play_event_t *ev = &log.events[i];
+        double error = ev->tick * tick_us - ev->exact_us;
+
+        error_max = error > error_max ? error : error_max;
+        if (!quiet) {
+            printf("%12.3f ms  %-3s %3u  %+9.1f us\n", ev->tick * tick_us / 1e3, ev->on ? "on" : "off", ev->key,
+                    error);
+        }
+    }
+
+    printf("%s: %u key events, %u ticks of %.1f us, late by %.1f us at most, tick %.0f ns on average, %.0f ns at most\n",
+            file, log.count, player.tick, tick_us, error_max, player.tick ? busy / player.tick : 0, busy_max);
+
+    free(log.events);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t bpm = DEFAULT_BPM;
+    uint32_t hz = DEFAULT_HZ;
+    bool quiet = false;
+    int failed = 0;
+    int opt_char;
+
+    while ((opt_char = getopt(argc, argv, "t:r:q")) != -1) {
+        switch (opt_char) {
+            case 't':
+                bpm = strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                hz = strtoul(optarg, NULL, 10);
+                break;
+            case 'q':
+                quiet = true;
+                break;
+            default:
+                bpm = 0;
+                break;
+        }
+    }
+
+    if (optind >= argc || bpm == 0 || hz == 0) {
+        fprintf(stderr, "Usage: %s [-t bpm] [-r hz] [-q] filename.ssc ...\n\n", argv[0]);
+        return 1;
+    }
+
+    for (int i = optind; i < argc; ++i) {
+        int status = play(argv[i], bpm, hz, quiet);
+
+        if (status) {
+            fprintf(stderr, "Failed to play %s: %s\n", argv[i], strerror(status));
+            failed++;
+        }
+    }
+
+    return failed ? 1 : 0;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
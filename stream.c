@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "stream.h"
+
+static inline bool midi_stream_less(const midi_stream_t *stream, uint16_t a, uint16_t b)
+{
+    if (stream->tick[a] != stream->tick[b]) {
+        return stream->tick[a] < stream->tick[b];
+    }
+
+    return a < b;
+}
+
+static void midi_stream_sift_down(midi_stream_t *stream, uint16_t pos)
+{
+    uint16_t *heap = stream->heap;
+
+    for (;;) {
+        uint32_t child = 2 * (uint32_t)pos + 1;
+        uint16_t tmp;
+
+        if (child >= stream->size) {
+            break;
+        }
+        if (child + 1 < stream->size && midi_stream_less(stream, heap[child + 1], heap[child])) {
+            child++;
+        }
+        if (!midi_stream_less(stream, heap[child], heap[pos])) {
+            break;
+        }
+
+        tmp = heap[pos];
+        heap[pos] = heap[child];
+        heap[child] = tmp;
+        pos = child;
+    }
+}
+
+midi_stream_t *midi_stream_new(midi_track_t **trk, uint16_t tracks)
+{
+    midi_stream_t *stream = calloc(1, sizeof *stream);
+
+    if (stream == NULL) {
+        return NULL;
+    }
+
+    stream->tracks = tracks;
+    stream->trk = calloc(tracks ? tracks : 1, sizeof *stream->trk);
+    stream->tick = calloc(tracks ? tracks : 1, sizeof *stream->tick);
+    stream->heap = calloc(tracks ? tracks : 1, sizeof *stream->heap);
+
+    if (stream->trk == NULL || stream->tick == NULL || stream->heap == NULL) {
+        midi_stream_close(stream);
+        return NULL;
+    }
+
+    for (uint16_t i = 0; i < tracks; ++i) {
+        stream->trk[i] = trk[i];
+        if (trk[i] == NULL) {
+            continue;
+        }
+
+        midi_iter_track(trk[i]);
+        if (midi_track_has_next(trk[i])) {
+            stream->tick[i] = trk[i]->cur->event.delta_time;
+            stream->heap[stream->size++] = i;
+        }
+    }
+
+    for (int i = stream->size / 2 - 1; i >= 0; --i) {
+        midi_stream_sift_down(stream, i);
+    }
+
+    return stream;
+}
+
+midi_stream_t *midi_stream_open(const midi_t *const midi)
+{
+    midi_stream_t *stream;
+    midi_track_t **trk = calloc(midi->hdr.tracks ? midi->hdr.tracks : 1, sizeof *trk);
+
+    if (trk == NULL) {
+        return NULL;
+    }
+
+    for (int i = 0; i < midi->hdr.tracks; ++i) {
+        trk[i] = midi_get_track(midi, i);
+        if (trk[i] == NULL) {
+            for (int j = 0; j < i; ++j) {
+                midi_free_track(trk[j]);
+            }
+            free(trk);
+            return NULL;
+        }
+    }
+
+    stream = midi_stream_new(trk, midi->hdr.tracks);
+    if (stream == NULL) {
+        for (int i = 0; i < midi->hdr.tracks; ++i) {
+            midi_free_track(trk[i]);
+        }
+    } else {
+        stream->owner = true;
+    }
+    free(trk);
+
+    return stream;
+}
+
+void midi_stream_close(midi_stream_t *stream)
+{
+    if (stream == NULL) {
+        return;
+    }
+
+    if (stream->owner && stream->trk != NULL) {
+        for (uint16_t i = 0; i < stream->tracks; ++i) {
+            midi_free_track(stream->trk[i]);
+        }
+    }
+
+    free(stream->trk);
+    free(stream->tick);
+    free(stream->heap);
+    free(stream);
+}
+
+bool midi_stream_has_next(const midi_stream_t *stream)
+{
+    return stream->size > 0;
+}
+
+midi_event_t *midi_stream_next(midi_stream_t *stream, uint32_t *tick, uint16_t *trk)
+{
+    uint16_t slot = stream->heap[0];
+    midi_track_t *track = stream->trk[slot];
+    midi_event_t *event = midi_track_next(track);
+
+    if (tick != NULL) {
+        *tick = stream->tick[slot];
+    }
+    if (trk != NULL) {
+        *trk = slot;
+    }
+
+    if (midi_track_has_next(track)) {
+        stream->tick[slot] += track->cur->event.delta_time;
+    } else {
+        stream->heap[0] = stream->heap[--stream->size];
+    }
+    midi_stream_sift_down(stream, 0);
+
+    return event;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
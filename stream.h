@@ -0,0 +1,58 @@
+#ifndef __STREAM_H__
+#define __STREAM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "midi.h"
+
+/**
+ * Merged event stream
+ *
+ * A k-way merge of the events of several tracks in absolute tick order.
+ * Events with the same tick keep their order within a track, and across
+ * tracks the lower track index comes first, so the merged order is
+ * deterministic.
+ *
+ *   track 0:  e0(0)        e1(480)              e2(1920)
+ *   track 1:  e0(0)  e1(240)     e2(960)
+ *                     |
+ *                     v
+ *   stream :  0:e0 1:e0 1:e1 0:e1 1:e2 0:e2
+ *
+ * Usage Sample:
+ *
+ * midi_stream_t *stream = midi_stream_open(midi);
+ * uint32_t tick;
+ * uint16_t trk;
+ *
+ * while (midi_stream_has_next(stream)) {
+ *     midi_event_t *event = midi_stream_next(stream, &tick, &trk);
+ *     // Do something
+ * }
+ *
+ * midi_stream_close(stream);
+ */
+
+typedef struct {
+    midi_track_t **     trk;
+    uint32_t *          tick;   // Absolute tick of the pending event of each track
+    uint16_t *          heap;   // Min-heap of track slots keyed by (tick, slot)
+    uint16_t            size;   // Tracks in the heap
+    uint16_t            tracks; // Total tracks
+    bool                owner;  // Tracks are freed by midi_stream_close()
+} midi_stream_t;
+
+// Merge all tracks of a midi file. The tracks are owned by the stream.
+midi_stream_t *midi_stream_open(const midi_t *const midi);
+// Merge tracks owned by the caller. They must outlive the stream.
+midi_stream_t *midi_stream_new(midi_track_t **trk, uint16_t tracks);
+void midi_stream_close(midi_stream_t *stream);
+
+bool midi_stream_has_next(const midi_stream_t *stream);
+// Next event in tick order, its absolute tick and the slot of its track
+midi_event_t *midi_stream_next(midi_stream_t *stream, uint32_t *tick, uint16_t *trk);
+
+#endif /* __STREAM_H__ */
+
+/* vim: set ts=4 sw=4 tw=0 list : */
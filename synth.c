@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "midi.h"
+#include "synth.h"
+
+#define SYNTH_PI                3.14159265358979323846
+#define SYNTH_ATTACK_BLOCKS     4           // ~6 ms at 44.1 kHz
+#define SYNTH_DECAY_SECONDS     2.5         // Time to fall by 60 dB while held
+#define SYNTH_FADE_SECONDS      0.15        // Time to fall by 60 dB after release
+#define SYNTH_SILENCE           0.001f      // -60 dB
+#define SYNTH_HEADROOM          0.2f
+
+void synth_init(synth_t *synth, uint32_t rate)
+{
+    double blocks_per_second = (double)rate / SYNTH_BLOCK;
+    double peak = 0.0;
+
+    memset(synth, 0, sizeof *synth);
+    synth->rate = rate;
+    synth->decay = (float)pow(SYNTH_SILENCE, 1.0 / (SYNTH_DECAY_SECONDS * blocks_per_second));
+    synth->fade = (float)pow(SYNTH_SILENCE, 1.0 / (SYNTH_FADE_SECONDS * blocks_per_second));
+
+    // Additive table: the first four harmonics with falling amplitude
+    for (int i = 0; i < SYNTH_TABLE_SIZE; ++i) {
+        double x = 2.0 * SYNTH_PI * i / SYNTH_TABLE_SIZE;
+        double v = sin(x) + 0.5 * sin(2 * x) + 0.25 * sin(3 * x) + 0.125 * sin(4 * x);
+
+        synth->table[i] = (float)v;
+        if (fabs(v) > peak) {
+            peak = fabs(v);
+        }
+    }
+    for (int i = 0; i < SYNTH_TABLE_SIZE; ++i) {
+        synth->table[i] /= (float)peak;
+    }
+
+    for (int key = 0; key < 128; ++key) {
+        double freq = 440.0 * pow(2.0, (key - 69) / 12.0);
+
+        synth->key_step[key] = (uint32_t)(freq / rate * 4294967296.0);
+    }
+
+    for (int chan = 0; chan < SYNTH_CHANNELS; ++chan) {
+        synth->cc_volume[chan] = 100;
+        synth->cc_expression[chan] = 127;
+        synth->volume[chan] = (100 / 127.0f);
+    }
+}
+
+static synth_voice_t *synth_alloc_voice(synth_t *synth)
+{
+    synth_voice_t *victim = NULL;
+
+    for (int i = 0; i < SYNTH_VOICES; ++i) {
+        synth_voice_t *v = &synth->voice[i];
+
+        if (!v->active) {
+            return v;
+        }
+
+        // Prefer stealing a released voice, then the quietest, then the oldest
+        if (victim == NULL
+                || (v->release && !victim->release)
+                || (v->release == victim->release && v->env < victim->env)
+                || (v->release == victim->release && v->env == victim->env && v->age < victim->age)) {
+            victim = v;
+        }
+    }
+
+    return victim;
+}
+
+void synth_note_on(synth_t *synth, uint8_t chan, uint8_t key, uint8_t velocity)
+{
+    synth_voice_t *v;
+    float vel;
+
+    chan &= 0x0F;
+    key &= 0x7F;
+
+    if (velocity == 0) {
+        synth_note_off(synth, chan, key);
+        return;
+    }
+
+    if (chan == SYNTH_DRUM_CHANNEL) {
+        return;
+    }
+
+    v = synth_alloc_voice(synth);
+    vel = (velocity & 0x7F) / 127.0f;
+
+    v->phase = 0;
+    v->step = synth->key_step[key];
+    v->age = synth->clock;
+    v->gain = vel * vel * SYNTH_HEADROOM;
+    v->env = 0.0f;
+    v->chan = chan;
+    v->key = key;
+    v->attack = SYNTH_ATTACK_BLOCKS;
+    v->active = true;
+    v->held = false;
+    v->release = false;
+}
+
+void synth_note_off(synth_t *synth, uint8_t chan, uint8_t key)
+{
+    chan &= 0x0F;
+    key &= 0x7F;
+
+    for (int i = 0; i < SYNTH_VOICES; ++i) {
+        synth_voice_t *v = &synth->voice[i];
+
+        if (!v->active || v->release || v->held || v->chan != chan || v->key != key) {
+            continue;
+        }
+
+        if (synth->hold[chan]) {
+            v->held = true;
+        } else {
+            v->release = true;
+        }
+    }
+}
+
+void synth_control(synth_t *synth, uint8_t chan, uint8_t ctrl, uint8_t value)
+{
+    chan &= 0x0F;
+
+    switch (ctrl) {
+        case MIDI_CTRL_VOLUME:
+            synth->cc_volume[chan] = value;
+            break;
+        case MIDI_CTRL_EXPRESSION:
+            synth->cc_expression[chan] = value;
+            break;
+        case MIDI_CTRL_HOLD_PEDAL:
+            synth->hold[chan] = (value >= 64);
+            if (!synth->hold[chan]) {
+                for (int i = 0; i < SYNTH_VOICES; ++i) {
+                    synth_voice_t *v = &synth->voice[i];
+
+                    if (v->active && v->held && v->chan == chan) {
+                        v->held = false;
+                        v->release = true;
+                    }
+                }
+            }
+            break;
+        case MIDI_CTRL_ALL_SOUND_OFF:
+        case MIDI_CTRL_ALL_NOTES_OFF:
+            for (int i = 0; i < SYNTH_VOICES; ++i) {
+                synth_voice_t *v = &synth->voice[i];
+
+                if (v->active && v->chan == chan) {
+                    v->held = false;
+                    v->release = true;
+                }
+            }
+            break;
+        default:
+            return;
+    }
+
+    synth->volume[chan] = (synth->cc_volume[chan] / 127.0f) * (synth->cc_expression[chan] / 127.0f);
+}
+
+int synth_active(const synth_t *synth)
+{
+    int count = 0;
+
+    for (int i = 0; i < SYNTH_VOICES; ++i) {
+        count += synth->voice[i].active;
+    }
+
+    return count;
+}
+
+/**
+ * Oscillator and mixer for one voice and one block.
+ *
+ * The table lookup is a gather, the mixing loop is a plain multiply-add over
+ * flat arrays with a linear envelope ramp and is vectorized by the compiler.
+ */
+static void synth_voice_block(synth_t *synth, synth_voice_t *v)
+{
+    float *restrict mix = synth->mix;
+    float *restrict osc = synth->osc;
+    const float *restrict table = synth->table;
+    uint32_t phase = v->phase;
+    const uint32_t step = v->step;
+    float start = v->env;
+    float end;
+    float gain = v->gain * synth->volume[v->chan];
+    float ramp;
+
+    if (v->attack > 0) {
+        end = start + (1.0f - start) / v->attack;
+        v->attack--;
+    } else if (v->release) {
+        end = start * synth->fade;
+    } else {
+        end = start * synth->decay;
+    }
+
+    for (uint32_t i = 0; i < SYNTH_BLOCK; ++i) {
+        osc[i] = table[phase >> (32 - SYNTH_TABLE_BITS)];
+        phase += step;
+    }
+
+    start *= gain;
+    ramp = (end * gain - start) / SYNTH_BLOCK;
+    for (uint32_t i = 0; i < SYNTH_BLOCK; ++i) {
+        mix[i] += osc[i] * (start + ramp * (float)i);
+    }
+
+    v->phase = phase;
+    v->env = end;
+
+    if (v->attack == 0 && end < SYNTH_SILENCE) {
+        v->active = false;
+    }
+}
+
+/**
+ * Voices are always advanced by whole blocks, so events take effect on the
+ * next block boundary (at most SYNTH_BLOCK frames late). Frames of a block
+ * that were not asked for yet are kept and handed out by the next call.
+ */
+void synth_render(synth_t *synth, int16_t *out, uint32_t frames)
+{
+    while (frames > 0) {
+        uint32_t n;
+
+        if (synth->pending == 0) {
+            memset(synth->mix, 0, sizeof synth->mix);
+
+            for (int i = 0; i < SYNTH_VOICES; ++i) {
+                if (synth->voice[i].active) {
+                    synth_voice_block(synth, &synth->voice[i]);
+                }
+            }
+
+            for (uint32_t i = 0; i < SYNTH_BLOCK; ++i) {
+                float s = synth->mix[i] * 32767.0f;
+
+                s = s > 32767.0f ? 32767.0f : s;
+                s = s < -32768.0f ? -32768.0f : s;
+                synth->block[i] = (int16_t)s;
+            }
+
+            synth->clock++;
+            synth->pending = SYNTH_BLOCK;
+        }
+
+        n = frames < synth->pending ? frames : synth->pending;
+        memcpy(out, &synth->block[SYNTH_BLOCK - synth->pending], n * sizeof *out);
+        synth->pending -= n;
+        out += n;
+        frames -= n;
+    }
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
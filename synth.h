@@ -0,0 +1,75 @@
+#ifndef __SYNTH_H__
+#define __SYNTH_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Preview Synthesizer
+ *
+ * A small wavetable synth for rendering previews of a midi file:
+ * - One additive wavetable (fundamental + a few harmonics) for every program
+ * - Fixed pool of SYNTH_VOICES voices, the quietest / oldest one is stolen
+ * - Attack / decay / release envelope evaluated once per block and ramped
+ *   linearly inside the block
+ * - Channel volume (CC 7), expression (CC 11) and hold pedal (CC 64)
+ * - The percussion channel (10) is not rendered
+ *
+ * Audio is produced in blocks of SYNTH_BLOCK frames. The inner loops work on
+ * flat float arrays so that the compiler can vectorize the mixing.
+ */
+
+#define SYNTH_VOICES            64
+#define SYNTH_BLOCK             64
+#define SYNTH_TABLE_BITS        11
+#define SYNTH_TABLE_SIZE        (1 << SYNTH_TABLE_BITS)
+#define SYNTH_CHANNELS          16
+#define SYNTH_DRUM_CHANNEL      9
+
+typedef struct {
+    uint32_t    phase;      // Phase accumulator, top SYNTH_TABLE_BITS index the table
+    uint32_t    step;       // Phase increment per frame
+    uint32_t    age;        // Block counter at note on
+    float       gain;       // Velocity gain
+    float       env;        // Envelope level at the start of the next block
+    uint8_t     chan;
+    uint8_t     key;
+    uint8_t     attack;     // Blocks left in attack
+    bool        active;
+    bool        held;       // Key released while hold pedal is down
+    bool        release;
+} synth_voice_t;
+
+typedef struct {
+    uint32_t        rate;
+    uint32_t        clock;                      // Blocks rendered
+    float           decay;                      // Envelope multiplier per block while key down
+    float           fade;                       // Envelope multiplier per block after key up
+    float           volume[SYNTH_CHANNELS];     // CC 7 * CC 11
+    uint8_t         cc_volume[SYNTH_CHANNELS];
+    uint8_t         cc_expression[SYNTH_CHANNELS];
+    bool            hold[SYNTH_CHANNELS];
+    uint32_t        key_step[128];
+    synth_voice_t   voice[SYNTH_VOICES];
+    float           table[SYNTH_TABLE_SIZE];
+    float           mix[SYNTH_BLOCK];
+    float           osc[SYNTH_BLOCK];
+    int16_t         block[SYNTH_BLOCK];         // Last rendered block
+    uint32_t        pending;                    // Frames of block not handed out yet
+} synth_t;
+
+void synth_init(synth_t *synth, uint32_t rate);
+
+void synth_note_on(synth_t *synth, uint8_t chan, uint8_t key, uint8_t velocity);
+void synth_note_off(synth_t *synth, uint8_t chan, uint8_t key);
+void synth_control(synth_t *synth, uint8_t chan, uint8_t ctrl, uint8_t value);
+
+// Number of voices still sounding
+int synth_active(const synth_t *synth);
+
+// Render frames of mono 16-bit audio
+void synth_render(synth_t *synth, int16_t *out, uint32_t frames);
+
+#endif /* __SYNTH_H__ */
+
+/* vim: set ts=4 sw=4 tw=0 list : */
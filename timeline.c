@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "timeline.h"
+
+typedef struct {
+    uint32_t    start;
+    uint8_t     velocity;
+    bool        on;
+} midi_key_state_t;
+
+uint32_t midi_track_notes(midi_track_t *trk, midi_note_cb_t cb, void *arg)
+{
+    return midi_track_walk(trk, cb, NULL, arg);
+}
+
+uint32_t midi_track_walk(midi_track_t *trk, midi_note_cb_t note_cb, midi_meta_cb_t meta_cb, void *arg)
+{
+    midi_key_state_t state[16][128];
+    midi_note_t note;
+    midi_event_t *event;
+    uint32_t tick = 0;
+
+    if (trk == NULL) {
+        return 0;
+    }
+
+    memset(state, 0, sizeof(state));
+    memset(&note, 0, sizeof(note));
+    note.track = trk->num;
+
+    midi_iter_track(trk);
+    while (midi_track_has_next(trk)) {
+        midi_key_state_t *key;
+        bool off;
+
+        event = midi_track_next(trk);
+        tick += event->delta_time;
+
+        if (event->type == MIDI_EVENT_TYPE_META) {
+            if (meta_cb != NULL) {
+                meta_cb(tick, event, arg);
+            }
+            continue;
+        }
+
+        if (note_cb == NULL
+                || event->type != MIDI_EVENT_TYPE_EVENT
+                || (event->cmd != MIDI_EVENT_NOTE_ON && event->cmd != MIDI_EVENT_NOTE_OFF)) {
+            continue;
+        }
+
+        key = &state[event->chan][event->data[0] & 0x7F];
+        off = (event->cmd == MIDI_EVENT_NOTE_OFF || event->data[1] == 0);
+
+        if (key->on) {
+            note.start = key->start;
+            note.end = tick;
+            note.chan = event->chan;
+            note.key = event->data[0] & 0x7F;
+            note.velocity = key->velocity;
+            key->on = false;
+            note_cb(&note, arg);
+        }
+
+        if (!off) {
+            key->on = true;
+            key->start = tick;
+            key->velocity = event->data[1];
+        }
+    }
+
+    if (note_cb == NULL) {
+        return tick;
+    }
+
+    // Close notes left sounding
+    for (int chan = 0; chan < 16; ++chan) {
+        for (int k = 0; k < 128; ++k) {
+            if (state[chan][k].on) {
+                note.start = state[chan][k].start;
+                note.end = tick;
+                note.chan = chan;
+                note.key = k;
+                note.velocity = state[chan][k].velocity;
+                note_cb(&note, arg);
+            }
+        }
+    }
+
+    return tick;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
@@ -0,0 +1,51 @@
+#ifndef __TIMELINE_H__
+#define __TIMELINE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "midi.h"
+
+/**
+ * Note Timeline
+ *
+ * Pairs the note on / note off events of a track into notes with an absolute
+ * start and end tick.
+ *
+ * - A note on with velocity 0 is a note off
+ * - A note on for a key that is already sounding on the same channel ends
+ *   the sounding note first
+ * - Notes still sounding at the end of the track end at the last tick
+ *
+ * Notes are handed to a callback as soon as they end, so the timeline of a
+ * track can be walked without storing it.
+ */
+
+typedef struct {
+    uint32_t    start;      // Absolute tick of note on
+    uint32_t    end;        // Absolute tick of note off
+    uint16_t    track;      // No. of track
+    uint8_t     chan;
+    uint8_t     key;
+    uint8_t     velocity;
+} midi_note_t;
+
+typedef void (*midi_note_cb_t)(const midi_note_t *note, void *arg);
+typedef void (*midi_meta_cb_t)(uint32_t tick, const midi_event_t *event, void *arg);
+
+/**
+ * Walk the notes of a track in note off order.
+ *
+ * Returns the absolute tick of the last event in the track.
+ */
+uint32_t midi_track_notes(midi_track_t *trk, midi_note_cb_t cb, void *arg);
+
+/**
+ * Walk the notes and the meta events of a track in one pass. Meta events are
+ * handed to meta_cb as they are reached, either callback may be NULL.
+ */
+uint32_t midi_track_walk(midi_track_t *trk, midi_note_cb_t note_cb, midi_meta_cb_t meta_cb, void *arg);
+
+#endif /* __TIMELINE_H__ */
+
+/* vim: set ts=4 sw=4 tw=0 list : */
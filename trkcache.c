@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "trkcache.h"
+
+static const uint8_t TRKCACHE_MAGIC[] = { 'M', 'T', 'K', 'C' };
+
+// Record layouts are part of the version, as is the byte order it is read in
+#define TRKCACHE_VERSION    (1u | (uint32_t)sizeof(midi_note_t) << 8 | (uint32_t)sizeof(midi_event_t) << 16)
+
+#define TRKCACHE_NOTE       'N'
+#define TRKCACHE_META       'M'
+
+typedef struct {
+    uint8_t     magic[4];
+    uint32_t    version;
+    uint16_t    tracks;
+    uint8_t     recover;
+    uint8_t     reserved;
+} trkcache_hdr_t;
+
+typedef struct {
+    uint64_t    hash;
+    uint32_t    events;
+    uint32_t    size;
+    uint64_t    len;
+} trkcache_entry_t;
+
+int trkcache_init(trkcache_t *cache, uint16_t tracks)
+{
+    memset(cache, 0, sizeof(*cache));
+
+    cache->track = calloc(tracks ? tracks : 1, sizeof *cache->track);
+    if (cache->track == NULL) {
+        return ENOMEM;
+    }
+    cache->tracks = tracks;
+
+    return 0;
+}
+
+void trkcache_free(trkcache_t *cache)
+{
+    if (cache->track != NULL) {
+        for (uint16_t i = 0; i < cache->tracks; ++i) {
+            free(cache->track[i].data);
+        }
+        free(cache->track);
+    }
+
+    memset(cache, 0, sizeof(*cache));
+}
+
+int trkcache_load(const char *path, trkcache_t *cache)
+{
+    trkcache_hdr_t hdr;
+    trkcache_entry_t entry;
+    FILE *fp;
+    int status = 0;
+
+    memset(cache, 0, sizeof(*cache));
+
+    fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return errno;
+    }
+
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || memcmp(hdr.magic, TRKCACHE_MAGIC, sizeof(hdr.magic)) != 0
+            || hdr.version != TRKCACHE_VERSION) {
+        fclose(fp);
+        return EINVAL;
+    }
+
+    status = trkcache_init(cache, hdr.tracks);
+    cache->recover = hdr.recover;
+
+    for (uint16_t i = 0; status == 0 && i < hdr.tracks; ++i) {
+        trkcache_track_t *t = &cache->track[i];
+
+        if (fread(&entry, sizeof(entry), 1, fp) != 1 || entry.len > SIZE_MAX) {
+            status = EINVAL;
+            break;
+        }
+
+        t->hash = entry.hash;
+        t->events = entry.events;
+        t->size = entry.size;
+        t->data = malloc(entry.len ? entry.len : 1);
+        if (t->data == NULL) {
+            status = ENOMEM;
+            break;
+        }
+        t->len = t->cap = entry.len;
+
+        if (entry.len > 0 && fread(t->data, entry.len, 1, fp) != 1) {
+            status = EINVAL;
+        }
+    }
+
+    fclose(fp);
+
+    if (status) {
+        trkcache_free(cache);
+    }
+
+    return status;
+}
+
+int trkcache_save(const char *path, const trkcache_t *cache)
+{
+    trkcache_hdr_t hdr;
+    char tmp[1024];
+    uint16_t tracks = 0;
+    FILE *fp;
+    int status = 0;
+
+    for (uint16_t i = 0; i < cache->tracks; ++i) {
+        tracks += !cache->track[i].failed;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRKCACHE_MAGIC, sizeof(hdr.magic));
+    hdr.version = TRKCACHE_VERSION;
+    hdr.tracks = tracks;
+    hdr.recover = cache->recover;
+
+    // Written aside and renamed, a cache is never seen half written
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    fp = fopen(tmp, "wb");
+    if (fp == NULL) {
+        return errno;
+    }
+
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1) {
+        status = errno ? errno : EIO;
+    }
+
+    for (uint16_t i = 0; status == 0 && i < cache->tracks; ++i) {
+        const trkcache_track_t *t = &cache->track[i];
+        trkcache_entry_t entry = { t->hash, t->events, t->size, t->len };
+
+        if (t->failed) {
+            continue;
+        }
+
+        if (fwrite(&entry, sizeof(entry), 1, fp) != 1 || (t->len > 0 && fwrite(t->data, t->len, 1, fp) != 1)) {
+            status = errno ? errno : EIO;
+        }
+    }
+
+    if (fclose(fp) != 0 && status == 0) {
+        status = errno;
+    }
+    if (status == 0 && rename(tmp, path) != 0) {
+        status = errno;
+    }
+    if (status) {
+        remove(tmp);
+    }
+
+    return status;
+}
+
+trkcache_track_t *trkcache_find(const trkcache_t *cache, uint64_t hash, uint16_t hint)
+{
+    // Most tracks are where they were, moved ones are still found
+    if (hint < cache->tracks && cache->track[hint].data != NULL && cache->track[hint].hash == hash) {
+        return &cache->track[hint];
+    }
+
+    for (uint16_t i = 0; i < cache->tracks; ++i) {
+        if (cache->track[i].data != NULL && cache->track[i].hash == hash) {
+            return &cache->track[i];
+        }
+    }
+
+    return NULL;
+}
+
+trkcache_track_t *trkcache_track(trkcache_t *cache, uint16_t n)
+{
+    return n < cache->tracks ? &cache->track[n] : NULL;
+}
+
+void trkcache_move(trkcache_t *cache, uint16_t n, trkcache_track_t *from)
+{
+    trkcache_track_t *to = trkcache_track(cache, n);
+
+    if (to == NULL || to == from) {
+        return;
+    }
+
+    free(to->data);
+    *to = *from;
+    memset(from, 0, sizeof(*from));
+}
+
+static void trkcache_append(trkcache_track_t *t, const void *a, size_t a_len, const void *b, size_t b_len)
+{
+    size_t need = t->len + 1 + a_len + b_len;
+
+    if (t->failed) {
+        return;
+    }
+
+    if (need > t->cap) {
+        size_t cap = t->cap ? t->cap * 2 : 4096;
+        uint8_t *data;
+
+        while (cap < need) {
+            cap *= 2;
+        }
+        data = realloc(t->data, cap);
+        if (data == NULL) {
+            t->failed = true;
+            return;
+        }
+        t->data = data;
+        t->cap = cap;
+    }
+
+    memcpy(t->data + t->len + 1, a, a_len);
+    if (b_len > 0) {
+        memcpy(t->data + t->len + 1 + a_len, b, b_len);
+    }
+    t->len = need;
+}
+
+void trkcache_note(const midi_note_t *note, void *arg)
+{
+    trkcache_track_t *t = arg;
+    size_t at = t->len;
+
+    trkcache_append(t, note, sizeof(*note), NULL, 0);
+    if (!t->failed) {
+        t->data[at] = TRKCACHE_NOTE;
+    }
+}
+
+void trkcache_meta(uint32_t tick, const midi_event_t *event, void *arg)
+{
+    trkcache_track_t *t = arg;
+    uint8_t rec[sizeof(tick) + sizeof(*event)];
+    size_t at = t->len;
+
+    memcpy(rec, &tick, sizeof(tick));
+    memcpy(rec + sizeof(tick), event, sizeof(*event));
+
+    trkcache_append(t, rec, sizeof(rec), event->data, event->size);
+    if (!t->failed) {
+        t->data[at] = TRKCACHE_META;
+    }
+}
+
+void trkcache_replay(const trkcache_track_t *t, uint16_t num, midi_note_cb_t note_cb, midi_meta_cb_t meta_cb, void *arg)
+{
+    union {
+        midi_event_t    event;
+        uint8_t         bytes[sizeof(midi_event_t) + UINT8_MAX];
+    } meta;
+    midi_note_t note;
+    uint32_t tick;
+    size_t pos = 0;
+
+    while (pos < t->len) {
+        uint8_t type = t->data[pos++];
+
+        if (type == TRKCACHE_NOTE && t->len - pos >= sizeof(note)) {
+            memcpy(&note, t->data + pos, sizeof(note));
+            pos += sizeof(note);
+
+            note.track = num;
+            if (note_cb != NULL) {
+                note_cb(&note, arg);
+            }
+        } else if (type == TRKCACHE_META && t->len - pos >= sizeof(tick) + sizeof(meta.event)) {
+            memcpy(&tick, t->data + pos, sizeof(tick));
+            memcpy(&meta.event, t->data + pos + sizeof(tick), sizeof(meta.event));
+            pos += sizeof(tick) + sizeof(meta.event);
+
+            if (t->len - pos < meta.event.size) {
+                break;
+            }
+            memcpy(meta.event.data, t->data + pos, meta.event.size);
+            pos += meta.event.size;
+
+            if (meta_cb != NULL) {
+                meta_cb(tick, &meta.event, arg);
+            }
+        } else {
+            break;
+        }
+    }
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
@@ -0,0 +1,81 @@
+#ifndef __TRKCACHE_H__
+#define __TRKCACHE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "midi.h"
+#include "timeline.h"
+
+/**
+ * Track Cache
+ *
+ * Keeps what the walk of every track handed to the emitters: its notes and
+ * meta events, in order, keyed by the hash of the track chunk (see
+ * midi_get_track_hash()). When a file is converted again, tracks whose hash
+ * is in the cache are replayed from it instead of being parsed and walked,
+ * so editing one part of a many track file only converts that part again:
+ *
+ * trkcache_t old, new;
+ *
+ * trkcache_load("a.mid.trkc", &old);           // Empty if there is none
+ * trkcache_init(&new, tracks);
+ * for every track i with hash h:
+ *     if ((t = trkcache_find(&old, h, i)) != NULL) {
+ *         trkcache_replay(t, i, note_cb, meta_cb, arg);
+ *         trkcache_move(&new, i, t);
+ *     } else {
+ *         // Walk the track, also calling trkcache_note() / trkcache_meta()
+ *         // with trkcache_track(&new, i) as arg
+ *     }
+ * trkcache_save("a.mid.trkc", &new);
+ *
+ * The cache file is for the machine that wrote it: records are stored in
+ * native byte order, a cache from elsewhere is ignored.
+ */
+
+typedef struct {
+    uint64_t    hash;       // midi_get_track_hash()
+    uint32_t    events;     // Of the midi_track_t, for begin_track()
+    uint32_t    size;
+    uint8_t *   data;       // Records: 'N' midi_note_t, 'M' tick midi_event_t data
+    size_t      len;
+    size_t      cap;
+    bool        failed;     // A record could not be stored, not saved
+} trkcache_track_t;
+
+typedef struct {
+    uint16_t            tracks;
+    bool                recover;    // Tracks were parsed in recovery mode
+    trkcache_track_t *  track;
+} trkcache_t;
+
+// Returns 0 or ENOMEM
+int trkcache_init(trkcache_t *cache, uint16_t tracks);
+void trkcache_free(trkcache_t *cache);
+
+/**
+ * Returns 0, or a POSIX errno with cache empty: ENOENT when there is no
+ * cache file, EINVAL when it is not one or from another machine.
+ */
+int trkcache_load(const char *path, trkcache_t *cache);
+// Returns 0 or a POSIX errno, tracks that failed are left out
+int trkcache_save(const char *path, const trkcache_t *cache);
+
+// The cached track with the given hash, at index hint first, NULL if none
+trkcache_track_t *trkcache_find(const trkcache_t *cache, uint64_t hash, uint16_t hint);
+trkcache_track_t *trkcache_track(trkcache_t *cache, uint16_t n);
+// Take over the records of from as track n, from is left empty
+void trkcache_move(trkcache_t *cache, uint16_t n, trkcache_track_t *from);
+
+// Recording callbacks for midi_track_walk(), arg is the trkcache_track_t
+void trkcache_note(const midi_note_t *note, void *arg);
+void trkcache_meta(uint32_t tick, const midi_event_t *event, void *arg);
+
+// Hand the records of t to the callbacks as the walk did, notes as track num
+void trkcache_replay(const trkcache_track_t *t, uint16_t num, midi_note_cb_t note_cb, midi_meta_cb_t meta_cb, void *arg);
+
+#endif /* __TRKCACHE_H__ */
+
+/* vim: set ts=4 sw=4 tw=0 list : */
@@ -0,0 +1,322 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#ifdef MIDI_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef MIDI_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "zfile.h"
+
+#define ZFILE_CHUNK         (64 * 1024)     // Compressed bytes read at a time
+
+static const uint8_t GZIP_MAGIC[] = { 0x1F, 0x8B };
+static const uint8_t ZSTD_MAGIC[] = { 0x28, 0xB5, 0x2F, 0xFD };
+
+#if defined(MIDI_HAVE_ZLIB) || defined(MIDI_HAVE_ZSTD)
+
+enum {
+    ZFILE_GZIP,
+    ZFILE_ZSTD
+};
+
+typedef struct {
+    FILE *          raw;
+    int             type;
+    bool            end;        // Stream fully decompressed
+    uint8_t *       cache;      // Everything decompressed so far
+    size_t          cached;
+    size_t          cap;
+    size_t          pos;        // Read position in the decompressed stream
+    uint8_t         in[ZFILE_CHUNK];
+#ifdef MIDI_HAVE_ZLIB
+    z_stream        gz;
+#endif
+#ifdef MIDI_HAVE_ZSTD
+    ZSTD_DStream *  zs;
+    ZSTD_inBuffer   zin;
+#endif
+} zfile_t;
+
+/**
+ * Decompress one more chunk into the cache. Returns 0, or -1 with errno set.
+ */
+static int zfile_fill(zfile_t *z)
+{
+    size_t avail;
+    size_t produced = 0;
+
+    if (z->cap - z->cached < ZFILE_CHUNK) {
+        size_t cap = z->cap ? z->cap * 2 : ZFILE_CHUNK * 4;
+        uint8_t *cache = realloc(z->cache, cap);
+
+        if (cache == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        z->cache = cache;
+        z->cap = cap;
+    }
+    avail = z->cap - z->cached;
+
+#ifdef MIDI_HAVE_ZLIB
+    if (z->type == ZFILE_GZIP) {
+        int ret;
+
+        if (z->gz.avail_in == 0) {
+            z->gz.next_in = z->in;
+            z->gz.avail_in = fread(z->in, 1, sizeof(z->in), z->raw);
+            if (ferror(z->raw)) {
+                errno = EIO;
+                return -1;
+            }
+        }
+
+        z->gz.next_out = z->cache + z->cached;
+        z->gz.avail_out = avail;
+        ret = inflate(&z->gz, Z_NO_FLUSH);
+        produced = avail - z->gz.avail_out;
+
+        // A truncated stream ends where the input does, keeping what there is
+        if (ret == Z_STREAM_END || (produced == 0 && z->gz.avail_in == 0 && feof(z->raw))) {
+            z->end = true;
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            errno = EILSEQ;
+            return -1;
+        }
+    }
+#endif
+#ifdef MIDI_HAVE_ZSTD
+    if (z->type == ZFILE_ZSTD) {
+        ZSTD_outBuffer out = { z->cache + z->cached, avail, 0 };
+        size_t ret;
+
+        if (z->zin.pos == z->zin.size) {
+            z->zin.src = z->in;
+            z->zin.size = fread(z->in, 1, sizeof(z->in), z->raw);
+            z->zin.pos = 0;
+            if (ferror(z->raw)) {
+                errno = EIO;
+                return -1;
+            }
+        }
+
+        ret = ZSTD_decompressStream(z->zs, &out, &z->zin);
+        if (ZSTD_isError(ret)) {
+            errno = EILSEQ;
+            return -1;
+        }
+        produced = out.pos;
+        if (produced == 0 && z->zin.pos == z->zin.size && feof(z->raw)) {
+            z->end = true;
+        }
+    }
+#endif
+
+    z->cached += produced;
+
+    return 0;
+}
+
+// Decompress until size bytes are cached or the stream ends
+static int zfile_need(zfile_t *z, size_t size)
+{
+    while (z->cached < size && !z->end) {
+        if (zfile_fill(z) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static ssize_t zfile_read(void *cookie, char *buf, size_t size)
+{
+    zfile_t *z = cookie;
+
+    if (zfile_need(z, z->pos + size) != 0) {
+        return -1;
+    }
+
+    if (z->pos >= z->cached) {
+        return 0;
+    }
+    if (size > z->cached - z->pos) {
+        size = z->cached - z->pos;
+    }
+
+    memcpy(buf, z->cache + z->pos, size);
+    z->pos += size;
+
+    return size;
+}
+
+static int zfile_seek(void *cookie, off64_t *offset, int whence)
+{
+    zfile_t *z = cookie;
+    off64_t pos;
+
+    switch (whence) {
+        case SEEK_SET:
+            pos = *offset;
+            break;
+        case SEEK_CUR:
+            pos = z->pos + *offset;
+            break;
+        case SEEK_END:
+            if (zfile_need(z, SIZE_MAX) != 0) {
+                return -1;
+            }
+            pos = z->cached + *offset;
+            break;
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+
+    if (pos < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Past the end is allowed like for plain files, reads there return EOF
+    z->pos = pos;
+    *offset = pos;
+
+    return 0;
+}
+
+static void zfile_free(zfile_t *z)
+{
+#ifdef MIDI_HAVE_ZLIB
+    if (z->type == ZFILE_GZIP) {
+        inflateEnd(&z->gz);
+    }
+#endif
+#ifdef MIDI_HAVE_ZSTD
+    if (z->type == ZFILE_ZSTD) {
+        ZSTD_freeDStream(z->zs);
+    }
+#endif
+
+    free(z->cache);
+    free(z);
+}
+
+static int zfile_close(void *cookie)
+{
+    zfile_t *z = cookie;
+
+    fclose(z->raw);
+    zfile_free(z);
+
+    return 0;
+}
+
+static FILE *zfile_wrap(FILE *raw, int type)
+{
+    cookie_io_functions_t io = {
+        .read = zfile_read,
+        .write = NULL,
+        .seek = zfile_seek,
+        .close = zfile_close,
+    };
+    zfile_t *z = calloc(1, sizeof *z);
+    FILE *fp;
+
+    if (z == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    z->raw = raw;
+    z->type = type;
+
+#ifdef MIDI_HAVE_ZLIB
+    // 16 + MAX_WBITS: gzip wrapper only
+    if (type == ZFILE_GZIP && inflateInit2(&z->gz, 16 + MAX_WBITS) != Z_OK) {
+        free(z);
+        errno = ENOMEM;
+        return NULL;
+    }
+#endif
+#ifdef MIDI_HAVE_ZSTD
+    if (type == ZFILE_ZSTD) {
+        z->zs = ZSTD_createDStream();
+        if (z->zs == NULL || ZSTD_isError(ZSTD_initDStream(z->zs))) {
+            ZSTD_freeDStream(z->zs);
+            free(z);
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+#endif
+
+    // raw is owned by the returned FILE *, closed with it
+    fp = fopencookie(z, "r", io);
+    if (fp == NULL) {
+        int err = errno;
+
+        zfile_free(z);
+        errno = err;
+        return NULL;
+    }
+
+    return fp;
+}
+
+#endif /* MIDI_HAVE_ZLIB || MIDI_HAVE_ZSTD */
+
+FILE *zfile_open(const char *path)
+{
+    uint8_t magic[4] = { 0 };
+    FILE *fp = fopen(path, "r");
+    size_t n;
+
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    n = fread(magic, 1, sizeof(magic), fp);
+    rewind(fp);
+
+    if (n >= sizeof(GZIP_MAGIC) && memcmp(magic, GZIP_MAGIC, sizeof(GZIP_MAGIC)) == 0) {
+#ifdef MIDI_HAVE_ZLIB
+        FILE *z = zfile_wrap(fp, ZFILE_GZIP);
+
+        if (z == NULL) {
+            fclose(fp);
+        }
+        return z;
+#else
+        fclose(fp);
+        errno = EPROTONOSUPPORT;
+        return NULL;
+#endif
+    }
+
+    if (n >= sizeof(ZSTD_MAGIC) && memcmp(magic, ZSTD_MAGIC, sizeof(ZSTD_MAGIC)) == 0) {
+#ifdef MIDI_HAVE_ZSTD
+        FILE *z = zfile_wrap(fp, ZFILE_ZSTD);
+
+        if (z == NULL) {
+            fclose(fp);
+        }
+        return z;
+#else
+        fclose(fp);
+        errno = EPROTONOSUPPORT;
+        return NULL;
+#endif
+    }
+
+    return fp;
+}
+
+/* vim: set ts=4 sw=4 tw=0 list : */
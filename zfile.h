@@ -0,0 +1,28 @@
+#ifndef __ZFILE_H__
+#define __ZFILE_H__
+
+#include <stdio.h>
+
+/**
+ * Transparent Compressed Input
+ *
+ * Opens a file for reading, detecting compression by magic:
+ *
+ *   1F 8B          gzip, with MIDI_HAVE_ZLIB
+ *   28 B5 2F FD    zstd, with MIDI_HAVE_ZSTD
+ *   anything else  plain file, opened as is
+ *
+ * A compressed file is returned as a FILE * that reads the decompressed
+ * bytes. Decompression is lazy: a read or a seek only decompresses as far
+ * as the position it needs, and everything decompressed so far is kept, so
+ * seeking back costs nothing. Seeking relative to the end decompresses the
+ * whole stream.
+ *
+ * Returns NULL with errno set on error. Compressed files without the
+ * matching support compiled in fail with EPROTONOSUPPORT.
+ */
+FILE *zfile_open(const char *path);
+
+#endif /* __ZFILE_H__ */
+
+/* vim: set ts=4 sw=4 tw=0 list : */